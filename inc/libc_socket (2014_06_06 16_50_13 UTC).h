@@ -7,6 +7,7 @@
 
 
 #include <sys/socket.h>
+#include <sys/types.h>              /* for off_t */
 
 
 /* Functions that wraps the libc. Basically initialize a function pointer the
@@ -35,6 +36,48 @@ int libc_getsockopt (int fd, int level, int optname, void *optval,
         		     socklen_t *optlen);
 int libc_setsockopt (int fd, int level, int optname, const void *optval,
                      socklen_t optlen);
+ssize_t libc_sendfile (int out_fd, int in_fd, off_t *offset, size_t count);
+
+
+/* Network emulator, in the manner of tc-netem, below libc_sendto() and
+ * libc_sendmsg(): the datagrams sent may be lost, duplicated, corrupted,
+ * delayed and reordered, and go through a bottleneck link, without root
+ * access. It is configured by the SIMPTCP_NETEM environment variable when
+ * the program starts, or by libc_netem_config(), with a list of
+ *
+ *   loss PERCENT                   independent losses
+ *   loss gemodel P [R [1-H [1-K]]] Gilbert-Elliott burst losses (percents):
+ *                                  P good to bad, R bad to good (100 - P),
+ *                                  1-H loss in bad (100), 1-K in good (0)
+ *   delay TIME [JITTER]            fixed delay, plus or minus a uniform jitter
+ *   reorder PERCENT                datagrams sent at once, ahead of the
+ *                                  delayed ones (with delay)
+ *   duplicate PERCENT              datagrams sent twice
+ *   corrupt PERCENT                datagrams with one bit flipped
+ *   rate RATE                      bottleneck bandwidth (bit, kbit, mbit, gbit)
+ *   limit DATAGRAMS                bottleneck and delay queue depth (1000,
+ *                                  at most 1000000)
+ *   seed N                         seed of the random decisions (1)
+ *
+ * for example "loss 1% delay 10ms 2ms rate 100mbit limit 50". TIME is in
+ * us, ms or s (us if no unit). The decisions only depend on the seed and on
+ * the order of the datagrams. A datagram lost, or dropped because the
+ * queue is full, looks sent to the caller, as on a real network. The
+ * emulator acts on what the process sends: set it on both sides to impair
+ * both directions.
+ */
+struct libc_netem_stats {
+    unsigned long datagrams;        /* datagrams handed to the emulator */
+    unsigned long lost;
+    unsigned long duplicated;
+    unsigned long corrupted;
+    unsigned long reordered;
+    unsigned long queue_drops;      /* queue full */
+    unsigned long send_errors;      /* delayed datagrams the libc refused */
+};
+
+int libc_netem_config (const char *spec);
+void libc_netem_get_stats (struct libc_netem_stats *st);
 
 #endif /* _LIBC_SOCKET_H_ */
 
@@ -7,12 +7,66 @@
 #define _SIMPTCP_API_H_
 
 #include <netdb.h>              /* for struct sockaddr and socklen_t */
+#include <sys/types.h>          /* for off_t */
 
 /*! \def IPPROTO_SIMPTCP
  *  \brief{SimpTCP protocol number <in.h>}
  */
 #define IPPROTO_SIMPTCP	15
 
+/* Socket options of level IPPROTO_SIMPTCP (the values are those of the 
+ * equivalent TCP options, which are also accepted with level IPPROTO_TCP) */
+#define SIMPTCP_NODELAY  1      /* don't coalesce small writes */
+#define SIMPTCP_CORK     3      /* hold data until a full segment or uncork */
+#define SIMPTCP_INFO     11     /* read only: connection statistics, as a
+                                   struct simptcp_info */
+#define SIMPTCP_QUICKACK 12     /* acknowledge without delay */
+#define SIMPTCP_CRC32C   64     /* protect the PDUs with a CRC32C rather than
+                                   the checksum (set before connect or on the
+                                   listening socket); a peer that does not
+                                   agree is refused, connect/accept fail */
+#define SIMPTCP_PREDICTION 65   /* read only: header prediction counters, as a
+                                   struct simptcp_prediction_stats */
+#define SIMPTCP_LATENCY  66     /* read only: latency histograms, as a
+                                   struct simptcp_latency (simptcp_hist.h) */
+
+/* Header prediction counters of a connection: PDUs recognised by the fast
+ * path (in-order data, pure ACK of the PDU in flight) and the others */
+struct simptcp_prediction_stats {
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/* Statistics of a connection (the TCP_INFO of simpTCP). Reading them takes
+ * no lock and no system call: they may be polled often. The states are
+ * numbered CLOSED, LISTEN, SYNSENT, SYNRCVD, ESTABLISHED, CLOSEWAIT,
+ * FINWAIT1, FINWAIT2, CLOSING, LASTACK, TIMEWAIT */
+#define SIMPTCP_INFO_NB_STATES 11
+
+struct simptcp_info {
+    unsigned char state;                /* current state */
+    unsigned char retransmits;          /* retransmissions of the PDU in flight */
+    unsigned char crc32c;               /* 1 if the PDUs carry a CRC32C */
+    unsigned int rto_us;                /* retransmission timeout */
+    unsigned int srtt_us;               /* smoothed round trip time (0: no
+                                           measure yet) */
+    unsigned int rttvar_us;             /* round trip time variation */
+    unsigned int snd_mss;               /* largest payload sent in a PDU */
+    unsigned int snd_cwnd;              /* PDUs in flight allowed (stop and
+                                           wait: 1) */
+    unsigned int rcv_wnd;               /* payload bytes the socket can take */
+    unsigned long long bytes_sent;      /* payload, retransmissions included */
+    unsigned long long bytes_retrans;
+    unsigned long long bytes_received;  /* payload delivered to the application */
+    unsigned long segs_out;             /* PDUs sent, ACKs included */
+    unsigned long segs_in;              /* PDUs received for the connection */
+    unsigned long total_retrans;        /* PDUs retransmitted */
+    unsigned long in_errors;            /* unexpected PDUs (duplicates..) */
+    unsigned long long state_time_us[SIMPTCP_INFO_NB_STATES];
+                                        /* time spent in each state, the
+                                           current one included */
+};
+
 int socket(int domain, int type, int protocol);
 int bind (int fd, const struct sockaddr *addr, socklen_t len);
 int connect (int fd, const struct sockaddr *addr, socklen_t len);
@@ -30,6 +84,12 @@ int getsockopt (int fd, int level, int optname, void *optval,
                 socklen_t *optlen);
 int setsockopt (int fd, int level, int optname, const void *optval, 
                 socklen_t optlen);
+ssize_t sendfile (int out_fd, int in_fd, off_t *offset, size_t count);
+
+/* SimpTCP specific primitives */
+ssize_t simptcp_recv_loan (int fd, const void **data);
+int simptcp_recv_release (int fd);
+ssize_t simptcp_sendfile (int fd_out, int fd_in, off_t *offset, size_t count);
 
 #endif /* _SIMPTCP_API_H_ */
 
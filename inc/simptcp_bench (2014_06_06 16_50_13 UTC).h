@@ -0,0 +1,66 @@
+/*
+ * simptcp_bench.h
+ */
+
+#ifndef _SIMPTCP_BENCH_H_
+#define _SIMPTCP_BENCH_H_
+
+#include <stdint.h>             /* for uint64_t */
+#include <time.h>               /* for clock_gettime() */
+#include <sys/time.h>
+#include <sys/resource.h>       /* for getrusage() */
+
+/* Timing helpers shared by the SimpTCP benchmark programs */
+
+/* reads the CPU time stamp counter (or a nanosecond clock where there is none) */
+static inline uint64_t bench_rdtsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* monotonic wall clock in nanoseconds */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* user + system CPU time consumed by the whole process, in seconds */
+static inline double bench_cpu_seconds(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* frequency of bench_rdtsc() in ticks per second, measured over 50 ms */
+static inline double bench_tsc_hz(void)
+{
+    uint64_t t0 = bench_now_ns(), c0 = bench_rdtsc();
+    uint64_t t1, c1;
+
+    do {
+        t1 = bench_now_ns();
+    } while (t1 - t0 < 50000000ULL);
+    c1 = bench_rdtsc();
+
+    return (double) (c1 - c0) * 1e9 / (double) (t1 - t0);
+}
+
+#endif /* _SIMPTCP_BENCH_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
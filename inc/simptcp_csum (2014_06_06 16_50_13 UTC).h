@@ -0,0 +1,71 @@
+/*
+ * simptcp_csum.h
+ */
+
+#ifndef _SIMPTCP_CSUM_H_
+#define _SIMPTCP_CSUM_H_
+
+#include <sys/types.h>          /* for u_int16_t, u_int32_t */
+
+
+/* Internet checksum kernels [RFC 1071].
+ *
+ * simptcp_csum_partial() adds the 16-bit words of a buffer to a 32-bit
+ * ones-complement accumulator, which is folded to 16 bits by
+ * simptcp_csum_fold(). The words are loaded in host order and the result is
+ * stored back unchanged: by the byte order independence of the ones-complement
+ * sum, this gives the network order checksum on any host. Buffers chained in
+ * one sum must all start at an even offset of the PDU, except the last one.
+ *
+ * The kernel (generic, SSE2 or AVX2) is chosen the first time
+ * simptcp_csum_partial() is called, according to what the CPU supports.
+ */
+u_int32_t simptcp_csum_partial (const void *data, int len, u_int32_t sum);
+u_int16_t simptcp_csum_fold (u_int32_t sum);
+u_int16_t simptcp_csum_replace16 (u_int16_t check, u_int16_t old_word,
+                                  u_int16_t new_word);
+u_int32_t simptcp_csum_block_add (u_int32_t sum, u_int32_t sum2, int offset);
+
+/* Copy-and-checksum: copies len bytes from src to dst and returns the partial
+ * sum of the data, as simptcp_csum_partial() would, in a single pass over
+ * them. The sum of a block that does not start at an even offset of the PDU
+ * is merged with simptcp_csum_block_add().
+ */
+u_int32_t simptcp_csum_copy (void *dst, const void *src, int len, u_int32_t sum);
+
+/* The kernels themselves, exposed for the benchmarks. A kernel may only be
+ * called if simptcp_csum_kernel_supported() says so.
+ */
+u_int32_t simptcp_csum_partial_generic (const void *data, int len, u_int32_t sum);
+u_int32_t simptcp_csum_partial_sse2 (const void *data, int len, u_int32_t sum);
+u_int32_t simptcp_csum_partial_avx2 (const void *data, int len, u_int32_t sum);
+u_int32_t simptcp_csum_copy_generic (void *dst, const void *src, int len,
+                                     u_int32_t sum);
+u_int32_t simptcp_csum_copy_sse2 (void *dst, const void *src, int len,
+                                  u_int32_t sum);
+u_int32_t simptcp_csum_copy_avx2 (void *dst, const void *src, int len,
+                                  u_int32_t sum);
+int simptcp_csum_kernel_supported (const char *name);
+const char * simptcp_csum_kernel_name (void);
+
+/* CRC32C (Castagnoli) [RFC 3720].
+ *
+ * simptcp_crc32c() extends the CRC crc of the previous buffers (0 for the
+ * first one) with len bytes of data, so that a PDU can be covered in several
+ * pieces. It uses the SSE4.2 crc32 instruction when the CPU has it and a
+ * table-driven (slicing-by-8) kernel otherwise. simptcp_crc32c_copy() also
+ * copies the data to dst on the way.
+ */
+u_int32_t simptcp_crc32c (const void *data, int len, u_int32_t crc);
+u_int32_t simptcp_crc32c_copy (void *dst, const void *src, int len, u_int32_t crc);
+u_int32_t simptcp_crc32c_table (const void *data, int len, u_int32_t crc);
+u_int32_t simptcp_crc32c_sse42 (const void *data, int len, u_int32_t crc);
+u_int32_t simptcp_crc32c_copy_table (void *dst, const void *src, int len,
+                                     u_int32_t crc);
+u_int32_t simptcp_crc32c_copy_sse42 (void *dst, const void *src, int len,
+                                     u_int32_t crc);
+const char * simptcp_crc32c_kernel_name (void);
+
+#endif /* _SIMPTCP_CSUM_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
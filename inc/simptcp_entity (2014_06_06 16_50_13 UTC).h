@@ -15,6 +15,11 @@
 #define MAX_OPEN_SOCK 5 /* the maximum number of open sockets */
 #define ETH_MTU 1500 /* Ethernet Max transmit Unit */
 #define  MAX_SIMPTCP_BUFFER_SIZE (ETH_MTU-20-8) /* to avoid IP fragmentation */
+#define SIMPTCP_RX_POOL_SIZE (MAX_OPEN_SOCK*SIMPTCP_RX_QUEUE_LEN+1) /* a socket 
+                                                  holds at most 
+                                                  SIMPTCP_RX_QUEUE_LEN received
+                                                  PDUs, so the entity always 
+                                                  finds a free buffer */
 
 /*!
 *  \struct simptcp 
@@ -27,7 +32,8 @@
 * - nombre et liste des socket simTCP crees a la charge de l'entite simpTCP
 * - nombre de connexions simpTCP creees a la charge de l'entite simpTCP
 * - descripteur  et l'adresse de niveau transport du socket UDP utilise par l'entite simpTCP pour acceder au service UDP
-* - occupation et pointeur sur le buffer qui memorise un PDU simpTCP recu avant l'etape de demultiplexage permettant d'identifier le socket simpTCP cible
+* - reserve de buffers de reception : un PDU simpTCP est recu dans un buffer de la reserve puis, s'il porte des donnees, confie par reference au socket simpTCP cible jusqu'a sa lecture par l'application
+* - reserve des structures simptcp_socket, une par descripteur : elles ne sont jamais rendues au systeme, si bien qu'un lecteur sans verrou (simptcp_metrics) peut consulter un socket en cours de fermeture
 * - Table de pointeur vers les fonctions qu'execute une entite simpTCP, se trouvant dans un etat donne, en reaction a un evennement (timout, reception PDU,..)  
 */
 struct simptcp { 
@@ -39,9 +45,14 @@ struct simptcp {
 	int udp_fd; /*!< udp socket descriptor */
 	struct sockaddr_in local_udp;  /*!< local UDP socket SAP address */
 	
-	char in_buffer[MAX_SIMPTCP_BUFFER_SIZE]; /*!< SimpTCP socket Receive buffer used ;	
-											  Provisionned for one single MAXSIZE PDU */
+	char rx_pool[SIMPTCP_RX_POOL_SIZE][MAX_SIMPTCP_BUFFER_SIZE]; /*!< Receive buffer pool ; 
+											  each buffer holds one single MAXSIZE PDU */
+	int rx_pool_refs[SIMPTCP_RX_POOL_SIZE]; /*!< reference count of each pool buffer */
+	struct simptcp_socket socket_pool[MAX_OPEN_SOCK]; /*!< control block of the 
+							     socket of each descriptor */
+	char * in_buffer; /*!< pool buffer the next PDU is received into */
 	unsigned int in_len; /*!< instantaneous in_buffer occupation */
+	struct timeval in_time; /*!< arrival time of the PDU in in_buffer */
 	
 	
 	
@@ -66,6 +77,15 @@ struct simptcp simptcp_entity;
 
 /* create a simptcp_core handler */
 int start_simptcp (int local_udp);
+/* initialize the simptcp control block only, without the handler */
+int init_simptcp (int local_udp);
+/* simptcp socket a received PDU is destined to, -1 if none */
+int demultiplex_packet (char * buffer, struct sockaddr_in * udp_remote);
+
+/* receive buffer pool */
+char * simptcp_rx_buffer_get ();
+void simptcp_rx_buffer_hold (char * buffer);
+void simptcp_rx_buffer_put (char * buffer);
 
 #endif /* _SIMPTCP_ENTITY_H_ */
 
@@ -0,0 +1,80 @@
+/*
+ * simptcp_hist.h
+ */
+
+#ifndef _SIMPTCP_HIST_H_
+#define _SIMPTCP_HIST_H_
+
+#include <sys/types.h>          /* for u_int32_t, u_int64_t */
+
+
+/* Latency histograms.
+ *
+ * Log-bucketed, in the manner of HdrHistogram: each power of 2 of
+ * microseconds is split into SIMPTCP_HIST_SUB linear buckets, so a value is
+ * known to within 1/SIMPTCP_HIST_SUB (12.5 %) from 1 us to 71 minutes. A
+ * histogram is a fixed array: recording is a few shifts and plain
+ * increments, without allocation nor lock. Each histogram has a single
+ * writer (the entity thread, or the thread that reads the socket); readers
+ * may see counts that are not quite consistent with each other.
+ */
+
+#define SIMPTCP_HIST_SUB_BITS   3
+#define SIMPTCP_HIST_SUB        (1 << SIMPTCP_HIST_SUB_BITS)
+#define SIMPTCP_HIST_BUCKETS    ((32 - SIMPTCP_HIST_SUB_BITS + 1) * SIMPTCP_HIST_SUB)
+
+/* the latencies measured, per socket and per entity */
+#define SIMPTCP_HIST_CONNECT    0   /* connect: SYN sent to established */
+#define SIMPTCP_HIST_SEND_ACK   1   /* PDU first sent to its ACK, retransmissions
+                                       included */
+#define SIMPTCP_HIST_RECV_WAKEUP 2  /* data datagram received to recv() return */
+#define SIMPTCP_HIST_TIMER_LATE 3   /* timer fired after its deadline */
+#define SIMPTCP_HIST_NB         4
+
+#define SIMPTCP_HIST_NAMES                                              \
+    { "connect_us", "send_ack_us", "recv_wakeup_us", "timer_late_us" }
+
+typedef struct simptcp_hist {
+    u_int64_t count;
+    u_int64_t sum;              /* us */
+    u_int32_t max;              /* us */
+    u_int32_t buckets[SIMPTCP_HIST_BUCKETS];
+} simptcp_hist;
+
+/* latency histograms of a socket (option SIMPTCP_LATENCY) */
+struct simptcp_latency {
+    simptcp_hist hist[SIMPTCP_HIST_NB];
+};
+
+u_int32_t simptcp_hist_lowest (int bucket);
+u_int32_t simptcp_hist_highest (int bucket);
+u_int32_t simptcp_hist_percentile (const simptcp_hist *h, double p);
+void simptcp_hist_merge (simptcp_hist *dst, const simptcp_hist *src);
+
+/* bucket of value v */
+static inline int simptcp_hist_bucket (u_int32_t v)
+{
+    int msb;
+
+    if (v < SIMPTCP_HIST_SUB)
+        return v;
+    msb = 31 - __builtin_clz(v);
+    return ((msb - SIMPTCP_HIST_SUB_BITS + 1) << SIMPTCP_HIST_SUB_BITS) +
+        ((v >> (msb - SIMPTCP_HIST_SUB_BITS)) & (SIMPTCP_HIST_SUB - 1));
+}
+
+/* records a value of us microseconds (negative values count as 0) */
+static inline void simptcp_hist_record (simptcp_hist *h, long long us)
+{
+    u_int32_t v = (us < 0) ? 0 : (us > 0xffffffffLL) ? 0xffffffff : us;
+
+    h->buckets[simptcp_hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+#endif /* _SIMPTCP_HIST_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -10,13 +10,37 @@
 #include <pthread.h>            /* for pthread_mutex_t, pthread_cond_t */
 #include <sys/socket.h>
 #include <pthread.h>
+#include <simptcp_hist.h>       /* for simptcp_hist */
 
 
 #define ETH_MTU 1500 /* Ethernet Max transmit Unit */
 
 #define SIMPTCP_SOCKET_MAX_BUFFER_SIZE (ETH_MTU-16-20-8) /* SIMPTCP_MAX_SIZE to avoid IP 
 							    fragmentation assuming no IP options */
+#define SIMPTCP_SOCKET_MAX_HEADER_SIZE 64 /* room for the generic header and its 
+                                            options; the payload is never copied 
+                                            into the transmit buffer */
 #define MAX_RETRANSMIT 255  /* Maximum number of retransmissions */
+#define SIMPTCP_MAX_SEND 5 /* Maximum number of transmissions of a PDU before
+                              the connection is given up */
+
+#define SIMPTCP_RTO_INITIAL 1000 /* retransmission timeout in ms before the
+                                   first RTT measure [RFC 6298] */
+#define SIMPTCP_RTO_MIN 200 /* bounds of the retransmission timeout in ms */
+#define SIMPTCP_RTO_MAX 60000
+
+#define SIMPTCP_NB_STATES 11 /* entries of simptcp_socket_states */
+
+#define SIMPTCP_TIMEWAIT 1000 /* time spent in TIMEWAIT in ms, unless the
+                                 descriptor is needed by a new socket */
+
+#define SIMPTCP_DELACK_TIMEOUT 40 /* delayed ACK timeout in ms */
+#define SIMPTCP_DELACK_SEGMENTS 2 /* acknowledge at least every second 
+                                     full segment */
+#define SIMPTCP_QUICKACK_SEGMENTS 8 /* segments acknowledged without delay 
+                                       after the handshake or a loss */
+#define SIMPTCP_RX_QUEUE_LEN 4 /* received PDUs a socket holds (by reference)
+                                  until the application reads them */
 
 
 
@@ -86,6 +110,9 @@ struct simptcp_socket { /* SimpTCP Protocol Control Block */
 
   int max_conn_req_backlog; /*!< this is fixed with sys call listen */
 
+  int orphan; /*!< closed by the application: the descriptor is released
+                 once the connection is over (#release_simptcp_socket) */
+
   /* simptcp SAP Address */
   struct sockaddr_in local_simptcp; /*!< local simptcp SAP address */  
   struct sockaddr_in remote_simptcp; /*!< remote simptcp SAP address */ 
@@ -99,33 +126,135 @@ struct simptcp_socket { /* SimpTCP Protocol Control Block */
  
   /* Related to data transmissions */
   short socket_state_sender; /*!< sender side FSM describing 
-							  the data transfer phase (started during TD) */
+							  the data transfer phase (started during TD):
+							  wait_ack while a data PDU is 
+							  unacknowledged, wait_message otherwise */
   unsigned int next_seq_num;  /*!< Next sequence number */
-  char out_buffer[SIMPTCP_SOCKET_MAX_BUFFER_SIZE]; /*!< SimpTCP socket Transmit
-						      buffer used to store 
-						      outgoing SimpTCP PDUs */
-  unsigned int out_len; /*!< instantaneous out_buffer occupation */
+  char out_buffer[SIMPTCP_SOCKET_MAX_HEADER_SIZE]; /*!< SimpTCP socket Transmit
+						      buffer used to store the header
+						      of the outgoing SimpTCP PDU */
+  const char * out_data; /*!< payload of the outgoing PDU, referenced in the
+			    application buffer and sent along with out_buffer
+			    (see send_pdu) */
+  unsigned int out_len; /*!< total length of the outgoing PDU (header + payload) */
+  char hdr_template[SIMPTCP_SOCKET_MAX_HEADER_SIZE]; /*!< header of the 
+							 connection with its
+							 constant fields (ports,
+							 header length, options,
+							 window) already in 
+							 network order, built 
+							 once established */
+  unsigned char hdr_template_len; /*!< header length of hdr_template, 0 until
+				     the connection is established */
+  u_int32_t hdr_template_sum; /*!< partial checksum of hdr_template */
+  u_int32_t out_sum; /*!< partial checksum of out_data when out_summed is set */
+  int out_summed; /*!< 1 if the payload passed to the next make_pdu has 
+		     already been summed (while it was copied) */
+  char snd_buf[2][SIMPTCP_SOCKET_MAX_BUFFER_SIZE]; /*!< small writes are 
+						      coalesced in snd_buf[snd_cur]
+						      while the other buffer may 
+						      be in flight */
+  int snd_cur; /*!< index of the buffer being filled */
+  unsigned int snd_len; /*!< number of bytes waiting in snd_buf[snd_cur] */
+  u_int32_t snd_sum; /*!< partial checksum of those bytes, computed while 
+			they were copied */
+  int nodelay; /*!< SIMPTCP_NODELAY: every write is sent as its own PDU */
+  int cork; /*!< SIMPTCP_CORK: partial segments are held until uncorked */
+  unsigned int mss; /*!< maximum payload of a PDU: SIMPTCP_MAX_SIZE less the 
+		       options carried by every PDU of the connection */
+  int crc32c_wanted; /*!< SIMPTCP_CRC32C: CRC32C mode required at connection
+			(client) or on the listening socket; a peer that
+			answers without it is refused with a RST */
+  int crc32c; /*!< 1 if the PDUs of the connection are protected by a CRC32C
+		 instead of the checksum (negotiated during the handshake) */
   char nbr_retransmit; /*!< number of times first unacked message 
-			  retransmitted (limited to 255) */
+			  retransmitted (limited to 255); the connection is
+			  given up at SIMPTCP_MAX_SEND */
 
   /* timer */
-  int timer_duration; /*!< expressed in ms, normally derived from estimated_rtt  */
+  int timer_duration; /*!< retransmission timeout (RTO) in ms, derived from 
+			 srtt_us and rttvar_us and doubled at each 
+			 retransmission */
+  unsigned int srtt_us; /*!< smoothed round trip time in us, 0 before the 
+			   first measure */
+  unsigned int rttvar_us; /*!< round trip time variation in us */
+  struct timeval rtt_sent; /*!< first transmission of the PDU being timed */
+  int rtt_timing; /*!< 1 while a PDU sent only once is being timed (Karn: 
+		     retransmitted PDUs give no measure) */
+  int ack_timing; /*!< 1 while the PDU first sent at rtt_sent waits for its 
+		     ACK, retransmitted or not (SIMPTCP_HIST_SEND_ACK) */
   struct timeval timeout; /*!< Expected timeout for last unacked packet */
 
   /* when receiving  Data */   
   short socket_state_receiver; /*!< receiver side FSM describing 
 				the data transfer phase */
   unsigned int next_ack_num;  /*!< Next ack number */
-  char in_buffer[SIMPTCP_SOCKET_MAX_BUFFER_SIZE]; /*!< SimpTCP socket Receive 
-						     buffer used to store 
-						     ingoing SimpTCP PDUs */
-  unsigned int in_len;/*!< instantaneous in_buffer occupation */
+  char * in_queue[SIMPTCP_RX_QUEUE_LEN]; /*!< received PDUs not yet read by 
+					   the application, oldest first from
+					   in_queue_head. They live in the 
+					   entity receive pool (referenced, 
+					   not copied) and are released once 
+					   fully read */
+  unsigned int in_queue_len[SIMPTCP_RX_QUEUE_LEN]; /*!< datagram length of 
+						      each queued PDU */
+  unsigned int in_queue_head; /*!< index of in_pdu in in_queue */
+  unsigned int in_queue_count; /*!< number of queued PDUs */
+  char * in_pdu; /*!< oldest queued PDU, the one being read (NULL if the 
+		   queue is empty) */
+  unsigned int in_len;/*!< datagram length of in_pdu: bounds its payload */
+  unsigned int in_off;/*!< number of payload bytes of in_pdu already read */
+  int in_loaned; /*!< 1 while in_pdu is lent to the application 
+		    (see simptcp_recv_loan) */
+  char * ucopy_buf; /*!< buffer of the application while it waits in recv: 
+		      the entity verifies the next PDU and copies its payload
+		      straight into it (see receive_direct) */
+  size_t ucopy_len; /*!< size of ucopy_buf */
+  size_t ucopy_filled; /*!< payload bytes copied into ucopy_buf from the PDU 
+			 being processed, not yet accepted */
+  size_t ucopy_done; /*!< payload bytes delivered into ucopy_buf */
+
+  /* delayed acknowledgements */
+  char ack_buffer[SIMPTCP_SOCKET_MAX_HEADER_SIZE]; /*!< pure ACKs are built
+						      here so that they never
+						      overwrite the header kept 
+						      in out_buffer for 
+						      retransmission */
+  int ack_pending; /*!< in-order segments received but not yet acknowledged */
+  int ack_pending_full; /*!< full-sized segments among ack_pending */
+  int ack_held; /*!< 1 if the ACK of the last PDU waits for the application
+		   to free a place in in_queue (flow control) */
+  int quickack; /*!< segments still to be acknowledged immediately */
+  int delack_pingpong; /*!< 1 when the application answers the data it 
+			  receives (interactive traffic): ACKs are then delayed
+			  in the hope of piggybacking them on the answer */
+  struct timeval delack_timeout; /*!< Expected timeout for the delayed ACK */
+  struct timeval last_data_in; /*!< arrival time of the last data segment */
+  struct timeval in_arrival; /*!< arrival time of the datagram of the data 
+			       waiting to be read (SIMPTCP_HIST_RECV_WAKEUP) */
+  struct timeval in_queue_arrival[SIMPTCP_RX_QUEUE_LEN]; /*!< arrival time 
+							    of each queued 
+							    PDU */
 
   /* MIB Statistics */
   unsigned long simptcp_send_count; /* number of sent SimpTCP PDU */
-  unsigned long simptcp_receive_count; /* number of sent SimpTCP PDU */
+  unsigned long simptcp_receive_count; /* number of received SimpTCP PDU */
   unsigned long simptcp_in_errors_count; /* number of unexpected received SimpTCP PDU */
+  unsigned long prediction_hits; /*!< established PDUs handled by the header
+				    prediction fast path */
+  unsigned long prediction_misses; /*!< established PDUs that took the 
+				      general path */
   unsigned long simptcp_retransmit_count; /* number of SimpTCP PDU retransmissions */
+  unsigned long long bytes_sent; /*!< payload bytes sent, retransmissions 
+				    included */
+  unsigned long long bytes_retrans; /*!< payload bytes retransmitted */
+  unsigned long long bytes_received; /*!< payload bytes delivered to the 
+					application */
+  struct timeval state_since; /*!< entry in the current state */
+  unsigned long long state_time_us[SIMPTCP_NB_STATES]; /*!< time spent in 
+							 each state left so
+							 far, in us */
+  simptcp_hist latency[SIMPTCP_HIST_NB]; /*!< latency histograms of the 
+					    connection (SIMPTCP_LATENCY) */
   
 
   /* optional fields */
@@ -263,13 +392,42 @@ typedef struct simptcp_socket_states_funcs {
 
 
 
+struct simptcp_info;             /* see simptcp_api.h */
+
 /* Fill a struct simptcp_socket with default values */
 int create_simptcp_socket();
+int release_simptcp_socket(int fd, int reuse);
+void orphan_simptcp_socket(int fd);
 char * simptcp_socket_state_get_str(simptcp_socket_state_funcs *state);
+void simptcp_socket_set_state(struct simptcp_socket *sock, simptcp_socket_state_funcs *state);
+int simptcp_socket_state_index(simptcp_socket_state_funcs *state);
 inline int lock_simptcp_socket(struct simptcp_socket *sock);
 inline int unlock_simptcp_socket(struct simptcp_socket *sock);
 int is_timeout(struct simptcp_socket * sock);
 int has_active_timer(struct simptcp_socket * sock);
+void start_timer(struct simptcp_socket * sock, int duration);
+void stop_timer(struct simptcp_socket * sock);
+void stop_delack_timer(struct simptcp_socket * sock);
+void rtt_start(struct simptcp_socket * sock);
+void rtt_ack(struct simptcp_socket * sock);
+void retransmit_pdu(struct simptcp_socket * sock);
+void simptcp_latency_record(struct simptcp_socket * sock, int hist, long long us);
+void build_header_template(struct simptcp_socket * socket);
+int make_pdu(struct simptcp_socket * socket, char * message, size_t longueur_message,
+             unsigned char flags);
+ssize_t send_pdu(struct simptcp_socket * socket);
+int is_delack_timeout(struct simptcp_socket * sock);
+int has_active_delack_timer(struct simptcp_socket * sock);
+void handle_delack_timeout(struct simptcp_socket * sock);
+int receive_direct(struct simptcp_socket * sock, char * buf, int len);
+ssize_t simptcp_socket_recv_loan(struct simptcp_socket * sock, const void ** data);
+int simptcp_socket_flush(struct simptcp_socket * sock);
+int simptcp_socket_setsockopt(struct simptcp_socket * sock, int optname,
+                              const void * optval, socklen_t optlen);
+void simptcp_socket_get_info(struct simptcp_socket * sock, struct simptcp_info * info);
+int simptcp_socket_getsockopt(struct simptcp_socket * sock, int optname,
+                              void * optval, socklen_t * optlen);
+int simptcp_socket_recv_release(struct simptcp_socket * sock);
 
 
 #endif // _SIMPTCP_LIB_H_
@@ -0,0 +1,81 @@
+/*
+ * simptcp_log.h
+ */
+
+#ifndef _SIMPTCP_LOG_H_
+#define _SIMPTCP_LOG_H_
+
+
+/* Leveled, per-subsystem logging.
+ *
+ * A message is kept only if its level is at most SIMPTCP_LOG_LEVEL, fixed at
+ * compile time, and at most the run-time level of its subsystem. Messages
+ * above SIMPTCP_LOG_LEVEL are compiled out, format string and arguments
+ * included. The run-time levels come from the SIMPTCP_LOG environment
+ * variable: a level ("4") or a list of subsystem=level ("lib=5,entity=4").
+ *
+ * Kept messages are formatted into a ring buffer and written out by a
+ * background thread (to stdout, or to the file named by SIMPTCP_LOG_FILE):
+ * the caller never blocks on I/O. When the ring is full the message is
+ * dropped. Each subsystem may also log at most SIMPTCP_LOG_RATE messages per
+ * second (default 5000, 0 for no limit); the number of dropped and
+ * rate-limited messages is reported in the log.
+ *
+ * A source file defines __SUBSYS__ (and __PREFIX__, printed before each
+ * message) before including this header.
+ */
+
+#define SIMPTCP_LOG_NONE        0
+#define SIMPTCP_LOG_ERR         1
+#define SIMPTCP_LOG_WARN        2
+#define SIMPTCP_LOG_INFO        3
+#define SIMPTCP_LOG_DEBUG       4
+#define SIMPTCP_LOG_TRACE       5   /* "function %s called" */
+
+/* the former -D__DEBUG__=1 builds keep all their traces */
+#ifndef SIMPTCP_LOG_LEVEL
+#if defined(__DEBUG__) && __DEBUG__
+#define SIMPTCP_LOG_LEVEL       SIMPTCP_LOG_TRACE
+#else
+#define SIMPTCP_LOG_LEVEL       SIMPTCP_LOG_INFO
+#endif
+#endif
+
+/* subsystems */
+#define SIMPTCP_LOG_API         0
+#define SIMPTCP_LOG_LIB         1
+#define SIMPTCP_LOG_ENTITY      2
+#define SIMPTCP_LOG_PACKET      3
+#define SIMPTCP_LOG_LIBC        4
+#define SIMPTCP_LOG_NB_SUBSYS   5
+
+#ifndef __PREFIX__
+#define __PREFIX__              ""
+#endif
+
+extern unsigned char simptcp_log_levels[SIMPTCP_LOG_NB_SUBSYS];
+
+void simptcp_log_write (int level, int subsys, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void simptcp_log_flush (void);
+
+/* true if a message of this level from this file (or from subsys) would be
+ * kept; guards the calls of the functions that only display something
+ */
+#define SIMPTCP_LOG_ON_FOR(subsys, level)                               \
+    (((level) <= SIMPTCP_LOG_LEVEL) && ((level) <= simptcp_log_levels[subsys]))
+#define SIMPTCP_LOG_ON(level)   SIMPTCP_LOG_ON_FOR(__SUBSYS__, level)
+
+#define SIMPTCP_LOG(level, fmt, ...)                                    \
+    do {                                                                \
+        if (SIMPTCP_LOG_ON(level))                                      \
+            simptcp_log_write((level), __SUBSYS__, __PREFIX__ fmt,      \
+                              ## __VA_ARGS__);                          \
+    } while (0)
+
+#define SIMPTCP_TRACE_CALL()                                            \
+    SIMPTCP_LOG(SIMPTCP_LOG_TRACE, "function %s called\n", __func__)
+
+#endif /* _SIMPTCP_LOG_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
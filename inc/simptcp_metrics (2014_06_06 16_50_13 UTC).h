@@ -0,0 +1,32 @@
+/*
+ * simptcp_metrics.h
+ */
+
+#ifndef _SIMPTCP_METRICS_H_
+#define _SIMPTCP_METRICS_H_
+
+
+/* OpenMetrics (Prometheus) exporter.
+ *
+ * An optional thread answers HTTP GET /metrics with the entity counters,
+ * gauges and latency histograms (see simptcp_stat.h) and those of every
+ * simpTCP socket, in the OpenMetrics text format. It listens on a Unix
+ * domain socket ("unix:/path") or on a TCP port of 127.0.0.1 ("port" or
+ * "localhost:port"), given by the SIMPTCP_METRICS environment variable
+ * when the entity starts, or to simptcp_metrics_start().
+ *
+ * A scrape only reads values that have a single writer, without taking
+ * mutex_socket nor waiting for the simptcp_handler thread: the figures of a
+ * socket may not be quite consistent with each other.
+ */
+
+#define SIMPTCP_METRICS_HIST_MAX_POW    26      /* histogram buckets of 1 us to
+                                                   2^26 us (67 s) */
+
+int simptcp_metrics_init (void);
+int simptcp_metrics_start (const char *addr);
+void simptcp_metrics_stop (void);
+
+#endif /* _SIMPTCP_METRICS_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
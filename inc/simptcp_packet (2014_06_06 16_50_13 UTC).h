@@ -5,6 +5,10 @@
 #ifndef _SIMPTCP_PACKET_H_
 #define _SIMPTCP_PACKET_H_
 
+#include <string.h>             /* for memcpy() */
+#include <sys/types.h>          /* for u_int16_t, u_int32_t */
+#include <netinet/in.h>         /* for htons,.. */
+
 /* Definition des valeurs que peut prendre le champ flags du PDU SimpTCP */
 
 /*!
@@ -76,6 +80,41 @@ typedef struct simptcp_generic_header
 #define SIMPTCP_MSS_OPTION 2
 #define SIMPTCP_SACK_OPTION 4
 #define SIMPTCP_TS_OPTION 8
+#define SIMPTCP_CRC32C_OPTION 16
+
+/*!
+ * \def SIMPTCP_MSS_LEN
+ * Longueur de l'option MSS : la charge utile maximale acceptee, sur 2 octets
+ */
+#define SIMPTCP_MSS_LEN 4
+
+/*!
+ * \def SIMPTCP_SACK_MAX_LEN
+ * Longueur maximale de l'option SACK : jusqu'a 4 blocs de 2 numeros de 
+ * sequence de 2 octets
+ */
+#define SIMPTCP_SACK_MAX_LEN 18
+
+/*!
+ * \def SIMPTCP_TS_LEN
+ * Longueur de l'option timestamp : valeur et echo de 4 octets chacun
+ */
+#define SIMPTCP_TS_LEN 10
+
+/*!
+ * \def SIMPTCP_CRC32C_PERMITTED_LEN
+ * Longueur de l'option CRC32C dans les PDU SYN : elle ne porte pas de valeur
+ * et propose (SYN) ou accepte (SYN+ACK) le mode CRC32C pour la connexion
+ */
+#define SIMPTCP_CRC32C_PERMITTED_LEN 2
+
+/*!
+ * \def SIMPTCP_CRC32C_LEN
+ * Longueur de l'option CRC32C dans les autres PDU d'une connexion en mode 
+ * CRC32C : elle porte le CRC32C (4 octets, ordre reseau) calcule sur tout le
+ * PDU, option comprise avec une valeur nulle. Le champ checksum vaut alors 0
+ */
+#define SIMPTCP_CRC32C_LEN 6
 
 /*! 
  * \brief structure relative a la declarartion
@@ -92,49 +131,339 @@ typedef struct simptcp_option_header
   unsigned char option_len; /*!< option length in bytes */
 }simptcp_option_header;
 
+/*!
+ * \def SIMPTCP_MAX_OPTIONS
+ * Nombre maximal d'options decodees dans un PDU
+ */
+#define SIMPTCP_MAX_OPTIONS 8
+
+/*!
+ * \def SIMPTCP_OPTION_BIT
+ * Bit associe a un type d'option dans #simptcp_options.present
+ */
+#define SIMPTCP_OPTION_BIT(kind) (1u << ((kind) & 31))
+
+/*! 
+ * \brief options d'un PDU SimpTCP, decodees par #simptcp_parse_options
+ */
+typedef struct simptcp_options
+{
+  unsigned int present; /*!< SIMPTCP_OPTION_BIT() des options presentes */
+  unsigned char nb; /*!< nombre d'options decodees */
+  unsigned char offset[SIMPTCP_MAX_OPTIONS]; /*!< position de l'en-tete de chaque option dans le PDU */
+}simptcp_options;
+
 
 
 
 /*
- * prototypes des methodes elementaires permettant 
- * de construire le PDU SimpTCP ou d'extraire des
- * informations du PDU SimpTCP. Certaines methodes
- * permettent egalement d'afficher sur la sortie 
- * standard le contenu du PDU
+ * Accesseurs aux champs de l'en-tete generique. Ils sont definis ici, 
+ * static inline, pour que le compilateur les integre dans le code appelant 
+ * (une lecture ou une ecriture, plus la conversion d'ordre des octets) : ce
+ * sont les fonctions les plus appelees du chemin de traitement des PDU.
+ * always_inline force cette integration aussi sans optimisation (-O0, le
+ * build par defaut), ou gcc ignore sinon le mot cle inline
 */
+#define SIMPTCP_INLINE static inline __attribute__((always_inline))
+
+/*! \fn void simptcp_set_sport (char *buffer, u_int16_t sport)
+ * \brief initialise le champ sport (source port) du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param sport numero de port source
+ */
+SIMPTCP_INLINE void simptcp_set_sport (char *buffer, u_int16_t sport)
+{
+    ((simptcp_generic_header *) buffer)->sport = htons(sport);
+}
+
+/*! \fn u_int16_t simptcp_get_sport (const char *buffer)
+ * \brief renvoie la valeur du champ sport (source port) du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return numero de port source
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_sport (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->sport);
+}
+
+/*! \fn void simptcp_set_dport (char *buffer, u_int16_t dport)
+ * \brief initialise le champ dport (destination port) du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param dport numero de port destination
+ */
+SIMPTCP_INLINE void simptcp_set_dport (char *buffer, u_int16_t dport)
+{
+    ((simptcp_generic_header *) buffer)->dport = htons(dport);
+}
+
+/*! \fn u_int16_t simptcp_get_dport (const char *buffer)
+ * \brief renvoie la valeur du champ dport (destination port) du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return numero de port destination
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_dport (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->dport);
+}
+
+/*! \fn void simptcp_set_flags (char *buffer, unsigned char flags)
+ * \brief initialise le champ flags du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param flags valeur des 7 flags (#SYN, #ACK, ..)
+ */
+SIMPTCP_INLINE void simptcp_set_flags (char *buffer, unsigned char flags)
+{
+    ((simptcp_generic_header *) buffer)->flags = flags;
+}
+
+/*! \fn unsigned char simptcp_get_flags (const char *buffer)
+ * \brief renvoie la valeur du champ flags du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return valeur des 7 flags (#SYN, #ACK, ..)
+ */
+SIMPTCP_INLINE unsigned char simptcp_get_flags (const char *buffer)
+{
+    return ((const simptcp_generic_header *) buffer)->flags;
+}
+
+/*! \fn void simptcp_set_seq_num (char *buffer, u_int16_t seq)
+ * \brief initialise le champ seq_num du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param seq numero de sequence
+ */
+SIMPTCP_INLINE void simptcp_set_seq_num (char *buffer, u_int16_t seq)
+{
+    ((simptcp_generic_header *) buffer)->seq_num = htons(seq);
+}
 
-void    simptcp_set_sport (char *buffer, u_int16_t sport);
-u_int16_t simptcp_get_sport (const char *buffer);
+/*! \fn u_int16_t simptcp_get_seq_num (const char *buffer)
+ * \brief renvoie la valeur du champ seq_num du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return numero de sequence
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_seq_num (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->seq_num);
+}
 
-void    simptcp_set_dport (char *buffer, u_int16_t dport);
-u_int16_t simptcp_get_dport (const char *buffer);
+/*! \fn void simptcp_set_ack_num (char *buffer, u_int16_t ack)
+ * \brief initialise le champ ack_num du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param ack numero d'acquittement
+ */
+SIMPTCP_INLINE void simptcp_set_ack_num (char *buffer, u_int16_t ack)
+{
+    ((simptcp_generic_header *) buffer)->ack_num = htons(ack);
+}
 
-void    simptcp_set_flags  (char *buffer, unsigned char flags);
-unsigned char  simptcp_get_flags  (const char *buffer);
+/*! \fn u_int16_t simptcp_get_ack_num (const char *buffer)
+ * \brief renvoie la valeur du champ ack_num du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return numero d'acquittement
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_ack_num (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->ack_num);
+}
 
-void    simptcp_set_seq_num   (char *buffer, u_int16_t seq);
-u_int16_t   simptcp_get_seq_num   (const char *buffer);
+/*! \fn void simptcp_set_head_len (char *buffer, unsigned char hlen)
+ * \brief initialise le champ header_len du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param hlen taille de l'en-tete, options comprises
+ */
+SIMPTCP_INLINE void simptcp_set_head_len (char *buffer, unsigned char hlen)
+{
+    ((simptcp_generic_header *) buffer)->header_len = hlen;
+}
 
-void    simptcp_set_ack_num   (char *buffer, u_int16_t ack);
-u_int16_t   simptcp_get_ack_num   (const char *buffer);
+/*! \fn unsigned char simptcp_get_head_len (const char *buffer)
+ * \brief renvoie la valeur du champ header_len du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return taille de l'en-tete, options comprises
+ */
+SIMPTCP_INLINE unsigned char simptcp_get_head_len (const char *buffer)
+{
+    return ((const simptcp_generic_header *) buffer)->header_len;
+}
 
-void    simptcp_set_head_len   (char *buffer, unsigned char hlen);
-unsigned char   simptcp_get_head_len   (const char *buffer);
+/*! \fn void simptcp_set_total_len (char *buffer, u_int16_t tlen)
+ * \brief initialise le champ total_len du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param tlen taille totale du PDU, charge utile incluse
+ */
+SIMPTCP_INLINE void simptcp_set_total_len (char *buffer, u_int16_t tlen)
+{
+    ((simptcp_generic_header *) buffer)->total_len = htons(tlen);
+}
 
-void    simptcp_set_total_len   (char *buffer, u_int16_t tlen);
-u_int16_t   simptcp_get_total_len   (const char *buffer);
+/*! \fn u_int16_t simptcp_get_total_len (const char *buffer)
+ * \brief renvoie la valeur du champ total_len du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return taille totale du PDU, charge utile incluse
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_total_len (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->total_len);
+}
 
-void    simptcp_set_win_size   (char *buffer, u_int16_t size);
-u_int16_t   simptcp_get_win_size   (const char *buffer);
+/*! \fn void simptcp_set_win_size (char *buffer, u_int16_t size)
+ * \brief initialise le champ window_size du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \param size taille de la fenetre de controle de flux
+ */
+SIMPTCP_INLINE void simptcp_set_win_size (char *buffer, u_int16_t size)
+{
+    ((simptcp_generic_header *) buffer)->window_size = htons(size);
+}
 
+/*! \fn u_int16_t simptcp_get_win_size (const char *buffer)
+ * \brief renvoie la valeur du champ window_size du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return taille de la fenetre de controle de flux
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_win_size (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->window_size);
+}
+
+/*! \fn u_int16_t simptcp_get_checksum (const char *buffer)
+ * \brief renvoie la valeur du champ checksum du PDU SimpTCP
+ * \param buffer pointeur sur PDU simptcp 
+ * \return valeur du champ checksum du PDU
+ */
+SIMPTCP_INLINE u_int16_t simptcp_get_checksum (const char *buffer)
+{
+    return ntohs(((const simptcp_generic_header *) buffer)->checksum);
+}
+
+/*! \struct simptcp_header_fields
+ * \brief en-tete generique d'un PDU SimpTCP decode en ordre hote
+ */
+typedef struct simptcp_header_fields
+{
+  u_int16_t sport;
+  u_int16_t dport;
+  u_int16_t seq_num;
+  u_int16_t ack_num;
+  unsigned char header_len;
+  unsigned char flags;
+  u_int16_t total_len;
+  u_int16_t window_size;
+  u_int16_t checksum;
+} simptcp_header_fields;
+
+/*! \fn void simptcp_parse_header (const char *buffer, simptcp_header_fields *fields)
+ * \brief decode en une fois tout l'en-tete generique d'un PDU : une seule 
+ * lecture des 16 octets (le PDU peut etre mal aligne), puis les conversions
+ * d'ordre des octets
+ * \param buffer pointeur sur PDU simptcp 
+ * \param [out] fields champs de l'en-tete en ordre hote
+ */
+SIMPTCP_INLINE void simptcp_parse_header (const char *buffer, simptcp_header_fields *fields)
+{
+    simptcp_generic_header h;
+
+    memcpy(&h, buffer, sizeof(h));
+    fields->sport = ntohs(h.sport);
+    fields->dport = ntohs(h.dport);
+    fields->seq_num = ntohs(h.seq_num);
+    fields->ack_num = ntohs(h.ack_num);
+    fields->header_len = h.header_len;
+    fields->flags = h.flags;
+    fields->total_len = ntohs(h.total_len);
+    fields->window_size = ntohs(h.window_size);
+    fields->checksum = ntohs(h.checksum);
+}
+
+/*! \fn void simptcp_build_header (char *buffer, const simptcp_header_fields *fields)
+ * \brief ecrit en une fois tout l'en-tete generique d'un PDU (checksum compris,
+ * tel que fourni)
+ * \param buffer pointeur sur PDU simptcp 
+ * \param fields champs de l'en-tete en ordre hote
+ */
+SIMPTCP_INLINE void simptcp_build_header (char *buffer, const simptcp_header_fields *fields)
+{
+    simptcp_generic_header h;
+
+    h.sport = htons(fields->sport);
+    h.dport = htons(fields->dport);
+    h.seq_num = htons(fields->seq_num);
+    h.ack_num = htons(fields->ack_num);
+    h.header_len = fields->header_len;
+    h.flags = fields->flags;
+    h.total_len = htons(fields->total_len);
+    h.window_size = htons(fields->window_size);
+    h.checksum = htons(fields->checksum);
+    memcpy(buffer, &h, sizeof(h));
+}
+
+
+/*
+ * prototypes des methodes elementaires permettant 
+ * de construire le PDU SimpTCP ou d'extraire des
+ * informations du PDU SimpTCP. Certaines methodes
+ * permettent egalement d'afficher sur la sortie 
+ * standard le contenu du PDU
+*/
 
-u_int16_t   simptcp_get_checksum   (const char *buffer);
 void simptcp_add_checksum (char *buffer, int len);
+void simptcp_add_checksum_iov (char *buffer, int hlen, const char *data, int dlen);
+void simptcp_add_checksum_sum (char *buffer, int hlen, u_int32_t data_sum);
+void simptcp_replace_word16 (char *buffer, int offset, u_int16_t value);
 int simptcp_check_checksum(char *buffer, int len);
+const char * simptcp_find_option (const char *buffer, int len, unsigned char kind);
+void simptcp_add_crc32c (char *buffer, int hlen, const char *data, int dlen);
+int simptcp_check_integrity (char *buffer, int len);
+int simptcp_check_integrity_copy (char *buffer, int len, void *payload);
 
 u_int16_t simptcp_extract_data (char * pdu, void * payload);
 
 void simptcp_print_packet (char * buf);
+void simptcp_print_packet_iov (char * buf, const char * data);
+
+int simptcp_walk_options (const char *buffer, int len, simptcp_options *opts);
+int simptcp_put_option (char *buffer, int max_hlen, unsigned char kind,
+                        const void *value, int vlen);
+
+/*! \fn int simptcp_parse_options (const char *buffer, int len, simptcp_options *opts)
+ * \brief decode et valide les options d'un PDU recu. Le cas courant, un 
+ * en-tete sans option, ne coute qu'une comparaison : la liste n'est parcourue
+ * (#simptcp_walk_options) que si header_len depasse l'en-tete generique
+ * \param buffer pointeur sur PDU simptcp 
+ * \param len taille du PDU recu
+ * \param [out] opts options decodees
+ * \return 0 si l'en-tete est valide, -1 s'il est mal forme (header_len hors
+ * du PDU, option tronquee ou de longueur invalide)
+ */
+SIMPTCP_INLINE int simptcp_parse_options (const char *buffer, int len, simptcp_options *opts)
+{
+    opts->present = 0;
+    opts->nb = 0;
+    if (__builtin_expect(simptcp_get_head_len(buffer) == SIMPTCP_GHEADER_SIZE, 1))
+        return (len < (int) SIMPTCP_GHEADER_SIZE) ? -1 : 0;
+    return simptcp_walk_options(buffer, len, opts);
+}
+
+/*! \fn const char * simptcp_option_get (const char *buffer, const simptcp_options *opts, unsigned char kind)
+ * \brief renvoie une option decodee par #simptcp_parse_options
+ * \param buffer pointeur sur PDU simptcp 
+ * \param opts options du PDU
+ * \param kind type de l'option recherchee
+ * \return pointeur sur l'en-tete de l'option (#simptcp_option_header, suivi
+ * de la valeur), NULL si elle est absente
+ */
+SIMPTCP_INLINE const char * simptcp_option_get (const char *buffer, const simptcp_options *opts,
+                                               unsigned char kind)
+{
+    int i;
+
+    if (!(opts->present & SIMPTCP_OPTION_BIT(kind)))
+        return NULL;
+    for (i = 0; i < opts->nb; i++)
+        if (((const simptcp_option_header *) (buffer + opts->offset[i]))->option_kind == kind)
+            return buffer + opts->offset[i];
+    return NULL;
+}
 
 
 
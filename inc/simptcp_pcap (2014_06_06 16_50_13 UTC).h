@@ -0,0 +1,48 @@
+/*
+ * simptcp_pcap.h
+ */
+
+#ifndef _SIMPTCP_PCAP_H_
+#define _SIMPTCP_PCAP_H_
+
+#include <sys/uio.h>            /* for struct iovec */
+#include <netinet/in.h>         /* for struct sockaddr_in */
+
+
+/* Capture of the simpTCP datagrams sent and received, to a pcap file.
+ *
+ * Each datagram is stored with made-up IPv4 and UDP headers (link type
+ * "raw IP") so that Wireshark or tcpdump read the file as they would a
+ * capture of the UDP socket, without root access. The capture is on when
+ * the SIMPTCP_PCAP environment variable names the file, or after
+ * simptcp_pcap_open(). SIMPTCP_PCAP_SNAPLEN limits the bytes kept per
+ * datagram (IP and UDP headers included) and SIMPTCP_PCAP_FILTER selects
+ * the datagrams by simpTCP port, for example "port 15000" or
+ * "src port 15000 or dst port 15001".
+ *
+ * The senders copy the datagram into a slot of a lock-free ring and never
+ * block: when the ring is full the datagram is not captured (and counted).
+ * A background thread writes the slots out.
+ */
+
+#define SIMPTCP_PCAP_SLOTS      1024    /* a power of 2 */
+#define SIMPTCP_PCAP_MAX_SNAPLEN 1500   /* ETH_MTU */
+#define SIMPTCP_PCAP_MAX_FILTERS 8
+
+extern volatile int simptcp_pcap_enabled;
+
+int simptcp_pcap_open (const char *path, int snaplen, const char *filter);
+void simptcp_pcap_close (void);
+void simptcp_pcap_capture (const struct sockaddr_in *src, const struct sockaddr_in *dst,
+                           const struct iovec *iov, int iovcnt);
+unsigned long simptcp_pcap_dropped (void);
+
+#define SIMPTCP_PCAP(src, dst, iov, iovcnt)                             \
+    do {                                                                \
+        if (simptcp_pcap_enabled)                                       \
+            simptcp_pcap_capture((src), (dst), (iov), (iovcnt));        \
+    } while (0)
+
+#endif /* _SIMPTCP_PCAP_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
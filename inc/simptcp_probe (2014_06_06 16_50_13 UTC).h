@@ -0,0 +1,109 @@
+/*
+ * simptcp_probe.h
+ */
+
+#ifndef _SIMPTCP_PROBE_H_
+#define _SIMPTCP_PROBE_H_
+
+
+/* USDT (SystemTap SDT) static tracepoints, provider "simptcp", for perf,
+ * bpftrace or SystemTap, for example:
+ *
+ *   bpftrace -e 'usdt:./server:simptcp:retransmit { @[arg2] = count(); }'
+ *   perf probe -x ./server sdt_simptcp:csum_drop
+ *
+ * A probe is a single NOP plus a note in the ELF file that tells the
+ * tracers where it is and where its arguments are: it costs nothing until
+ * a tracer attaches to it. Its arguments are plain values (no function is
+ * called to compute them). The probes are
+ *
+ *   demux_hit(fd, buf, len)             PDU demultiplexed to socket fd
+ *   demux_miss(buf, len)                PDU for no socket
+ *   pdu_<state>(sock, buf, len)         entry of <state>_..._process_simptcp_pdu
+ *   state(sock, port, old, new)         state change (numbered as in
+ *                                       SIMPTCP_INFO: CLOSED 0 .. TIMEWAIT 10)
+ *   retransmit(sock, port, count, rto_ms) PDU retransmitted, count-th time
+ *   csum_drop(buf, len)                 corrupted or malformed PDU dropped
+ *   send_error(sock, port, errno, len)  sendmsg/sendto failure
+ *
+ * where buf points to the simpTCP header and port is the local simpTCP port.
+ * The probes use <sys/sdt.h> when it is installed (systemtap-sdt-dev),
+ * otherwise an equivalent note is emitted here on x86-64. Compile with
+ * -DSIMPTCP_USDT=0 to leave them out.
+ */
+
+#ifndef SIMPTCP_USDT
+# if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#   define SIMPTCP_USDT 2       /* <sys/sdt.h> */
+#  endif
+# endif
+# if !defined(SIMPTCP_USDT) && defined(__GNUC__) && defined(__x86_64__)
+#  define SIMPTCP_USDT 1        /* the notes below */
+# endif
+#endif
+
+#if defined(SIMPTCP_USDT) && (SIMPTCP_USDT == 2)
+
+#include <sys/sdt.h>
+
+#define SIMPTCP_PROBE2(name, a1, a2)                                    \
+    DTRACE_PROBE2(simptcp, name, a1, a2)
+#define SIMPTCP_PROBE3(name, a1, a2, a3)                                \
+    DTRACE_PROBE3(simptcp, name, a1, a2, a3)
+#define SIMPTCP_PROBE4(name, a1, a2, a3, a4)                            \
+    DTRACE_PROBE4(simptcp, name, a1, a2, a3, a4)
+
+#elif defined(SIMPTCP_USDT) && (SIMPTCP_USDT == 1)
+
+/* the .note.stapsdt format of <sys/sdt.h> (version 3): the address of the
+ * NOP, the base used to relocate it, no semaphore, the provider, the name
+ * and the arguments, each "-8@operand" (all of them passed as longs)
+ */
+#define _SIMPTCP_SDT_ASM(name, args)                                    \
+    "990: nop\n"                                                        \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                       \
+    ".balign 4\n"                                                       \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                  \
+    "991: .asciz \"stapsdt\"\n"                                         \
+    "992: .balign 4\n"                                                  \
+    "993: .8byte 990b\n"                                                \
+    ".8byte _.stapsdt.base\n"                                           \
+    ".8byte 0\n"                                                        \
+    ".asciz \"simptcp\"\n"                                              \
+    ".asciz \"" #name "\"\n"                                            \
+    ".asciz \"" args "\"\n"                                             \
+    "994: .balign 4\n"                                                  \
+    ".popsection\n"                                                     \
+    ".ifndef _.stapsdt.base\n"                                          \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n"                                            \
+    ".hidden _.stapsdt.base\n"                                          \
+    "_.stapsdt.base: .space 1\n"                                        \
+    ".size _.stapsdt.base, 1\n"                                         \
+    ".popsection\n"                                                     \
+    ".endif\n"
+
+#define SIMPTCP_PROBE2(name, a1, a2)                                    \
+    __asm__ __volatile__ (_SIMPTCP_SDT_ASM(name, "-8@%0 -8@%1")         \
+                          :: "nor" ((long) (a1)), "nor" ((long) (a2)))
+#define SIMPTCP_PROBE3(name, a1, a2, a3)                                \
+    __asm__ __volatile__ (_SIMPTCP_SDT_ASM(name, "-8@%0 -8@%1 -8@%2")   \
+                          :: "nor" ((long) (a1)), "nor" ((long) (a2)),  \
+                             "nor" ((long) (a3)))
+#define SIMPTCP_PROBE4(name, a1, a2, a3, a4)                            \
+    __asm__ __volatile__ (_SIMPTCP_SDT_ASM(name, "-8@%0 -8@%1 -8@%2 -8@%3") \
+                          :: "nor" ((long) (a1)), "nor" ((long) (a2)),  \
+                             "nor" ((long) (a3)), "nor" ((long) (a4)))
+
+#else
+
+#define SIMPTCP_PROBE2(name, a1, a2)                    do { } while (0)
+#define SIMPTCP_PROBE3(name, a1, a2, a3)                do { } while (0)
+#define SIMPTCP_PROBE4(name, a1, a2, a3, a4)            do { } while (0)
+
+#endif
+
+#endif /* _SIMPTCP_PROBE_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
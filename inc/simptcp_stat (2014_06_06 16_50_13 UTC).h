@@ -0,0 +1,112 @@
+/*
+ * simptcp_stat.h
+ */
+
+#ifndef _SIMPTCP_STAT_H_
+#define _SIMPTCP_STAT_H_
+
+#include <sys/types.h>          /* for u_int32_t, u_int64_t */
+#include <simptcp_hist.h>
+
+
+/* Entity-wide counters.
+ *
+ * Each thread that counts something gets its own slot, a cache line aligned
+ * array of counters that only it writes: counting is a plain increment, with
+ * no atomic operation and no false sharing. When the thread exits its slot,
+ * counts included, is handed to the next thread that registers. Threads in
+ * excess of SIMPTCP_STAT_MAX_SLOTS - 1 share the last slot and update it
+ * with atomic operations. The slots live in a shared
+ * memory segment, /simptcp-<pid>, that the simptcp_stat program maps read
+ * only to sum and sample them; reading it costs the stack nothing. With
+ * SIMPTCP_STAT=0 in the environment the counters are kept in private memory.
+ * The segment goes away with the process: SIMPTCP_STAT_SAVE=path writes it
+ * to path at exit ("%p" in path standing for the pid), and simptcp_stat
+ * reads such a file as it would the segment.
+ */
+
+/* counters */
+#define SIMPTCP_STAT_RX_DATAGRAMS       0   /* datagrams received */
+#define SIMPTCP_STAT_TX_DATAGRAMS       1   /* PDUs sent (data, control, ACKs) */
+#define SIMPTCP_STAT_RX_ERRORS          2   /* recvfrom errors (other than EAGAIN) */
+#define SIMPTCP_STAT_TX_ERRORS          3   /* sendmsg/sendto errors */
+#define SIMPTCP_STAT_CSUM_DROPS         4   /* corrupted or malformed PDUs */
+#define SIMPTCP_STAT_NOMATCH_DROPS      5   /* PDUs for no simpTCP socket */
+#define SIMPTCP_STAT_BADSTATE_DROPS     6   /* PDUs ignored in the socket state */
+#define SIMPTCP_STAT_QUEUE_DROPS        7   /* data PDUs dropped, the previous
+                                               one not yet read */
+#define SIMPTCP_STAT_LOOPS              8   /* iterations of the entity loop */
+#define SIMPTCP_STAT_IDLE_US            9   /* entity time without datagram */
+#define SIMPTCP_STAT_NB                 10
+
+#define SIMPTCP_STAT_NAMES                                              \
+    { "rx_datagrams", "tx_datagrams", "rx_errors", "tx_errors",         \
+      "csum_drops", "nomatch_drops", "badstate_drops", "queue_drops",   \
+      "loops", "idle_us" }
+
+#define SIMPTCP_STAT_MAX_SLOTS          32  /* the last slot is shared by the
+                                               threads in excess */
+
+/* one thread's counters and latency histograms (see simptcp_hist.h), alone
+ * in their cache lines */
+typedef struct simptcp_stat_slot {
+    u_int64_t values[SIMPTCP_STAT_NB];
+    simptcp_hist hist[SIMPTCP_HIST_NB];
+} __attribute__((aligned(64))) simptcp_stat_slot;
+
+/* the shared memory segment */
+#define SIMPTCP_STAT_MAGIC              "SIMPSTA2"
+#define SIMPTCP_STAT_SHM_FORMAT         "/simptcp-%d"
+
+typedef struct simptcp_stat_shm {
+    char magic[8];
+    u_int32_t nb_counters;      /* SIMPTCP_STAT_NB */
+    u_int32_t nb_hists;         /* SIMPTCP_HIST_NB */
+    u_int32_t hist_buckets;     /* SIMPTCP_HIST_BUCKETS */
+    u_int32_t max_slots;        /* SIMPTCP_STAT_MAX_SLOTS */
+    u_int32_t nb_slots;         /* slots in use */
+    u_int32_t pid;
+    u_int64_t start_us;         /* creation time (gettimeofday) */
+    simptcp_stat_slot slots[SIMPTCP_STAT_MAX_SLOTS] __attribute__((aligned(64)));
+} simptcp_stat_shm;
+
+extern __thread simptcp_stat_slot *simptcp_stat_my_slot;
+extern __thread int simptcp_stat_shared;   /* my_slot is the shared slot */
+
+int simptcp_stat_init (void);
+simptcp_stat_slot * simptcp_stat_register (void);
+void simptcp_stat_shared_latency (simptcp_hist *h, long long us);
+void simptcp_stat_sum (u_int64_t values[SIMPTCP_STAT_NB]);
+void simptcp_stat_hist_sum (simptcp_hist hist[SIMPTCP_HIST_NB]);
+
+/* adds n to counter c of the calling thread */
+static inline void simptcp_stat_add (int c, u_int64_t n)
+{
+    simptcp_stat_slot *slot = simptcp_stat_my_slot;
+
+    if (__builtin_expect(slot == NULL, 0))
+        slot = simptcp_stat_register();
+    if (__builtin_expect(simptcp_stat_shared, 0))
+        __atomic_fetch_add(&(slot->values[c]), n, __ATOMIC_RELAXED);
+    else
+        slot->values[c] += n;
+}
+
+#define SIMPTCP_STAT_INC(c)     simptcp_stat_add((c), 1)
+
+/* records a latency of us microseconds in histogram h of the calling thread */
+static inline void simptcp_stat_latency (int h, long long us)
+{
+    simptcp_stat_slot *slot = simptcp_stat_my_slot;
+
+    if (__builtin_expect(slot == NULL, 0))
+        slot = simptcp_stat_register();
+    if (__builtin_expect(simptcp_stat_shared, 0))
+        simptcp_stat_shared_latency(&(slot->hist[h]), us);
+    else
+        simptcp_hist_record(&(slot->hist[h]), us);
+}
+
+#endif /* _SIMPTCP_STAT_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,104 @@
+/*
+ * simptcp_trace.h
+ */
+
+#ifndef _SIMPTCP_TRACE_H_
+#define _SIMPTCP_TRACE_H_
+
+#include <sys/types.h>          /* for u_int16_t, u_int32_t, u_int64_t */
+
+
+/* Binary event trace.
+ *
+ * Each thread records fixed-size events, stamped with the CPU time stamp
+ * counter, in its own ring (the last SIMPTCP_TRACE_RING_EVENTS events): a
+ * record is a few stores, with no lock and no system call. Tracing is off
+ * unless the SIMPTCP_TRACE environment variable is set or
+ * simptcp_trace_enable() is called; SIMPTCP_TRACE_EVENTS=0 at compile time
+ * removes the probes altogether.
+ *
+ * The ring of a thread that exits goes back to a free list, and the next
+ * thread that starts tracing takes it over, with its id and its last events:
+ * at most 256 threads trace at the same time, the others record nothing.
+ *
+ * The rings are written to a file by simptcp_trace_dump(), on SIGUSR2 and at
+ * exit (to SIMPTCP_TRACE_FILE, by default simptcp-<pid>.trace). The
+ * simptcp_trace program decodes the file.
+ */
+
+#ifndef SIMPTCP_TRACE_EVENTS
+#define SIMPTCP_TRACE_EVENTS    1
+#endif
+
+#define SIMPTCP_TRACE_RING_EVENTS 8192  /* per thread, a power of 2 */
+
+/* event types, and the meaning of their arguments */
+#define SIMPTCP_TRACE_PDU_SEND   1  /* a..f: sport, dport, seq, ack, flags | hlen << 8, tlen */
+#define SIMPTCP_TRACE_PDU_RECV   2  /* same as PDU_SEND */
+#define SIMPTCP_TRACE_DROP       3  /* a: length of the corrupted or malformed PDU */
+#define SIMPTCP_TRACE_DEMUX      4  /* a: dport, b: fd (0xffff: no socket), c: length */
+#define SIMPTCP_TRACE_STATE      5  /* a: old state, b: new state (SIMPTCP_TRACE_STATE_NAMES) */
+#define SIMPTCP_TRACE_TIMER_ARM  6  /* a: timer, value: duration in ms */
+#define SIMPTCP_TRACE_TIMER_STOP 7  /* a: timer */
+#define SIMPTCP_TRACE_TIMER_FIRE 8  /* a: timer */
+
+/* timers */
+#define SIMPTCP_TRACE_RTX_TIMER     0
+#define SIMPTCP_TRACE_DELACK_TIMER  1
+
+/* states, in the order of struct simptcp_socket_states_funcs */
+#define SIMPTCP_TRACE_STATE_NAMES                                       \
+    { "CLOSED", "LISTEN", "SYNSENT", "SYNRCVD", "ESTABLISHED", "CLOSEWAIT", \
+      "FINWAIT1", "FINWAIT2", "CLOSING", "LASTACK", "TIMEWAIT" }
+
+/* one event: 32 bytes */
+typedef struct simptcp_trace_event {
+    u_int64_t tsc;              /* time stamp counter */
+    u_int8_t type;              /* SIMPTCP_TRACE_* */
+    u_int8_t thread;            /* ring (thread) that recorded the event */
+    u_int16_t port;             /* local simptcp port of the socket, 0 if unknown */
+    u_int32_t value;
+    u_int16_t a, b, c, d, e, f;
+    u_int32_t pad;
+} simptcp_trace_event;
+
+/* trace file: this header, then nb_events events sorted per thread */
+#define SIMPTCP_TRACE_MAGIC     "SIMPTRC1"
+
+typedef struct simptcp_trace_file_header {
+    char magic[8];
+    u_int32_t event_size;       /* sizeof(simptcp_trace_event) */
+    u_int32_t nb_threads;
+    u_int64_t nb_events;
+    double tsc_hz;              /* time stamp counter frequency */
+} simptcp_trace_file_header;
+
+extern volatile int simptcp_trace_enabled;
+
+void simptcp_trace_enable (int on);
+int simptcp_trace_dump (const char *path);
+void simptcp_trace_record (int type, u_int16_t port, u_int32_t value,
+                           u_int16_t a, u_int16_t b, u_int16_t c,
+                           u_int16_t d, u_int16_t e, u_int16_t f);
+void simptcp_trace_pdu (int type, u_int16_t port, const char *pdu, int len);
+
+#if SIMPTCP_TRACE_EVENTS
+#define SIMPTCP_TRACE(type, port, value, a, b, c, d, e, f)              \
+    do {                                                                \
+        if (simptcp_trace_enabled)                                      \
+            simptcp_trace_record((type), (port), (value), (a), (b), (c), \
+                                 (d), (e), (f));                        \
+    } while (0)
+#define SIMPTCP_TRACE_PDU(type, port, pdu, len)                         \
+    do {                                                                \
+        if (simptcp_trace_enabled)                                      \
+            simptcp_trace_pdu((type), (port), (pdu), (len));            \
+    } while (0)
+#else
+#define SIMPTCP_TRACE(type, port, value, a, b, c, d, e, f) do { } while (0)
+#define SIMPTCP_TRACE_PDU(type, port, pdu, len) do { } while (0)
+#endif
+
+#endif /* _SIMPTCP_TRACE_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
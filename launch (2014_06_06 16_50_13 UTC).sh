@@ -1,7 +1,219 @@
 #!/bin/sh
+#
+# launch.sh: builds the tree and runs a simpTCP scenario headlessly on the
+# loopback, then writes a JSON report of the run: the benchmark results of
+# each side, their exit status and the entity counters and latencies of
+# every process (saved at exit with SIMPTCP_STAT_SAVE, read by simptcp_stat).
+#
+# usage: launch.sh [-B] [-p port] [-c conns] [-t secs] [-n netem] [-o report]
+#                  [-d dir] scenario [-- benchmark options]
+#
+#   -B         do not build
+#   -p port    port of the server (one per scenario by default; smoke: 15556)
+#   -c conns   connections: perf streams, rr/crr/pingpong concurrency (1)
+#   -t secs    duration of perf, rr, crr and pingpong (5)
+#   -n netem   network emulator setting of both sides, for example
+#              "loss 1% delay 5ms 1ms" (see libc_socket.h)
+#   -o report  report file (standard output by default)
+#   -d dir     directory for the outputs, logs and counters of the run
+#              (a new temporary directory by default)
+#
+# scenarios:
+#   smoke      server and client exchange one line
+#   perf       simptcp_perf throughput (options after -- go to its client)
+#   rr, crr, pingpong
+#              simptcp_rr latency and transactions per second
+#   sendfile   sendfile_bench transfer of a 4 MiB file
+#
+# example: ./launch.sh -n "loss 1%" -c 2 -o perf-loss1.json perf -- -l 4096
+#
 
-cd ~/Bureau/3A/BE_RESEAU/stcp-daras-rprevos/branches/src
-make
+ROOT=$(cd "$(dirname "$0")" && pwd)
+SRC="$ROOT/src"
 
-gnome-terminal --tab -e "/bin/bash -c './server 15556; exec /bin/bash -i'"
-gnome-terminal --tab -e "/bin/bash -c './client localhost 15556; exec /bin/bash -i'"
+build=1
+port=
+conns=1
+secs=5
+netem=
+report=
+dir=
+
+usage()
+{
+    sed -n '8,28p' "$0" | sed 's/^# \{0,1\}//' >&2
+    exit 1
+}
+
+while getopts "Bp:c:t:n:o:d:" opt; do
+    case $opt in
+    B) build=0 ;;
+    p) port=$OPTARG ;;
+    c) conns=$OPTARG ;;
+    t) secs=$OPTARG ;;
+    n) netem=$OPTARG ;;
+    o) report=$OPTARG ;;
+    d) dir=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -ge 1 ] || usage
+scenario=$1
+shift
+[ "$1" = "--" ] && shift
+
+case $scenario in
+smoke)              targets="server client"
+                    # server always starts its entity on 15556, which must be
+                    # the port it listens on
+                    if [ -n "$port" ] && [ "$port" != 15556 ]; then
+                        echo "launch.sh: the smoke server only listens on 15556" >&2
+                        exit 1
+                    fi
+                    port=15556 ;;
+perf)               targets="simptcp_perf";         port=${port:-5201} ;;
+rr|crr|pingpong)    targets="simptcp_rr";           port=${port:-5202} ;;
+sendfile)           targets="sendfile_bench";       port=${port:-15557} ;;
+*)                  usage ;;
+esac
+
+if [ $build -eq 1 ]; then
+    make -C "$SRC" $targets simptcp_stat >&2 || exit 1
+fi
+
+if [ -z "$dir" ]; then
+    dir=$(mktemp -d "${TMPDIR:-/tmp}/simptcp-run.XXXXXX") || exit 1
+fi
+mkdir -p "$dir" || exit 1
+rm -f "$dir"/stat-*
+
+# environment of the simpTCP processes
+SIMPTCP_STAT_SAVE="$dir/stat-%p"
+export SIMPTCP_STAT_SAVE
+if [ -n "$netem" ]; then
+    SIMPTCP_NETEM=$netem
+    export SIMPTCP_NETEM
+else
+    unset SIMPTCP_NETEM
+fi
+
+# starts the server of the scenario in the background ($1: its arguments),
+# and waits for its entity to be up
+start_server()
+{
+    SIMPTCP_LOG_FILE="$dir/server.log" "$@" > "$dir/server.out" 2> "$dir/server.err" &
+    server_pid=$!
+    i=0
+    while [ ! -e "/dev/shm/simptcp-$server_pid" ] && [ $i -lt 50 ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    sleep 0.2
+}
+
+# waits at most $1 seconds for the server to exit
+wait_server()
+{
+    i=0
+    while kill -0 "$server_pid" 2> /dev/null && [ $i -lt $(($1 * 10)) ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    if kill -0 "$server_pid" 2> /dev/null; then
+        kill "$server_pid"
+    fi
+    wait "$server_pid"
+    server_rc=$?
+}
+
+run_client()
+{
+    SIMPTCP_LOG_FILE="$dir/client.log" timeout $((secs + 60)) "$@" \
+        > "$dir/client.out" 2> "$dir/client.err"
+    client_rc=$?
+}
+
+# a file (standard input without argument) as a JSON string
+json_string()
+{
+    printf '"'
+    sed -e 's/\x1b\[[0-9;]*m//g' -e 's/\\/\\\\/g' -e 's/"/\\"/g' \
+        -e 's/\t/\\t/g' -e 's/\r//g' "$@" | awk '{ printf "%s%s", (NR > 1 ? "\\n" : ""), $0 }'
+    printf '"'
+}
+
+# a file that holds a JSON object as it is, any other output as a string
+json_output()
+{
+    if [ -s "$1" ] && [ "$(head -c 1 "$1")" = "{" ]; then
+        cat "$1"
+    else
+        json_string "$1"
+    fi
+}
+
+cd "$SRC" || exit 1
+server_pid=
+server_rc=
+client_rc=
+case $scenario in
+smoke)
+    start_server ./server "$port"
+    echo "hello simpTCP" > "$dir/client.in"
+    run_client ./client localhost "$port" < "$dir/client.in"
+    wait_server 5
+    ;;
+perf)
+    start_server ./simptcp_perf -s -p "$port" -J
+    run_client ./simptcp_perf -c localhost -p "$port" -t "$secs" -P "$conns" -J "$@"
+    wait_server 10
+    ;;
+rr|crr|pingpong)
+    # the server is a child of simptcp_rr
+    run_client ./simptcp_rr -m "$scenario" -c "$conns" -t "$secs" -p "$port" -J "$@"
+    ;;
+sendfile)
+    head -c 4194304 /dev/urandom > "$dir/file.bin"
+    start_server ./sendfile_bench server "$port"
+    run_client ./sendfile_bench client localhost "$port" "$dir/file.bin" "$@"
+    wait_server 10
+    ;;
+esac
+
+{
+    printf '{\n  "scenario": "%s",\n' "$scenario"
+    printf '  "date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    printf '  "commit": "%s",\n' "$(git -C "$ROOT" rev-parse --short HEAD 2> /dev/null)"
+    printf '  "cpus": %s,\n' "$(getconf _NPROCESSORS_ONLN)"
+    printf '  "port": %s,\n  "connections": %s,\n  "seconds": %s,\n' \
+        "$port" "$conns" "$secs"
+    printf '  "netem": %s,\n' "$(printf '%s\n' "$netem" | json_string)"
+    printf '  "options": %s,\n' "$(printf '%s\n' "$*" | json_string)"
+    printf '  "run_dir": %s,\n' "$(printf '%s\n' "$dir" | json_string)"
+    printf '  "exit": {"server": %s, "client": %s},\n' \
+        "${server_rc:-null}" "${client_rc:-null}"
+    if [ -n "$server_pid" ]; then
+        printf '  "server": '
+        json_output "$dir/server.out"
+        printf ',\n'
+    fi
+    printf '  "client": '
+    json_output "$dir/client.out"
+    printf ',\n  "stats": ['
+    sep=
+    for f in "$dir"/stat-*; do
+        [ -e "$f" ] || continue
+        printf '%s\n' "$sep"
+        ./simptcp_stat -J "$f"
+        sep=,
+    done
+    printf ']\n}\n'
+} > "$dir/report.json"
+
+if [ -n "$report" ]; then
+    cp "$dir/report.json" "$report"
+else
+    cat "$dir/report.json"
+fi
+[ "$client_rc" = 0 ]
@@ -3,17 +3,23 @@
  */
 
 #include <stdio.h>              /* for printf() */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>               /* for clock_gettime() */
+#include <unistd.h>             /* for getpid() */
+#include <pthread.h>
 #include <netdb.h>              /* for struct sockaddr and socklen_t */
+#include <libc_socket.h>        /* for struct libc_netem_stats */
 
 #define __USE_GNU
 #include <dlfcn.h>              /* for dlsym(), */
 #include <term_colors.h>        /* for color macros */
 #define __PREFIX__              "[" COLOR("LIBC-SOCKET", BRIGHT_BLUE) " ] "
 #include <term_io.h>            /* for printf() and perror() redefinitions */
+#define __SUBSYS__              SIMPTCP_LOG_LIBC
+#include <simptcp_log.h>       /* for SIMPTCP_LOG() */
 
-#ifndef __DEBUG__
-#define __DEBUG__               1
-#endif
 
 
 #define INIT_FUNCTION_POINTER(funcname)                         \
@@ -22,7 +28,8 @@
 
 #define CHECK_FUNCTION_POINTER(funcname)                        \
     if (!funcname ## _ptr) {                                    \
-        printf("Unable to resolve symbol %s\n", #funcname);     \
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Unable to resolve symbol %s\n", \
+                    #funcname);                                 \
         return -1;                                              \
     }
 
@@ -50,15 +57,535 @@ static int (*getsockopt_ptr) (int fd, int level, int optname, void *optval,
                              socklen_t *optlen);
 static int (*setsockopt_ptr) (int fd, int level, int optname, const void *optval,
                              socklen_t optlen);
+static ssize_t (*sendfile_ptr) (int out_fd, int in_fd, off_t *offset, size_t count);
+
+
+/* Network emulator (see libc_socket.h). The datagrams that are not sent at
+ * once wait in a heap ordered by departure time, for the netem thread.
+ */
+
+#define NETEM_DEFAULT_LIMIT     1000
+#define NETEM_MAX_LIMIT         1000000
+
+struct netem_config {
+    int enabled;
+    double loss;                /* probabilities */
+    int gemodel;
+    double ge_p, ge_r, ge_h, ge_k;      /* ge_h: loss in bad, ge_k: in good */
+    u_int64_t delay_ns, jitter_ns;
+    double reorder, duplicate, corrupt;
+    u_int64_t rate_bps;         /* 0: unlimited */
+    unsigned int limit;
+    u_int64_t seed;
+};
+
+struct netem_datagram {
+    u_int64_t due_ns;
+    u_int64_t order;            /* ties: first in, first out */
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    size_t len;
+    char data[];
+};
+
+static pthread_mutex_t netem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netem_cond;
+static int netem_thread_started;
+static struct netem_config netem;
+static struct libc_netem_stats netem_stats;
+static u_int64_t netem_rand_state;
+static int netem_bad;                   /* Gilbert-Elliott state */
+static u_int64_t netem_link_free_ns;    /* the bottleneck is busy until then */
+static u_int64_t netem_order;
+static struct netem_datagram **netem_heap;
+static unsigned int netem_heap_len, netem_heap_size;
+
+static u_int64_t netem_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*: uniform in [0, 1) */
+static double netem_random (void)
+{
+    u_int64_t x = netem_rand_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    netem_rand_state = x;
+    return ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int netem_before (const struct netem_datagram *a,
+                         const struct netem_datagram *b)
+{
+    return (a->due_ns < b->due_ns) ||
+        ((a->due_ns == b->due_ns) && (a->order < b->order));
+}
+
+static void netem_heap_push (struct netem_datagram *d)
+{
+    unsigned int i = netem_heap_len++, parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!netem_before(d, netem_heap[parent]))
+            break;
+        netem_heap[i] = netem_heap[parent];
+        i = parent;
+    }
+    netem_heap[i] = d;
+}
+
+static struct netem_datagram * netem_heap_pop (void)
+{
+    struct netem_datagram *top = netem_heap[0], *last;
+    unsigned int i = 0, child;
+
+    last = netem_heap[--netem_heap_len];
+    while ((child = 2 * i + 1) < netem_heap_len) {
+        if ((child + 1 < netem_heap_len) &&
+            netem_before(netem_heap[child + 1], netem_heap[child]))
+            child++;
+        if (!netem_before(netem_heap[child], last))
+            break;
+        netem_heap[i] = netem_heap[child];
+        i = child;
+    }
+    if (netem_heap_len > 0)
+        netem_heap[i] = last;
+    return top;
+}
+
+static void netem_transmit (struct netem_datagram *d)
+{
+    if (sendto_ptr(d->fd, d->data, d->len, 0, (struct sockaddr *) &(d->addr),
+                   d->addr_len) == -1) {
+        pthread_mutex_lock(&netem_lock);
+        netem_stats.send_errors++;
+        pthread_mutex_unlock(&netem_lock);
+    }
+}
+
+/* sends the datagrams of the heap when they are due */
+static void * netem_thread (void *arg)
+{
+    struct netem_datagram *d;
+    struct timespec deadline;
+    u_int64_t now;
+
+    (void) arg;
+    pthread_mutex_lock(&netem_lock);
+    while (1) {
+        if (netem_heap_len == 0) {
+            pthread_cond_wait(&netem_cond, &netem_lock);
+            continue;
+        }
+        now = netem_now_ns();
+        if (netem_heap[0]->due_ns > now) {
+            deadline.tv_sec = netem_heap[0]->due_ns / 1000000000ULL;
+            deadline.tv_nsec = netem_heap[0]->due_ns % 1000000000ULL;
+            pthread_cond_timedwait(&netem_cond, &netem_lock, &deadline);
+            continue;
+        }
+        d = netem_heap_pop();
+        pthread_mutex_unlock(&netem_lock);
+        netem_transmit(d);
+        free(d);
+        pthread_mutex_lock(&netem_lock);
+    }
+    return NULL;
+}
+
+/* with netem_lock */
+static int netem_start_thread (void)
+{
+    pthread_condattr_t attr;
+    pthread_attr_t tattr;
+    pthread_t thread;
+    int res;
+
+    if (netem_thread_started)
+        return 0;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&netem_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_attr_init(&tattr);
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    res = pthread_create(&thread, &tattr, netem_thread, NULL);
+    pthread_attr_destroy(&tattr);
+    if (res != 0)
+        return -1;
+    netem_thread_started = 1;
+    return 0;
+}
+
+/* a child of fork() has no netem thread, and must not send the datagrams
+ * of its parent */
+static void netem_atfork_child (void)
+{
+    pthread_mutex_init(&netem_lock, NULL);
+    netem_thread_started = 0;
+    while (netem_heap_len > 0)
+        free(netem_heap_pop());
+}
+
+/* queues a copy of the datagram to leave at due_ns, or sends it now; with
+ * netem_lock. Returns -1 if the queue is full */
+static int netem_output (int fd, const struct iovec *iov, int iovcnt,
+                         const struct sockaddr *addr, socklen_t addr_len,
+                         size_t len, u_int64_t due_ns, int corrupt)
+{
+    struct netem_datagram *d;
+    size_t off = 0;
+    int i;
+
+    if (netem_heap_len >= netem.limit)
+        return -1;
+    d = malloc(sizeof(struct netem_datagram) + len);
+    if (d == NULL)
+        return -1;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(d->data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    if (corrupt && (len > 0))
+        d->data[(size_t) (netem_random() * len)] ^= 1 << (int) (netem_random() * 8);
+    d->fd = fd;
+    if (addr_len > sizeof(d->addr))
+        addr_len = sizeof(d->addr);
+    memcpy(&(d->addr), addr, addr_len);
+    d->addr_len = addr_len;
+    d->len = len;
+    d->due_ns = due_ns;
+    d->order = netem_order++;
+
+    if (due_ns <= netem_now_ns()) {
+        /* not worth a trip through the thread (sendto does not block) */
+        pthread_mutex_unlock(&netem_lock);
+        netem_transmit(d);
+        free(d);
+        pthread_mutex_lock(&netem_lock);
+        return 0;
+    }
+    if (netem_start_thread() < 0) {
+        free(d);
+        return -1;
+    }
+    netem_heap_push(d);
+    pthread_cond_signal(&netem_cond);
+    return 0;
+}
+
+/* applies the impairments to a datagram; returns what the libc would */
+static ssize_t netem_send (int fd, const struct iovec *iov, int iovcnt,
+                           const struct sockaddr *addr, socklen_t addr_len)
+{
+    size_t len = 0;
+    int i, copies, lost, corrupt, reorder;
+    u_int64_t now, depart, due;
+    double jitter;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    pthread_mutex_lock(&netem_lock);
+    netem_stats.datagrams++;
+
+    /* loss, independent or in bursts */
+    if (netem.gemodel) {
+        if (netem_bad)
+            netem_bad = !(netem_random() < netem.ge_r);
+        else
+            netem_bad = (netem_random() < netem.ge_p);
+        lost = (netem_random() < (netem_bad ? netem.ge_h : netem.ge_k));
+    }
+    else
+        lost = (netem.loss > 0) && (netem_random() < netem.loss);
+    if (lost) {
+        netem_stats.lost++;
+        pthread_mutex_unlock(&netem_lock);
+        return len;
+    }
+
+    copies = 1;
+    if ((netem.duplicate > 0) && (netem_random() < netem.duplicate)) {
+        netem_stats.duplicated++;
+        copies = 2;
+    }
+    for (; copies > 0; copies--) {
+        corrupt = (netem.corrupt > 0) && (netem_random() < netem.corrupt);
+        reorder = (netem.delay_ns > 0) && (netem.reorder > 0) &&
+            (netem_random() < netem.reorder);
+
+        /* the bottleneck sends one datagram after the other */
+        now = netem_now_ns();
+        depart = now;
+        if (netem.rate_bps > 0) {
+            if (netem_link_free_ns > depart)
+                depart = netem_link_free_ns;
+            depart += (u_int64_t) len * 8 * 1000000000ULL / netem.rate_bps;
+        }
+        due = depart;
+        if (!reorder && (netem.delay_ns > 0)) {
+            jitter = (netem.jitter_ns > 0) ?
+                (2 * netem_random() - 1) * netem.jitter_ns : 0;
+            if (jitter + netem.delay_ns > 0)
+                due += netem.delay_ns + (long long) jitter;
+        }
+        if (netem_output(fd, iov, iovcnt, addr, addr_len, len, due, corrupt) < 0) {
+            netem_stats.queue_drops++;
+            continue;
+        }
+        netem_link_free_ns = depart;
+        if (corrupt)
+            netem_stats.corrupted++;
+        if (reorder)
+            netem_stats.reordered++;
+    }
+    pthread_mutex_unlock(&netem_lock);
+    return len;
+}
+
+/* a percent, "1%" or "1": 0.01 */
+static int netem_parse_percent (const char *s, double *p)
+{
+    char *end;
+
+    *p = strtod(s, &end) / 100.0;
+    if ((end == s) || ((*end != '\0') && strcmp(end, "%")) || (*p < 0) || (*p > 1))
+        return -1;
+    return 0;
+}
+
+/* a time, "10ms", "500us", "1s" or "500" (us) */
+static int netem_parse_time (const char *s, u_int64_t *ns)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if ((end == s) || (v < 0))
+        return -1;
+    if ((*end == '\0') || !strcmp(end, "us"))
+        *ns = v * 1000;
+    else if (!strcmp(end, "ms"))
+        *ns = v * 1000000;
+    else if (!strcmp(end, "s"))
+        *ns = v * 1000000000;
+    else
+        return -1;
+    return 0;
+}
+
+/* a rate, "100mbit", "1gbit", "64kbit" or "9600bit" (bit/s if no unit) */
+static int netem_parse_rate (const char *s, u_int64_t *bps)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if ((end == s) || (v <= 0))
+        return -1;
+    if ((*end == '\0') || !strcmp(end, "bit"))
+        *bps = v;
+    else if (!strcmp(end, "kbit"))
+        *bps = v * 1000;
+    else if (!strcmp(end, "mbit"))
+        *bps = v * 1000000;
+    else if (!strcmp(end, "gbit"))
+        *bps = v * 1000000000;
+    else
+        return -1;
+    return (*bps > 0) ? 0 : -1;
+}
+
+/* a queue depth, "50": 1 to NETEM_MAX_LIMIT datagrams */
+static int netem_parse_limit (const char *s, unsigned int *limit)
+{
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(s, &end, 10);
+    if ((end == s) || (*end != '\0') || (*s == '-') || (errno != 0) ||
+        (v < 1) || (v > NETEM_MAX_LIMIT))
+        return -1;
+    *limit = v;
+    return 0;
+}
+
+static int netem_parse (const char *spec, struct netem_config *c)
+{
+    char *copy, *save = NULL, *tok, *arg;
+    int i, res = -1;
+
+    memset(c, 0, sizeof(*c));
+    c->limit = NETEM_DEFAULT_LIMIT;
+    c->seed = 1;
+    copy = strdup(spec);
+    if (copy == NULL)
+        return -1;
+
+#define NEXT_ARG() (arg = strtok_r(NULL, " \t", &save))
+    for (tok = strtok_r(copy, " \t", &save); tok != NULL;
+         tok = strtok_r(NULL, " \t", &save)) {
+        if (!strcmp(tok, "loss")) {
+            if (NEXT_ARG() == NULL)
+                goto out;
+            if (!strcmp(arg, "gemodel")) {
+                double *params[4];
+
+                c->gemodel = 1;
+                params[0] = &(c->ge_p);
+                params[1] = &(c->ge_r);
+                params[2] = &(c->ge_h);
+                params[3] = &(c->ge_k);
+                c->ge_r = -1;
+                c->ge_h = 1;
+                c->ge_k = 0;
+                if ((NEXT_ARG() == NULL) || netem_parse_percent(arg, params[0]))
+                    goto out;
+                /* the optional parameters, up to the next keyword */
+                for (i = 1; i < 4; i++) {
+                    char *peek = save;
+
+                    while ((peek != NULL) && ((*peek == ' ') || (*peek == '\t')))
+                        peek++;
+                    if ((peek == NULL) || !((*peek >= '0' && *peek <= '9') ||
+                                            (*peek == '.')))
+                        break;
+                    if ((NEXT_ARG() == NULL) || netem_parse_percent(arg, params[i]))
+                        goto out;
+                }
+                if (c->ge_r < 0)
+                    c->ge_r = 1 - c->ge_p;
+            }
+            else if (netem_parse_percent(arg, &(c->loss)))
+                goto out;
+        }
+        else if (!strcmp(tok, "delay")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_time(arg, &(c->delay_ns)))
+                goto out;
+            while ((save != NULL) && ((*save == ' ') || (*save == '\t')))
+                save++;
+            if ((save != NULL) && (*save >= '0') && (*save <= '9') &&
+                ((NEXT_ARG() == NULL) || netem_parse_time(arg, &(c->jitter_ns))))
+                goto out;
+        }
+        else if (!strcmp(tok, "reorder")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_percent(arg, &(c->reorder)))
+                goto out;
+        }
+        else if (!strcmp(tok, "duplicate")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_percent(arg, &(c->duplicate)))
+                goto out;
+        }
+        else if (!strcmp(tok, "corrupt")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_percent(arg, &(c->corrupt)))
+                goto out;
+        }
+        else if (!strcmp(tok, "rate")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_rate(arg, &(c->rate_bps)))
+                goto out;
+        }
+        else if (!strcmp(tok, "limit")) {
+            if ((NEXT_ARG() == NULL) || netem_parse_limit(arg, &(c->limit)))
+                goto out;
+        }
+        else if (!strcmp(tok, "seed")) {
+            if (NEXT_ARG() == NULL)
+                goto out;
+            c->seed = strtoull(arg, NULL, 0);
+        }
+        else
+            goto out;
+        c->enabled = 1;
+    }
+#undef NEXT_ARG
+    res = 0;
+out:
+    free(copy);
+    return res;
+}
+
+/* configures the emulator (NULL or "" turns it off); -1 if spec is wrong */
+int libc_netem_config (const char *spec)
+{
+    static int atfork_installed;
+    struct netem_config c;
+    struct netem_datagram **heap;
+
+    if (spec == NULL)
+        spec = "";
+    if (netem_parse(spec, &c) < 0) {
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Bad network emulator setting \"%s\"\n", spec);
+        return -1;
+    }
+
+    pthread_mutex_lock(&netem_lock);
+    if (c.limit > netem_heap_size) {
+        heap = realloc(netem_heap, c.limit * sizeof(struct netem_datagram *));
+        if (heap == NULL) {
+            pthread_mutex_unlock(&netem_lock);
+            return -1;
+        }
+        netem_heap = heap;
+        netem_heap_size = c.limit;
+    }
+    netem = c;
+    /* xorshift needs a state other than 0 */
+    netem_rand_state = c.seed ? c.seed : 1;
+    netem_bad = 0;
+    memset(&netem_stats, 0, sizeof(netem_stats));
+    if (!atfork_installed) {
+        atfork_installed = 1;
+        pthread_atfork(NULL, NULL, netem_atfork_child);
+    }
+    pthread_mutex_unlock(&netem_lock);
+    return 0;
+}
+
+void libc_netem_get_stats (struct libc_netem_stats *st)
+{
+    pthread_mutex_lock(&netem_lock);
+    *st = netem_stats;
+    pthread_mutex_unlock(&netem_lock);
+}
+
+static void netem_report (void)
+{
+    struct libc_netem_stats st;
+
+    libc_netem_get_stats(&st);
+    fprintf(stderr, "simptcp_netem[%d]: %lu datagrams, %lu lost, %lu duplicated, "
+            "%lu corrupted, %lu reordered, %lu queue drops\n", (int) getpid(),
+            st.datagrams, st.lost, st.duplicated, st.corrupted, st.reordered,
+            st.queue_drops);
+}
+
+/* SIMPTCP_NETEM=spec: impair from the start, report at exit */
+static void __attribute__((constructor)) netem_configure (void)
+{
+    const char *spec = getenv("SIMPTCP_NETEM");
+
+    if ((spec == NULL) || (*spec == '\0'))
+        return;
+    if (libc_netem_config(spec) == 0)
+        atexit(netem_report);
+}
 
 /* Functions that wraps the libc. Basically initialize a function pointer the
  * first time a function is called, and then directly call the libc socket api
  */
 int libc_socket(int domain, int type, int protocol)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(socket);
     CHECK_FUNCTION_POINTER(socket);
@@ -68,9 +595,7 @@ int libc_socket(int domain, int type, int protocol)
 
 int libc_bind (int fd, const struct sockaddr *addr, socklen_t len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(bind);
     CHECK_FUNCTION_POINTER(bind);
@@ -80,9 +605,7 @@ int libc_bind (int fd, const struct sockaddr *addr, socklen_t len)
 
 int libc_connect (int fd, const struct sockaddr *addr, socklen_t len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(connect);
     CHECK_FUNCTION_POINTER(connect);
@@ -92,9 +615,7 @@ int libc_connect (int fd, const struct sockaddr *addr, socklen_t len)
 
 ssize_t libc_send (int fd, const void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(send);
     CHECK_FUNCTION_POINTER(send);
@@ -104,9 +625,7 @@ ssize_t libc_send (int fd, const void *buf, size_t n, int flags)
 
 ssize_t libc_recv (int fd, void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(recv);
     CHECK_FUNCTION_POINTER(recv);
@@ -117,13 +636,18 @@ ssize_t libc_recv (int fd, void *buf, size_t n, int flags)
 ssize_t libc_sendto(int fd, const void *buf, size_t n, int flags, 
                     const struct sockaddr *addr, socklen_t addr_len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(sendto);
     CHECK_FUNCTION_POINTER(sendto);
-    
+
+    if (netem.enabled && (addr != NULL)) {
+        struct iovec iov;
+
+        iov.iov_base = (void *) buf;
+        iov.iov_len = n;
+        return netem_send(fd, &iov, 1, addr, addr_len);
+    }
     return sendto_ptr(fd, buf, n, flags, addr, addr_len);
 }
 ssize_t libc_recvfrom(int fd, void *buf, size_t n, int flags, 
@@ -141,21 +665,22 @@ ssize_t libc_recvfrom(int fd, void *buf, size_t n, int flags,
 
 ssize_t libc_sendmsg (int fd, const struct msghdr *message, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(sendmsg);
     CHECK_FUNCTION_POINTER(sendmsg);
 
+    /* the emulator sends with sendto */
+    INIT_FUNCTION_POINTER(sendto);
+    if (netem.enabled && (message->msg_name != NULL) && sendto_ptr)
+        return netem_send(fd, message->msg_iov, message->msg_iovlen,
+                          message->msg_name, message->msg_namelen);
     return sendmsg_ptr(fd, message, flags);
 }
 
 ssize_t libc_recvmsg (int fd, struct msghdr *message, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(recvmsg);
     CHECK_FUNCTION_POINTER(recvmsg);
@@ -166,9 +691,7 @@ ssize_t libc_recvmsg (int fd, struct msghdr *message, int flags)
 
 int libc_listen (int fd, int n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(listen);
     CHECK_FUNCTION_POINTER(listen);
@@ -178,9 +701,7 @@ int libc_listen (int fd, int n)
 
 int libc_accept (int fd, struct sockaddr *addr, socklen_t *addr_len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(accept);
     CHECK_FUNCTION_POINTER(accept);
@@ -190,9 +711,7 @@ int libc_accept (int fd, struct sockaddr *addr, socklen_t *addr_len)
 
 int libc_shutdown (int fd, int how)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(shutdown);
     CHECK_FUNCTION_POINTER(shutdown);
@@ -202,9 +721,7 @@ int libc_shutdown (int fd, int how)
 
 int libc_close (int fd)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(close);
     CHECK_FUNCTION_POINTER(close);
@@ -214,9 +731,7 @@ int libc_close (int fd)
 
 ssize_t libc_read (int fd, void *buf, size_t n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(read);
     CHECK_FUNCTION_POINTER(read);
@@ -226,9 +741,7 @@ ssize_t libc_read (int fd, void *buf, size_t n)
 
 ssize_t libc_write (int fd, const void *buf, size_t n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(write);
     CHECK_FUNCTION_POINTER(write);
@@ -238,9 +751,7 @@ ssize_t libc_write (int fd, const void *buf, size_t n)
 
 int libc_getsockname (int fd, struct sockaddr *addr, socklen_t *len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(getsockname);
     CHECK_FUNCTION_POINTER(getsockname);
@@ -250,9 +761,7 @@ int libc_getsockname (int fd, struct sockaddr *addr, socklen_t *len)
 
 int libc_getpeername (int fd, struct sockaddr *addr, socklen_t *len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(getpeername);
     CHECK_FUNCTION_POINTER(getpeername);
@@ -264,9 +773,7 @@ int libc_getpeername (int fd, struct sockaddr *addr, socklen_t *len)
 int libc_getsockopt (int fd, int level, int optname, void *optval, 
 		     socklen_t *optlen)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(getsockopt);
     CHECK_FUNCTION_POINTER(getsockopt);
@@ -277,9 +784,7 @@ int libc_getsockopt (int fd, int level, int optname, void *optval,
 int libc_setsockopt (int fd, int level, int optname, const void *optval,
                      socklen_t optlen)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     INIT_FUNCTION_POINTER(setsockopt);
     CHECK_FUNCTION_POINTER(setsockopt);
@@ -287,4 +792,14 @@ int libc_setsockopt (int fd, int level, int optname, const void *optval,
     return setsockopt_ptr(fd, level, optname, optval, optlen);
 }
 
+ssize_t libc_sendfile (int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    SIMPTCP_TRACE_CALL();
+
+    INIT_FUNCTION_POINTER(sendfile);
+    CHECK_FUNCTION_POINTER(sendfile);
+
+    return sendfile_ptr(out_fd, in_fd, offset, count);
+}
+
 /* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,229 @@
+/*! \file sendfile_bench.c
+ * \brief Large file transfer benchmark over simpTCP.
+ *  The receiver discards what it reads, the sender transmits a file either
+ *  with sendfile() or with a read()/write() loop through user space, and both
+ *  report the CPU cycles spent per byte transferred.
+ *
+ *  usage: sendfile_bench server port
+ *         sendfile_bench client server_hostname server_port file [-r]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <simptcp_api.h>
+#include <simptcp_entity.h>
+#include <simptcp_packet.h>
+#include <simptcp_bench.h>
+#include <simptcp_hist.h>
+
+/*!
+ *  \def DEFAULT_LOCAL_UDP_PORT
+ * \brief default udp port number used by the simptcp protocol entity of the
+ * sending side. At the receiving side, the local udp port number is the
+ * port number of the listening simptcp socket
+ */
+#define DEFAULT_LOCAL_UDP_PORT 15555
+
+#define READ_BUFFER_SIZE 65536
+
+void error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/* prints the header prediction hit rate of a connection */
+void report_prediction(const char *side, int fd)
+{
+    struct simptcp_prediction_stats st;
+    socklen_t len = sizeof(st);
+    unsigned long total;
+
+    if (getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_PREDICTION, &st, &len) < 0)
+        return;
+    total = st.hits + st.misses;
+    printf("%s: header prediction %lu/%lu PDUs (%.1f%%)\n", side, st.hits,
+           total, total > 0 ? 100.0 * st.hits / total : 0.0);
+}
+
+/* prints the round trip time estimate and the losses of a connection */
+void report_info(const char *side, int fd)
+{
+    struct simptcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_INFO, &info, &len) < 0)
+        return;
+    printf("%s: srtt %u us, rttvar %u us, rto %u ms, %lu PDUs out, %lu in, "
+           "%lu retransmitted (%llu bytes)\n", side, info.srtt_us,
+           info.rttvar_us, info.rto_us / 1000, info.segs_out, info.segs_in,
+           info.total_retrans, info.bytes_retrans);
+}
+
+/* prints the median and tail of the latencies of a connection */
+void report_latency(const char *side, int fd)
+{
+    static const char *names[] = SIMPTCP_HIST_NAMES;
+    struct simptcp_latency lat;
+    socklen_t len = sizeof(lat);
+    int i;
+
+    if (getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_LATENCY, &lat, &len) < 0)
+        return;
+    for (i = 0; i < SIMPTCP_HIST_NB; i++)
+        if (lat.hist[i].count > 0)
+            printf("%s: %s p50 %u, p99 %u, max %u (%llu samples)\n", side, names[i],
+                   simptcp_hist_percentile(&(lat.hist[i]), 50),
+                   simptcp_hist_percentile(&(lat.hist[i]), 99), lat.hist[i].max,
+                   (unsigned long long) lat.hist[i].count);
+}
+
+/* prints the figures of one side of the transfer */
+void report(const char *side, unsigned long long bytes, uint64_t ns,
+            double cpu, double tsc_hz)
+{
+    double secs = ns / 1e9;
+
+    printf("%s: %llu bytes in %.3f s (%.2f MB/s)\n", side, bytes, secs,
+           secs > 0 ? bytes / secs / 1e6 : 0.0);
+    if (bytes > 0)
+        printf("%s: %.2f CPU cycles/byte (%.3f s of CPU time at %.0f MHz)\n",
+               side, cpu * tsc_hz / bytes, cpu, tsc_hz / 1e6);
+}
+
+int run_server(int portno)
+{
+    int sockfd, newsockfd;
+    socklen_t clilen;
+    struct sockaddr_in serv_addr, cli_addr;
+    static char buffer[READ_BUFFER_SIZE];
+    unsigned long long total = 0;
+    uint64_t t0 = 0;
+    double cpu0 = 0, tsc_hz;
+    ssize_t n;
+
+    tsc_hz = bench_tsc_hz();
+
+    /* the local udp port must be the one of the listening socket */
+    start_simptcp(portno);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(portno);
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+        error("ERROR on binding");
+    listen(sockfd, 5);
+
+    clilen = sizeof(cli_addr);
+    newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+    if (newsockfd < 0)
+        error("ERROR on accept");
+
+    /* read until the sender closes the connection */
+    while ((n = recv(newsockfd, buffer, READ_BUFFER_SIZE, 0)) > 0) {
+        if (total == 0) {
+            t0 = bench_now_ns();
+            cpu0 = bench_cpu_seconds();
+        }
+        total += n;
+    }
+    report("receiver", total, bench_now_ns() - t0,
+           bench_cpu_seconds() - cpu0, tsc_hz);
+    report_prediction("receiver", newsockfd);
+    report_info("receiver", newsockfd);
+    report_latency("receiver", newsockfd);
+
+    close(newsockfd);
+    close(sockfd);
+    return 0;
+}
+
+int run_client(const char *host, int portno, const char *path, int use_rw)
+{
+    int sockfd, filefd;
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
+    struct stat st;
+    static char buffer[SIMPTCP_MAX_SIZE];
+    unsigned long long total = 0;
+    uint64_t t0;
+    double cpu0, tsc_hz;
+    ssize_t n;
+
+    filefd = open(path, O_RDONLY);
+    if (filefd < 0 || fstat(filefd, &st) < 0)
+        error("ERROR opening file");
+
+    tsc_hz = bench_tsc_hz();
+
+    start_simptcp(DEFAULT_LOCAL_UDP_PORT);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+    server = gethostbyname(host);
+    if (server == NULL) {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    bcopy((char *) server->h_addr, (char *) &serv_addr.sin_addr.s_addr,
+          server->h_length);
+    serv_addr.sin_port = htons(portno);
+    if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+        error("ERROR connecting");
+
+    t0 = bench_now_ns();
+    cpu0 = bench_cpu_seconds();
+    if (use_rw) {
+        /* reference: copy through a user space buffer */
+        while ((n = pread(filefd, buffer, sizeof(buffer), total)) > 0) {
+            if (send(sockfd, buffer, n, 0) < 0)
+                error("ERROR writing to socket");
+            total += n;
+        }
+    } else {
+        n = sendfile(sockfd, filefd, NULL, st.st_size);
+        if (n < 0)
+            error("ERROR in sendfile");
+        total = n;
+    }
+    report(use_rw ? "sender (read/write)" : "sender (sendfile)", total,
+           bench_now_ns() - t0, bench_cpu_seconds() - cpu0, tsc_hz);
+    report_prediction("sender", sockfd);
+    report_info("sender", sockfd);
+    report_latency("sender", sockfd);
+
+    if (close(sockfd) == -1)
+        error("ERROR closing client");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "server") == 0)
+        return run_server(atoi(argv[2]));
+    if (argc >= 5 && strcmp(argv[1], "client") == 0)
+        return run_client(argv[2], atoi(argv[3]), argv[4],
+                          argc >= 6 && strcmp(argv[5], "-r") == 0);
+
+    fprintf(stderr, "usage %s server port\n"
+            "      %s client server_hostname server_port file [-r]\n",
+            argv[0], argv[0]);
+    return 1;
+}
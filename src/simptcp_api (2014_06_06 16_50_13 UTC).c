@@ -8,17 +8,20 @@
 #include <string.h>             /* for memset() */
 #include <unistd.h>             /* for usleep() */
 #include <errno.h>              /* for errno macros */
+#include <sys/mman.h>           /* for mmap() */
+#include <sys/stat.h>           /* for fstat() */
+#include <netinet/in.h>         /* for IPPROTO_TCP */
 #include <simptcp_api.h>        /* for simptcp related functions */
 #include <simptcp_lib.h>       /* for simptcp_core related functions */
 #include <simptcp_entity.h> 
+#include <simptcp_packet.h>     /* for SIMPTCP_MAX_SIZE */
 #include <libc_socket.h>        /* for libc_related functions */
 #include <term_colors.h>        /* for color macros */
 #define __PREFIX__              "[" COLOR("SIMPTCP_API", BRIGHT_YELLOW) " ] "
 #include <term_io.h>
+#define __SUBSYS__              SIMPTCP_LOG_API
+#include <simptcp_log.h>       /* for SIMPTCP_LOG() */
 
-#ifndef __DEBUG__
-#define __DEBUG__               1
-#endif
 
 
 
@@ -30,16 +33,13 @@ int is_simptcp_descriptor(int fd)
 {
 	int res = 0;
 
-#if __DEBUG__
-	printf("function %s called\n", __func__);
-#endif
+	SIMPTCP_TRACE_CALL();
 
 	if ((fd >= 0) && (fd <= UINT16_MAX)) {
 		res = (simptcp_entity.simptcp_socket_descriptors[fd] != NULL);
 	}
-#if __DEBUG__
-	printf("descriptor %d %s a simptcp descriptor\n", fd, res ? "IS" : "IS NOT");
-#endif
+	SIMPTCP_LOG(SIMPTCP_LOG_TRACE, "descriptor %d %s a simptcp descriptor\n",
+		    fd, res ? "IS" : "IS NOT");
 
 	return res;
 }
@@ -52,17 +52,13 @@ int is_simptcp_socket(int domain, int type, int protocol)
 {
 	int res = 0;
 
-#if __DEBUG__
-	printf("function %s called\n", __func__);
-#endif
+	SIMPTCP_TRACE_CALL();
 
 	res = ((domain == AF_INET) && (type == SOCK_STREAM) &&  
 		   (protocol == IPPROTO_SIMPTCP));
 
-#if __DEBUG__
-	printf("socket (%d,%d,%d) %s a simptcp socket\n",
-		   domain, type, protocol, res ? "CREATES" : "DOES NOT CREATE");
-#endif
+	SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "socket (%d,%d,%d) %s a simptcp socket\n",
+		    domain, type, protocol, res ? "CREATES" : "DOES NOT CREATE");
 
 	return res;
 }
@@ -72,9 +68,7 @@ int is_simptcp_socket(int domain, int type, int protocol)
 int socket(int domain, int type, int protocol)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     if (!is_simptcp_socket(domain, type, protocol))
       return libc_socket(domain, type, protocol);
@@ -85,9 +79,7 @@ int socket(int domain, int type, int protocol)
 
 int bind (int fd, const struct sockaddr *addr, socklen_t len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     
     if (!is_simptcp_descriptor(fd)) {
         return libc_bind(fd, addr, len);
@@ -102,9 +94,7 @@ int bind (int fd, const struct sockaddr *addr, socklen_t len)
 
 int connect (int fd, const struct sockaddr *addr, socklen_t len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     struct simptcp_socket* sock;
  
 
@@ -120,9 +110,7 @@ ssize_t send (int fd, const void *buf, size_t n, int flags)
 {
     struct simptcp_socket* sock;
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     if (!is_simptcp_descriptor(fd)) {
         return libc_send(fd, buf, n, flags);
@@ -138,9 +126,7 @@ ssize_t recv (int fd, void *buf, size_t n, int flags)
 {
     struct simptcp_socket* sock;
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     if (!is_simptcp_descriptor(fd)) {
         return libc_recv(fd, buf, n, flags);
@@ -159,9 +145,7 @@ int listen (int fd, int n)
 {
   struct simptcp_socket* sock;
     
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     
     if (!is_simptcp_descriptor(fd)) {
         return libc_listen(fd, n);
@@ -181,9 +165,7 @@ int accept (int fd, struct sockaddr *addr, socklen_t *addr_len)
 {
   struct simptcp_socket* sock;
     
-#if __DEBUG__
-  printf("function %s called\n", __func__);
-#endif
+  SIMPTCP_TRACE_CALL();
   
   if (!is_simptcp_descriptor(fd)) {
     return libc_accept(fd, addr, addr_len);
@@ -198,9 +180,7 @@ int shutdown (int fd, int how)
 {
   struct simptcp_socket* sock;
 
-#if __DEBUG__
-  printf("function %s called\n", __func__);
-#endif
+  SIMPTCP_TRACE_CALL();
 	
   if (!is_simptcp_descriptor(fd))
     return libc_shutdown(fd, how);
@@ -212,24 +192,25 @@ int shutdown (int fd, int how)
 
 int close (int fd)
 {
-#if __DEBUG__
-  printf("function %s called\n", __func__);
-#endif
+  int res;
+
+  SIMPTCP_TRACE_CALL();
 	
   if (!is_simptcp_descriptor(fd)) {
     return libc_close(fd);
   }
 
   /* Here comes the code for the close related to simtcp */
+  res = shutdown(fd, SHUT_RDWR);
 
-  return shutdown(fd, SHUT_RDWR);
+  /* the descriptor is released once the connection is over */
+  orphan_simptcp_socket(fd);
+  return res;
 }
 
 ssize_t read (int fd, void *buf, size_t n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     if (!is_simptcp_descriptor(fd)) {
         return libc_read(fd, buf, n);
@@ -241,9 +222,7 @@ ssize_t read (int fd, void *buf, size_t n)
 
 ssize_t write (int fd, const void *buf, size_t n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 	
     if (!is_simptcp_descriptor(fd)) {
         return libc_write(fd, buf, n);
@@ -255,42 +234,187 @@ ssize_t write (int fd, const void *buf, size_t n)
 
 int getsockname (int fd, struct sockaddr *addr, socklen_t *len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     return libc_getsockname(fd, addr, len);
 }
 
 int getpeername (int fd, struct sockaddr *addr, socklen_t *len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 	
     return libc_getpeername(fd, addr, len);
 }
 
-// TODO : Hide the fact that an udp socket is used in reality.
 int getsockopt (int fd, int level, int optname, void *optval, 
                 socklen_t *optlen)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    struct simptcp_socket* sock;
+
+    SIMPTCP_TRACE_CALL();
    
-    return libc_getsockopt(fd, level, optname, optval, optlen);
+    if (!is_simptcp_descriptor(fd)) {
+        return libc_getsockopt(fd, level, optname, optval, optlen);
+    }
+
+    /* simptcp options; the TCP ones share the same values */
+    if ((level != IPPROTO_SIMPTCP) && (level != IPPROTO_TCP))
+        return -ENOPROTOOPT;
+
+    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    return simptcp_socket_getsockopt(sock, optname, optval, optlen);
 }
 
-// TODO: Prevent some setsockopt() parameters values.
 int setsockopt (int fd, int level, int optname, const void *optval, 
                 socklen_t optlen)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    struct simptcp_socket* sock;
+
+    SIMPTCP_TRACE_CALL();
  
-    return libc_setsockopt(fd, level,optname, optval, optlen);
+    if (!is_simptcp_descriptor(fd)) {
+        return libc_setsockopt(fd, level,optname, optval, optlen);
+    }
+
+    /* simptcp options; the TCP ones share the same values */
+    if ((level != IPPROTO_SIMPTCP) && (level != IPPROTO_TCP))
+        return -ENOPROTOOPT;
+
+    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    return simptcp_socket_setsockopt(sock, optname, optval, optlen);
+}
+
+ssize_t sendfile (int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    SIMPTCP_TRACE_CALL();
+
+    if (!is_simptcp_descriptor(out_fd)) {
+        return libc_sendfile(out_fd, in_fd, offset, count);
+    }
+
+    /* Here comes the code for the sendfile related to simptcp */
+    return simptcp_sendfile(out_fd, in_fd, offset, count);
+}
+
+/* transmits count bytes of the file fd_in, starting at *offset (or at the
+ * current file position if offset is NULL), on the simptcp socket fd_out.
+ * Regular files are mapped in memory and the PDUs are built straight from
+ * the mapped pages, so the data never goes through a user space buffer.
+ * Other descriptors fall back to reading one PDU worth of data at a time.
+ * Returns the number of bytes sent and updates *offset (or the file position)
+ * accordingly; it stops early when the socket accepts less than a full chunk.
+ * Returns -1 with errno set when nothing could be sent (EBADF if fd_out is not
+ * a simptcp socket).
+ */
+ssize_t simptcp_sendfile (int fd_out, int fd_in, off_t *offset, size_t count)
+{
+    struct simptcp_socket* sock;
+    struct stat st;
+    char bounce[SIMPTCP_MAX_SIZE];
+    char * map = MAP_FAILED;
+    off_t pos, map_start = 0;
+    size_t map_len = 0, done = 0, chunk;
+    ssize_t res = 0;
+
+    SIMPTCP_TRACE_CALL();
+
+    if (!is_simptcp_descriptor(fd_out)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    sock=simptcp_entity.simptcp_socket_descriptors[fd_out];
+
+    pos = (offset != NULL) ? *offset : lseek(fd_in, 0, SEEK_CUR);
+
+    /* map the requested range of a regular file */
+    if ((pos >= 0) && (fstat(fd_in, &st) == 0) && S_ISREG(st.st_mode)) {
+        if (pos >= st.st_size)
+            count = 0;
+        else if (count > (size_t)(st.st_size - pos))
+            count = st.st_size - pos;
+        if (count > 0) {
+            map_start = pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+            map_len = count + (pos - map_start);
+            map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd_in, map_start);
+            if (map != MAP_FAILED)
+                madvise(map, map_len, MADV_SEQUENTIAL);
+        }
+    }
+
+    while (done < count) {
+        chunk = count - done;
+        if (chunk > sock->mss)
+            chunk = sock->mss;
+
+        if (map != MAP_FAILED) {
+            /* the PDU payload is referenced in the mapped pages */
+            res = sock->socket_state->send(sock, map + (pos - map_start) + done, chunk, 0);
+        } else {
+            if (pos >= 0)
+                res = pread(fd_in, bounce, chunk, pos + done);
+            else
+                res = libc_read(fd_in, bounce, chunk);
+            if (res <= 0)
+                break;
+            chunk = res;
+            res = sock->socket_state->send(sock, bounce, chunk, 0);
+        }
+        if (res <= 0)
+            break;
+        done += res;
+        /* short send: the socket is closing, what follows would be lost */
+        if ((size_t)res < chunk)
+            break;
+    }
+
+    if (map != MAP_FAILED)
+        munmap(map, map_len);
+
+    if (pos >= 0) {
+        if (offset != NULL)
+            *offset = pos + done;
+        else
+            lseek(fd_in, pos + done, SEEK_SET);
+    }
+
+    if ((done == 0) && (res < 0))
+        return -1;
+
+    return done;
+}
+
+/* lends to the application a read-only view of the data received on a simptcp
+ * socket, without copying it. The view stays valid until simptcp_recv_release
+ * is called; no new data is accepted on the socket in the meantime.
+ * Returns the length of the data, 0 when the connection has been closed by the
+ * remote side or -1 on error.
+ */
+ssize_t simptcp_recv_loan (int fd, const void **data)
+{
+    struct simptcp_socket* sock;
+
+    SIMPTCP_TRACE_CALL();
+
+    if (!is_simptcp_descriptor(fd))
+        return -EBADF;
+
+    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    return simptcp_socket_recv_loan(sock, data);
+}
+
+/* gives back the data lent by simptcp_recv_loan */
+int simptcp_recv_release (int fd)
+{
+    struct simptcp_socket* sock;
+
+    SIMPTCP_TRACE_CALL();
+
+    if (!is_simptcp_descriptor(fd))
+        return -EBADF;
+
+    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    return simptcp_socket_recv_release(sock);
 }
 
 
@@ -0,0 +1,442 @@
+/*! \file simptcp_bench.c
+ *  \brief Microbenchmark of the SimpTCP per-byte kernels (Internet checksum
+ *  and CRC32C, alone or fused with a copy) over payload sizes from 64 bytes to
+ *  64 KB. For every kernel the CPU supports, the result is first checked
+ *  against the portable kernel, then the time per call, throughput and CPU
+ *  cycles per byte are printed. The fused copy kernels are compared with a
+ *  memcpy() followed by the separate sum ("+" rows). A last table gives the
+ *  cost per packet of decoding and writing the generic header, field by field
+ *  with the inline accessors or in one go, and through out-of-line calls as
+ *  the accessors were before.
+ *
+ *  usage: simptcp_bench [MB per measure]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>             /* for offsetof() */
+#include <netinet/in.h>         /* for u_int16_t */
+#include <simptcp_packet.h>
+#include <simptcp_csum.h>
+#include <simptcp_bench.h>
+
+#define MAX_LEN 65536
+
+static const int sizes[] = { 64, 128, 256, 512, 1024, 1500, 4096, 16384, 65536 };
+#define NB_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static unsigned char data[MAX_LEN + 64];
+static unsigned char copy[MAX_LEN + 64];
+static volatile u_int32_t sink;
+static double tsc_hz;
+static unsigned long long bytes_per_measure = 64ULL << 20;
+
+/* the former checksum: 16-bit words added with no end-around carry */
+static u_int32_t csum_legacy (const void *buf, int len, u_int32_t sum)
+{
+    const u_int16_t *w = buf;
+    u_int16_t s = sum;
+    int i;
+
+    for (i = 0; i < len / 2; i++)
+        s += w[i];
+    return s;
+}
+
+typedef u_int32_t (*csum_kernel) (const void *buf, int len, u_int32_t sum);
+
+/* the copy kernels, benchmarked into copy[] */
+static u_int32_t memcpy_csum (const void *buf, int len, u_int32_t sum)
+{
+    memcpy(copy, buf, len);
+    return simptcp_csum_partial(copy, len, sum);
+}
+
+static u_int32_t csum_copy (const void *buf, int len, u_int32_t sum)
+{
+    return simptcp_csum_copy(copy, buf, len, sum);
+}
+
+static u_int32_t memcpy_crc32c (const void *buf, int len, u_int32_t crc)
+{
+    memcpy(copy, buf, len);
+    return simptcp_crc32c(copy, len, crc);
+}
+
+static u_int32_t crc32c_copy (const void *buf, int len, u_int32_t crc)
+{
+    return simptcp_crc32c_copy(copy, buf, len, crc);
+}
+
+/* header kernels: decode or write the generic header of the PDU at pdu and
+ * return something depending on every field, so that nothing is optimized out
+ */
+typedef u_int32_t (*header_kernel) (char *pdu, u_int32_t seed);
+
+#define NB_PDUS 64              /* PDUs cycled through by the header kernels */
+#define PDU_STRIDE 64
+
+static u_int32_t header_getters (char *pdu, u_int32_t seed)
+{
+    return seed + simptcp_get_sport(pdu) + simptcp_get_dport(pdu)
+        + simptcp_get_seq_num(pdu) + simptcp_get_ack_num(pdu)
+        + simptcp_get_head_len(pdu) + simptcp_get_flags(pdu)
+        + simptcp_get_total_len(pdu) + simptcp_get_win_size(pdu)
+        + simptcp_get_checksum(pdu);
+}
+
+static u_int32_t header_parse (char *pdu, u_int32_t seed)
+{
+    simptcp_header_fields h;
+
+    simptcp_parse_header(pdu, &h);
+    return seed + h.sport + h.dport + h.seq_num + h.ack_num + h.header_len
+        + h.flags + h.total_len + h.window_size + h.checksum;
+}
+
+static u_int32_t header_setters (char *pdu, u_int32_t seed)
+{
+    simptcp_set_sport(pdu, seed);
+    simptcp_set_dport(pdu, seed + 1);
+    simptcp_set_seq_num(pdu, seed + 2);
+    simptcp_set_ack_num(pdu, seed + 3);
+    simptcp_set_head_len(pdu, SIMPTCP_GHEADER_SIZE);
+    simptcp_set_flags(pdu, ACK);
+    simptcp_set_total_len(pdu, seed + 4);
+    simptcp_set_win_size(pdu, seed + 5);
+    return seed + (unsigned char) pdu[0];
+}
+
+static u_int32_t header_build (char *pdu, u_int32_t seed)
+{
+    simptcp_header_fields h;
+
+    h.sport = seed;
+    h.dport = seed + 1;
+    h.seq_num = seed + 2;
+    h.ack_num = seed + 3;
+    h.header_len = SIMPTCP_GHEADER_SIZE;
+    h.flags = ACK;
+    h.total_len = seed + 4;
+    h.window_size = seed + 5;
+    h.checksum = 0;
+    simptcp_build_header(pdu, &h);
+    return seed + (unsigned char) pdu[0];
+}
+
+/* the former out-of-line accessors, one call per field */
+#define OUT_OF_LINE_GET(field, type)                                    \
+    static __attribute__((noinline)) type call_get_##field (const char *b) \
+    { return simptcp_get_##field(b); }
+OUT_OF_LINE_GET(sport, u_int16_t)
+OUT_OF_LINE_GET(dport, u_int16_t)
+OUT_OF_LINE_GET(seq_num, u_int16_t)
+OUT_OF_LINE_GET(ack_num, u_int16_t)
+OUT_OF_LINE_GET(head_len, unsigned char)
+OUT_OF_LINE_GET(flags, unsigned char)
+OUT_OF_LINE_GET(total_len, u_int16_t)
+OUT_OF_LINE_GET(win_size, u_int16_t)
+OUT_OF_LINE_GET(checksum, u_int16_t)
+
+static u_int32_t header_calls (char *pdu, u_int32_t seed)
+{
+    return seed + call_get_sport(pdu) + call_get_dport(pdu)
+        + call_get_seq_num(pdu) + call_get_ack_num(pdu)
+        + call_get_head_len(pdu) + call_get_flags(pdu)
+        + call_get_total_len(pdu) + call_get_win_size(pdu)
+        + call_get_checksum(pdu);
+}
+
+/* times one header kernel and prints a line of the per-packet table */
+static void measure_header (const char *name, header_kernel kernel)
+{
+    unsigned long long i, iters = bytes_per_measure / 16;
+    uint64_t t0, c0, ns, cycles;
+    u_int32_t s = 0;
+
+    t0 = bench_now_ns();
+    c0 = bench_rdtsc();
+    for (i = 0; i < iters; i++)
+        s = kernel((char *) copy + (i % NB_PDUS) * PDU_STRIDE + 1, s);
+    cycles = bench_rdtsc() - c0;
+    ns = bench_now_ns() - t0;
+    sink = s;
+
+    printf("%-12s %12.2f %12.1f\n", name, (double) ns / iters,
+           (double) cycles / iters);
+}
+
+/* times one kernel on one size and prints a line of the table */
+static void measure (const char *name, csum_kernel kernel, const void *buf,
+                     int len)
+{
+    unsigned long long i, iters = bytes_per_measure / len;
+    uint64_t t0, c0, ns, cycles;
+    u_int32_t s = 0;
+
+    if (iters < 16)
+        iters = 16;
+
+    /* warm up caches and branch predictors */
+    for (i = 0; i < 16; i++)
+        s += kernel(buf, len, 0);
+
+    t0 = bench_now_ns();
+    c0 = bench_rdtsc();
+    for (i = 0; i < iters; i++)
+        s += kernel(buf, len, s & 1);
+    cycles = bench_rdtsc() - c0;
+    ns = bench_now_ns() - t0;
+    sink = s;
+
+    printf("%-12s %7d %12.1f %10.2f %10.3f\n", name, len,
+           (double) ns / iters, (double) len * iters / ns,
+           (double) cycles / ((double) len * iters));
+}
+
+/* checks every supported kernel against the generic one, on all lengths and
+ * on misaligned buffers; returns the number of mismatches
+ */
+static int check_kernels (void)
+{
+    static const char *names[] = { "sse2", "avx2" };
+    static const csum_kernel kernels[] = { simptcp_csum_partial_sse2,
+                                           simptcp_csum_partial_avx2 };
+    int k, len, off, errors = 0;
+    u_int16_t ref;
+
+    for (k = 0; k < 2; k++) {
+        if (!simptcp_csum_kernel_supported(names[k]))
+            continue;
+        for (off = 0; off < 4; off++)
+            for (len = 0; len <= 600; len++) {
+                ref = simptcp_csum_fold(simptcp_csum_partial_generic(data + off, len, 0));
+                if (simptcp_csum_fold(kernels[k](data + off, len, 0)) != ref) {
+                    printf("%s: mismatch for len %d offset %d\n", names[k], len, off);
+                    errors++;
+                }
+            }
+    }
+    return errors;
+}
+
+/* checks the copy kernels: same sum as the generic kernel, same bytes as the
+ * source, and the same sum again when the copy is made in pieces of any
+ * parity merged by simptcp_csum_block_add(); returns the number of mismatches
+ */
+static int check_copy_kernels (void)
+{
+    static const char *names[] = { "generic", "sse2", "avx2" };
+    typedef u_int32_t (*copy_kernel) (void *, const void *, int, u_int32_t);
+    static const copy_kernel kernels[] = { simptcp_csum_copy_generic,
+                                           simptcp_csum_copy_sse2,
+                                           simptcp_csum_copy_avx2 };
+    int k, len, off, cut, errors = 0;
+    u_int32_t sum;
+    u_int16_t ref;
+
+    for (k = 0; k < 3; k++) {
+        if (!simptcp_csum_kernel_supported(names[k]))
+            continue;
+        for (off = 0; off < 4; off++)
+            for (len = 0; len <= 600; len++) {
+                ref = simptcp_csum_fold(simptcp_csum_partial_generic(data + off, len, 0));
+                memset(copy, 0, len + 1);
+                cut = len / 3;
+                sum = kernels[k](copy, data + off, cut, 0);
+                sum = simptcp_csum_block_add(sum, kernels[k](copy + cut, data + off + cut,
+                                                             len - cut, 0), cut);
+                if ((simptcp_csum_fold(sum) != ref) || memcmp(copy, data + off, len)
+                    || (copy[len] != 0)) {
+                    printf("%s copy: mismatch for len %d offset %d\n", names[k], len, off);
+                    errors++;
+                }
+            }
+    }
+    for (len = 0; len <= 600; len++)
+        if ((simptcp_crc32c_copy_table(copy, data + 1, len, 0)
+             != simptcp_crc32c_table(data + 1, len, 0)) || memcmp(copy, data + 1, len)
+            || (simptcp_csum_kernel_supported("sse4.2")
+                && (simptcp_crc32c_copy_sse42(copy, data + 3, len, 0)
+                    != simptcp_crc32c_table(data + 3, len, 0)
+                    || memcmp(copy, data + 3, len)))) {
+            printf("crc32c copy: mismatch for len %d\n", len);
+            errors++;
+        }
+    return errors;
+}
+
+/* checks the CRC32C kernels against the check value of RFC 3720 and the
+ * SSE4.2 kernel against the table one; returns the number of mismatches
+ */
+static int check_crc32c (void)
+{
+    int len, off, errors = 0;
+
+    if (simptcp_crc32c_table("123456789", 9, 0) != 0xe3069283) {
+        printf("table: wrong check value\n");
+        errors++;
+    }
+    if (!simptcp_csum_kernel_supported("sse4.2"))
+        return errors;
+    for (off = 0; off < 4; off++)
+        for (len = 0; len <= 600; len++)
+            /* chained in two pieces, as for a header and its payload */
+            if (simptcp_crc32c_sse42(data + off + len / 3, len - len / 3,
+                                     simptcp_crc32c_sse42(data + off, len / 3, 0))
+                != simptcp_crc32c_table(data + off, len, 0)) {
+                printf("sse4.2: mismatch for len %d offset %d\n", len, off);
+                errors++;
+            }
+    return errors;
+}
+
+/* checks that the batched decode and write of the header agree with the
+ * accessors, on a misaligned PDU
+ */
+static int check_header (void)
+{
+    simptcp_header_fields h;
+    char *pdu = (char *) copy + 1;
+
+    memcpy(pdu, data, SIMPTCP_GHEADER_SIZE);
+    simptcp_parse_header(pdu, &h);
+    if (h.sport != simptcp_get_sport(pdu) || h.dport != simptcp_get_dport(pdu)
+        || h.seq_num != simptcp_get_seq_num(pdu) || h.ack_num != simptcp_get_ack_num(pdu)
+        || h.header_len != simptcp_get_head_len(pdu) || h.flags != simptcp_get_flags(pdu)
+        || h.total_len != simptcp_get_total_len(pdu)
+        || h.window_size != simptcp_get_win_size(pdu)
+        || h.checksum != simptcp_get_checksum(pdu)) {
+        printf("header parse: mismatch\n");
+        return 1;
+    }
+    memset(pdu, 0, SIMPTCP_GHEADER_SIZE);
+    simptcp_build_header(pdu, &h);
+    if (memcmp(pdu, data, SIMPTCP_GHEADER_SIZE)) {
+        printf("header build: mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* checks the option encoder and parser: options written by
+ * simptcp_put_option() are found again, malformed headers are rejected
+ */
+static int check_options (void)
+{
+    char pdu[64];
+    u_int16_t mss = htons(1400);
+    simptcp_options opts;
+    const char *opt;
+    int errors = 0;
+
+    memset(pdu, 0, sizeof(pdu));
+    simptcp_set_head_len(pdu, SIMPTCP_GHEADER_SIZE);
+    if ((simptcp_parse_options(pdu, SIMPTCP_GHEADER_SIZE, &opts) != 0) || (opts.nb != 0)
+        || (simptcp_parse_options(pdu, SIMPTCP_GHEADER_SIZE - 1, &opts) != -1))
+        errors++;
+
+    if ((simptcp_put_option(pdu, sizeof(pdu), SIMPTCP_MSS_OPTION, &mss, 2)
+         != SIMPTCP_GHEADER_SIZE + SIMPTCP_MSS_LEN)
+        || (simptcp_put_option(pdu, sizeof(pdu), SIMPTCP_CRC32C_OPTION, NULL, 4)
+            != SIMPTCP_GHEADER_SIZE + SIMPTCP_MSS_LEN + SIMPTCP_CRC32C_LEN)
+        || (simptcp_put_option(pdu, sizeof(pdu), SIMPTCP_MSS_OPTION, &mss, 3) != -1)
+        || (simptcp_put_option(pdu, SIMPTCP_GHEADER_SIZE + 12, SIMPTCP_TS_OPTION, NULL, 8) != -1))
+        errors++;
+
+    if ((simptcp_parse_options(pdu, sizeof(pdu), &opts) != 0) || (opts.nb != 2)
+        || ((opt = simptcp_option_get(pdu, &opts, SIMPTCP_MSS_OPTION)) == NULL)
+        || memcmp(opt + sizeof(simptcp_option_header), &mss, 2)
+        || (simptcp_option_get(pdu, &opts, SIMPTCP_CRC32C_OPTION) == NULL)
+        || (simptcp_option_get(pdu, &opts, SIMPTCP_TS_OPTION) != NULL))
+        errors++;
+
+    /* header_len beyond the PDU, truncated option, wrong length */
+    if (simptcp_parse_options(pdu, SIMPTCP_GHEADER_SIZE + 4, &opts) != -1)
+        errors++;
+    simptcp_set_head_len(pdu, SIMPTCP_GHEADER_SIZE + 5);
+    if (simptcp_parse_options(pdu, sizeof(pdu), &opts) != -1)
+        errors++;
+    simptcp_set_head_len(pdu, SIMPTCP_GHEADER_SIZE + SIMPTCP_MSS_LEN);
+    pdu[SIMPTCP_GHEADER_SIZE + 1] = SIMPTCP_MSS_LEN - 1;
+    if (simptcp_parse_options(pdu, sizeof(pdu), &opts) != -1)
+        errors++;
+
+    if (errors > 0)
+        printf("options: %d mismatches\n", errors);
+    return errors;
+}
+
+/* checks that the incremental update gives the same checksum as a full one */
+static int check_incremental (void)
+{
+    char pdu[1500];
+    u_int16_t check;
+
+    memcpy(pdu, data, sizeof(pdu));
+    simptcp_set_head_len(pdu, SIMPTCP_GHEADER_SIZE);
+    simptcp_add_checksum(pdu, sizeof(pdu));
+    simptcp_replace_word16(pdu, offsetof(simptcp_generic_header, ack_num), 0xbeef);
+    check = ((simptcp_generic_header *) pdu)->checksum;
+    simptcp_add_checksum(pdu, sizeof(pdu));
+    if (check != ((simptcp_generic_header *) pdu)->checksum
+        || !simptcp_check_checksum(pdu, sizeof(pdu))) {
+        printf("incremental update: mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    unsigned int i;
+
+    if (argc > 1)
+        bytes_per_measure = strtoull(argv[1], NULL, 10) << 20;
+
+    srand(1);
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = rand();
+
+    if (check_kernels() + check_copy_kernels() + check_crc32c() + check_incremental()
+        + check_header() + check_options() > 0)
+        return 1;
+
+    tsc_hz = bench_tsc_hz();
+    printf("checksum kernel selected: %s, CRC32C kernel selected: %s, "
+           "TSC at %.0f MHz\n\n", simptcp_csum_kernel_name(),
+           simptcp_crc32c_kernel_name(), tsc_hz / 1e6);
+
+    printf("%-12s %7s %12s %10s %10s\n", "kernel", "bytes", "ns/call", "GB/s",
+           "cycles/B");
+    for (i = 0; i < NB_SIZES; i++) {
+        measure("legacy", csum_legacy, data, sizes[i]);
+        measure("generic", simptcp_csum_partial_generic, data, sizes[i]);
+        if (simptcp_csum_kernel_supported("sse2"))
+            measure("sse2", simptcp_csum_partial_sse2, data, sizes[i]);
+        if (simptcp_csum_kernel_supported("avx2"))
+            measure("avx2", simptcp_csum_partial_avx2, data, sizes[i]);
+        measure("crc-table", simptcp_crc32c_table, data, sizes[i]);
+        if (simptcp_csum_kernel_supported("sse4.2"))
+            measure("crc-sse4.2", simptcp_crc32c_sse42, data, sizes[i]);
+        measure("memcpy+csum", memcpy_csum, data, sizes[i]);
+        measure("csum-copy", csum_copy, data, sizes[i]);
+        measure("memcpy+crc", memcpy_crc32c, data, sizes[i]);
+        measure("crc-copy", crc32c_copy, data, sizes[i]);
+        printf("\n");
+    }
+
+    for (i = 0; i < NB_PDUS; i++)
+        memcpy(copy + i * PDU_STRIDE + 1, data + i * PDU_STRIDE, SIMPTCP_GHEADER_SIZE);
+    printf("%-12s %12s %12s\n", "header", "ns/packet", "cycles/pkt");
+    measure_header("getters", header_getters);
+    measure_header("parse", header_parse);
+    measure_header("getter-calls", header_calls);
+    measure_header("setters", header_setters);
+    measure_header("build", header_build);
+
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,565 @@
+/*
+ * simptcp_csum.c
+ */
+
+#include <string.h>             /* for memcpy() */
+#include <simptcp_csum.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#define SIMPTCP_CSUM_X86        1
+#include <immintrin.h>          /* for SSE2, SSE4.2 and AVX2 intrinsics */
+#endif
+
+
+/* folds a 64-bit ones-complement accumulator on 32 bits */
+static inline u_int32_t fold64 (u_int64_t sum)
+{
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    return (u_int32_t) sum;
+}
+
+/* folds a 32-bit accumulator on 16 bits (the result is not complemented) */
+u_int16_t simptcp_csum_fold (u_int32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (u_int16_t) sum;
+}
+
+/* updates the checksum check of a PDU in which the 16-bit word old_word is
+ * replaced by new_word, without reading the rest of the PDU [RFC 1624, eqn 3].
+ * Both words are taken as they are stored in the PDU.
+ */
+u_int16_t simptcp_csum_replace16 (u_int16_t check, u_int16_t old_word,
+                                  u_int16_t new_word)
+{
+    u_int32_t sum = (u_int16_t) ~check;
+
+    sum += (u_int16_t) ~old_word;
+    sum += new_word;
+    return (u_int16_t) ~simptcp_csum_fold(sum);
+}
+
+/* portable kernel: 32-bit loads into a 64-bit accumulator, so that the carries
+ * are only folded once at the end
+ */
+u_int32_t simptcp_csum_partial_generic (const void *data, int len, u_int32_t sum)
+{
+    const unsigned char *p = data;
+    u_int64_t acc = sum;
+    u_int32_t w0, w1, w2, w3;
+    u_int16_t h;
+
+    while (len >= 16) {
+        memcpy(&w0, p, 4);
+        memcpy(&w1, p + 4, 4);
+        memcpy(&w2, p + 8, 4);
+        memcpy(&w3, p + 12, 4);
+        acc += (u_int64_t) w0 + w1 + w2 + w3;
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        memcpy(&w0, p, 4);
+        acc += w0;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&h, p, 2);
+        acc += h;
+        p += 2;
+        len -= 2;
+    }
+    /* odd length: the last byte is padded with 0, without writing the pad */
+    if (len > 0) {
+        h = 0;
+        memcpy(&h, p, 1);
+        acc += h;
+    }
+
+    return fold64(acc);
+}
+
+#ifdef SIMPTCP_CSUM_X86
+
+/* SSE2 kernel: 16 bytes per iteration, the 32-bit words are widened to 64-bit
+ * lanes so that no carry is lost
+ */
+__attribute__((target("sse2")))
+u_int32_t simptcp_csum_partial_sse2 (const void *data, int len, u_int32_t sum)
+{
+    const unsigned char *p = data;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero, v;
+    u_int64_t lanes[2];
+
+    while (len >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        p += 16;
+        len -= 16;
+    }
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+
+    return simptcp_csum_partial_generic(p, len,
+                                        fold64((u_int64_t) sum + fold64(lanes[0])
+                                               + fold64(lanes[1])));
+}
+
+/* AVX2 kernel: 64 bytes per iteration on two accumulators. The 16-byte tail
+ * is handled here rather than by the SSE2 kernel: its non-VEX code would pay
+ * an AVX-SSE transition right after the 256-bit loop
+ */
+__attribute__((target("avx2")))
+u_int32_t simptcp_csum_partial_avx2 (const void *data, int len, u_int32_t sum)
+{
+    const unsigned char *p = data;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero, v0, v1;
+    u_int64_t lanes[4];
+
+    while (len >= 64) {
+        v0 = _mm256_loadu_si256((const __m256i *) p);
+        v1 = _mm256_loadu_si256((const __m256i *) (p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_unpacklo_epi32(v1, zero));
+        acc3 = _mm256_add_epi64(acc3, _mm256_unpackhi_epi32(v1, zero));
+        p += 64;
+        len -= 64;
+    }
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1),
+                            _mm256_add_epi64(acc2, acc3));
+    while (len >= 16) {
+        v0 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) p));
+        acc0 = _mm256_add_epi64(acc0, v0);
+        p += 16;
+        len -= 16;
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc0);
+    _mm256_zeroupper();
+
+    return simptcp_csum_partial_generic(p, len,
+                                     fold64((u_int64_t) sum + fold64(lanes[0])
+                                            + fold64(lanes[1]) + fold64(lanes[2])
+                                            + fold64(lanes[3])));
+}
+
+#else /* !SIMPTCP_CSUM_X86 */
+
+u_int32_t simptcp_csum_partial_sse2 (const void *data, int len, u_int32_t sum)
+{
+    return simptcp_csum_partial_generic(data, len, sum);
+}
+
+u_int32_t simptcp_csum_partial_avx2 (const void *data, int len, u_int32_t sum)
+{
+    return simptcp_csum_partial_generic(data, len, sum);
+}
+
+#endif /* SIMPTCP_CSUM_X86 */
+
+/* adds the partial sum sum2 of a block starting at byte offset of the PDU to
+ * sum: a block at an odd offset has its bytes swapped in the 16-bit words
+ */
+u_int32_t simptcp_csum_block_add (u_int32_t sum, u_int32_t sum2, int offset)
+{
+    u_int32_t s = simptcp_csum_fold(sum2);
+
+    if (offset & 1)
+        s = ((s & 0xff) << 8) | (s >> 8);
+    return fold64((u_int64_t) sum + s);
+}
+
+/* portable copy-and-checksum kernel: every word is added as it is stored */
+u_int32_t simptcp_csum_copy_generic (void *dst, const void *src, int len,
+                                     u_int32_t sum)
+{
+    const unsigned char *p = src;
+    unsigned char *d = dst;
+    u_int64_t acc = 0;
+    u_int32_t w0, w1, w2, w3;
+
+    while (len >= 16) {
+        memcpy(&w0, p, 4);
+        memcpy(&w1, p + 4, 4);
+        memcpy(&w2, p + 8, 4);
+        memcpy(&w3, p + 12, 4);
+        memcpy(d, &w0, 4);
+        memcpy(d + 4, &w1, 4);
+        memcpy(d + 8, &w2, 4);
+        memcpy(d + 12, &w3, 4);
+        acc += (u_int64_t) w0 + w1 + w2 + w3;
+        p += 16;
+        d += 16;
+        len -= 16;
+    }
+    /* the tail is summed from the copy, which is already in L1 */
+    memcpy(d, p, len);
+
+    return simptcp_csum_partial_generic(d, len, fold64((u_int64_t) sum + fold64(acc)));
+}
+
+#ifdef SIMPTCP_CSUM_X86
+
+__attribute__((target("sse2")))
+u_int32_t simptcp_csum_copy_sse2 (void *dst, const void *src, int len,
+                                  u_int32_t sum)
+{
+    const unsigned char *p = src;
+    unsigned char *d = dst;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero, v;
+    u_int64_t lanes[2];
+
+    while (len >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        _mm_storeu_si128((__m128i *) d, v);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        p += 16;
+        d += 16;
+        len -= 16;
+    }
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+
+    return simptcp_csum_copy_generic(d, p, len,
+                                     fold64((u_int64_t) sum + fold64(lanes[0])
+                                            + fold64(lanes[1])));
+}
+
+__attribute__((target("avx2")))
+u_int32_t simptcp_csum_copy_avx2 (void *dst, const void *src, int len,
+                                  u_int32_t sum)
+{
+    const unsigned char *p = src;
+    unsigned char *d = dst;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero, v0, v1;
+    __m128i v;
+    u_int64_t lanes[4];
+
+    while (len >= 64) {
+        v0 = _mm256_loadu_si256((const __m256i *) p);
+        v1 = _mm256_loadu_si256((const __m256i *) (p + 32));
+        _mm256_storeu_si256((__m256i *) d, v0);
+        _mm256_storeu_si256((__m256i *) (d + 32), v1);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc2 = _mm256_add_epi64(acc2, _mm256_unpacklo_epi32(v1, zero));
+        acc3 = _mm256_add_epi64(acc3, _mm256_unpackhi_epi32(v1, zero));
+        p += 64;
+        d += 64;
+        len -= 64;
+    }
+    acc0 = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1),
+                            _mm256_add_epi64(acc2, acc3));
+    while (len >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        _mm_storeu_si128((__m128i *) d, v);
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepu32_epi64(v));
+        p += 16;
+        d += 16;
+        len -= 16;
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc0);
+    _mm256_zeroupper();
+
+    return simptcp_csum_copy_generic(d, p, len,
+                                  fold64((u_int64_t) sum + fold64(lanes[0])
+                                         + fold64(lanes[1]) + fold64(lanes[2])
+                                         + fold64(lanes[3])));
+}
+
+#else /* !SIMPTCP_CSUM_X86 */
+
+u_int32_t simptcp_csum_copy_sse2 (void *dst, const void *src, int len,
+                                  u_int32_t sum)
+{
+    return simptcp_csum_copy_generic(dst, src, len, sum);
+}
+
+u_int32_t simptcp_csum_copy_avx2 (void *dst, const void *src, int len,
+                                  u_int32_t sum)
+{
+    return simptcp_csum_copy_generic(dst, src, len, sum);
+}
+
+#endif /* SIMPTCP_CSUM_X86 */
+
+/* CRC32C polynomial, bit-reflected */
+#define CRC32C_POLY 0x82f63b78
+
+/* slicing-by-8 tables: crc32c_lut[k][b] is the CRC of byte b followed by k
+ * zero bytes */
+static u_int32_t crc32c_lut[8][256];
+static volatile int crc32c_lut_ready;
+
+static void crc32c_lut_init (void)
+{
+    u_int32_t c;
+    int b, k;
+
+    for (b = 0; b < 256; b++) {
+        c = b;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+        crc32c_lut[0][b] = c;
+    }
+    for (b = 0; b < 256; b++)
+        for (k = 1; k < 8; k++)
+            crc32c_lut[k][b] = (crc32c_lut[k - 1][b] >> 8)
+                ^ crc32c_lut[0][crc32c_lut[k - 1][b] & 0xff];
+    crc32c_lut_ready = 1;
+}
+
+/* table-driven kernel, 8 bytes per iteration */
+u_int32_t simptcp_crc32c_table (const void *data, int len, u_int32_t crc)
+{
+    const unsigned char *p = data;
+    u_int32_t c = ~crc, lo, hi;
+
+    if (!crc32c_lut_ready)
+        crc32c_lut_init();
+
+    while (len >= 8) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= c;
+        c = crc32c_lut[7][lo & 0xff] ^ crc32c_lut[6][(lo >> 8) & 0xff]
+            ^ crc32c_lut[5][(lo >> 16) & 0xff] ^ crc32c_lut[4][lo >> 24]
+            ^ crc32c_lut[3][hi & 0xff] ^ crc32c_lut[2][(hi >> 8) & 0xff]
+            ^ crc32c_lut[1][(hi >> 16) & 0xff] ^ crc32c_lut[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        c = (c >> 8) ^ crc32c_lut[0][(c ^ *p++) & 0xff];
+
+    return ~c;
+}
+
+/* table-driven copy-and-CRC kernel: the table lookups leave no room for a
+ * fused store, so the data are copied by blocks small enough to be summed
+ * while they are still in L1
+ */
+#define CRC32C_COPY_BLOCK 256
+
+u_int32_t simptcp_crc32c_copy_table (void *dst, const void *src, int len,
+                                     u_int32_t crc)
+{
+    const unsigned char *p = src;
+    unsigned char *d = dst;
+    int n;
+
+    while (len > 0) {
+        n = (len < CRC32C_COPY_BLOCK) ? len : CRC32C_COPY_BLOCK;
+        memcpy(d, p, n);
+        crc = simptcp_crc32c_table(d, n, crc);
+        p += n;
+        d += n;
+        len -= n;
+    }
+    return crc;
+}
+
+#ifdef SIMPTCP_CSUM_X86
+
+/* SSE4.2 kernel: one crc32 instruction per 8 bytes */
+__attribute__((target("sse4.2")))
+u_int32_t simptcp_crc32c_sse42 (const void *data, int len, u_int32_t crc)
+{
+    const unsigned char *p = data;
+#ifdef __x86_64__
+    u_int64_t c = (u_int32_t) ~crc, w;
+
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        len -= 8;
+    }
+#else
+    u_int32_t c = ~crc, w;
+
+    while (len >= 4) {
+        memcpy(&w, p, 4);
+        c = _mm_crc32_u32(c, w);
+        p += 4;
+        len -= 4;
+    }
+#endif
+    while (len-- > 0)
+        c = _mm_crc32_u8((u_int32_t) c, *p++);
+
+    return ~(u_int32_t) c;
+}
+
+/* SSE4.2 copy-and-CRC kernel: each 8-byte word is stored and fed to crc32 */
+__attribute__((target("sse4.2")))
+u_int32_t simptcp_crc32c_copy_sse42 (void *dst, const void *src, int len,
+                                     u_int32_t crc)
+{
+    const unsigned char *p = src;
+    unsigned char *d = dst;
+#ifdef __x86_64__
+    u_int64_t c = (u_int32_t) ~crc, w;
+
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        memcpy(d, &w, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        d += 8;
+        len -= 8;
+    }
+#else
+    u_int32_t c = ~crc, w;
+
+    while (len >= 4) {
+        memcpy(&w, p, 4);
+        memcpy(d, &w, 4);
+        c = _mm_crc32_u32(c, w);
+        p += 4;
+        d += 4;
+        len -= 4;
+    }
+#endif
+    while (len-- > 0) {
+        *d++ = *p;
+        c = _mm_crc32_u8((u_int32_t) c, *p++);
+    }
+
+    return ~(u_int32_t) c;
+}
+
+#else /* !SIMPTCP_CSUM_X86 */
+
+u_int32_t simptcp_crc32c_sse42 (const void *data, int len, u_int32_t crc)
+{
+    return simptcp_crc32c_table(data, len, crc);
+}
+
+u_int32_t simptcp_crc32c_copy_sse42 (void *dst, const void *src, int len,
+                                     u_int32_t crc)
+{
+    return simptcp_crc32c_copy_table(dst, src, len, crc);
+}
+
+#endif /* SIMPTCP_CSUM_X86 */
+
+/* returns 1 if the kernel "generic", "sse2", "avx2", "table" or "sse4.2" can
+ * run on this CPU */
+int simptcp_csum_kernel_supported (const char *name)
+{
+    if ((strcmp(name, "generic") == 0) || (strcmp(name, "table") == 0))
+        return 1;
+#ifdef SIMPTCP_CSUM_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse4.2") == 0)
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    return 0;
+}
+
+/* Kernels used by simptcp_csum_partial and simptcp_csum_copy, resolved on the
+ * first call */
+static u_int32_t (*csum_partial_ptr) (const void *data, int len, u_int32_t sum);
+static u_int32_t (*csum_copy_ptr) (void *dst, const void *src, int len,
+                                   u_int32_t sum);
+static const char *csum_kernel;
+
+static void csum_select (void)
+{
+    if (simptcp_csum_kernel_supported("avx2")) {
+        csum_kernel = "avx2";
+        csum_copy_ptr = simptcp_csum_copy_avx2;
+        csum_partial_ptr = simptcp_csum_partial_avx2;
+    } else if (simptcp_csum_kernel_supported("sse2")) {
+        csum_kernel = "sse2";
+        csum_copy_ptr = simptcp_csum_copy_sse2;
+        csum_partial_ptr = simptcp_csum_partial_sse2;
+    } else {
+        csum_kernel = "generic";
+        csum_copy_ptr = simptcp_csum_copy_generic;
+        csum_partial_ptr = simptcp_csum_partial_generic;
+    }
+}
+
+/* name of the kernel used by simptcp_csum_partial */
+const char * simptcp_csum_kernel_name (void)
+{
+    if (!csum_partial_ptr)
+        csum_select();
+    return csum_kernel;
+}
+
+u_int32_t simptcp_csum_partial (const void *data, int len, u_int32_t sum)
+{
+    if (!csum_partial_ptr)
+        csum_select();
+    return csum_partial_ptr(data, len, sum);
+}
+
+u_int32_t simptcp_csum_copy (void *dst, const void *src, int len, u_int32_t sum)
+{
+    if (!csum_partial_ptr)
+        csum_select();
+    return csum_copy_ptr(dst, src, len, sum);
+}
+
+/* Kernels used by simptcp_crc32c and simptcp_crc32c_copy, resolved on the
+ * first call */
+static u_int32_t (*crc32c_ptr) (const void *data, int len, u_int32_t crc);
+static u_int32_t (*crc32c_copy_ptr) (void *dst, const void *src, int len,
+                                     u_int32_t crc);
+static const char *crc32c_kernel;
+
+static void crc32c_select (void)
+{
+    if (simptcp_csum_kernel_supported("sse4.2")) {
+        crc32c_kernel = "sse4.2";
+        crc32c_copy_ptr = simptcp_crc32c_copy_sse42;
+        crc32c_ptr = simptcp_crc32c_sse42;
+    } else {
+        crc32c_lut_init();
+        crc32c_kernel = "table";
+        crc32c_copy_ptr = simptcp_crc32c_copy_table;
+        crc32c_ptr = simptcp_crc32c_table;
+    }
+}
+
+/* name of the kernel used by simptcp_crc32c */
+const char * simptcp_crc32c_kernel_name (void)
+{
+    if (!crc32c_ptr)
+        crc32c_select();
+    return crc32c_kernel;
+}
+
+u_int32_t simptcp_crc32c (const void *data, int len, u_int32_t crc)
+{
+    if (!crc32c_ptr)
+        crc32c_select();
+    return crc32c_ptr(data, len, crc);
+}
+
+u_int32_t simptcp_crc32c_copy (void *dst, const void *src, int len, u_int32_t crc)
+{
+    if (!crc32c_ptr)
+        crc32c_select();
+    return crc32c_copy_ptr(dst, src, len, crc);
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -22,10 +22,14 @@
 #include <term_colors.h>
 #define __PREFIX__	    "[" COLOR("SIMPTCP_ENTITY", BRIGHT_CYAN) "] "
 #include <term_io.h>
+#define __SUBSYS__              SIMPTCP_LOG_ENTITY
+#include <simptcp_log.h>       /* for SIMPTCP_LOG() */
+#include <simptcp_trace.h>     /* for SIMPTCP_TRACE() */
+#include <simptcp_pcap.h>      /* for SIMPTCP_PCAP() */
+#include <simptcp_stat.h>      /* for SIMPTCP_STAT_INC() */
+#include <simptcp_metrics.h>   /* for simptcp_metrics_init() */
+#include <simptcp_probe.h>     /* for SIMPTCP_PROBE() */
 
-#ifndef __DEBUG__
-#define __DEBUG__               1
-#endif
 
 extern simptcp_socket_states_funcs simptcp_socket_states;
 
@@ -40,9 +44,7 @@ int set_non_blocking(int fd)
 {
     int flags;
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
 /* If they have O_NONBLOCK, use the Posix way to do it */
 #if defined(O_NONBLOCK)
@@ -58,6 +60,95 @@ int set_non_blocking(int fd)
 }
 
 
+/*!
+ * \fn char * simptcp_rx_buffer_get()
+ * \brief reserve un buffer libre de la reserve de reception de l'entite
+ * \return pointeur sur le buffer reserve (compteur de references a 1), NULL si
+ * tous les buffers sont utilises
+ */
+char * simptcp_rx_buffer_get()
+{
+  int i;
+
+  for (i = 0; i < SIMPTCP_RX_POOL_SIZE; i++) {
+    if (__sync_bool_compare_and_swap(&(simptcp_entity.rx_pool_refs[i]), 0, 1))
+      return simptcp_entity.rx_pool[i];
+  }
+  return NULL;
+}
+
+/*!
+ * \fn void simptcp_rx_buffer_hold(char * buffer)
+ * \brief prend une reference supplementaire sur un buffer de la reserve de 
+ * reception, typiquement pour le confier a un socket simpTCP
+ * \param buffer buffer de la reserve
+ */
+void simptcp_rx_buffer_hold(char * buffer)
+{
+  int i = (buffer - simptcp_entity.rx_pool[0]) / MAX_SIMPTCP_BUFFER_SIZE;
+
+  assert((i >= 0) && (i < SIMPTCP_RX_POOL_SIZE));
+  __sync_fetch_and_add(&(simptcp_entity.rx_pool_refs[i]), 1);
+}
+
+/*!
+ * \fn void simptcp_rx_buffer_put(char * buffer)
+ * \brief libere une reference sur un buffer de la reserve de reception. Le
+ * buffer redevient disponible lorsque plus personne ne le reference
+ * \param buffer buffer de la reserve
+ */
+void simptcp_rx_buffer_put(char * buffer)
+{
+  int i = (buffer - simptcp_entity.rx_pool[0]) / MAX_SIMPTCP_BUFFER_SIZE;
+
+  assert((i >= 0) && (i < SIMPTCP_RX_POOL_SIZE));
+  __sync_fetch_and_sub(&(simptcp_entity.rx_pool_refs[i]), 1);
+}
+
+/*!
+ * \fn struct simptcp_socket * ucopy_lookup(char * buffer, struct sockaddr_in * udp_remote)
+ * \brief recherche le socket connecte destinataire d'un PDU pas encore verifie,
+ * s'il a une application en attente dans recv (voir #receive_direct). 
+ * Contrairement a #demultiplex_packet, ne modifie aucun socket
+ * \param buffer qui pointe sur le PDU SimpTCP recu
+ * \param udp_remote qui pointe sur l'adresse du socket UDP emetteur du PDU SimpTCP 
+ * \return le socket SimpTCP ou NULL
+ */
+static struct simptcp_socket * ucopy_lookup(char * buffer, struct sockaddr_in * udp_remote)
+{
+  struct simptcp_socket *sock;
+  u_int16_t sport = htons(simptcp_get_sport(buffer));
+  u_int16_t dport = htons(simptcp_get_dport(buffer));
+  int fd;
+
+  for (fd=0;fd< MAX_OPEN_SOCK;fd++)
+    {
+      if (((sock=simptcp_entity.simptcp_socket_descriptors[fd]) != NULL)
+	  && (sock->ucopy_buf != NULL)
+	  && sock->local_simptcp.sin_port == dport
+	  && sock->remote_simptcp.sin_addr.s_addr == udp_remote->sin_addr.s_addr
+	  && sock->remote_simptcp.sin_port == sport)
+	return sock;
+    }
+  return NULL;
+}
+
+/*!
+ * \fn static long long timer_lateness(const struct timeval * deadline)
+ * \brief retard d'un timer qui vient d'expirer sur son echeance 
+ * (SIMPTCP_HIST_TIMER_LATE)
+ * \param deadline echeance du timer
+ * \return retard en us
+ */
+static long long timer_lateness(const struct timeval * deadline)
+{
+  struct timeval t0;
+
+  gettimeofday(&t0, NULL);
+  return (t0.tv_sec - deadline->tv_sec) * 1000000LL + (t0.tv_usec - deadline->tv_usec);
+}
+
+
 /*!
  * \fn void * simptcp_entity_handler()
  * \brief handler lance au demarrage de SimpTCP (au lancement de l'application utilisant 
@@ -77,44 +168,84 @@ void * simptcp_entity_handler()
   struct sockaddr_in udp_remote; 
   unsigned int slen = sizeof(struct sockaddr_in);
   int fd; /* simptcp socket file descriptor */
+  struct simptcp_socket *ucopy; /* socket with a reader waiting in recv */
   struct timeval t0;
+  struct iovec iov; /* received datagram, for the capture */
+  struct timeval tick, last_tick; /* start of this and of the last iteration */
+  int idle = 0; /* the last iteration received nothing */
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
+  gettimeofday(&last_tick, NULL);
   while (1) {
 
+    /* entity statistics: iterations, time spent without datagram */
+    gettimeofday(&tick, NULL);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_LOOPS);
+    if (idle)
+      simptcp_stat_add(SIMPTCP_STAT_IDLE_US, (tick.tv_sec - last_tick.tv_sec) * 1000000 +
+		       (tick.tv_usec - last_tick.tv_usec));
+    last_tick = tick;
+
     usleep(10);
     /* check for a new arriving packet */
     simptcp_entity.in_len = libc_recvfrom(simptcp_entity.udp_fd,buffer, 
 				     MAX_SIMPTCP_BUFFER_SIZE,0, 
 				      (struct sockaddr*) &udp_remote, &slen);
+    idle = (simptcp_entity.in_len == -1);
+    if (idle && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+      SIMPTCP_STAT_INC(SIMPTCP_STAT_RX_ERRORS);
 
     if (simptcp_entity.in_len != -1) {
-#if __DEBUG__
-      printf("************************************************************\n"
-	     "Received packet of size %d on %s:%hu\n",
-	     simptcp_entity.in_len, inet_ntoa(udp_remote.sin_addr),
-	     simptcp_get_dport(buffer));
-#endif
-      /* check if corrupted */
-      if (!simptcp_check_checksum(buffer,simptcp_entity.in_len)) {
-#if __DEBUG__
-	printf("Dropping corrupted packet\n");
-#endif
+      gettimeofday(&(simptcp_entity.in_time), NULL);
+      SIMPTCP_STAT_INC(SIMPTCP_STAT_RX_DATAGRAMS);
+      SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "Received packet of size %d on %s:%hu\n",
+		  simptcp_entity.in_len, inet_ntoa(udp_remote.sin_addr),
+		  simptcp_get_dport(buffer));
+      iov.iov_base = buffer;
+      iov.iov_len = simptcp_entity.in_len;
+      SIMPTCP_PCAP(&udp_remote, &(simptcp_entity.local_udp), &iov, 1);
+      /* check if corrupted; if a reader is waiting for this packet, its
+	 payload is copied to the reader's buffer by the same pass */
+      ucopy = ucopy_lookup(buffer, &udp_remote);
+      if (!receive_direct(ucopy, buffer, simptcp_entity.in_len)) {
+	SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "Dropping corrupted packet\n");
+	SIMPTCP_TRACE(SIMPTCP_TRACE_DROP, 0, 0, simptcp_entity.in_len, 0, 0, 0, 0, 0);
+	SIMPTCP_STAT_INC(SIMPTCP_STAT_CSUM_DROPS);
+	SIMPTCP_PROBE2(csum_drop, buffer, simptcp_entity.in_len);
 	/* TODO : on pourrait prévoir un memset */
 	continue ;
       }
       else { /* clean simptcp packet */
-#if __DEBUG__
-	simptcp_print_packet(buffer);
-#endif
+	SIMPTCP_TRACE_PDU(SIMPTCP_TRACE_PDU_RECV, simptcp_get_dport(buffer),
+			  buffer, simptcp_entity.in_len);
+	if (SIMPTCP_LOG_ON_FOR(SIMPTCP_LOG_PACKET, SIMPTCP_LOG_DEBUG))
+	  simptcp_print_packet(buffer);
 	/* Demultiplex packet */
 	  
-	if ((fd=demultiplex_packet(buffer,&udp_remote)) >=0)
+	fd=demultiplex_packet(buffer,&udp_remote);
+	SIMPTCP_TRACE(SIMPTCP_TRACE_DEMUX, simptcp_get_dport(buffer), 0,
+		      simptcp_get_dport(buffer), (fd >= 0) ? fd : 0xffff,
+		      simptcp_entity.in_len, 0, 0, 0);
+	if (fd >=0) {
 	  /* the packets is destined to an open simptcp socket */
+	  SIMPTCP_PROBE3(demux_hit, fd, buffer, simptcp_entity.in_len);
+	  simptcp_entity.simptcp_socket_descriptors[fd]->simptcp_receive_count++;
 	  simptcp_entity.simptcp_socket_descriptors[fd]->socket_state->process_simptcp_pdu(simptcp_entity.simptcp_socket_descriptors[fd],buffer,simptcp_entity.in_len);
+	  /* payload copied to the reader but not accepted (duplicate..) */
+	  if (ucopy != NULL)
+	    ucopy->ucopy_filled = 0;
+
+	  /* the socket may have queued the buffer by reference: receive
+	     the next packet into another buffer of the pool */
+	  simptcp_rx_buffer_put(buffer);
+	  buffer = simptcp_entity.in_buffer = simptcp_rx_buffer_get();
+	  assert(buffer != NULL);
+	}
+	else {
+	  SIMPTCP_STAT_INC(SIMPTCP_STAT_NOMATCH_DROPS);
+	  SIMPTCP_PROBE2(demux_miss, buffer, simptcp_entity.in_len);
+	}
       }
     }
     //   else if ((simptcp_entity.in_len ==-1) && (errno != EAGAIN))
@@ -129,8 +260,32 @@ void * simptcp_entity_handler()
 	    (has_active_timer(simptcp_entity.simptcp_socket_descriptors[fd])) &&
 	    (is_timeout(simptcp_entity.simptcp_socket_descriptors[fd])))
 	  {/* timeout detected on the open socket */
+	    SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_FIRE,
+			  ntohs(simptcp_entity.simptcp_socket_descriptors[fd]->local_simptcp.sin_port),
+			  0, SIMPTCP_TRACE_RTX_TIMER, 0, 0, 0, 0, 0);
+	    simptcp_latency_record(simptcp_entity.simptcp_socket_descriptors[fd],
+				   SIMPTCP_HIST_TIMER_LATE,
+				   timer_lateness(&(simptcp_entity.simptcp_socket_descriptors[fd]->timeout)));
 	    simptcp_entity.simptcp_socket_descriptors[fd]->socket_state->handle_timeout(simptcp_entity.simptcp_socket_descriptors[fd]);
 	  }
+	if (((simptcp_entity.simptcp_socket_descriptors[fd]) != NULL) &&
+	    (has_active_delack_timer(simptcp_entity.simptcp_socket_descriptors[fd])) &&
+	    (is_delack_timeout(simptcp_entity.simptcp_socket_descriptors[fd])))
+	  {/* delayed ACK due on the open socket */
+	    SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_FIRE,
+			  ntohs(simptcp_entity.simptcp_socket_descriptors[fd]->local_simptcp.sin_port),
+			  0, SIMPTCP_TRACE_DELACK_TIMER, 0, 0, 0, 0, 0);
+	    simptcp_latency_record(simptcp_entity.simptcp_socket_descriptors[fd],
+				   SIMPTCP_HIST_TIMER_LATE,
+				   timer_lateness(&(simptcp_entity.simptcp_socket_descriptors[fd]->delack_timeout)));
+	    handle_delack_timeout(simptcp_entity.simptcp_socket_descriptors[fd]);
+	  }
+	if (((simptcp_entity.simptcp_socket_descriptors[fd]) != NULL) &&
+	    (simptcp_entity.simptcp_socket_descriptors[fd]->orphan) &&
+	    (simptcp_entity.simptcp_socket_descriptors[fd]->socket_state ==
+	     &(simptcp_entity.simptcp_socket_states->closed)))
+	  /* closed by the application, connection over (end of timewait) */
+	  release_simptcp_socket(fd, 0);
       } 
 
   } /* while(1) */
@@ -138,20 +293,21 @@ void * simptcp_entity_handler()
 
 
 /*!
- * \fn int start_simptcp(int local_udp)
- * \brief initialise simptcp control block et lance 
- * le handler #simptcp_entity_handler
- * \param local_udp numero de port udp utilise par simpTCP.
- * Valeur fixee par #DEFAULT_LOCAL_UDP_PORT
+ * \fn int init_simptcp(int local_udp)
+ * \brief initialise simptcp control block (socket UDP, reserve de buffers,
+ * statistiques) sans lancer le handler #simptcp_entity_handler : les 
+ * microbenchmarks (simptcp_microbench) appellent ainsi les fonctions de 
+ * l'entite une a une, sans qu'elle tourne en parallele
+ * \param local_udp numero de port udp utilise par simpTCP (0 : port libre
+ * choisi par le systeme)
  * \return -1 si echec (avec errno positionne), 0 sinon. 
  */
-int start_simptcp(int local_udp)
+int init_simptcp(int local_udp)
 {    
-  int res = -1;
+  int res = -1, i;
+  socklen_t slen;
   
-#if __DEBUG__
-  printf("function %s called\n", __func__);
-#endif
+  SIMPTCP_TRACE_CALL();
 	simptcp_entity.local_udp.sin_family = AF_INET;
 	simptcp_entity.local_udp.sin_addr.s_addr = htonl(INADDR_ANY);
 	simptcp_entity.local_udp.sin_port = htons(local_udp);
@@ -159,7 +315,8 @@ int start_simptcp(int local_udp)
 	/* creation of the underlying UDP socket */
 	res = libc_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if (res < 0) {
-	  perror("Creation of UDP socket for simptcp failed");
+	  SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Creation of UDP socket for simptcp failed: %s\n",
+		      strerror(errno));
 	  return res;
 	}    
 	simptcp_entity.udp_fd=res;
@@ -169,15 +326,46 @@ int start_simptcp(int local_udp)
 	/* initialiser le numéro de port du socket */
 	res= libc_bind(simptcp_entity.udp_fd,(struct sockaddr *) &simptcp_entity.local_udp,sizeof(simptcp_entity.local_udp) );
 	if (res < 0) {
-      perror("bind UDP socket for simptcp failed");
+      SIMPTCP_LOG(SIMPTCP_LOG_ERR, "bind UDP socket for simptcp failed: %s\n",
+		  strerror(errno));
       return res;
 	}    
+	/* adresse et port effectivement attribues (port libre si 0), pour la
+	   capture pcap */
+	slen = sizeof(simptcp_entity.local_udp);
+	libc_getsockname(simptcp_entity.udp_fd, (struct sockaddr *) &simptcp_entity.local_udp, &slen);
 	simptcp_entity.simptcp_socket_list=NULL;
 	simptcp_entity.simptcp_socket_states=&(simptcp_socket_states);
 	simptcp_entity.open_simptcp_connections=0;
 	simptcp_entity.open_simptcp_sockets=0;
-	memset(simptcp_entity.in_buffer, 0,MAX_SIMPTCP_BUFFER_SIZE);   
-    
+	/* les verrous des sockets de la reserve sont initialises une fois pour
+	   toutes : un socket repris n'est que remis a zero (#init_simptcp_socket) */
+	for (i = 0; i < MAX_OPEN_SOCK; i++)
+	  pthread_mutex_init(&(simptcp_entity.socket_pool[i].mutex_socket), NULL);
+	memset(simptcp_entity.rx_pool_refs, 0, sizeof(simptcp_entity.rx_pool_refs));
+	simptcp_entity.in_buffer = simptcp_rx_buffer_get();
+	simptcp_stat_init();
+	simptcp_metrics_init();
+
+	return 0;
+}
+
+/*!
+ * \fn int start_simptcp(int local_udp)
+ * \brief initialise simptcp control block (#init_simptcp) et lance 
+ * le handler #simptcp_entity_handler
+ * \param local_udp numero de port udp utilise par simpTCP.
+ * Valeur fixee par #DEFAULT_LOCAL_UDP_PORT
+ * \return -1 si echec (avec errno positionne), 0 sinon. 
+ */
+int start_simptcp(int local_udp)
+{    
+  int res = -1;
+  
+  SIMPTCP_TRACE_CALL();
+	res = init_simptcp(local_udp);
+	if (res < 0)
+	  return res;
     
 	/* launch a separate process that will execute simptcp_handler in parallel
 	 * to the main program (client/server)
@@ -185,7 +373,8 @@ int start_simptcp(int local_udp)
 	res = pthread_create(&(simptcp_entity.simptcp_handler), NULL, 
 			     simptcp_entity_handler, NULL);
 	if (res < 0) {
-	  perror("Unable to create core handler");
+	  SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Unable to create core handler: %s\n",
+		      strerror(res));
 	  return -1;
 	} 
     
@@ -217,9 +406,7 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
   int fd; /* simtcp socket descriptor */
   int slen=sizeof(struct sockaddr_in);
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif 
+    SIMPTCP_TRACE_CALL();
 
  /* set the sockaddr of the remote simptcp socket 
     from which the packet originates*/
@@ -237,14 +424,15 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
     {
       if ((sock=simptcp_entity.simptcp_socket_descriptors[fd]) != NULL)
 	{ /* this is an open socket ..*/
+	  /* a closed socket waiting to be released has no connection any
+	     more: its port may be used again by the peer */
 	  if (sock->local_simptcp.sin_port == dport
 	      && sock->remote_simptcp.sin_addr.s_addr == simptcp_remote.sin_addr.s_addr
-	     && sock->remote_simptcp.sin_port == simptcp_remote.sin_port)
+	     && sock->remote_simptcp.sin_port == simptcp_remote.sin_port
+	      && sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed))
 	    { /* this is the fetched socket */
-#if __DEBUG__
-	      printf("Delivering packet to socket fd %u at state %s\n",
-		     fd, simptcp_socket_state_get_str(sock->socket_state));
-#endif
+	      SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "Delivering packet to socket fd %u at state %s\n",
+			  fd, simptcp_socket_state_get_str(sock->socket_state));
 	      return fd;
 	    } 
 	}
@@ -257,10 +445,8 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
 	  if ((sock->local_simptcp.sin_port == dport)
 	      && (sock->socket_type == listening_server))
 	    { /* this is the fetched listening socket */
-#if __DEBUG__
-	      printf("Delivering packet to socket fd %u at state %s\n",
-		     fd, simptcp_socket_state_get_str(sock->socket_state));
-#endif
+	      SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "Delivering packet to socket fd %u at state %s\n",
+			  fd, simptcp_socket_state_get_str(sock->socket_state));
 	      /* for a listening socket an additionnal work is needed :
 		 save the remote udp/simpTCP addresses; they will be used
 		 when processing the received pdu
@@ -276,9 +462,7 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
 	}
     }
   /* No match found */
-#if __DEBUG__
-  printf("No Match found \n");
-#endif
+  SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "No Match found \n");
  return -1; 
 }
 
@@ -0,0 +1,72 @@
+/*
+ * simptcp_hist.c
+ */
+
+#include <simptcp_hist.h>
+
+
+/* smallest value of a bucket */
+u_int32_t simptcp_hist_lowest (int bucket)
+{
+    int msb;
+
+    if (bucket < SIMPTCP_HIST_SUB)
+        return bucket;
+    msb = (bucket >> SIMPTCP_HIST_SUB_BITS) + SIMPTCP_HIST_SUB_BITS - 1;
+    return (u_int32_t) (SIMPTCP_HIST_SUB + (bucket & (SIMPTCP_HIST_SUB - 1)))
+        << (msb - SIMPTCP_HIST_SUB_BITS);
+}
+
+/* largest value of a bucket */
+u_int32_t simptcp_hist_highest (int bucket)
+{
+    int msb;
+
+    if (bucket < SIMPTCP_HIST_SUB)
+        return bucket;
+    msb = (bucket >> SIMPTCP_HIST_SUB_BITS) + SIMPTCP_HIST_SUB_BITS - 1;
+    return simptcp_hist_lowest(bucket) + ((1u << (msb - SIMPTCP_HIST_SUB_BITS)) - 1);
+}
+
+/* value under which p percent of the values fall (the top of their bucket,
+ * at most the largest value); 0 if the histogram is empty
+ */
+u_int32_t simptcp_hist_percentile (const simptcp_hist *h, double p)
+{
+    u_int64_t total = 0, rank, seen = 0;
+    u_int32_t v;
+    int b;
+
+    for (b = 0; b < SIMPTCP_HIST_BUCKETS; b++)
+        total += h->buckets[b];
+    if (total == 0)
+        return 0;
+
+    rank = (u_int64_t) (p / 100.0 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+    for (b = 0; b < SIMPTCP_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+    v = simptcp_hist_highest(b);
+    return (v > h->max) ? h->max : v;
+}
+
+/* adds the values of src to dst */
+void simptcp_hist_merge (simptcp_hist *dst, const simptcp_hist *src)
+{
+    int b;
+
+    for (b = 0; b < SIMPTCP_HIST_BUCKETS; b++)
+        dst->buckets[b] += src->buckets[b];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
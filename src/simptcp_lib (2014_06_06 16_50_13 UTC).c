@@ -9,24 +9,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>             /* for offsetof() */
 #include <errno.h>              /* for errno macros */
 #include <sys/socket.h>
 #include <netinet/in.h>         /* for htons,.. */
 #include <arpa/inet.h>
 #include <unistd.h>             /* for usleep() */
 #include <sys/time.h>           /* for gettimeofday,..*/
+#include <sys/uio.h>            /* for struct iovec */
 
 #include <libc_socket.h>
 #include <simptcp_packet.h>
+#include <simptcp_csum.h>         /* for simptcp_csum_copy() */
 #include <simptcp_entity.h>
+#include <simptcp_api.h>        /* for SIMPTCP_NODELAY,.. */
+#include <simptcp_trace.h>      /* for SIMPTCP_TRACE() */
+#include <simptcp_pcap.h>       /* for SIMPTCP_PCAP() */
+#include <simptcp_stat.h>       /* for SIMPTCP_STAT_INC() */
+#include <simptcp_probe.h>      /* for SIMPTCP_PROBE() */
 #include "simptcp_func_var.c"    /* for socket related functions' prototypes */
 #include <term_colors.h>        /* for color macros */
 #define __PREFIX__              "[" COLOR("SIMPTCP_LIB", BRIGHT_YELLOW) " ] "
 #include <term_io.h>
+#define __SUBSYS__              SIMPTCP_LOG_LIB
+#include <simptcp_log.h>       /* for SIMPTCP_LOG() */
 
-#ifndef __DEBUG__
-#define __DEBUG__               1
-#endif
 
 
 
@@ -64,6 +71,52 @@ char *  simptcp_socket_state_get_str(simptcp_socket_state_funcs * state) {
         assert(0);
 }
 
+/*! \fn void simptcp_socket_set_state (struct simptcp_socket *sock, simptcp_socket_state_funcs *state)
+ * \brief fait passer un socket simpTCP dans un nouvel etat ; le changement 
+ * d'etat est enregistre dans la trace (#SIMPTCP_TRACE_STATE). Pour un client,
+ * le temps passe en SYNSENT avant l'etablissement est la duree du connect 
+ * (SIMPTCP_HIST_CONNECT)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param state nouvel etat, un des champs de simptcp_socket_states
+ */
+void simptcp_socket_set_state (struct simptcp_socket *sock, simptcp_socket_state_funcs *state)
+{
+    simptcp_socket_state_funcs *states = (simptcp_socket_state_funcs *) &simptcp_socket_states;
+
+    struct timeval t0;
+    long long us;
+
+    SIMPTCP_TRACE(SIMPTCP_TRACE_STATE, ntohs(sock->local_simptcp.sin_port), 0,
+                  sock->socket_state - states, state - states, 0, 0, 0, 0);
+    SIMPTCP_PROBE4(state, sock, ntohs(sock->local_simptcp.sin_port),
+                   sock->socket_state - states, state - states);
+
+    /* temps passe dans l'etat quitte (SIMPTCP_INFO) */
+    gettimeofday(&t0, NULL);
+    us = (t0.tv_sec - sock->state_since.tv_sec) * 1000000LL +
+        (t0.tv_usec - sock->state_since.tv_usec);
+    sock->state_time_us[sock->socket_state - states] += us;
+    sock->state_since = t0;
+
+    if ((sock->socket_type == client) &&
+        (sock->socket_state == & simptcp_socket_states.synsent) &&
+        (state == & simptcp_socket_states.established))
+        simptcp_latency_record(sock, SIMPTCP_HIST_CONNECT, us);
+
+    sock->socket_state = state;
+}
+
+/*! \fn int simptcp_socket_state_index (simptcp_socket_state_funcs *state)
+ * \brief numero d'un etat, dans l'ordre des champs de simptcp_socket_states
+ * (CLOSED = 0 .. TIMEWAIT = SIMPTCP_NB_STATES - 1)
+ * \param state un des champs de simptcp_socket_states
+ * \return le numero de l'etat
+ */
+int simptcp_socket_state_index (simptcp_socket_state_funcs *state)
+{
+    return state - (simptcp_socket_state_funcs *) &simptcp_socket_states;
+}
+
 /**
  * \brief called at socket creation 
  * \return the first sequence number to be used by the socket
@@ -72,25 +125,22 @@ char *  simptcp_socket_state_get_str(simptcp_socket_state_funcs * state) {
 unsigned int get_initial_seq_num()
 {
     unsigned int init_seq_num=15; 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     return init_seq_num;
 }
 
 
 /*!
- * \brief Initialise les champs de la structure #simptcp_socket
+ * \brief Initialise les champs de la structure #simptcp_socket, sous son 
+ * verrou : celui-ci a ete initialise avec la reserve de sockets (#init_simptcp)
  * \param sock pointeur sur la structure simptcp_socket associee a un socket simpTCP 
  * \param lport numero de port associe au socket simptcp local 
  */
 void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     assert(sock != NULL);
     lock_simptcp_socket(sock);
@@ -100,6 +150,7 @@ void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
     sock->socket_type = unknown;
     sock->new_conn_req=NULL;
     sock->pending_conn_req=0;
+    sock->orphan=0;
 
     /* set simpctp local socket address */
     memset(&(sock->local_simptcp), 0, sizeof (struct sockaddr));
@@ -113,25 +164,70 @@ void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
     sock->socket_state = &(simptcp_entity.simptcp_socket_states->closed);
 
     /* protocol entity sending side */
-    sock->socket_state_sender=-1; 
+    sock->socket_state_sender=wait_message; 
     sock->next_seq_num=get_initial_seq_num();
-    memset(sock->out_buffer, 0, SIMPTCP_SOCKET_MAX_BUFFER_SIZE);   
+    memset(sock->out_buffer, 0, SIMPTCP_SOCKET_MAX_HEADER_SIZE);   
+    sock->out_data=NULL;
     sock->out_len=0;
+    sock->out_sum=0;
+    sock->out_summed=0;
+    sock->hdr_template_len=0;
+    sock->hdr_template_sum=0;
+    sock->snd_cur=0;
+    sock->snd_len=0;
+    sock->snd_sum=0;
+    sock->nodelay=0;
+    sock->cork=0;
+    sock->mss=SIMPTCP_MAX_SIZE;
+    sock->crc32c_wanted=0;
+    sock->crc32c=0;
     sock->nbr_retransmit=0;
-    sock->timer_duration=1500;
+    sock->timer_duration=SIMPTCP_RTO_INITIAL;
+    sock->srtt_us=0;
+    sock->rttvar_us=0;
+    sock->rtt_timing=0;
+    sock->ack_timing=0;
+    sock->timeout.tv_sec=0;
+    sock->timeout.tv_usec=0;
     /* protocol entity receiving side */
     sock->socket_state_receiver=-1;
     sock->next_ack_num=0;
-    memset(sock->in_buffer, 0, SIMPTCP_SOCKET_MAX_BUFFER_SIZE);   
+    sock->in_queue_head=0;
+    sock->in_queue_count=0;
+    sock->in_pdu=NULL;
     sock->in_len=0;
+    sock->in_off=0;
+    sock->in_loaned=0;
+    sock->ucopy_buf=NULL;
+    sock->ucopy_len=0;
+    sock->ucopy_filled=0;
+    sock->ucopy_done=0;
+    memset(sock->ack_buffer, 0, SIMPTCP_SOCKET_MAX_HEADER_SIZE);
+    sock->ack_pending=0;
+    sock->ack_pending_full=0;
+    sock->ack_held=0;
+    sock->quickack=0;
+    sock->delack_pingpong=0;
+    sock->delack_timeout.tv_sec=0;
+    sock->delack_timeout.tv_usec=0;
+    sock->last_data_in.tv_sec=0;
+    sock->last_data_in.tv_usec=0;
+    sock->in_arrival.tv_sec=0;
+    sock->in_arrival.tv_usec=0;
 
     /* MIB statistics initialisation  */
     sock->simptcp_send_count=0; 
     sock->simptcp_receive_count=0; 
     sock->simptcp_in_errors_count=0; 
+    sock->prediction_hits=0;
+    sock->prediction_misses=0;
     sock->simptcp_retransmit_count=0; 
-
-    pthread_mutex_init(&(sock->mutex_socket), NULL);
+    sock->bytes_sent=0;
+    sock->bytes_retrans=0;
+    sock->bytes_received=0;
+    memset(sock->state_time_us, 0, sizeof(sock->state_time_us));
+    gettimeofday(&(sock->state_since), NULL);
+    memset(sock->latency, 0, sizeof(sock->latency));
 
     /* Add Optional field initialisations */
     unlock_simptcp_socket(sock);
@@ -142,41 +238,157 @@ void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
 
 /*! \fn int create_simptcp_socket()
  * \brief cree un nouveau socket SimpTCP et l'initialise. 
- * parcourt la table de  descripteur a la recheche d'une entree libre. S'il en trouve, cree
- * une nouvelle instance de la structure simpTCP, la rattache a la table de descrpteurs et l'initialise. 
+ * parcourt la table de  descripteur a la recheche d'une entree libre. S'il en trouve, 
+ * y rattache la structure simptcp_socket de la reserve de l'entite (socket_pool) qui 
+ * correspond a ce descripteur et l'initialise. S'il n'y en a pas, reprend le descripteur
+ * d'un socket ferme par l'application qui est encore en timewait (#release_simptcp_socket)
  * \return descripteur du socket simpTCP cree ou une erreur en cas d'echec
  */
 int create_simptcp_socket()
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    int fd;
-
-    /* get a free simptcp socket descriptor */
-    for (fd=0;fd< MAX_OPEN_SOCK;fd++) {
-        if ((simptcp_entity.simptcp_socket_descriptors[fd]) == NULL){ 
-            /* this is a free descriptor */
-            /* Allocating memory for the new simptcp_socket */
-            simptcp_entity.simptcp_socket_descriptors[fd] = 
-                (struct simptcp_socket *) malloc(sizeof(struct simptcp_socket));
-            if (!simptcp_entity.simptcp_socket_descriptors[fd]) {
-                return -ENOMEM;
+    SIMPTCP_TRACE_CALL();
+    int fd, pass;
+
+    /* get a free simptcp socket descriptor; the application and the entity
+       (listening sockets) may look for one at the same time */
+    for (pass=0;pass<2;pass++) {
+        for (fd=0;fd< MAX_OPEN_SOCK;fd++) {
+            /* second pass: take over a closed socket in timewait */
+            if ((pass == 1) && (release_simptcp_socket(fd, 1) == -1))
+                continue;
+            if (__sync_bool_compare_and_swap(&(simptcp_entity.simptcp_socket_descriptors[fd]),
+                                             NULL, &(simptcp_entity.socket_pool[fd]))) {
+                /* initialize the simptcp socket control block with
+                   local port number set to 15000+fd */
+                init_simptcp_socket(simptcp_entity.simptcp_socket_descriptors[fd],15000+fd);
+                __sync_fetch_and_add(&(simptcp_entity.open_simptcp_sockets), 1);
+
+                /* return the socket descriptor */
+                return fd;
             }
-            /* initialize the simptcp socket control block with
-               local port number set to 15000+fd */
-            init_simptcp_socket(simptcp_entity.simptcp_socket_descriptors[fd],15000+fd);
-            simptcp_entity.open_simptcp_sockets++;
-
-            /* return the socket descriptor */
-            return fd;
-        }
-    } /* for */
+        } /* for */
+    }
     /* The maximum number of open simptcp
        socket reached  */
     return -ENFILE; 
 }
 
+/*! \fn void orphan_simptcp_socket(int fd)
+ * \brief appelee par close, une fois la connexion fermee (shutdown) : le socket
+ * n'appartient plus a l'application. Son descripteur est libere tout de suite si
+ * le socket est ferme ; en timewait, il l'est a la fin du timewait par l'entite
+ * ou par #create_simptcp_socket. Un socket d'ecoute cesse d'ecouter, et les 
+ * demandes de connexion qu'il n'a pas acceptees sont abandonnees
+ * \param fd descripteur du socket simpTCP
+ */
+void orphan_simptcp_socket(int fd)
+{
+    struct simptcp_socket *sock = simptcp_entity.simptcp_socket_descriptors[fd];
+
+    SIMPTCP_TRACE_CALL();
+
+    lock_simptcp_socket(sock);
+    if (sock->socket_type == listening_server) {
+        while (sock->pending_conn_req > 0)
+            sock->new_conn_req[--sock->pending_conn_req]->orphan = 1;
+    }
+    /* connexion terminee ou abandonnee, ou socket jamais connecte */
+    if (sock->socket_state != & simptcp_socket_states.timewait) {
+        stop_timer(sock);
+        stop_delack_timer(sock);
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+    }
+    sock->orphan = 1;
+    unlock_simptcp_socket(sock);
+
+    release_simptcp_socket(fd, 0);
+}
+
+/*! \fn void rx_queue_push (struct simptcp_socket* sock, char* buf, int len)
+ * \brief place par reference (sans recopie) un PDU recu en fin de la file de
+ * reception du socket. Le socket doit etre verrouille et la file non pleine
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param buf PDU recu, dans la reserve de reception de l'entite
+ * \param len taille du datagramme recu
+ */
+static void rx_queue_push (struct simptcp_socket* sock, char* buf, int len)
+{
+    unsigned int i = (sock->in_queue_head + sock->in_queue_count) % SIMPTCP_RX_QUEUE_LEN;
+
+    simptcp_rx_buffer_hold(buf);
+    sock->in_queue[i] = buf;
+    sock->in_queue_len[i] = len;
+    sock->in_queue_arrival[i] = simptcp_entity.in_time;
+    if (sock->in_queue_count++ == 0) {
+        sock->in_len = len;
+        sock->in_off = 0;
+        sock->in_arrival = simptcp_entity.in_time;
+        sock->in_pdu = buf;
+    }
+}
+
+/*! \fn void rx_queue_pop (struct simptcp_socket* sock)
+ * \brief rend a l'entite le PDU en tete de la file de reception (in_pdu), 
+ * entierement lu, et passe au suivant. Le socket doit etre verrouille
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+static void rx_queue_pop (struct simptcp_socket* sock)
+{
+    simptcp_rx_buffer_put(sock->in_pdu);
+    sock->in_queue_head = (sock->in_queue_head + 1) % SIMPTCP_RX_QUEUE_LEN;
+    sock->in_off = 0;
+    if (--sock->in_queue_count > 0) {
+        sock->in_len = sock->in_queue_len[sock->in_queue_head];
+        sock->in_arrival = sock->in_queue_arrival[sock->in_queue_head];
+        sock->in_pdu = sock->in_queue[sock->in_queue_head];
+    }
+    else {
+        sock->in_len = 0;
+        sock->in_pdu = NULL;
+    }
+}
+
+/*! \fn int release_simptcp_socket(int fd, int reuse)
+ * \brief libere le descripteur d'un socket ferme par l'application 
+ * (#orphan_simptcp_socket) dont la connexion est terminee. Les PDU recus que 
+ * le socket detenait sont rendus a l'entite. La structure simptcp_socket reste dans
+ * la reserve de l'entite, pour le prochain socket du meme descripteur
+ * \param fd descripteur du socket simpTCP
+ * \param reuse 1 si un nouveau socket a besoin du descripteur : un socket en 
+ * timewait est alors libere aussi
+ * \return 0 si le descripteur a ete libere, -1 sinon
+ */
+int release_simptcp_socket(int fd, int reuse)
+{
+    struct simptcp_socket *sock = simptcp_entity.simptcp_socket_descriptors[fd];
+
+    if (sock == NULL)
+        return -1;
+
+    lock_simptcp_socket(sock);
+    if (!sock->orphan ||
+        ((sock->socket_state != & simptcp_socket_states.closed) &&
+         (!reuse || (sock->socket_state != & simptcp_socket_states.timewait)))) {
+        unlock_simptcp_socket(sock);
+        return -1;
+    }
+    sock->orphan = 0;
+    stop_timer(sock);
+    stop_delack_timer(sock);
+    if (sock->socket_state != & simptcp_socket_states.closed)
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+    while (sock->in_pdu != NULL)
+        rx_queue_pop(sock);
+    sock->in_loaned = 0;
+    free(sock->new_conn_req);
+    sock->new_conn_req = NULL;
+    simptcp_entity.simptcp_socket_descriptors[fd] = NULL;
+    __sync_fetch_and_sub(&(simptcp_entity.open_simptcp_sockets), 1);
+    unlock_simptcp_socket(sock);
+
+    return 0;
+}
+
 /*! \fn void print_simptcp_socket(struct simptcp_socket *sock)
  * \brief affiche sur la sortie standard les variables d'etat associees a un socket simpTCP 
  * Les valeurs des principaux champs de la structure simptcp_socket d'un socket est affichee a l'ecran
@@ -206,6 +418,8 @@ void print_simptcp_socket(struct simptcp_socket *sock)
     printf("receive count       : %lu\n", sock->simptcp_receive_count);
     printf("receive error count       : %lu\n", sock->simptcp_in_errors_count);
     printf("retransmit count       : %lu\n", sock->simptcp_retransmit_count);
+    printf("header prediction       : %lu hits, %lu misses\n", 
+           sock->prediction_hits, sock->prediction_misses);
     printf("----------------------------------------\n");
 }
 
@@ -252,6 +466,40 @@ inline int unlock_simptcp_socket(struct simptcp_socket *sock)
     return pthread_mutex_unlock(&(sock->mutex_socket));
 }
 
+/*! \fn static void set_deadline(struct timeval * deadline, int duration)
+ * \brief fixe l'instant ou la duree "duration" sera ecoulee. Les microsecondes
+ * sont normalisees pour que la comparaison faite par #deadline_passed soit 
+ * exacte (sinon un timer court pouvait expirer jusqu'a une seconde trop tard)
+ * \param deadline instant a fixer
+ * \param duration duree a mesurer en ms
+ */
+static void set_deadline(struct timeval * deadline, int duration)
+{
+    struct timeval t0;
+
+    gettimeofday(&t0,NULL);
+
+    deadline->tv_sec=t0.tv_sec + (duration/1000);
+    deadline->tv_usec=t0.tv_usec + (duration %1000)*1000;
+    if (deadline->tv_usec >= 1000000) {
+        deadline->tv_sec++;
+        deadline->tv_usec -= 1000000;
+    }
+}
+
+/*! \fn static int deadline_passed(const struct timeval * deadline)
+ * \brief indique si l'instant "deadline" est depasse
+ * \return 1 si l'instant est depasse, 0 sinon
+ */
+static int deadline_passed(const struct timeval * deadline)
+{
+    struct timeval t0;
+
+    gettimeofday(&t0,NULL);
+    return ((deadline->tv_sec < t0.tv_sec) || 
+            ( (deadline->tv_sec == t0.tv_sec) && (deadline->tv_usec < t0.tv_usec)));
+}
+
 /*! \fn void start_timer(struct simptcp_socket * sock, int duration)
  * \brief lance le timer associe au socket en fixant l'instant ou la duree a mesurer "duration" sera ecoulee (champ "timeout" de #simptcp_socket)
  * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
@@ -259,16 +507,12 @@ inline int unlock_simptcp_socket(struct simptcp_socket *sock)
  */
 void start_timer(struct simptcp_socket * sock, int duration)
 {
-    struct timeval t0;
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     assert(sock!=NULL);
 
-    gettimeofday(&t0,NULL);
-
-    sock->timeout.tv_sec=t0.tv_sec + (duration/1000);
-    sock->timeout.tv_usec=t0.tv_usec + (duration %1000)*1000;  
+    SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_ARM, ntohs(sock->local_simptcp.sin_port), duration,
+                  SIMPTCP_TRACE_RTX_TIMER, 0, 0, 0, 0, 0);
+    set_deadline(&(sock->timeout), duration);
 }
 
 /*! \fn void stop_timer(struct simptcp_socket * sock)
@@ -277,10 +521,11 @@ void start_timer(struct simptcp_socket * sock, int duration)
  */
 void stop_timer(struct simptcp_socket * sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif  
+    SIMPTCP_TRACE_CALL();
     assert(sock!=NULL);
+    if (has_active_timer(sock))
+        SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_STOP, ntohs(sock->local_simptcp.sin_port), 0,
+                      SIMPTCP_TRACE_RTX_TIMER, 0, 0, 0, 0, 0);
     sock->timeout.tv_sec=0;
     sock->timeout.tv_usec=0; 
 }
@@ -295,60 +540,920 @@ int has_active_timer(struct simptcp_socket * sock)
     return (sock->timeout.tv_sec!=0) || (sock->timeout.tv_usec!=0);
 }
 
-/*! \fn int is_timeout(struct simptcp_socket * sock)
- * \brief Indique si la duree mesuree par le timer associe a un socket simpTCP est actifs'est ecoulee ou pas
- * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
- * \return 1 si duree ecoulee, 0 sinon
+/*! \fn int is_timeout(struct simptcp_socket * sock)
+ * \brief Indique si la duree mesuree par le timer associe a un socket simpTCP est actifs'est ecoulee ou pas
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 1 si duree ecoulee, 0 sinon
+ */
+int is_timeout(struct simptcp_socket * sock)
+{
+    assert(sock!=NULL);
+    /* make sure that the timer is launched */
+    assert(has_active_timer(sock));
+
+    return deadline_passed(&(sock->timeout));
+}
+
+/*! \fn void rtt_start(struct simptcp_socket * sock)
+ * \brief commence la mesure du temps d'aller-retour du PDU emis pour la 
+ * premiere fois (le timer de retransmission doit etre lance avec le RTO,
+ * champ timer_duration)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void rtt_start(struct simptcp_socket * sock)
+{
+    gettimeofday(&(sock->rtt_sent), NULL);
+    sock->rtt_timing = 1;
+    sock->ack_timing = 1;
+}
+
+/*! \fn void rtt_ack(struct simptcp_socket * sock)
+ * \brief termine la mesure a la reception de l'acquittement du PDU et en 
+ * deduit SRTT, RTTVAR et le RTO [RFC 6298]. Un PDU retransmis ne donne 
+ * aucune mesure (algorithme de Karn) : le RTO double reste alors en vigueur.
+ * Le delai depuis la premiere emission, retransmissions comprises, est
+ * enregistre (SIMPTCP_HIST_SEND_ACK)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void rtt_ack(struct simptcp_socket * sock)
+{
+    struct timeval t0;
+    unsigned int r, delta, rto;
+
+    if (!sock->ack_timing)
+        return;
+    sock->ack_timing = 0;
+
+    gettimeofday(&t0, NULL);
+    r = (t0.tv_sec - sock->rtt_sent.tv_sec) * 1000000 +
+        (t0.tv_usec - sock->rtt_sent.tv_usec);
+    simptcp_latency_record(sock, SIMPTCP_HIST_SEND_ACK, r);
+
+    if (!sock->rtt_timing)
+        return;
+    sock->rtt_timing = 0;
+    if (r == 0)
+        r = 1;
+
+    if (sock->srtt_us == 0) {
+        sock->srtt_us = r;
+        sock->rttvar_us = r / 2;
+    }
+    else {
+        delta = (sock->srtt_us > r) ? sock->srtt_us - r : r - sock->srtt_us;
+        sock->rttvar_us = (3 * sock->rttvar_us + delta) / 4;
+        sock->srtt_us = (7 * sock->srtt_us + r) / 8;
+    }
+
+    /* RTO = SRTT + max(G, 4 RTTVAR), G granularite de 1 ms */
+    rto = (sock->srtt_us + ((4 * sock->rttvar_us > 1000) ? 4 * sock->rttvar_us : 1000)
+           + 999) / 1000;
+    if (rto < SIMPTCP_RTO_MIN)
+        rto = SIMPTCP_RTO_MIN;
+    if (rto > SIMPTCP_RTO_MAX)
+        rto = SIMPTCP_RTO_MAX;
+    sock->timer_duration = rto;
+}
+
+/*! \fn void retransmit_pdu(struct simptcp_socket * sock)
+ * \brief reemet le PDU en attente d'acquittement (out_buffer) et relance le
+ * timer avec un RTO double (jusqu'a SIMPTCP_RTO_MAX)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void retransmit_pdu(struct simptcp_socket * sock)
+{
+    sock->simptcp_retransmit_count++;
+    sock->bytes_retrans += sock->out_len - simptcp_get_head_len(sock->out_buffer);
+    sock->rtt_timing = 0;
+    sock->timer_duration *= 2;
+    if (sock->timer_duration > SIMPTCP_RTO_MAX)
+        sock->timer_duration = SIMPTCP_RTO_MAX;
+    SIMPTCP_PROBE4(retransmit, sock, ntohs(sock->local_simptcp.sin_port),
+                   sock->simptcp_retransmit_count, sock->timer_duration);
+
+    send_pdu(sock);
+    start_timer(sock, sock->timer_duration);
+}
+
+/*! \fn void simptcp_latency_record(struct simptcp_socket * sock, int hist, long long us)
+ * \brief enregistre une latence dans l'histogramme "hist" du socket 
+ * (SIMPTCP_LATENCY) et dans celui de l'entite (simptcp_stat). Chaque 
+ * histogramme n'a qu'un ecrivain : ni verrou ni allocation
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param hist SIMPTCP_HIST_CONNECT, SIMPTCP_HIST_SEND_ACK, 
+ * SIMPTCP_HIST_RECV_WAKEUP ou SIMPTCP_HIST_TIMER_LATE
+ * \param us latence en us
+ */
+void simptcp_latency_record(struct simptcp_socket * sock, int hist, long long us)
+{
+    simptcp_hist_record(&(sock->latency[hist]), us);
+    simptcp_stat_latency(hist, us);
+}
+
+/*! \fn void start_delack_timer(struct simptcp_socket * sock, int duration)
+ * \brief lance le timer d'acquittement differe du socket (champ "delack_timeout" de #simptcp_socket)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param duration duree a mesurer en ms
+ */
+void start_delack_timer(struct simptcp_socket * sock, int duration)
+{
+    assert(sock!=NULL);
+    SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_ARM, ntohs(sock->local_simptcp.sin_port), duration,
+                  SIMPTCP_TRACE_DELACK_TIMER, 0, 0, 0, 0, 0);
+    set_deadline(&(sock->delack_timeout), duration);
+}
+
+/*! \fn void stop_delack_timer(struct simptcp_socket * sock)
+ * \brief stoppe le timer d'acquittement differe du socket
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void stop_delack_timer(struct simptcp_socket * sock)
+{
+    assert(sock!=NULL);
+    if (has_active_delack_timer(sock))
+        SIMPTCP_TRACE(SIMPTCP_TRACE_TIMER_STOP, ntohs(sock->local_simptcp.sin_port), 0,
+                      SIMPTCP_TRACE_DELACK_TIMER, 0, 0, 0, 0, 0);
+    sock->delack_timeout.tv_sec=0;
+    sock->delack_timeout.tv_usec=0;
+}
+
+/*! \fn int has_active_delack_timer(struct simptcp_socket * sock)
+ * \brief Indique si un acquittement differe est en attente d'emission
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 1 si timer actif, 0 sinon
+ */
+int has_active_delack_timer(struct simptcp_socket * sock)
+{
+    return (sock->delack_timeout.tv_sec!=0) || (sock->delack_timeout.tv_usec!=0);
+}
+
+/*! \fn int is_delack_timeout(struct simptcp_socket * sock)
+ * \brief Indique si le delai d'acquittement differe est ecoule
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 1 si duree ecoulee, 0 sinon
+ */
+int is_delack_timeout(struct simptcp_socket * sock)
+{
+    assert(sock!=NULL);
+    assert(has_active_delack_timer(sock));
+
+    return deadline_passed(&(sock->delack_timeout));
+}
+
+
+/*! \fn void enable_crc32c (struct simptcp_socket * socket)
+ * \brief passe la connexion en mode CRC32C (negocie pendant le handshake) :
+ * chaque PDU porte l'option CRC32C, la charge utile maximale diminue d'autant
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void enable_crc32c (struct simptcp_socket * socket)
+{
+    socket->crc32c = 1;
+    socket->mss = SIMPTCP_MAX_SIZE - SIMPTCP_CRC32C_LEN;
+}
+
+/*! \fn unsigned char put_options (struct simptcp_socket * socket, char * header, unsigned char flags)
+ * \brief ecrit a la suite de l'en-tete generique les options du PDU : 
+ * l'option CRC32C sans valeur dans les SYN (proposition du client, 
+ * acceptation du serveur), avec le CRC dans les autres PDU d'une connexion 
+ * en mode CRC32C. Le champ header_len est mis a jour
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param header en-tete du PDU en construction
+ * \param flags flags du PDU
+ * \return taille de l'en-tete, options comprises
+ */
+unsigned char put_options (struct simptcp_socket * socket, char * header, unsigned char flags)
+{
+    simptcp_set_head_len(header, SIMPTCP_GHEADER_SIZE);
+
+    if (flags & SYN) {
+        if ((flags & ACK) ? socket->crc32c : socket->crc32c_wanted)
+            simptcp_put_option(header, SIMPTCP_SOCKET_MAX_HEADER_SIZE, SIMPTCP_CRC32C_OPTION,
+                               NULL, SIMPTCP_CRC32C_PERMITTED_LEN - sizeof(simptcp_option_header));
+    }
+    else if (socket->crc32c)
+        simptcp_put_option(header, SIMPTCP_SOCKET_MAX_HEADER_SIZE, SIMPTCP_CRC32C_OPTION,
+                           NULL, SIMPTCP_CRC32C_LEN - sizeof(simptcp_option_header));
+    return simptcp_get_head_len(header);
+}
+
+/*! \fn static int pdu_has_crc32c (struct simptcp_socket * socket, const char * header)
+ * \brief indique si un PDU de la connexion est protege par CRC32C : c'est le 
+ * cas de tous les PDU d'une connexion en mode CRC32C, sauf les SYN qui ne 
+ * portent que la proposition de l'option (cf. #put_options)
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param header en-tete du PDU
+ * \return 1 si CRC32C, 0 si checksum
+ */
+static int pdu_has_crc32c (struct simptcp_socket * socket, const char * header)
+{
+    return socket->crc32c && !(simptcp_get_flags(header) & SYN);
+}
+
+/*! \fn void seal_pdu (struct simptcp_socket * socket, char * header, const char * data, size_t dlen)
+ * \brief calcule le code de controle d'un PDU dont l'en-tete est complet : 
+ * CRC32C si la connexion est en mode CRC32C (hors SYN), checksum sinon
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param header en-tete du PDU
+ * \param data charge utile (peut etre NULL si dlen vaut 0)
+ * \param dlen taille de la charge utile
+ */
+void seal_pdu (struct simptcp_socket * socket, char * header, const char * data, size_t dlen)
+{
+    unsigned char hlen = simptcp_get_head_len(header);
+
+    if (pdu_has_crc32c(socket, header))
+        simptcp_add_crc32c(header, hlen, data, dlen);
+    else
+        simptcp_add_checksum_iov(header, hlen, data, dlen);
+}
+
+/*! \fn void set_header_word (struct simptcp_socket * socket, char * header, int offset, u_int16_t value, const char * data, size_t dlen)
+ * \brief modifie un champ de 16 bits de l'en-tete d'un PDU deja scelle : le 
+ * checksum est mis a jour de facon incrementale, sans relire la charge utile ;
+ * en mode CRC32C, le CRC est recalcule
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param header en-tete du PDU
+ * \param offset position du champ dans l'en-tete
+ * \param value nouvelle valeur (ordre hote)
+ * \param data charge utile du PDU
+ * \param dlen taille de la charge utile
+ */
+void set_header_word (struct simptcp_socket * socket, char * header, int offset,
+                      u_int16_t value, const char * data, size_t dlen)
+{
+    u_int16_t word = htons(value);
+
+    if (pdu_has_crc32c(socket, header)) {
+        memcpy(header + offset, &word, 2);
+        simptcp_add_crc32c(header, simptcp_get_head_len(header), data, dlen);
+    }
+    else
+        simptcp_replace_word16(header, offset, value);
+}
+
+/*! \fn void build_header_template (struct simptcp_socket * socket)
+ * \brief construit le modele d'en-tete de la connexion, une fois etablie : 
+ * ports, longueur d'en-tete, options et fenetre ne changent plus et sont 
+ * ecrits une fois pour toutes en ordre reseau, avec la somme partielle des 
+ * octets qui ne seront pas reecrits (tout sauf seq_num .. total_len). Les 
+ * numeros de sequence et d'acquittement, les flags, la longueur totale et le
+ * checksum y sont nuls
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void build_header_template (struct simptcp_socket * socket)
+{
+    char * t = socket->hdr_template;
+    unsigned char hlen;
+
+    memset(t, 0, SIMPTCP_SOCKET_MAX_HEADER_SIZE);
+    simptcp_set_sport(t, ntohs(socket->local_simptcp.sin_port));
+    simptcp_set_dport(t, ntohs(socket->remote_simptcp.sin_port));
+    hlen = put_options(socket, t, 0);
+    simptcp_set_head_len(t, hlen);
+    simptcp_set_win_size(t, 0);
+
+    socket->hdr_template_sum = 
+        simptcp_csum_partial(t + offsetof(simptcp_generic_header, window_size),
+                             hlen - offsetof(simptcp_generic_header, window_size),
+                             simptcp_csum_partial(t, offsetof(simptcp_generic_header, seq_num), 0));
+    socket->hdr_template_len = hlen;
+}
+
+/*! \fn void header_from_template (struct simptcp_socket * socket, char * header, unsigned char flags, const char * data, size_t dlen, u_int32_t data_sum)
+ * \brief construit l'en-tete d'un PDU par recopie du modele de la connexion :
+ * seuls seq_num, ack_num, flags et total_len sont ecrits, et le checksum est
+ * obtenu a partir de la somme du modele (ou le CRC32C calcule)
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param header en-tete a construire
+ * \param flags flags du PDU
+ * \param data charge utile (peut etre NULL si dlen vaut 0)
+ * \param dlen taille de la charge utile
+ * \param data_sum somme partielle de la charge utile (ignoree en mode CRC32C)
+ */
+void header_from_template (struct simptcp_socket * socket, char * header,
+                           unsigned char flags, const char * data, size_t dlen,
+                           u_int32_t data_sum)
+{
+    simptcp_generic_header * h = (simptcp_generic_header *) header;
+    unsigned char hlen = socket->hdr_template_len;
+    u_int32_t sum;
+
+    memcpy(header, socket->hdr_template, hlen);
+    h->seq_num = htons((u_int16_t) socket->next_seq_num);
+    h->ack_num = htons((u_int16_t) socket->next_ack_num);
+    h->flags = flags;
+    h->total_len = htons((u_int16_t) (hlen + dlen));
+
+    if (socket->crc32c) {
+        simptcp_add_crc32c(header, hlen, data, dlen);
+        return;
+    }
+    /* somme du modele + les 8 octets ecrits (seq_num .. total_len) */
+    sum = simptcp_csum_partial(&(h->seq_num), 8, socket->hdr_template_sum);
+    sum = simptcp_csum_block_add(sum, data_sum, hlen);
+    h->checksum = ~simptcp_csum_fold(sum);
+}
+
+int make_pdu (struct simptcp_socket * socket, char * message, size_t longueur_message, unsigned char flags) {
+    unsigned char hlen;
+
+    SIMPTCP_TRACE_CALL();
+
+    /* message */
+    if (longueur_message > socket->mss) {
+        return -1 ;
+    }
+
+    /* connexion etablie : l'en-tete est construit a partir du modele */
+    if ((socket->hdr_template_len > 0) && !(flags & SYN)) {
+        header_from_template(socket, socket->out_buffer, flags, message, longueur_message,
+                             socket->crc32c ? 0 :
+                             socket->out_summed ? socket->out_sum :
+                             simptcp_csum_partial(message, longueur_message, 0));
+        socket->out_summed = 0;
+        socket->out_len = socket->hdr_template_len + longueur_message;
+        socket->out_data = message;
+        if (SIMPTCP_LOG_ON_FOR(SIMPTCP_LOG_PACKET, SIMPTCP_LOG_DEBUG))
+            simptcp_print_packet_iov(socket->out_buffer, message) ;
+        return 0;
+    }
+
+    /* num port source */
+    simptcp_set_sport(socket->out_buffer, ntohs(socket->local_simptcp.sin_port));
+    /* num port dest */
+    simptcp_set_dport(socket->out_buffer, ntohs(socket->remote_simptcp.sin_port));	
+    /* sep_num */
+    simptcp_set_seq_num(socket->out_buffer, (u_int16_t)(socket->next_seq_num));
+    /* ack_num */
+    simptcp_set_ack_num(socket->out_buffer, (u_int16_t)(socket->next_ack_num));
+    /* header + options */
+    hlen = put_options(socket, socket->out_buffer, flags);
+    simptcp_set_head_len(socket->out_buffer, hlen) ;
+    /* flags */
+    simptcp_set_flags  (socket->out_buffer, flags);
+    /* total_len */
+    simptcp_set_total_len(socket->out_buffer, (u_int16_t)hlen+longueur_message);
+    socket->out_len = (u_int16_t)hlen+longueur_message;
+    /* window_size */
+    simptcp_set_win_size   (socket->out_buffer,0 );
+
+    /* la charge utile n'est pas recopiee derriere l'en-tete : elle est 
+       referencee dans le buffer de l'application et sera transmise
+       par send_pdu() */
+    socket->out_data = message;
+
+    /* checksum ou CRC32C ; la somme de la charge utile a pu etre calculee
+       lors de sa recopie dans le buffer d'emission */
+    if (socket->out_summed && !socket->crc32c)
+        simptcp_add_checksum_sum(socket->out_buffer, hlen, socket->out_sum);
+    else
+        seal_pdu (socket, socket->out_buffer, message, longueur_message);
+    socket->out_summed = 0;
+
+    /* affichage du PDU */
+    if (SIMPTCP_LOG_ON_FOR(SIMPTCP_LOG_PACKET, SIMPTCP_LOG_DEBUG))
+        simptcp_print_packet_iov(socket->out_buffer, message) ;
+
+    return 0 ;
+}
+
+/*! \fn ssize_t send_pdu (struct simptcp_socket * socket)
+ * \brief emet vers le socket UDP distant le PDU prepare par #make_pdu.
+ * L'en-tete (out_buffer) et la charge utile (out_data) sont passes au noyau
+ * sous forme de deux iovecs d'un meme datagramme : la charge utile est lue
+ * directement dans le buffer de l'application, sans recopie intermediaire.
+ * Le buffer de l'application reste valide tant que le PDU n'est pas acquitte
+ * puisque l'appel send est bloquant jusqu'a reception de l'acquittement.
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return nombre d'octets emis, -1 en cas d'erreur
+ */
+ssize_t send_pdu (struct simptcp_socket * socket)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    unsigned int hlen = simptcp_get_head_len(socket->out_buffer);
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov[0].iov_base = socket->out_buffer;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void *) socket->out_data;
+    iov[1].iov_len = socket->out_len - hlen;
+
+    msg.msg_name = &(socket->remote_udp);
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (iov[1].iov_len > 0) ? 2 : 1;
+
+    socket->simptcp_send_count++;
+    socket->bytes_sent += iov[1].iov_len;
+
+    SIMPTCP_TRACE_PDU(SIMPTCP_TRACE_PDU_SEND, ntohs(socket->local_simptcp.sin_port),
+                      socket->out_buffer, socket->out_len);
+    SIMPTCP_PCAP(&(simptcp_entity.local_udp), &(socket->remote_udp), iov, msg.msg_iovlen);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_DATAGRAMS);
+    n = libc_sendmsg(simptcp_entity.udp_fd, &msg, 0);
+    if (n == -1) {
+        SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_ERRORS);
+        SIMPTCP_PROBE4(send_error, socket, ntohs(socket->local_simptcp.sin_port),
+                       errno, socket->out_len);
+    }
+    return n;
+}
+
+/*! \fn ssize_t send_ack (struct simptcp_socket * socket)
+ * \brief construit dans ack_buffer et emet un acquittement pur (cumulatif) de
+ * tout ce qui a ete recu jusqu'a next_ack_num. out_buffer n'est pas modifie :
+ * le PDU de donnees en attente d'acquittement peut toujours etre retransmis.
+ * Une fois la connexion etablie, l'en-tete est construit a partir du modele
+ * de la connexion (#header_from_template).
+ * Les acquittements differes eventuellement en attente sont annules.
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return nombre d'octets emis, -1 en cas d'erreur
+ */
+ssize_t send_ack (struct simptcp_socket * socket)
+{
+    unsigned char hlen;
+    struct iovec iov;
+    ssize_t n;
+
+    if (socket->hdr_template_len > 0) {
+        hlen = socket->hdr_template_len;
+        header_from_template(socket, socket->ack_buffer, ACK, NULL, 0, 0);
+    }
+    else {
+        hlen = put_options(socket, socket->ack_buffer, ACK);
+        simptcp_set_sport(socket->ack_buffer, ntohs(socket->local_simptcp.sin_port));
+        simptcp_set_dport(socket->ack_buffer, ntohs(socket->remote_simptcp.sin_port));
+        simptcp_set_seq_num(socket->ack_buffer, (u_int16_t)(socket->next_seq_num));
+        simptcp_set_ack_num(socket->ack_buffer, (u_int16_t)(socket->next_ack_num));
+        simptcp_set_head_len(socket->ack_buffer, hlen);
+        simptcp_set_flags(socket->ack_buffer, ACK);
+        simptcp_set_total_len(socket->ack_buffer, hlen);
+        simptcp_set_win_size(socket->ack_buffer, 0);
+        seal_pdu(socket, socket->ack_buffer, NULL, 0);
+    }
+
+    if (SIMPTCP_LOG_ON_FOR(SIMPTCP_LOG_PACKET, SIMPTCP_LOG_DEBUG))
+        simptcp_print_packet(socket->ack_buffer);
+
+    socket->ack_pending = 0;
+    socket->ack_pending_full = 0;
+    socket->ack_held = 0;
+    stop_delack_timer(socket);
+    socket->simptcp_send_count++;
+
+    SIMPTCP_TRACE_PDU(SIMPTCP_TRACE_PDU_SEND, ntohs(socket->local_simptcp.sin_port),
+                      socket->ack_buffer, hlen);
+    if (simptcp_pcap_enabled) {
+        iov.iov_base = socket->ack_buffer;
+        iov.iov_len = hlen;
+        simptcp_pcap_capture(&(simptcp_entity.local_udp), &(socket->remote_udp), &iov, 1);
+    }
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_DATAGRAMS);
+    n = libc_sendto(simptcp_entity.udp_fd, socket->ack_buffer, hlen,
+                    0, (struct sockaddr *) &(socket->remote_udp), sizeof(struct sockaddr_in));
+    if (n == -1) {
+        SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_ERRORS);
+        SIMPTCP_PROBE4(send_error, socket, ntohs(socket->local_simptcp.sin_port),
+                       errno, hlen);
+    }
+    return n;
+}
+
+/*! \fn ssize_t send_rst (struct simptcp_socket * socket, u_int16_t seq, u_int16_t ack)
+ * \brief construit dans ack_buffer et emet un PDU RST vers le socket distant :
+ * la demande de connexion est refusee. Le PDU ne porte pas d'option et est
+ * protege par le checksum (aucun mode n'a ete negocie)
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param seq numero de sequence du RST
+ * \param ack numero d'acquittement du RST (le PDU suivant attendu du socket distant)
+ * \return nombre d'octets emis, -1 en cas d'erreur
+ */
+ssize_t send_rst (struct simptcp_socket * socket, u_int16_t seq, u_int16_t ack)
+{
+    unsigned char hlen = SIMPTCP_GHEADER_SIZE;
+    struct iovec iov;
+    ssize_t n;
+
+    simptcp_set_sport(socket->ack_buffer, ntohs(socket->local_simptcp.sin_port));
+    simptcp_set_dport(socket->ack_buffer, ntohs(socket->remote_simptcp.sin_port));
+    simptcp_set_seq_num(socket->ack_buffer, seq);
+    simptcp_set_ack_num(socket->ack_buffer, ack);
+    simptcp_set_head_len(socket->ack_buffer, hlen);
+    simptcp_set_flags(socket->ack_buffer, RST);
+    simptcp_set_total_len(socket->ack_buffer, hlen);
+    simptcp_set_win_size(socket->ack_buffer, 0);
+    simptcp_add_checksum(socket->ack_buffer, hlen);
+
+    if (SIMPTCP_LOG_ON_FOR(SIMPTCP_LOG_PACKET, SIMPTCP_LOG_DEBUG))
+        simptcp_print_packet(socket->ack_buffer);
+
+    socket->simptcp_send_count++;
+
+    SIMPTCP_TRACE_PDU(SIMPTCP_TRACE_PDU_SEND, ntohs(socket->local_simptcp.sin_port),
+                      socket->ack_buffer, hlen);
+    if (simptcp_pcap_enabled) {
+        iov.iov_base = socket->ack_buffer;
+        iov.iov_len = hlen;
+        simptcp_pcap_capture(&(simptcp_entity.local_udp), &(socket->remote_udp), &iov, 1);
+    }
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_DATAGRAMS);
+    n = libc_sendto(simptcp_entity.udp_fd, socket->ack_buffer, hlen,
+                    0, (struct sockaddr *) &(socket->remote_udp), sizeof(struct sockaddr_in));
+    if (n == -1) {
+        SIMPTCP_STAT_INC(SIMPTCP_STAT_TX_ERRORS);
+        SIMPTCP_PROBE4(send_error, socket, ntohs(socket->local_simptcp.sin_port),
+                       errno, hlen);
+    }
+    return n;
+}
+
+/*! \fn void schedule_ack (struct simptcp_socket * socket, int full)
+ * \brief decide de l'acquittement d'un segment de donnees recu en sequence.
+ * L'acquittement est immediat en mode quick-ack (apres l'etablissement de la
+ * connexion ou une perte), lorsque le trafic n'est pas interactif (l'emetteur
+ * ne peut avoir qu'un segment en vol : le retarder ne ferait que ralentir le
+ * transfert) ou au second segment plein non acquitte. Sinon il est differe de
+ * SIMPTCP_DELACK_TIMEOUT ms, en esperant le transmettre avec la reponse de 
+ * l'application (voir established_simptcp_socket_state_send).
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param full 1 si le segment recu est de taille maximale
+ */
+void schedule_ack (struct simptcp_socket * socket, int full)
+{
+    gettimeofday(&(socket->last_data_in), NULL);
+
+    socket->ack_pending++;
+    if (full)
+        socket->ack_pending_full++;
+
+    if (socket->quickack > 0 || !socket->delack_pingpong ||
+        socket->ack_pending_full >= SIMPTCP_DELACK_SEGMENTS) {
+        if (socket->quickack > 0)
+            socket->quickack--;
+        if (send_ack(socket) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+    }
+    else if (!has_active_delack_timer(socket))
+        start_delack_timer(socket, SIMPTCP_DELACK_TIMEOUT);
+}
+
+/*! \fn void enter_quickack_mode (struct simptcp_socket * socket)
+ * \brief les SIMPTCP_QUICKACK_SEGMENTS prochains segments seront acquittes 
+ * sans delai (apres le handshake ou une perte)
+ * \param socket pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void enter_quickack_mode (struct simptcp_socket * socket)
+{
+    socket->quickack = SIMPTCP_QUICKACK_SEGMENTS;
+}
+
+/*! \fn void handle_delack_timeout (struct simptcp_socket * sock)
+ * \brief lancee par l'entite protocolaire a l'expiration du timer 
+ * d'acquittement differe : l'application n'a pas repondu a temps, l'ACK part 
+ * seul et on quitte le mode interactif
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void handle_delack_timeout (struct simptcp_socket * sock)
+{
+    SIMPTCP_TRACE_CALL();
+    lock_simptcp_socket(sock);
+    sock->delack_pingpong = 0;
+    if (sock->ack_pending > 0) {
+        if (send_ack(sock) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+    }
+    else
+        stop_delack_timer(sock);
+    unlock_simptcp_socket(sock);
+}
+
+/*! \fn int receive_direct (struct simptcp_socket * sock, char * buf, int len)
+ * \brief verifie l'integrite d'un PDU recu par l'entite. Si l'application 
+ * attend dans recv sur ce socket avec un buffer assez grand, la charge utile y
+ * est recopiee pendant la verification (une seule lecture du PDU) ; elle ne 
+ * sera rendue a l'application que si le PDU est accepte par 
+ * process_simptcp_pdu (ucopy_filled)
+ * \param sock socket simpTCP destinataire presume (peut etre NULL)
+ * \param buf PDU recu
+ * \param len taille du PDU recu
+ * \return 1 si le PDU est intact, 0 sinon
+ */
+int receive_direct (struct simptcp_socket * sock, char * buf, int len)
+{
+    int dlen = len - simptcp_get_head_len(buf);
+    int ok;
+
+    if (sock == NULL)
+        return simptcp_check_integrity(buf, len);
+
+    lock_simptcp_socket(sock);
+    sock->ucopy_filled = 0;
+    /* rien ne doit attendre dans la file de reception : la charge utile
+       passerait devant */
+    if ((sock->ucopy_buf != NULL) && (sock->in_pdu == NULL) && (dlen > 0) && 
+        ((size_t) dlen <= sock->ucopy_len) && (sock->ucopy_done == 0)) {
+        ok = simptcp_check_integrity_copy(buf, len, sock->ucopy_buf);
+        if (ok)
+            sock->ucopy_filled = dlen;
+    }
+    else
+        ok = simptcp_check_integrity(buf, len);
+    unlock_simptcp_socket(sock);
+
+    return ok;
+}
+
+/*! \fn void transmit_data (struct simptcp_socket * sock, const char * data, size_t len)
+ * \brief emet un PDU de donnees et arme le timer de retransmission. Un 
+ * acquittement differe en attente part avec les donnees. Le socket doit etre 
+ * verrouille et aucun PDU ne doit etre en attente d'acquittement. Les donnees
+ * ne sont pas recopiees : elles doivent rester valides jusqu'a l'acquittement.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param data charge utile
+ * \param len taille de la charge utile (au plus SIMPTCP_MAX_SIZE)
+ */
+void transmit_data (struct simptcp_socket * sock, const char * data, size_t len)
+{
+    unsigned char pdu_flags = 0;
+    struct timeval t0;
+
+    /* l'application repond rapidement aux donnees recues : trafic interactif,
+       les acquittements suivants seront differes */
+    gettimeofday(&t0, NULL);
+    if ((t0.tv_sec - sock->last_data_in.tv_sec) * 1000 +
+        (t0.tv_usec - sock->last_data_in.tv_usec) / 1000 < SIMPTCP_DELACK_TIMEOUT)
+        sock->delack_pingpong = 1;
+
+    /* un acquittement differe est en attente : il part avec les donnees */
+    if (sock->ack_pending > 0) {
+        pdu_flags = ACK;
+        sock->ack_pending = 0;
+        sock->ack_pending_full = 0;
+        stop_delack_timer(sock);
+    }
+
+    if (make_pdu (sock, (char*)data, len, pdu_flags) !=  0) {
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur Make_PDU\n");
+    }
+
+    /* mise à l'etat d'attente d'un ack, avant l'emission : l'acquittement 
+       peut arriver avant le retour de send_pdu */
+    sock->socket_state_sender = wait_ack;
+    sock->next_seq_num++;
+    start_timer(sock, sock->timer_duration);
+    rtt_start(sock);
+
+    if (send_pdu(sock) == -1)
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+}
+
+/*! \fn int can_transmit_queued (struct simptcp_socket * sock)
+ * \brief indique si les donnees du buffer d'emission peuvent partir alors 
+ * qu'aucun PDU n'est en vol : un segment plein part toujours, un segment 
+ * partiel seulement si le socket n'est pas bouchonne
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return 1 si les donnees peuvent etre emises, 0 sinon
+ */
+int can_transmit_queued (struct simptcp_socket * sock)
+{
+    return (sock->snd_len >= sock->mss) || 
+        ((sock->snd_len > 0) && !sock->cork);
+}
+
+/*! \fn void transmit_queued (struct simptcp_socket * sock)
+ * \brief emet le contenu du buffer d'emission ; les ecritures suivantes sont
+ * recopiees dans l'autre buffer pendant que celui-ci est en vol. Le socket
+ * doit etre verrouille et aucun PDU ne doit etre en attente d'acquittement.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void transmit_queued (struct simptcp_socket * sock)
+{
+    const char * data = sock->snd_buf[sock->snd_cur];
+    size_t len = sock->snd_len;
+
+    sock->out_sum = sock->snd_sum;
+    sock->out_summed = 1;
+    sock->snd_cur ^= 1;
+    sock->snd_len = 0;
+    sock->snd_sum = 0;
+    transmit_data(sock, data, len);
+}
+
+/*! \fn int wait_for_ack (struct simptcp_socket * sock)
+ * \brief attend l'acquittement du PDU en vol (s'il y en a un)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return 0 si succes, -1 si la connexion a ete abandonnee
+ */
+int wait_for_ack (struct simptcp_socket * sock)
+{
+    while (sock->nbr_retransmit < SIMPTCP_MAX_SEND && 
+           sock->socket_state_sender == wait_ack) ;
+
+    if (sock->nbr_retransmit >= SIMPTCP_MAX_SEND)
+        return -1;
+
+    return 0;
+}
+
+/*! \fn int simptcp_socket_flush (struct simptcp_socket * sock)
+ * \brief emet les donnees en attente dans le buffer d'emission, meme si le 
+ * socket est bouchonne, et attend qu'elles soient toutes acquittees
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return 0 si succes, -1 si la connexion a ete abandonnee
+ */
+int simptcp_socket_flush (struct simptcp_socket * sock)
+{
+    lock_simptcp_socket(sock);
+    while ((sock->socket_state_sender == wait_ack) || (sock->snd_len > 0)) {
+        if (sock->socket_state_sender != wait_ack)
+            transmit_queued(sock);
+        unlock_simptcp_socket(sock);
+        if (wait_for_ack(sock) == -1)
+            return -1;
+        lock_simptcp_socket(sock);
+    }
+    unlock_simptcp_socket(sock);
+
+    return 0;
+}
+
+/*! \fn int simptcp_socket_setsockopt (struct simptcp_socket * sock, int optname, const void * optval, socklen_t optlen)
+ * \brief positionne une option de niveau IPPROTO_SIMPTCP. Retirer 
+ * SIMPTCP_CORK ou positionner SIMPTCP_NODELAY emet les donnees en attente ;
+ * positionner SIMPTCP_QUICKACK emet l'acquittement differe en attente.
+ * SIMPTCP_CRC32C ne peut etre positionne qu'avant connect ou sur le socket 
+ * d'ecoute (il est herite par les sockets acceptes).
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param optname SIMPTCP_NODELAY, SIMPTCP_CORK, SIMPTCP_QUICKACK ou SIMPTCP_CRC32C
+ * \param optval pointeur sur un int (0 ou 1)
+ * \param optlen taille de optval
+ * \return 0 si succes, -EINVAL ou -ENOPROTOOPT sinon
+ */
+int simptcp_socket_setsockopt (struct simptcp_socket * sock, int optname,
+                               const void * optval, socklen_t optlen)
+{
+    int val;
+
+    if ((optval == NULL) || (optlen < sizeof(int)))
+        return -EINVAL;
+    val = (*(const int *) optval != 0);
+
+    lock_simptcp_socket(sock);
+    switch (optname) {
+    case SIMPTCP_NODELAY:
+        sock->nodelay = val;
+        break;
+    case SIMPTCP_CORK:
+        sock->cork = val;
+        break;
+    case SIMPTCP_CRC32C:
+        /* negocie a l'ouverture de la connexion */
+        if ((sock->socket_state != & simptcp_socket_states.closed) &&
+            (sock->socket_state != & simptcp_socket_states.listen)) {
+            unlock_simptcp_socket(sock);
+            return -EINVAL;
+        }
+        sock->crc32c_wanted = val;
+        break;
+    case SIMPTCP_QUICKACK:
+        if (val) {
+            enter_quickack_mode(sock);
+            if (sock->ack_pending > 0)
+                send_ack(sock);
+        }
+        else {
+            sock->quickack = 0;
+            sock->delack_pingpong = 1;
+        }
+        break;
+    default:
+        unlock_simptcp_socket(sock);
+        return -ENOPROTOOPT;
+    }
+
+    /* "push" des donnees en attente */
+    if ((sock->socket_state_sender != wait_ack) && can_transmit_queued(sock))
+        transmit_queued(sock);
+    unlock_simptcp_socket(sock);
+
+    return 0;
+}
+
+/*! \fn void simptcp_socket_get_info (struct simptcp_socket * sock, struct simptcp_info * info)
+ * \brief releve les statistiques de la connexion (option SIMPTCP_INFO). Ni 
+ * verrou ni appel systeme : l'option peut etre lue frequemment, au prix de
+ * compteurs qui peuvent ne pas etre tout a fait coherents entre eux
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param info statistiques relevees
  */
-int is_timeout(struct simptcp_socket * sock)
+void simptcp_socket_get_info (struct simptcp_socket * sock, struct simptcp_info * info)
 {
     struct timeval t0;
-
-    assert(sock!=NULL);
-    /* make sure that the timer is launched */
-    assert(has_active_timer(sock));
-
-    gettimeofday(&t0,NULL);
-    return ((sock->timeout.tv_sec < t0.tv_sec) || 
-            ( (sock->timeout.tv_sec == t0.tv_sec) && (sock->timeout.tv_usec < t0.tv_usec)));
+    int state = simptcp_socket_state_index(sock->socket_state);
+
+    memset(info, 0, sizeof(struct simptcp_info));
+    info->state = state;
+    info->retransmits = sock->nbr_retransmit;
+    info->crc32c = sock->crc32c;
+    info->rto_us = sock->timer_duration * 1000;
+    info->srtt_us = sock->srtt_us;
+    info->rttvar_us = sock->rttvar_us;
+    info->snd_mss = sock->mss;
+    info->snd_cwnd = 1;          /* stop and wait */
+    info->rcv_wnd = (SIMPTCP_RX_QUEUE_LEN - sock->in_queue_count) * sock->mss;
+    info->bytes_sent = sock->bytes_sent;
+    info->bytes_retrans = sock->bytes_retrans;
+    info->bytes_received = sock->bytes_received;
+    info->segs_out = sock->simptcp_send_count;
+    info->segs_in = sock->simptcp_receive_count;
+    info->total_retrans = sock->simptcp_retransmit_count;
+    info->in_errors = sock->simptcp_in_errors_count;
+    memcpy(info->state_time_us, sock->state_time_us, sizeof(info->state_time_us));
+
+    /* l'etat courant, jusqu'a maintenant */
+    gettimeofday(&t0, NULL);
+    info->state_time_us[state] += (t0.tv_sec - sock->state_since.tv_sec) * 1000000LL +
+        (t0.tv_usec - sock->state_since.tv_usec);
 }
 
+/*! \fn int simptcp_socket_getsockopt (struct simptcp_socket * sock, int optname, void * optval, socklen_t * optlen)
+ * \brief lit une option de niveau IPPROTO_SIMPTCP
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param optname SIMPTCP_NODELAY, SIMPTCP_CORK, SIMPTCP_QUICKACK, SIMPTCP_CRC32C,
+ * SIMPTCP_PREDICTION, SIMPTCP_INFO ou SIMPTCP_LATENCY
+ * \param optval pointeur sur un int (struct simptcp_prediction_stats pour
+ * SIMPTCP_PREDICTION, struct simptcp_info pour SIMPTCP_INFO, struct 
+ * simptcp_latency pour SIMPTCP_LATENCY)
+ * \param optlen taille de optval, mise a jour
+ * \return 0 si succes, -EINVAL ou -ENOPROTOOPT sinon
+ */
+int simptcp_socket_getsockopt (struct simptcp_socket * sock, int optname,
+                               void * optval, socklen_t * optlen)
+{
+    int val;
+    struct simptcp_prediction_stats stats;
+
+    if (optname == SIMPTCP_INFO) {
+        if ((optval == NULL) || (optlen == NULL) || 
+            (*optlen < sizeof(struct simptcp_info)))
+            return -EINVAL;
+        simptcp_socket_get_info(sock, optval);
+        *optlen = sizeof(struct simptcp_info);
+        return 0;
+    }
 
-int make_pdu (struct simptcp_socket * socket, char * message, size_t longueur_message, unsigned char flags) {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    /* num port source */
-    simptcp_set_sport(socket->out_buffer, ntohs(socket->local_simptcp.sin_port));
-    /* num port dest */
-    simptcp_set_dport(socket->out_buffer, ntohs(socket->remote_simptcp.sin_port));	
-    /* sep_num */
-    simptcp_set_seq_num(socket->out_buffer, (u_int16_t)(socket->next_seq_num));
-    /* ack_num */
-    simptcp_set_ack_num(socket->out_buffer, (u_int16_t)(socket->next_ack_num));
-    /* header */
-    simptcp_set_head_len(socket->out_buffer, SIMPTCP_GHEADER_SIZE) ;
-    /* flags */
-    simptcp_set_flags  (socket->out_buffer, flags);
-    /* total_len */
-    simptcp_set_total_len(socket->out_buffer, (u_int16_t)SIMPTCP_GHEADER_SIZE+longueur_message);
-    socket->out_len = (u_int16_t)SIMPTCP_GHEADER_SIZE+longueur_message;
-    /* window_size */
-    simptcp_set_win_size   (socket->out_buffer,0 );
+    if (optname == SIMPTCP_LATENCY) {
+        if ((optval == NULL) || (optlen == NULL) || 
+            (*optlen < sizeof(struct simptcp_latency)))
+            return -EINVAL;
+        memcpy(((struct simptcp_latency *) optval)->hist, sock->latency,
+               sizeof(sock->latency));
+        *optlen = sizeof(struct simptcp_latency);
+        return 0;
+    }
 
-    memcpy( &(socket->out_buffer[sizeof(simptcp_generic_header)]), message, longueur_message) ;
+    if (optname == SIMPTCP_PREDICTION) {
+        if ((optval == NULL) || (optlen == NULL) || (*optlen < sizeof(stats)))
+            return -EINVAL;
+        stats.hits = sock->prediction_hits;
+        stats.misses = sock->prediction_misses;
+        memcpy(optval, &stats, sizeof(stats));
+        *optlen = sizeof(stats);
+        return 0;
+    }
 
-    /* checksum */
-    simptcp_add_checksum (socket->out_buffer, (u_int16_t)SIMPTCP_GHEADER_SIZE+longueur_message );
-    /* message */
-    if (sizeof(simptcp_generic_header) + longueur_message > SIMPTCP_SOCKET_MAX_BUFFER_SIZE) {
-        return -1 ;
+    if ((optval == NULL) || (optlen == NULL) || (*optlen < sizeof(int)))
+        return -EINVAL;
+
+    switch (optname) {
+    case SIMPTCP_NODELAY:
+        val = sock->nodelay;
+        break;
+    case SIMPTCP_CORK:
+        val = sock->cork;
+        break;
+    case SIMPTCP_QUICKACK:
+        val = (sock->quickack > 0) || !sock->delack_pingpong;
+        break;
+    case SIMPTCP_CRC32C:
+        /* demande avant la connexion, resultat de la negociation ensuite */
+        if ((sock->socket_state == & simptcp_socket_states.closed) ||
+            (sock->socket_state == & simptcp_socket_states.listen))
+            val = sock->crc32c_wanted;
+        else
+            val = sock->crc32c;
+        break;
+    default:
+        return -ENOPROTOOPT;
     }
 
-    /* affichage du PDU */
-    simptcp_print_packet(socket->out_buffer) ;
+    *(int *) optval = val;
+    *optlen = sizeof(int);
 
-    return 0 ;
+    return 0;
 }
 
 
@@ -370,9 +1475,7 @@ int make_pdu (struct simptcp_socket * socket, char * message, size_t longueur_me
  */
 int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     /* debut modifications de sock */
     lock_simptcp_socket(sock);
 
@@ -387,21 +1490,20 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
     sock->next_seq_num= 0;
     sock->next_ack_num= 0;
 
+    /* le modele d'en-tete d'une connexion precedente n'est plus valable */
+    sock->hdr_template_len = 0;
+
     /* creation du PDU */
     if ( make_pdu (sock, NULL, 0, SYN) !=  0) {
-        printf("Erreur Make_PDU\n") ;
-        return -1 ;
-    }
-
-    /* envoi du PDU */
-    if (libc_sendto(simptcp_entity.udp_fd, (sock->out_buffer), sock->out_len, 0, addr, len) == -1)
-    {
-        printf("Erreur SendTo") ;
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur Make_PDU\n");
+        unlock_simptcp_socket(sock);
         return -1 ;
     }
 
-    /* socket passé dans l'état synsent */
-    sock->socket_state = & simptcp_socket_states.synsent ;
+    /* socket passé dans l'état synsent, avant l'emission : le SYN-ACK peut
+       arriver avant le retour de send_pdu, et demultiplex_packet consulte
+       le type du socket sans le verrouiller */
+    simptcp_socket_set_state(sock, & simptcp_socket_states.synsent);
 
     /* mise au type listening_serveur pour recevoir le SYN-ACK du serveur depuis son nouveau socket */
     sock->socket_type = listening_server;
@@ -409,29 +1511,46 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
     /* incrémentation du numéro de la prochaine trame à emettre */
     sock->next_seq_num++;
 
+    /* envoi du PDU */
+    if (send_pdu(sock) == -1)
+    {
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur SendTo\n");
+        sock->socket_type = client;
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+        unlock_simptcp_socket(sock);
+        return -1 ;
+    }
+
     /* fin de modification de sock */
     unlock_simptcp_socket(sock);
 
     /* lancement du timer */
-    start_timer(sock, 1000) ;
+    start_timer(sock, sock->timer_duration) ;
+    rtt_start(sock);
 
     /* 5 tentatives de connection au maximum */
     int connect_max = 5 ;
 
-    /* attente de l'établissement de la connection ou de l'échec de connection */
-    while (sock->simptcp_send_count < connect_max && strcmp(simptcp_socket_state_get_str(sock->socket_state),"ESTABLISHED")!=0) ;
+    /* attente de l'établissement de la connection ou de l'échec de connection
+       (la connexion est fermee si elle est refusee, voir RST) */
+    while (sock->nbr_retransmit < connect_max && 
+           sock->socket_state != & simptcp_socket_states.closed &&
+           strcmp(simptcp_socket_state_get_str(sock->socket_state),"ESTABLISHED")!=0) ;
 
     /* arret du timer */
     stop_timer(sock) ;
 
-    /* retour d'erreur en cas d'échec */
-    if (sock->simptcp_send_count >= connect_max) {
-        sock->socket_state = & simptcp_socket_states.closed ;
+    /* retour d'erreur en cas d'échec ou de refus */
+    if (sock->nbr_retransmit >= connect_max ||
+        sock->socket_state == & simptcp_socket_states.closed) {
+        sock->socket_type = client;
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+        sock->nbr_retransmit = 0;
         return -1;
     }
 
     /* remise à 0 du compteur d'échec */
-    sock->simptcp_send_count = 0;
+    sock->nbr_retransmit = 0;
 
     return 0;
 }
@@ -444,14 +1563,20 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
  */
 int closed_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 { 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     /* debut modifications du socket */
     lock_simptcp_socket(sock);
 
+    /* au moins une demande de connexion en attente */
+    if (n < 1)
+        n = 1;
+
     /* On initialise la liste des sockets ayant effectue une demande de connexion */
     sock->new_conn_req = malloc(n*sizeof(struct simptcp_socket *));
+    if (sock->new_conn_req == NULL) {
+        unlock_simptcp_socket(sock);
+        return -1;
+    }
 
     /* On modifie le type de socket en listening_server */
     sock->socket_type = listening_server;
@@ -460,7 +1585,7 @@ int closed_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n
     sock->max_conn_req_backlog = n;
 
     /* On fixe l'état de la socket */
-    sock->socket_state = & simptcp_socket_states.listen ;
+    simptcp_socket_set_state(sock, & simptcp_socket_states.listen);
 
     /* initialisation du next num seq et ack */
     sock->next_seq_num= 0;
@@ -484,10 +1609,8 @@ int closed_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n
 int closed_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("ERROR : demande interdite.") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "ERROR : demande interdite.\n");
     return - 1;
 }
 
@@ -502,10 +1625,8 @@ int closed_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sock
  */
 ssize_t closed_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("ERROR : demande interdite.") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "ERROR : demande interdite.\n");
     return -1;
 }
 
@@ -520,9 +1641,7 @@ ssize_t closed_simptcp_socket_state_send (struct simptcp_socket* sock, const voi
  */
 ssize_t closed_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     return -1;
 }
@@ -538,9 +1657,7 @@ ssize_t closed_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf
  */
 int closed_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 }
 
@@ -552,9 +1669,7 @@ int closed_simptcp_socket_state_close (struct simptcp_socket* sock)
  */
 int closed_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -568,9 +1683,9 @@ int closed_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
  */
 void closed_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_closed, sock, buf, len);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_BADSTATE_DROPS);
 
 }
 
@@ -585,9 +1700,7 @@ void closed_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* soc
 
 void closed_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
 }
 
@@ -605,10 +1718,8 @@ void closed_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
  */
 int listen_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("ERROR: Demande interdite.");
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "ERROR: Demande interdite.\n");
     return -1;   
 }
 
@@ -623,9 +1734,7 @@ int listen_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
  */
 int listen_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 }
 
@@ -636,68 +1745,87 @@ int listen_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n
  * \brief lancee lorsque l'application lance l'appel "accept" alors que le socket simpTCP est dans l'etat "listen" 
  * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
  * \param [out] addr pointeur sur l'adresse du socket distant de la connexion qui vient d'etre acceptee
- * \param len taille en octet de l'adresse du socket distant
- * \return 0 si succes, -1 si erreur/echec
+ * \param [in,out] len taille en octet de l'adresse du socket distant
+ * (tronquee a *len) ; peut etre NULL, comme addr
+ * \return descripteur du socket de la connexion acceptee, -1 si erreur/echec
  */
 int listen_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    struct simptcp_socket *new_sock;
+    int fd, i;
+
+    SIMPTCP_TRACE_CALL();
 
     /* on boucle tant qu'on n'a pas de demande de connection */
     while (sock->pending_conn_req == 0);
 
+    /* la plus ancienne demande est retiree de la file. Le socket d'ecoute
+       n'est pas garde verrouille pendant la poignee de main : l'entite doit
+       pouvoir y deposer les demandes suivantes */
     lock_simptcp_socket(sock);
+    new_sock = sock->new_conn_req[0];
+    for (i = 1; i < sock->pending_conn_req; i++)
+        sock->new_conn_req[i-1] = sock->new_conn_req[i];
+    sock->pending_conn_req--;
+    unlock_simptcp_socket(sock);
 
-    if (sock->new_conn_req[0] != NULL) {
-
-        /* creation du PDU */          
-        if ( make_pdu (sock->new_conn_req[0], NULL, 0, SYN+ACK) !=  0) {
-            printf("Erreur Make_PDU\n") ;
-            return -1 ;
-        }
-
-        if (libc_sendto(simptcp_entity.udp_fd, sock->new_conn_req[0]->out_buffer, sock->new_conn_req[0]->out_len, 0,(struct sockaddr*)(&(sock->new_conn_req[0]->remote_udp)),sock->new_conn_req[0]->out_len)   == -1) {
-            printf("\nErreur libc_sendto\n");
-            return -1;
-        }
-
-        /* incrementation du next num seq */
-        sock->new_conn_req[0]->next_seq_num ++ ;
-
-        /* mise a l'etat synsent */
-        sock->new_conn_req[0]->socket_state = & simptcp_socket_states.synsent;
-
-        /* 5 tentatives de connection au maximum */
-        int connect_max = 5 ;
+    /* descripteur du nouveau socket */
+    for (fd = 0; fd < MAX_OPEN_SOCK; fd++)
+        if (simptcp_entity.simptcp_socket_descriptors[fd] == new_sock)
+            break;
+    if (fd == MAX_OPEN_SOCK)
+        return -1;
 
-        /* lancement du timer */
-        start_timer(sock->new_conn_req[0],1000);
+    /* creation du PDU */          
+    if ( make_pdu (new_sock, NULL, 0, SYN+ACK) !=  0) {
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur Make_PDU\n");
+        orphan_simptcp_socket(fd);
+        return -1 ;
+    }
 
-        /* attente de la reception du ACK pour le SYN envoye */
-        while (sock->new_conn_req[0]->simptcp_send_count < connect_max && strcmp(simptcp_socket_state_get_str(sock->new_conn_req[0]->socket_state),"ESTABLISHED")!=0) ;
+    /* incrementation du next num seq */
+    new_sock->next_seq_num ++ ;
 
-        sock->new_conn_req[0]->simptcp_send_count = 0;
+    /* mise a l'etat synsent, et lancement du timer, avant l'emission :
+       l'ACK du client peut etre traite par l'entite avant le retour de
+       send_pdu (le nouveau socket n'est pas verrouille ici) */
+    simptcp_socket_set_state(new_sock, & simptcp_socket_states.synsent);
+    start_timer(new_sock, new_sock->timer_duration);
+    rtt_start(new_sock);
 
-        stop_timer(sock->new_conn_req[0]);          
+    if (send_pdu(new_sock)   == -1) {
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sendto\n");
+        orphan_simptcp_socket(fd);
+        return -1;
+    }
 
-        if (sock->new_conn_req[0]->simptcp_send_count >= connect_max)
-            return -1;
+    /* 5 tentatives de connection au maximum */
+    int connect_max = 5 ;
 
-        /* suppression dans le tableau pending_con_req */
-        sock->new_conn_req[0] = NULL;
-        sock->pending_conn_req--;
+    /* attente de la reception du ACK pour le SYN envoye */
+    while (new_sock->nbr_retransmit < connect_max && 
+           new_sock->socket_state != & simptcp_socket_states.closed &&
+           strcmp(simptcp_socket_state_get_str(new_sock->socket_state),"ESTABLISHED")!=0) ;
 
+    stop_timer(new_sock);          
 
-    }
-    else
+    /* echec, ou connexion refusee par le client (RST) */
+    if (new_sock->nbr_retransmit >= connect_max ||
+        new_sock->socket_state == & simptcp_socket_states.closed) {
+        orphan_simptcp_socket(fd);
         return -1;
+    }
 
-    unlock_simptcp_socket(sock);
+    new_sock->nbr_retransmit = 0;
 
+    /* adresse du socket distant */
+    if ((addr != NULL) && (len != NULL)) {
+        if (*len > sizeof(struct sockaddr_in))
+            *len = sizeof(struct sockaddr_in);
+        memcpy(addr, &(new_sock->remote_simptcp), *len);
+    }
 
-    return 1;
+    return fd;
 }
 
 /**
@@ -713,9 +1841,7 @@ int listen_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sock
  */
 ssize_t listen_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 }
 
@@ -732,9 +1858,7 @@ ssize_t listen_simptcp_socket_state_send (struct simptcp_socket* sock, const voi
  */
 ssize_t listen_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -749,9 +1873,7 @@ ssize_t listen_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf
  */
 int listen_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -767,11 +1889,9 @@ int listen_simptcp_socket_state_close (struct simptcp_socket* sock)
  */
 int listen_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
-    printf("Main socket closed\n");
+    SIMPTCP_LOG(SIMPTCP_LOG_INFO, "Main socket closed\n");
 
     return 0;
 
@@ -789,14 +1909,54 @@ int listen_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
  */
 void listen_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_listen, sock, buf, len);
     if (simptcp_get_flags(buf) == SYN) {
         if (simptcp_get_seq_num(buf) == sock->next_ack_num) {
 
             struct simptcp_socket* new_sock;
-            int fd = create_simptcp_socket();
+            int fd, i;
+
+            /* le mode CRC32C est exige : une demande en mode checksum, plus
+               faible, est refusee plutot qu'acceptee en silence */
+            if (sock->crc32c_wanted && 
+                (simptcp_find_option(buf, len, SIMPTCP_CRC32C_OPTION) == NULL)) {
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Demande de connexion sans CRC32C refusee\n");
+                if (send_rst(sock, 0, simptcp_get_seq_num(buf) + 1) == -1)
+                    SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+                return;
+            }
+
+            /* SYN retransmis par un client dont la demande est deja en 
+               attente de l'accept (dans la file), ou en cours d'acceptation
+               (socket serveur en synsent) */
+            for (fd = 0; fd < MAX_OPEN_SOCK; fd++) {
+                new_sock = simptcp_entity.simptcp_socket_descriptors[fd];
+                if ((new_sock == NULL) || (new_sock == sock) ||
+                    (new_sock->remote_simptcp.sin_addr.s_addr != 
+                     sock->remote_simptcp.sin_addr.s_addr) ||
+                    (new_sock->remote_simptcp.sin_port != 
+                     sock->remote_simptcp.sin_port))
+                    continue;
+                if ((new_sock->socket_type == nonlistening_server) &&
+                    (new_sock->socket_state == & simptcp_socket_states.synsent))
+                    return;
+                for (i = 0; i < sock->pending_conn_req; i++)
+                    if (sock->new_conn_req[i] == new_sock)
+                        return;
+            }
+
+            /* file des demandes pleine : le client retransmettra son SYN */
+            if (sock->pending_conn_req >= sock->max_conn_req_backlog)
+                return;
+
+            /* plus de descripteur libre : la demande est ignoree */
+            fd = create_simptcp_socket();
+            if (fd < 0) {
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Demande de connexion ignoree : %s\n",
+                            strerror(-fd));
+                return;
+            }
 
             new_sock = simptcp_entity. simptcp_socket_descriptors[fd];
 
@@ -810,21 +1970,29 @@ void listen_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* soc
             new_sock->next_ack_num = simptcp_get_ack_num(buf)+1;
             new_sock->next_seq_num = simptcp_get_seq_num(buf);
 
-            /* incrementation du nombre de demandes */
-            sock->pending_conn_req++ ;
+            /* options heritees du socket d'ecoute */
+            new_sock->nodelay = sock->nodelay;
+            new_sock->cork = sock->cork;
+            new_sock->crc32c_wanted = sock->crc32c_wanted;
 
-            /* reférencement de la copie dans new_conn_req */
-            sock->new_conn_req[0] = new_sock;
+            /* mode CRC32C si le client le propose et qu'on l'accepte */
+            if (sock->crc32c_wanted && 
+                (simptcp_find_option(buf, len, SIMPTCP_CRC32C_OPTION) != NULL))
+                enable_crc32c(new_sock);
 
             unlock_simptcp_socket(new_sock) ;
+
+            /* reférencement de la copie en fin de file, puis incrementation
+               du nombre de demandes (accept attend qu'il soit non nul) */
+            lock_simptcp_socket(sock);
+            sock->new_conn_req[sock->pending_conn_req] = new_sock;
+            sock->pending_conn_req++ ;
+            unlock_simptcp_socket(sock);
         }
     }
     else {
-        if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-            printf("Erreur Make_PDU\n") ;
-
-        if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-            printf("\nErreur libc_sento\n");
+        if (send_ack(sock) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
     }
 }
@@ -839,9 +2007,7 @@ void listen_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* soc
  */
 void listen_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 }
 
 
@@ -862,10 +2028,8 @@ void listen_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
  */
 int synsent_simptcp_socket_state_active_open (struct  simptcp_socket* sock,struct sockaddr* addr, socklen_t len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("ERROR : demande de connexion deja envoye.") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "ERROR : demande de connexion deja envoye.\n");
     return -1;
 
 }
@@ -881,9 +2045,7 @@ int synsent_simptcp_socket_state_active_open (struct  simptcp_socket* sock,struc
  */
 int synsent_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -900,9 +2062,7 @@ int synsent_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
  */
 int synsent_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -920,10 +2080,8 @@ int synsent_simptcp_socket_state_accept (struct simptcp_socket* sock, struct soc
  */
 ssize_t synsent_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("ERROR : connexion pas etablie.") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "ERROR : connexion pas etablie.\n");
     return -1;
 
 }
@@ -941,9 +2099,7 @@ ssize_t synsent_simptcp_socket_state_send (struct simptcp_socket* sock, const vo
  */
 ssize_t synsent_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -958,9 +2114,7 @@ ssize_t synsent_simptcp_socket_state_recv (struct simptcp_socket* sock, void *bu
  */
 int synsent_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -977,9 +2131,7 @@ int synsent_simptcp_socket_state_close (struct simptcp_socket* sock)
 int synsent_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -997,9 +2149,8 @@ int synsent_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_synsent, sock, buf, len);
     lock_simptcp_socket(sock);
 
     /* verification SYN ACK */
@@ -1008,40 +2159,65 @@ void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
         if (simptcp_get_seq_num(buf) == sock->next_ack_num) {
             sock->socket_type = client;
 
-            /* on passe en mode established */
-            sock->socket_state = & simptcp_socket_states.established ;
-
             /* aquisition du nouveau port du serveur */
             sock->remote_simptcp.sin_port = htons(simptcp_get_sport(buf)); 
 
+            /* le serveur a refuse le mode CRC32C : la connexion est
+               abandonnee plutot qu'etablie en mode checksum, plus faible
+               que celui demande */
+            if (sock->crc32c_wanted && 
+                (simptcp_find_option(buf, len, SIMPTCP_CRC32C_OPTION) == NULL)) {
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "CRC32C refuse par le serveur : connexion abandonnee\n");
+                if (send_rst(sock, sock->next_seq_num, simptcp_get_seq_num(buf) + 1) == -1)
+                    SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+                stop_timer(sock);
+                simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+                unlock_simptcp_socket(sock);
+                return;
+            }
+
+            rtt_ack(sock);
+
+            /* on passe en mode established */
+            simptcp_socket_set_state(sock, & simptcp_socket_states.established);
+            enter_quickack_mode(sock);
+
+            /* le serveur a accepte le mode CRC32C */
+            if (sock->crc32c_wanted)
+                enable_crc32c(sock);
+            build_header_template(sock);
+
             /* on envoie un ACK et on prévient qu'on attend la trame suivante */
             sock->next_ack_num++;
 
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) {
-                printf("Erreur Make_PDU\n") ;
-            }
-
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
 
         }
         /* mauvais numero de sequence */
         else {
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) {
-                printf("Erreur Make_PDU\n") ;
-            }
-
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
         }
     }
 
     else if (simptcp_get_flags(buf) == ACK) {
         if (simptcp_get_ack_num(buf) == sock->next_seq_num) {
-            sock->socket_state = & simptcp_socket_states.established ;
+            simptcp_socket_set_state(sock, & simptcp_socket_states.established);
+            enter_quickack_mode(sock);
+            build_header_template(sock);
+            stop_timer(sock);
+            rtt_ack(sock);
+        }
+    }
+
+    /* connexion refusee par le socket distant */
+    else if (simptcp_get_flags(buf) == RST) {
+        if (simptcp_get_ack_num(buf) == sock->next_seq_num) {
             stop_timer(sock);
+            simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
         }
     }
 
@@ -1060,9 +2236,7 @@ void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
 void synsent_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     /* arrêt du timer */
     stop_timer(sock) ;
 
@@ -1070,16 +2244,13 @@ void synsent_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
     lock_simptcp_socket(sock) ;
 
     /* incrémentation du nombre d'envoie */
-    sock->simptcp_send_count ++ ;
+    sock->nbr_retransmit ++ ;
 
     /* unlock du socket */
     unlock_simptcp_socket(sock) ;
 
-    /* ré-émission du PDU */
-    libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) ;
-
-    /* relance du timer */
-    start_timer(sock, 1000) ;
+    /* ré-émission du PDU et relance du timer */
+    retransmit_pdu(sock) ;
 
 }
 
@@ -1101,9 +2272,7 @@ void synsent_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int synrcvd_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1120,9 +2289,7 @@ int synrcvd_simptcp_socket_state_active_open (struct  simptcp_socket* sock, stru
 int synrcvd_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1140,9 +2307,7 @@ int synrcvd_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int synrcvd_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1161,9 +2326,7 @@ int synrcvd_simptcp_socket_state_accept (struct simptcp_socket* sock, struct soc
 ssize_t synrcvd_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1182,9 +2345,7 @@ ssize_t synrcvd_simptcp_socket_state_send (struct simptcp_socket* sock, const vo
 ssize_t synrcvd_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1200,9 +2361,7 @@ ssize_t synrcvd_simptcp_socket_state_recv (struct simptcp_socket* sock, void *bu
 int synrcvd_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1219,9 +2378,7 @@ int synrcvd_simptcp_socket_state_close (struct simptcp_socket* sock)
 int synrcvd_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return 0;
 
 }
@@ -1238,11 +2395,11 @@ int synrcvd_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
  */
 void synrcvd_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_synrcvd, sock, buf, len);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_BADSTATE_DROPS);
     /*	if (simptcp_get_flags(buf) == ACK) {
-        sock->socket_state = & simptcp_socket_states.established ;
+        simptcp_socket_set_state(sock, & simptcp_socket_states.established);
         stop_timer(sock);
         }*/
 
@@ -1258,9 +2415,7 @@ void synrcvd_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
  */
 void synrcvd_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 }
 
 
@@ -1282,10 +2437,8 @@ void synrcvd_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int established_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("Connexion deja etablie.\n") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "Connexion deja etablie.\n");
     return -1;
 
 }
@@ -1302,10 +2455,8 @@ int established_simptcp_socket_state_active_open (struct  simptcp_socket* sock,
 int established_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("Connexion deja etablie.\n") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "Connexion deja etablie.\n");
     return -1;
 
 }
@@ -1323,10 +2474,8 @@ int established_simptcp_socket_state_passive_open (struct simptcp_socket* sock,
 int established_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    printf("Connexion deja etablie.\n") ;
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_LOG(SIMPTCP_LOG_WARN, "Connexion deja etablie.\n");
     return 0;
 
 }
@@ -1344,49 +2493,91 @@ int established_simptcp_socket_state_accept (struct simptcp_socket* sock, struct
  */
 ssize_t established_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
+    const char * data = buf;
+    size_t done = 0, chunk;
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-
-
-    if (make_pdu (sock, (char*)buf, n, 0) !=  0) {
-        printf("Erreur Make_PDU\n") ;
-    }
-
-    if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, simptcp_get_total_len(sock->out_buffer), 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-        printf("\nErreur libc_sento\n");
-
-    /* mise à l'etat d'attente d'un ack */
-    sock->socket_state_receiver = 2;
+    SIMPTCP_TRACE_CALL();
 
-    start_timer(sock,1000);
+    lock_simptcp_socket(sock);
 
-    /* incrémentation next_seq_num */
-    sock->next_seq_num++;
+    while (done < n) {
+        chunk = n - done;
 
-    /* 5 tentatives de connection au maximum */
-    int connect_max = 5 ;
+        if ((sock->snd_len == 0) && 
+            ((chunk >= sock->mss) || (sock->nodelay && !sock->cork))) {
+            /* segment plein (ou SIMPTCP_NODELAY) sans donnees en attente : 
+               il est emis directement depuis le buffer de l'application, 
+               et l'appel bloque jusqu'a son acquittement */
+            if (chunk > sock->mss)
+                chunk = sock->mss;
 
-    /* attente de l'établissement de la connection ou de l'échec de connection */
-    while (sock->simptcp_send_count < connect_max && sock->socket_state_receiver == 2) ;
+            unlock_simptcp_socket(sock);
+            if (wait_for_ack(sock) == -1)
+                return (done > 0) ? (ssize_t)done : -1;
+            lock_simptcp_socket(sock);
 
+            transmit_data(sock, data + done, chunk);
 
-    /* arret du timer */
-    stop_timer(sock) ;
+            unlock_simptcp_socket(sock);
+            if (wait_for_ack(sock) == -1)
+                return (done > 0) ? (ssize_t)done : -1;
+            lock_simptcp_socket(sock);
+        }
+        else {
+            /* petite ecriture : recopie dans le buffer d'emission. Elle part
+               tout de suite si aucun PDU n'est en attente d'acquittement 
+               (Nagle) et si le socket n'est pas bouchonne (SIMPTCP_CORK), 
+               sinon a la reception de l'acquittement */
+            if (chunk > sock->mss - sock->snd_len)
+                chunk = sock->mss - sock->snd_len;
+
+            /* la somme est calculee pendant la recopie : le PDU n'aura plus
+               a relire la charge utile */
+            if (sock->crc32c)
+                memcpy(sock->snd_buf[sock->snd_cur] + sock->snd_len, data + done, chunk);
+            else
+                sock->snd_sum = simptcp_csum_block_add(sock->snd_sum,
+                    simptcp_csum_copy(sock->snd_buf[sock->snd_cur] + sock->snd_len,
+                                      data + done, chunk, 0),
+                    sock->snd_len);
+            sock->snd_len += chunk;
+
+            if (sock->socket_state_sender != wait_ack && can_transmit_queued(sock))
+                transmit_queued(sock);
+
+            /* buffer plein et PDU precedent en vol : on attend que l'entite 
+               l'emette a la reception de l'acquittement */
+            while (sock->snd_len >= sock->mss) {
+                unlock_simptcp_socket(sock);
+                if (wait_for_ack(sock) == -1)
+                    return (done > 0) ? (ssize_t)done : -1;
+                lock_simptcp_socket(sock);
+                if (sock->socket_state_sender != wait_ack && sock->snd_len > 0)
+                    transmit_queued(sock);
+            }
+        }
 
-    /* retour d'erreur en cas d'échec */
-    if (sock->simptcp_send_count >= connect_max) {
-        sock->socket_state = & simptcp_socket_states.closed ;
-        return -1;
+        done += chunk;
     }
 
-    /* remise à 0 du compteur d'échec */
-    sock->simptcp_send_count = 0;
-
+    unlock_simptcp_socket(sock);
 
-    return 0;
+    return n;
 }    
+/*! \fn void rx_queue_consumed (struct simptcp_socket* sock)
+ * \brief lancee quand l'application a lu un PDU de la file de reception : 
+ * l'acquittement retenu faute de place (#deliver_data) part maintenant. Le 
+ * socket doit etre verrouille
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+static void rx_queue_consumed (struct simptcp_socket* sock)
+{
+    if (sock->ack_held && (sock->in_queue_count < SIMPTCP_RX_QUEUE_LEN)) {
+        if (send_ack(sock) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+    }
+}
+
 /**
  * called when application calls recv
  */
@@ -1401,16 +2592,146 @@ ssize_t established_simptcp_socket_state_send (struct simptcp_socket* sock, cons
 ssize_t established_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    sock->socket_state_sender = 1;
+    SIMPTCP_TRACE_CALL();
+    char * pdu;
+    size_t hlen, dlen, chunk;
+    struct timeval t0;
+
+    /* rien en attente : l'entite pourra deposer la prochaine charge utile
+       directement dans buf, en la verifiant au passage */
+    lock_simptcp_socket(sock);
+    if ((sock->in_pdu == NULL) && !sock->in_loaned) {
+        sock->ucopy_buf = buf;
+        sock->ucopy_len = n;
+        sock->ucopy_done = 0;
+    }
+    unlock_simptcp_socket(sock);
+
+    /* en attente d'une trame de la part du client */
+    while ((sock->in_pdu == NULL) && (sock->ucopy_done == 0) && 
+           (sock->socket_state == & simptcp_socket_states.established));
+
+    lock_simptcp_socket(sock);
+    sock->ucopy_buf = NULL;
+    dlen = sock->ucopy_done;
+    sock->ucopy_done = 0;
+    unlock_simptcp_socket(sock);
+    if (dlen > 0) {
+        gettimeofday(&t0, NULL);
+        simptcp_latency_record(sock, SIMPTCP_HIST_RECV_WAKEUP,
+                               (t0.tv_sec - sock->in_arrival.tv_sec) * 1000000LL +
+                               (t0.tv_usec - sock->in_arrival.tv_usec));
+        return dlen;
+    }
+
+    /* la connexion a ete fermee par le distant */
+    if (sock->in_pdu == NULL)
+        return 0;
+
+    if (sock->in_loaned) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    lock_simptcp_socket(sock);
+
+    /* unique recopie : du buffer de reception de l'entite vers le buffer 
+       de l'application, PDU apres PDU tant que buf n'est pas plein. La 
+       charge utile est bornee par la taille du datagramme recu (in_len) */
+    dlen = 0;
+    while ((sock->in_pdu != NULL) && (dlen < n)) {
+        pdu = sock->in_pdu;
+        hlen = simptcp_get_head_len(pdu);
+
+        /* delai depuis l'arrivee, a la premiere lecture du PDU */
+        if (sock->in_off == 0) {
+            gettimeofday(&t0, NULL);
+            simptcp_latency_record(sock, SIMPTCP_HIST_RECV_WAKEUP,
+                                   (t0.tv_sec - sock->in_arrival.tv_sec) * 1000000LL +
+                                   (t0.tv_usec - sock->in_arrival.tv_usec));
+        }
+
+        chunk = sock->in_len - hlen - sock->in_off;
+        if (chunk > n - dlen)
+            chunk = n - dlen;
+        memcpy((char *) buf + dlen, pdu + hlen + sock->in_off, chunk);
+        sock->in_off += chunk;
+        dlen += chunk;
+
+        /* PDU entierement lu : on le rend a l'entite */
+        if (hlen + sock->in_off >= sock->in_len)
+            rx_queue_pop(sock);
+    }
+    rx_queue_consumed(sock);
+
+    unlock_simptcp_socket(sock);
+
+    return dlen;
+
+}
+
+/*! \fn ssize_t simptcp_socket_recv_loan (struct simptcp_socket* sock, const void ** data)
+ * \brief prete a l'application, en lecture seule, la charge utile non lue du PDU recu
+ * sur le socket, sans la recopier. Le PDU reste reserve jusqu'a l'appel de
+ * #simptcp_socket_recv_release ; les PDU recus d'ici la attendent derriere lui
+ * dans la file de reception. Apres la fin de connexion du distant (closewait),
+ * les donnees deja recues restent lisibles
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param [out] data pointeur sur la charge utile pretee
+ * \return taille en octet de la charge utile pretee, 0 si la connexion est fermee, -1 si echec
+ */
+ssize_t simptcp_socket_recv_loan (struct simptcp_socket* sock, const void ** data)
+{
+    size_t hlen, dlen;
+
+    SIMPTCP_TRACE_CALL();
+    if ((sock->socket_state != & simptcp_socket_states.established) &&
+        (sock->socket_state != & simptcp_socket_states.closewait)) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (sock->in_loaned) {
+        errno = EBUSY;
+        return -1;
+    }
 
     /* en attente d'une trame de la part du client */
-    while(sock->socket_state_sender == 1);
+    while ((sock->in_pdu == NULL) && (sock->socket_state == & simptcp_socket_states.established));
+
+    if (sock->in_pdu == NULL)
+        return 0;
+
+    lock_simptcp_socket(sock);
+    sock->in_loaned = 1;
+    hlen = simptcp_get_head_len(sock->in_pdu);
+    *data = sock->in_pdu + hlen + sock->in_off;
+    dlen = sock->in_len - hlen - sock->in_off;
+    unlock_simptcp_socket(sock);
+
+    return dlen;
+}
+
+/*! \fn int simptcp_socket_recv_release (struct simptcp_socket* sock)
+ * \brief rend a l'entite le PDU prete par #simptcp_socket_recv_loan. La charge 
+ * utile pretee est consideree comme lue
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return 0 si succes, -1 si aucun PDU n'etait prete
+ */
+int simptcp_socket_recv_release (struct simptcp_socket* sock)
+{
+    SIMPTCP_TRACE_CALL();
+    if (!sock->in_loaned) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    return simptcp_extract_data(sock->in_buffer,buf);
+    lock_simptcp_socket(sock);
+    sock->in_loaned = 0;
+    rx_queue_pop(sock);
+    rx_queue_consumed(sock);
+    unlock_simptcp_socket(sock);
 
+    return 0;
 }
 
 /**
@@ -1424,9 +2745,7 @@ ssize_t established_simptcp_socket_state_recv (struct simptcp_socket* sock, void
 int established_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     return 0;
 
@@ -1443,12 +2762,15 @@ int established_simptcp_socket_state_close (struct simptcp_socket* sock)
  */
 int established_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    /* les donnees en attente (petites ecritures, socket bouchonne) sont 
+       emises et acquittees avant la fermeture */
+    if (simptcp_socket_flush(sock) == -1)
+        return -1;
+
     /* si le socket est un serveur, on attend une demande de déconnection de la part du client */
     if (sock->socket_type != client) {
-        printf("\nWainting for closing request from client\n");
+        SIMPTCP_LOG(SIMPTCP_LOG_INFO, "Wainting for closing request from client\n");
         while (sock->socket_state != & simptcp_socket_states.closewait) ;
 
         return closewait_simptcp_socket_state_shutdown(sock,how);
@@ -1457,43 +2779,138 @@ int established_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int
 
 
     if ( make_pdu (sock, NULL, 0, FIN) !=  0) {
-        printf("Erreur Make_PDU\n") ;
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur Make_PDU\n");
         return -1;
     }
 
-    if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1){
-        printf("\nErreur libc_sento\n");
+    if (send_pdu(sock) == -1){
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
         return -1;
     }
 
     sock->next_seq_num ++;
 
     /* changement d'état du socket */
-    sock->socket_state = & simptcp_socket_states.finwait1 ;
+    simptcp_socket_set_state(sock, & simptcp_socket_states.finwait1);
 
-    start_timer(sock,1000);
+    start_timer(sock, sock->timer_duration);
+    rtt_start(sock);
 
     /* 5 tentatives de connection au maximum */
     int connect_max = 5 ;
 
-    /* attente de l'établissement de la connection ou de l'échec de connection */
-    while (sock->simptcp_send_count < connect_max && sock->socket_state != & simptcp_socket_states.closed) ;
+    /* attente de la fin de la connexion (timewait) ou de l'échec de la fermeture */
+    while (sock->nbr_retransmit < connect_max && 
+           sock->socket_state != & simptcp_socket_states.closed &&
+           sock->socket_state != & simptcp_socket_states.timewait) ;
 
 
-    /* arret du timer */
-    stop_timer(sock) ;
+    /* arret du timer (sauf celui du timewait) */
+    if (sock->socket_state != & simptcp_socket_states.timewait)
+        stop_timer(sock) ;
 
     /* retour d'erreur en cas d'échec */
-    if (sock->simptcp_send_count >= connect_max) {
-        sock->socket_state = & simptcp_socket_states.closed;
+    if (sock->nbr_retransmit >= connect_max) {
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
         return -1;
     }
     /* remise à 0 du compteur d'échec */
-    sock->simptcp_send_count = 0;
+    sock->nbr_retransmit = 0;
 
     return 0;
 }
 
+/*! \fn u_int64_t prediction_word (u_int16_t seq, u_int16_t ack, unsigned char hlen, unsigned char flags, u_int16_t tlen)
+ * \brief construit, tels qu'ils figurent dans le PDU, les 8 octets de l'en-tete 
+ * compares par la prediction d'en-tete : seq_num, ack_num, header_len, flags
+ * et total_len
+ * \return les 8 octets sous forme d'un mot, a comparer avec #PREDICTION_LOAD
+ */
+static inline u_int64_t prediction_word (u_int16_t seq, u_int16_t ack, unsigned char hlen,
+                                         unsigned char flags, u_int16_t tlen)
+{
+    simptcp_generic_header h;
+    u_int64_t word;
+
+    h.seq_num = htons(seq);
+    h.ack_num = htons(ack);
+    h.header_len = hlen;
+    h.flags = flags;
+    h.total_len = htons(tlen);
+    memcpy(&word, &h.seq_num, sizeof(word));
+    return word;
+}
+
+/* chargement en une fois des 8 octets compares par la prediction d'en-tete */
+#define PREDICTION_LOAD(word, buf) \
+    memcpy(&(word), (char *) (buf) + offsetof(simptcp_generic_header, seq_num), \
+           sizeof(word))
+
+/*! \fn void process_ack (struct simptcp_socket* sock)
+ * \brief traite l'acquittement du PDU en vol : arret du timer et emission
+ * des donnees accumulees entre-temps
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+static void process_ack (struct simptcp_socket* sock)
+{
+    lock_simptcp_socket(sock);
+    if (sock->socket_state_sender == wait_ack) {
+        stop_timer(sock);
+        rtt_ack(sock);
+        sock->nbr_retransmit = 0;
+        sock->socket_state_sender = wait_message;
+
+        /* les petites ecritures accumulees pendant l'attente 
+           partent maintenant (Nagle) */
+        if (can_transmit_queued(sock))
+            transmit_queued(sock);
+    }
+    unlock_simptcp_socket(sock);
+}
+
+/*! \fn void deliver_data (struct simptcp_socket* sock, void* buf, int len)
+ * \brief remet a l'application le PDU de donnees attendu et programme son 
+ * acquittement. La file de reception du socket ne doit pas etre pleine
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param buf pointeur sur le PDU simpTCP recu
+ * \param len taille en octets du PDU recu
+ */
+static void deliver_data (struct simptcp_socket* sock, void* buf, int len)
+{
+    lock_simptcp_socket(sock);
+    if (sock->ucopy_filled > 0) {
+        /* la charge utile est deja dans le buffer de l'application 
+           (receive_direct) : le recv peut rendre la main */
+        sock->ucopy_done = sock->ucopy_filled;
+        sock->ucopy_filled = 0;
+    }
+    else {
+        /* on place le pdu par reference (sans recopie) dans la file 
+           de reception du socket pour pouvoir etre lu par le recv */
+        rx_queue_push(sock, buf, len);
+    }
+    if (sock->in_queue_count == 0)
+        sock->in_arrival = simptcp_entity.in_time;
+    sock->bytes_received += len - simptcp_get_head_len(buf);
+    unlock_simptcp_socket(sock);
+
+    sock->next_ack_num++;
+
+    /* acquittement immediat ou differe ; si la file de reception est 
+       pleine, il attend que l'application y libere une place (controle 
+       de flux) : le PDU suivant n'aurait pas ou etre range */
+    lock_simptcp_socket(sock);
+    if (sock->in_queue_count == SIMPTCP_RX_QUEUE_LEN) {
+        sock->ack_pending++;
+        sock->ack_held = 1;
+        stop_delack_timer(sock);
+    }
+    else
+        schedule_ack(sock, 
+                     len - simptcp_get_head_len(buf) >= sock->mss);
+    unlock_simptcp_socket(sock);
+}
+
 /**
  * called when library demultiplexed a packet to this particular socket
  */
@@ -1506,68 +2923,89 @@ int established_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int
  */
 void established_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
+    u_int64_t word;
+    unsigned char hlen;
+    simptcp_header_fields h;
+
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_established, sock, buf, len);
+
+    /* prediction d'en-tete [Van Jacobson] : les deux cas courants, 
+       acquittement pur du PDU en vol et PDU de donnees attendu (sans flag),
+       sont reconnus par une seule comparaison des 8 octets seq_num .. 
+       total_len avec les valeurs attendues */
+    hlen = SIMPTCP_GHEADER_SIZE + (sock->crc32c ? SIMPTCP_CRC32C_LEN : 0);
+    PREDICTION_LOAD(word, buf);
+
+    if ((word == prediction_word(sock->next_ack_num, sock->next_seq_num, 
+                                 hlen, ACK, hlen)) &&
+        (sock->socket_state_sender == wait_ack)) {
+        sock->prediction_hits++;
+        process_ack(sock);
+        return;
+    }
+    if (((word & prediction_word(0xffff, 0xffff, 0xff, 0xff, 0)) ==
+         prediction_word(sock->next_ack_num, sock->next_seq_num, hlen, 0, 0)) &&
+        (len > hlen) && (sock->in_queue_count < SIMPTCP_RX_QUEUE_LEN)) {
+        sock->prediction_hits++;
+        deliver_data(sock, buf, len);
+        return;
+    }
+    sock->prediction_misses++;
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    /* cas general : l'en-tete est decode en une fois */
+    simptcp_parse_header(buf, &h);
 
-    if (simptcp_get_flags(buf) == ACK){
+    if (h.flags == ACK){
         /* vérification du numero d'ack */
-        if (simptcp_get_ack_num(buf) == sock->next_seq_num)
-        {
-            sock->socket_state_receiver = -1;
-        }
+        if (h.ack_num == sock->next_seq_num)
+            process_ack(sock);
     }
 
-    if (simptcp_get_flags(buf) == 0){
-        if (simptcp_get_seq_num(buf) == sock->next_ack_num) {
-            /* on place le pdu dans la structure sock pour pouvoir etre lu par le recv */	
-            memcpy(sock->in_buffer,buf,len);
-            /* on indique au recv qu'un paquet est arrivé */
-            sock->socket_state_sender=-1;
-
-            sock->next_ack_num++;
-
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-                printf("Erreur Make_PDU\n") ;
+    /* donnees, eventuellement accompagnees d'un acquittement (piggybacking) */
+    if (h.flags == 0 || 
+        (h.flags == ACK && h.total_len > h.header_len)){
+        if (h.seq_num == sock->next_ack_num) {
+            /* la file de reception est pleine, l'application ne lit pas :
+               on ne l'acquitte pas, l'emetteur le retransmettra */
+            if (sock->in_queue_count == SIMPTCP_RX_QUEUE_LEN) {
+                SIMPTCP_STAT_INC(SIMPTCP_STAT_QUEUE_DROPS);
+                return;
+            }
 
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            deliver_data(sock, buf, len);
         }
         else {
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-                printf("Erreur Make_PDU\n") ;
-
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            /* duplicata : notre acquittement a ete perdu ou trop tarde, 
+               on acquitte tout de suite et on passe en mode quick-ack */
+            lock_simptcp_socket(sock);
+            sock->simptcp_in_errors_count++;
+            enter_quickack_mode(sock);
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+            unlock_simptcp_socket(sock);
         }
 
     }
 
-    if (simptcp_get_flags(buf) == FIN) {
-        if (simptcp_get_seq_num(buf) == sock->next_ack_num) {
+    if (h.flags == FIN) {
+        if (h.seq_num == sock->next_ack_num) {
 
             /* incrementation du next num seq */
             sock->next_ack_num ++ ;
 
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-                printf("Erreur Make_PDU\n") ;
-
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
-            sock->socket_state = & simptcp_socket_states.closewait ;
+            simptcp_socket_set_state(sock, & simptcp_socket_states.closewait);
 
 
 
 
         }
         else {
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-                printf("Erreur Make_PDU\n") ;
-
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
         }
 
@@ -1586,9 +3024,7 @@ void established_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket
 void established_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     /* arrêt du timer */
     stop_timer(sock) ;
@@ -1596,18 +3032,33 @@ void established_simptcp_socket_state_handle_timeout (struct simptcp_socket* soc
     /* lock du socket */
     lock_simptcp_socket(sock) ;
 
+    /* le PDU a ete acquitte entre temps */
+    if (sock->socket_state_sender != wait_ack) {
+        unlock_simptcp_socket(sock) ;
+        return;
+    }
+
     /* incrémentation du nombre d'envoie */
-    sock->simptcp_send_count ++ ;
+    sock->nbr_retransmit ++ ;
+
+    /* abandon de la connexion : personne n'attend forcement l'acquittement
+       (les petites ecritures sont emises en asynchrone) */
+    if (sock->nbr_retransmit >= SIMPTCP_MAX_SEND) {
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
+        unlock_simptcp_socket(sock) ;
+        return;
+    }
+
+    /* ré-émission du PDU, avec le dernier numero d'acquittement (mise a jour
+       incrementale du checksum, sans relire la charge utile), et relance 
+       du timer */
+    set_header_word(sock, sock->out_buffer, offsetof(simptcp_generic_header, ack_num),
+                    (u_int16_t)(sock->next_ack_num), sock->out_data,
+                    sock->out_len - simptcp_get_head_len(sock->out_buffer));
+    retransmit_pdu(sock) ;
 
     /* unlock du socket */
     unlock_simptcp_socket(sock) ;
-    /* ré-émission du PDU */
-    libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) ;
-
-    /* relance du timer */
-    start_timer(sock, 1000) ;
-
-
 }
 
 
@@ -1629,9 +3080,7 @@ void established_simptcp_socket_state_handle_timeout (struct simptcp_socket* soc
 int closewait_simptcp_socket_state_active_open (struct  simptcp_socket* sock,  struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1648,9 +3097,7 @@ int closewait_simptcp_socket_state_active_open (struct  simptcp_socket* sock,  s
 int closewait_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1668,9 +3115,7 @@ int closewait_simptcp_socket_state_passive_open (struct simptcp_socket* sock, in
 int closewait_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1689,9 +3134,7 @@ int closewait_simptcp_socket_state_accept (struct simptcp_socket* sock, struct s
 ssize_t closewait_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1705,15 +3148,17 @@ ssize_t closewait_simptcp_socket_state_send (struct simptcp_socket* sock, const
  * \param [out] buf  pointeur sur le message recu
  * \param n Taille max du buffer de reception pointe par buf
  * \param flags options
- * \return  taille en octet du message recu, -1 si echec
+ * \return  taille en octet du message recu, 0 une fois les donnees recues 
+ * avant le FIN lues, -1 si echec
  */
 ssize_t closewait_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    return -1;
+    SIMPTCP_TRACE_CALL();
+
+    /* les donnees recues (et acquittees) avant le FIN sont d'abord rendues 
+       a l'application ; la fin de connexion (0) vient ensuite */
+    return established_simptcp_socket_state_recv(sock, buf, n, flags);
 
 }
 
@@ -1728,9 +3173,7 @@ ssize_t closewait_simptcp_socket_state_recv (struct simptcp_socket* sock, void *
 int closewait_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1747,34 +3190,33 @@ int closewait_simptcp_socket_state_close (struct simptcp_socket* sock)
 int closewait_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
-    sock->socket_state = & simptcp_socket_states.lastack ;
+    simptcp_socket_set_state(sock, & simptcp_socket_states.lastack);
     if ( make_pdu (sock, NULL, 0, FIN) !=  0) 
-        printf("Erreur Make_PDU\n") ;
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur Make_PDU\n");
 
-    if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-        printf("\nErreur libc_sento\n");
+    if (send_pdu(sock) == -1)
+        SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
     sock->next_seq_num ++ ;
 
-    start_timer(sock,1000);
+    start_timer(sock, sock->timer_duration);
+    rtt_start(sock);
 
     int connect_max = 5;
-    while (sock->simptcp_send_count < connect_max && (sock->socket_state != (& simptcp_socket_states.closed)));
+    while (sock->nbr_retransmit < connect_max && (sock->socket_state != (& simptcp_socket_states.closed)));
 
     /* arret du timer */
     stop_timer(sock) ;
 
     /* retour d'erreur en cas d'échec */
-    if (sock->simptcp_send_count >= connect_max) {
-        sock->socket_state = & simptcp_socket_states.closed;
+    if (sock->nbr_retransmit >= connect_max) {
+        simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
         return -1;
     }
     /* remise à 0 du compteur d'échec */
-    sock->simptcp_send_count = 0;
+    sock->nbr_retransmit = 0;
 
 
 
@@ -1794,9 +3236,9 @@ int closewait_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int ho
  */
 void closewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_closewait, sock, buf, len);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_BADSTATE_DROPS);
 
 }
 
@@ -1810,9 +3252,7 @@ void closewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket*
  */
 void closewait_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 }
 
 
@@ -1834,9 +3274,7 @@ void closewait_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int finwait1_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1853,9 +3291,7 @@ int finwait1_simptcp_socket_state_active_open (struct  simptcp_socket* sock, str
 int finwait1_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 }
 
@@ -1872,9 +3308,7 @@ int finwait1_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int finwait1_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1893,9 +3327,7 @@ int finwait1_simptcp_socket_state_accept (struct simptcp_socket* sock, struct so
 ssize_t finwait1_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1914,9 +3346,7 @@ ssize_t finwait1_simptcp_socket_state_send (struct simptcp_socket* sock, const v
 ssize_t finwait1_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1932,9 +3362,7 @@ ssize_t finwait1_simptcp_socket_state_recv (struct simptcp_socket* sock, void *b
 int finwait1_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 }
 
@@ -1950,9 +3378,7 @@ int finwait1_simptcp_socket_state_close (struct simptcp_socket* sock)
 int finwait1_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -1969,14 +3395,14 @@ int finwait1_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how
  */
 void finwait1_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_finwait1, sock, buf, len);
     if (simptcp_get_flags(buf) == ACK)
         /* vérification du numero de ack */
         if (simptcp_get_ack_num(buf) == sock->next_seq_num) {
-            sock->socket_state = & simptcp_socket_states.finwait2 ;
+            simptcp_socket_set_state(sock, & simptcp_socket_states.finwait2);
             stop_timer(sock);
+            rtt_ack(sock);
         }
 }
 
@@ -1990,9 +3416,7 @@ void finwait1_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
  */
 void finwait1_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     /* arrêt du timer */
     stop_timer(sock) ;
@@ -2001,15 +3425,12 @@ void finwait1_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
     lock_simptcp_socket(sock) ;
 
     /* incrémentation du nombre d'envoie */
-    sock->simptcp_send_count ++ ;
+    sock->nbr_retransmit ++ ;
 
     /* unlock du socket */
     unlock_simptcp_socket(sock) ;
-    /* ré-émission du PDU */
-    libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) ;
-
-    /* relance du timer */
-    start_timer(sock, 1000) ;
+    /* ré-émission du PDU et relance du timer */
+    retransmit_pdu(sock) ;
 
 
 }
@@ -2033,9 +3454,7 @@ void finwait1_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int finwait2_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2052,9 +3471,7 @@ int finwait2_simptcp_socket_state_active_open (struct  simptcp_socket* sock, str
 int finwait2_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2072,9 +3489,7 @@ int finwait2_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int finwait2_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2093,9 +3508,7 @@ int finwait2_simptcp_socket_state_accept (struct simptcp_socket* sock, struct so
 ssize_t finwait2_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2114,9 +3527,7 @@ ssize_t finwait2_simptcp_socket_state_send (struct simptcp_socket* sock, const v
 ssize_t finwait2_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2132,9 +3543,7 @@ ssize_t finwait2_simptcp_socket_state_recv (struct simptcp_socket* sock, void *b
 int finwait2_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2151,9 +3560,7 @@ int finwait2_simptcp_socket_state_close (struct simptcp_socket* sock)
 int finwait2_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2170,9 +3577,8 @@ int finwait2_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how
  */
 void finwait2_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_finwait2, sock, buf, len);
 
     if (simptcp_get_flags(buf) == FIN) {
         if (simptcp_get_seq_num(buf) == sock->next_ack_num) {
@@ -2180,26 +3586,20 @@ void finwait2_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
             /* incrementation du next num seq */
             sock->next_ack_num ++ ;
 
-            if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-                printf("Erreur Make_PDU\n") ;
+            if (send_ack(sock) == -1)
+                SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
-            if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-                printf("\nErreur libc_sento\n");
 
-
-            sock->socket_state = & simptcp_socket_states.timewait ;
-            /*attente d'une seconde dans l'etat timewait */
-            sleep(1);
-            sock->socket_state = & simptcp_socket_states.closed ;
+            /* le timewait est mesure par le timer du socket, pas en 
+               bloquant l'entite */
+            simptcp_socket_set_state(sock, & simptcp_socket_states.timewait);
+            start_timer(sock, SIMPTCP_TIMEWAIT);
         }
     }
     /* mauvais numero de sequence */
     else {
-        if ( make_pdu (sock, NULL, 0, ACK) !=  0) 
-            printf("Erreur Make_PDU\n") ;
-
-        if (libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) == -1)
-            printf("\nErreur libc_sento\n");
+        if (send_ack(sock) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
 
     }
 
@@ -2215,9 +3615,7 @@ void finwait2_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
  */
 void finwait2_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 }
 
 
@@ -2239,9 +3637,7 @@ void finwait2_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int closing_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2258,9 +3654,7 @@ int closing_simptcp_socket_state_active_open (struct  simptcp_socket* sock, stru
 int closing_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2278,9 +3672,7 @@ int closing_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int closing_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2299,9 +3691,7 @@ int closing_simptcp_socket_state_accept (struct simptcp_socket* sock, struct soc
 ssize_t closing_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2320,9 +3710,7 @@ ssize_t closing_simptcp_socket_state_send (struct simptcp_socket* sock, const vo
 ssize_t closing_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2338,9 +3726,7 @@ ssize_t closing_simptcp_socket_state_recv (struct simptcp_socket* sock, void *bu
 int closing_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2357,9 +3743,7 @@ int closing_simptcp_socket_state_close (struct simptcp_socket* sock)
 int closing_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2376,9 +3760,9 @@ int closing_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
  */
 void closing_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_closing, sock, buf, len);
+    SIMPTCP_STAT_INC(SIMPTCP_STAT_BADSTATE_DROPS);
 }
 
 /**
@@ -2391,9 +3775,7 @@ void closing_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
  */
 void closing_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 }
 
 
@@ -2415,9 +3797,7 @@ void closing_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int lastack_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2434,9 +3814,7 @@ int lastack_simptcp_socket_state_active_open (struct  simptcp_socket* sock, stru
 int lastack_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2454,9 +3832,7 @@ int lastack_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int lastack_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2475,9 +3851,7 @@ int lastack_simptcp_socket_state_accept (struct simptcp_socket* sock, struct soc
 ssize_t lastack_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2496,9 +3870,7 @@ ssize_t lastack_simptcp_socket_state_send (struct simptcp_socket* sock, const vo
 ssize_t lastack_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2514,9 +3886,7 @@ ssize_t lastack_simptcp_socket_state_recv (struct simptcp_socket* sock, void *bu
 int lastack_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2533,9 +3903,7 @@ int lastack_simptcp_socket_state_close (struct simptcp_socket* sock)
 int lastack_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2552,16 +3920,16 @@ int lastack_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
  */
 void lastack_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_lastack, sock, buf, len);
     /* Verification de la reception d'un ACK */
     if (simptcp_get_flags(buf) == ACK) {
         /* Verification de la validite de la trame en regardant son num_ack */
         if (simptcp_get_ack_num(buf) == sock->next_seq_num) {
             lock_simptcp_socket(sock); 
             stop_timer(sock);
-            sock->socket_state = & simptcp_socket_states.closed ;
+            rtt_ack(sock);
+            simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
             unlock_simptcp_socket(sock);
         }
     }
@@ -2578,9 +3946,7 @@ void lastack_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
  */
 void lastack_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     /* arrêt du timer */
     stop_timer(sock) ;
@@ -2589,15 +3955,12 @@ void lastack_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
     lock_simptcp_socket(sock) ;
 
     /* incrémentation du nombre d'envoi */
-    sock->simptcp_send_count ++ ;
+    sock->nbr_retransmit ++ ;
 
     /* unlock du socket */
     unlock_simptcp_socket(sock) ;
-    /* ré-émission du PDU */
-    libc_sendto(simptcp_entity.udp_fd, sock->out_buffer, sock->out_len, 0,(struct sockaddr*)(&(sock->remote_udp)), sock->out_len) ;
-
-    /* relance du timer */
-    start_timer(sock, 1000) ;
+    /* ré-émission du PDU et relance du timer */
+    retransmit_pdu(sock) ;
 
 
 }
@@ -2622,9 +3985,7 @@ void lastack_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 int timewait_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struct sockaddr* addr, socklen_t len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2641,9 +4002,7 @@ int timewait_simptcp_socket_state_active_open (struct  simptcp_socket* sock, str
 int timewait_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2661,9 +4020,7 @@ int timewait_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int
 int timewait_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sockaddr* addr, socklen_t* len) 
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2682,9 +4039,7 @@ int timewait_simptcp_socket_state_accept (struct simptcp_socket* sock, struct so
 ssize_t timewait_simptcp_socket_state_send (struct simptcp_socket* sock, const void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2703,9 +4058,7 @@ ssize_t timewait_simptcp_socket_state_send (struct simptcp_socket* sock, const v
 ssize_t timewait_simptcp_socket_state_recv (struct simptcp_socket* sock, void *buf, size_t n, int flags)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2721,9 +4074,7 @@ ssize_t timewait_simptcp_socket_state_recv (struct simptcp_socket* sock, void *b
 int timewait_simptcp_socket_state_close (struct simptcp_socket* sock)
 {
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2739,9 +4090,7 @@ int timewait_simptcp_socket_state_close (struct simptcp_socket* sock)
  */
 int timewait_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
     return -1;
 
 }
@@ -2758,9 +4107,16 @@ int timewait_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int how
  */
 void timewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* sock, void* buf, int len)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
+    SIMPTCP_PROBE3(pdu_timewait, sock, buf, len);
+    /* FIN retransmis : notre dernier ACK a ete perdu */
+    if (simptcp_get_flags(buf) == FIN) {
+        if (send_ack(sock) == -1)
+            SIMPTCP_LOG(SIMPTCP_LOG_ERR, "Erreur libc_sento\n");
+        start_timer(sock, SIMPTCP_TIMEWAIT);
+    }
+    else
+        SIMPTCP_STAT_INC(SIMPTCP_STAT_BADSTATE_DROPS);
 }
 
 /**
@@ -2773,9 +4129,11 @@ void timewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
  */
 void timewait_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 {
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
+    /* fin du timewait : si l'application a ferme le socket, l'entite 
+       liberera son descripteur */
+    stop_timer(sock);
+    simptcp_socket_set_state(sock, & simptcp_socket_states.closed);
 }
 
@@ -0,0 +1,254 @@
+/*
+ * simptcp_log.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>               /* for clock_gettime() */
+#include <pthread.h>
+#include <simptcp_log.h>
+
+#define LOG_RING_SIZE           (256 * 1024)    /* a power of 2 */
+#define LOG_LINE_MAX            512
+#define LOG_DEFAULT_RATE        5000            /* messages per second */
+#define LOG_WRITER_PERIOD_MS    100
+
+/* run-time level of each subsystem, set from SIMPTCP_LOG */
+unsigned char simptcp_log_levels[SIMPTCP_LOG_NB_SUBSYS] = {
+    SIMPTCP_LOG_LEVEL, SIMPTCP_LOG_LEVEL, SIMPTCP_LOG_LEVEL,
+    SIMPTCP_LOG_LEVEL, SIMPTCP_LOG_LEVEL
+};
+
+static const char *subsys_names[SIMPTCP_LOG_NB_SUBSYS] = {
+    "api", "lib", "entity", "packet", "libc"
+};
+static const char level_letters[] = "-EWIDT";
+
+/* the ring: messages are appended at head by the callers and written out
+ * from tail by the writer; both only grow (modulo LOG_RING_SIZE)
+ */
+static char ring[LOG_RING_SIZE];
+static size_t ring_head, ring_tail;
+static unsigned long ring_dropped;
+static int writer_waiting;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
+/* serializes the writer thread and simptcp_log_flush() */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *output;
+
+/* rate limiting: messages counted per subsystem over the current second */
+static unsigned int rate_limit = LOG_DEFAULT_RATE;
+static struct {
+    time_t second;
+    unsigned int count;
+    unsigned long suppressed;
+} rates[SIMPTCP_LOG_NB_SUBSYS];
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+
+
+/* reads SIMPTCP_LOG ("4" or "lib=5,entity=4") and SIMPTCP_LOG_RATE before
+ * main(), so that the levels are set before the first message
+ */
+static void __attribute__((constructor)) log_configure (void)
+{
+    const char *spec = getenv("SIMPTCP_LOG");
+    const char *rate = getenv("SIMPTCP_LOG_RATE");
+    char *end;
+    long level;
+    int i, n;
+
+    if (rate != NULL)
+        rate_limit = strtoul(rate, NULL, 10);
+
+    while ((spec != NULL) && (*spec != '\0')) {
+        for (i = 0; i < SIMPTCP_LOG_NB_SUBSYS; i++) {
+            n = strlen(subsys_names[i]);
+            if (!strncmp(spec, subsys_names[i], n) && (spec[n] == '='))
+                break;
+        }
+        if (i < SIMPTCP_LOG_NB_SUBSYS)
+            spec += strlen(subsys_names[i]) + 1;
+        level = strtol(spec, &end, 10);
+        if (end == spec)
+            break;
+        if (level > SIMPTCP_LOG_TRACE)
+            level = SIMPTCP_LOG_TRACE;
+        if (level < SIMPTCP_LOG_NONE)
+            level = SIMPTCP_LOG_NONE;
+        for (n = 0; n < SIMPTCP_LOG_NB_SUBSYS; n++)
+            if ((i == SIMPTCP_LOG_NB_SUBSYS) || (i == n))
+                simptcp_log_levels[n] = level;
+        spec = (*end == ',') ? end + 1 : end;
+    }
+}
+
+/* writes out what the ring holds, and the loss counters if they moved */
+static void log_drain (void)
+{
+    size_t head, tail, off, len;
+    unsigned long dropped, suppressed = 0;
+    struct timespec now;
+    int i;
+
+    pthread_mutex_lock(&output_lock);
+
+    pthread_mutex_lock(&ring_lock);
+    head = ring_head;
+    tail = ring_tail;
+    dropped = ring_dropped;
+    ring_dropped = 0;
+    for (i = 0; i < SIMPTCP_LOG_NB_SUBSYS; i++) {
+        suppressed += rates[i].suppressed;
+        rates[i].suppressed = 0;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    /* the callers do not touch [tail, head) until ring_tail moves */
+    while (tail != head) {
+        off = tail & (LOG_RING_SIZE - 1);
+        len = head - tail;
+        if (len > LOG_RING_SIZE - off)
+            len = LOG_RING_SIZE - off;
+        fwrite(ring + off, 1, len, output);
+        tail += len;
+    }
+    if (dropped + suppressed > 0) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        fprintf(output, "%ld.%06ld W [SIMPTCP_LOG] %lu messages dropped (ring full), "
+                "%lu rate-limited\n", (long) now.tv_sec, now.tv_nsec / 1000,
+                dropped, suppressed);
+    }
+    fflush(output);
+
+    pthread_mutex_lock(&ring_lock);
+    ring_tail = head;
+    pthread_mutex_unlock(&ring_lock);
+
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void * log_writer (void *arg)
+{
+    struct timespec deadline;
+
+    (void) arg;
+    while (1) {
+        pthread_mutex_lock(&ring_lock);
+        if (ring_head == ring_tail) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_WRITER_PERIOD_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            writer_waiting = 1;
+            pthread_cond_timedwait(&ring_cond, &ring_lock, &deadline);
+            writer_waiting = 0;
+        }
+        pthread_mutex_unlock(&ring_lock);
+        log_drain();
+    }
+    return NULL;
+}
+
+static void log_start (void)
+{
+    const char *path = getenv("SIMPTCP_LOG_FILE");
+    pthread_attr_t attr;
+    pthread_t writer;
+
+    output = stdout;
+    if ((path != NULL) && ((output = fopen(path, "a")) == NULL))
+        output = stdout;
+
+    atexit(simptcp_log_flush);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&writer, &attr, log_writer, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+/* writes out the pending messages now (also done at exit) */
+void simptcp_log_flush (void)
+{
+    if (output != NULL)
+        log_drain();
+}
+
+/* formats a message and appends it to the ring, or drops it if the ring is
+ * full or its subsystem is over the rate limit; the rate limit is checked
+ * first, so that a suppressed message costs no formatting; called through
+ * SIMPTCP_LOG()
+ */
+void simptcp_log_write (int level, int subsys, const char *fmt, ...)
+{
+    char line[LOG_LINE_MAX];
+    struct timespec now;
+    va_list ap;
+    size_t off, first;
+    int len, n;
+
+    pthread_once(&writer_once, log_start);
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (rate_limit > 0) {
+        pthread_mutex_lock(&ring_lock);
+        if (rates[subsys].second != now.tv_sec) {
+            rates[subsys].second = now.tv_sec;
+            rates[subsys].count = 0;
+        }
+        if (++rates[subsys].count > rate_limit) {
+            rates[subsys].suppressed++;
+            pthread_mutex_unlock(&ring_lock);
+            return;
+        }
+        pthread_mutex_unlock(&ring_lock);
+    }
+
+    len = snprintf(line, sizeof(line), "%ld.%06ld %c ", (long) now.tv_sec,
+                   now.tv_nsec / 1000, level_letters[level]);
+    /* skip the blank lines some messages start with */
+    while (*fmt == '\n')
+        fmt++;
+    va_start(ap, fmt);
+    n = vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        n = 0;
+    len += n;
+    if (len > (int) sizeof(line) - 1)
+        len = sizeof(line) - 1;
+    /* one message per line */
+    if (line[len - 1] != '\n') {
+        if (len == (int) sizeof(line) - 1)
+            len--;
+        line[len++] = '\n';
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    if (LOG_RING_SIZE - (ring_head - ring_tail) < (size_t) len) {
+        ring_dropped++;
+        pthread_mutex_unlock(&ring_lock);
+        return;
+    }
+    off = ring_head & (LOG_RING_SIZE - 1);
+    first = LOG_RING_SIZE - off;
+    if (first >= (size_t) len)
+        memcpy(ring + off, line, len);
+    else {
+        memcpy(ring + off, line, first);
+        memcpy(ring, line + first, len - first);
+    }
+    ring_head += len;
+    if (writer_waiting && (ring_head - ring_tail > LOG_RING_SIZE / 2))
+        pthread_cond_signal(&ring_cond);
+    pthread_mutex_unlock(&ring_lock);
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,434 @@
+/*
+ * simptcp_metrics.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>             /* for unlink() */
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>           /* for struct timeval */
+#include <sys/un.h>             /* for struct sockaddr_un */
+#include <netinet/in.h>
+#include <arpa/inet.h>          /* for inet_ntop() */
+#include <simptcp_lib.h>
+#include <simptcp_entity.h>
+#include <simptcp_api.h>        /* for struct simptcp_info */
+#include <simptcp_stat.h>
+#include <simptcp_pcap.h>       /* for simptcp_pcap_dropped() */
+#include <libc_socket.h>
+#include <simptcp_metrics.h>
+
+#define ACCEPT_PERIOD_MS        200     /* the thread checks for stop this often */
+#define REQUEST_MAX             2048
+#define REQUEST_TIMEOUT_S       1
+#define CONTENT_TYPE            "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* what a scrape reads of a socket */
+struct socket_snapshot {
+    int used;
+    const char *state;
+    struct sockaddr_in local, remote;
+    struct simptcp_info info;
+    simptcp_hist latency[SIMPTCP_HIST_NB];
+};
+
+static int listen_fd = -1;
+static char unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static int stopping;
+static pthread_t exporter;
+
+static const char *stat_names[] = SIMPTCP_STAT_NAMES;
+static const char *hist_names[] = SIMPTCP_HIST_NAMES;
+
+
+/* copies the figures of every socket; the socket structures are read as
+ * they are, without lock
+ */
+static void snapshot_sockets (struct socket_snapshot snap[MAX_OPEN_SOCK])
+{
+    struct simptcp_socket *sock;
+    int fd;
+
+    memset(snap, 0, MAX_OPEN_SOCK * sizeof(struct socket_snapshot));
+    for (fd = 0; fd < MAX_OPEN_SOCK; fd++) {
+        sock = __atomic_load_n(&(simptcp_entity.simptcp_socket_descriptors[fd]),
+                               __ATOMIC_ACQUIRE);
+        if ((sock == NULL) || (sock->socket_state == NULL))
+            continue;
+        snap[fd].used = 1;
+        snap[fd].state = simptcp_socket_state_get_str(sock->socket_state);
+        snap[fd].local = sock->local_simptcp;
+        snap[fd].remote = sock->remote_simptcp;
+        simptcp_socket_get_info(sock, &(snap[fd].info));
+        memcpy(snap[fd].latency, sock->latency, sizeof(snap[fd].latency));
+    }
+}
+
+/* the samples of a histogram family: cumulative buckets at the powers of 2
+ * of microseconds, count and sum in seconds; labels is "" or "a=\"b\",.."
+ */
+static void render_hist (FILE *out, const char *name, const char *labels,
+                         const simptcp_hist *h)
+{
+    const char *sep = (labels[0] != '\0') ? "," : "";
+    u_int64_t cum = 0;
+    int b = 0, k;
+
+    for (k = 0; k <= SIMPTCP_METRICS_HIST_MAX_POW; k++) {
+        /* the values below 2^k us */
+        while ((b < SIMPTCP_HIST_BUCKETS) && (simptcp_hist_highest(b) < (1u << k)))
+            cum += h->buckets[b++];
+        fprintf(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep,
+                (1u << k) / 1e6, (unsigned long long) cum);
+    }
+    while (b < SIMPTCP_HIST_BUCKETS)
+        cum += h->buckets[b++];
+    /* the buckets, not h->count, that a concurrent record may have updated
+       first: +Inf and _count must agree */
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+            (unsigned long long) cum);
+    fprintf(out, "%s_count{%s} %llu\n", name, labels, (unsigned long long) cum);
+    fprintf(out, "%s_sum{%s} %.6f\n", name, labels, h->sum / 1e6);
+}
+
+static void family (FILE *out, const char *name, const char *type, const char *unit,
+                    const char *help)
+{
+    fprintf(out, "# TYPE %s %s\n", name, type);
+    if (unit != NULL)
+        fprintf(out, "# UNIT %s %s\n", name, unit);
+    fprintf(out, "# HELP %s %s\n", name, help);
+}
+
+static void render_entity (FILE *out, const struct socket_snapshot snap[MAX_OPEN_SOCK])
+{
+    u_int64_t values[SIMPTCP_STAT_NB];
+    simptcp_hist hist[SIMPTCP_HIST_NB];
+    char labels[64];
+    int i, n;
+
+    simptcp_stat_sum(values);
+    simptcp_stat_hist_sum(hist);
+
+    family(out, "simptcp_datagrams", "counter", NULL, "UDP datagrams of the entity.");
+    fprintf(out, "simptcp_datagrams_total{direction=\"rx\"} %llu\n",
+            (unsigned long long) values[SIMPTCP_STAT_RX_DATAGRAMS]);
+    fprintf(out, "simptcp_datagrams_total{direction=\"tx\"} %llu\n",
+            (unsigned long long) values[SIMPTCP_STAT_TX_DATAGRAMS]);
+
+    family(out, "simptcp_errors", "counter", NULL, "Failed recvfrom and sendmsg calls.");
+    fprintf(out, "simptcp_errors_total{direction=\"rx\"} %llu\n",
+            (unsigned long long) values[SIMPTCP_STAT_RX_ERRORS]);
+    fprintf(out, "simptcp_errors_total{direction=\"tx\"} %llu\n",
+            (unsigned long long) values[SIMPTCP_STAT_TX_ERRORS]);
+
+    family(out, "simptcp_drops", "counter", NULL, "PDUs dropped, by reason.");
+    for (i = SIMPTCP_STAT_CSUM_DROPS; i <= SIMPTCP_STAT_QUEUE_DROPS; i++)
+        fprintf(out, "simptcp_drops_total{reason=\"%.*s\"} %llu\n",
+                (int) (strlen(stat_names[i]) - strlen("_drops")), stat_names[i],
+                (unsigned long long) values[i]);
+
+    family(out, "simptcp_entity_loops", "counter", NULL,
+           "Iterations of the entity loop.");
+    fprintf(out, "simptcp_entity_loops_total %llu\n",
+            (unsigned long long) values[SIMPTCP_STAT_LOOPS]);
+
+    family(out, "simptcp_entity_idle_seconds", "counter", "seconds",
+           "Time the entity loop received nothing.");
+    fprintf(out, "simptcp_entity_idle_seconds_total %.6f\n",
+            values[SIMPTCP_STAT_IDLE_US] / 1e6);
+
+    family(out, "simptcp_pcap_dropped", "counter", NULL,
+           "Datagrams not captured, the capture ring being full.");
+    fprintf(out, "simptcp_pcap_dropped_total %lu\n", simptcp_pcap_dropped());
+
+    for (i = 0, n = 0; i < MAX_OPEN_SOCK; i++)
+        n += snap[i].used;
+    family(out, "simptcp_sockets", "gauge", NULL, "Open simpTCP sockets.");
+    fprintf(out, "simptcp_sockets %d\n", n);
+
+    for (i = 0, n = 0; i < SIMPTCP_RX_POOL_SIZE; i++)
+        n += (__atomic_load_n(&(simptcp_entity.rx_pool_refs[i]), __ATOMIC_RELAXED) > 0);
+    family(out, "simptcp_rx_buffers_used", "gauge", NULL,
+           "Buffers of the receive pool in use.");
+    fprintf(out, "simptcp_rx_buffers_used %d\n", n);
+
+    family(out, "simptcp_latency_seconds", "histogram", "seconds",
+           "Latencies measured by the entity.");
+    for (i = 0; i < SIMPTCP_HIST_NB; i++) {
+        snprintf(labels, sizeof(labels), "measure=\"%.*s\"",
+                 (int) (strlen(hist_names[i]) - strlen("_us")), hist_names[i]);
+        render_hist(out, "simptcp_latency_seconds", labels, &(hist[i]));
+    }
+}
+
+/* one counter or gauge family of the sockets, the value of each computed by
+ * expr from info, its struct simptcp_info
+ */
+#define SOCKET_FAMILY(out, snap, name, type, unit, help, fmt, expr)           \
+    do {                                                                \
+        int fd_;                                                        \
+        family((out), (name), (type), (unit), (help));                  \
+        for (fd_ = 0; fd_ < MAX_OPEN_SOCK; fd_++)                       \
+            if ((snap)[fd_].used) {                                     \
+                const struct simptcp_info *info = &((snap)[fd_].info);  \
+                fprintf((out), "%s%s{fd=\"%d\"} " fmt "\n", (name),     \
+                        strcmp((type), "counter") ? "" : "_total", fd_, (expr)); \
+            }                                                           \
+    } while (0)
+
+static void render_sockets (FILE *out, const struct socket_snapshot snap[MAX_OPEN_SOCK])
+{
+    char local[INET_ADDRSTRLEN], remote[INET_ADDRSTRLEN], labels[64];
+    int fd, i;
+
+    family(out, "simptcp_socket", "info", NULL, "simpTCP sockets.");
+    for (fd = 0; fd < MAX_OPEN_SOCK; fd++)
+        if (snap[fd].used) {
+            inet_ntop(AF_INET, &(snap[fd].local.sin_addr), local, sizeof(local));
+            inet_ntop(AF_INET, &(snap[fd].remote.sin_addr), remote, sizeof(remote));
+            fprintf(out, "simptcp_socket_info{fd=\"%d\",state=\"%s\",local=\"%s:%hu\","
+                    "remote=\"%s:%hu\",crc32c=\"%d\"} 1\n", fd, snap[fd].state,
+                    local, ntohs(snap[fd].local.sin_port), remote,
+                    ntohs(snap[fd].remote.sin_port), snap[fd].info.crc32c);
+        }
+
+    SOCKET_FAMILY(out, snap, "simptcp_socket_srtt_seconds", "gauge", "seconds",
+                  "Smoothed round trip time (0: no measure yet).", "%.6f",
+                  info->srtt_us / 1e6);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_rttvar_seconds", "gauge", "seconds",
+                  "Round trip time variation.", "%.6f", info->rttvar_us / 1e6);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_rto_seconds", "gauge", "seconds",
+                  "Retransmission timeout.", "%.3f", info->rto_us / 1e6);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_sent_bytes", "counter", "bytes",
+                  "Payload sent, retransmissions included.", "%llu", info->bytes_sent);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_retransmitted_bytes", "counter", "bytes",
+                  "Payload retransmitted.", "%llu", info->bytes_retrans);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_received_bytes", "counter", "bytes",
+                  "Payload delivered to the application.", "%llu",
+                  info->bytes_received);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_segments_out", "counter", NULL,
+                  "PDUs sent, ACKs included.", "%lu", info->segs_out);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_segments_in", "counter", NULL,
+                  "PDUs received for the socket.", "%lu", info->segs_in);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_retransmits", "counter", NULL,
+                  "PDUs retransmitted.", "%lu", info->total_retrans);
+    SOCKET_FAMILY(out, snap, "simptcp_socket_in_errors", "counter", NULL,
+                  "Unexpected PDUs received (duplicates..).", "%lu", info->in_errors);
+
+    family(out, "simptcp_socket_latency_seconds", "histogram", "seconds",
+           "Latencies measured on the socket.");
+    for (fd = 0; fd < MAX_OPEN_SOCK; fd++)
+        if (snap[fd].used)
+            for (i = 0; i < SIMPTCP_HIST_NB; i++) {
+                snprintf(labels, sizeof(labels), "fd=\"%d\",measure=\"%.*s\"", fd,
+                         (int) (strlen(hist_names[i]) - strlen("_us")), hist_names[i]);
+                render_hist(out, "simptcp_socket_latency_seconds", labels,
+                            &(snap[fd].latency[i]));
+            }
+}
+
+/* renders the whole exposition; returns a malloc'ed buffer of *len bytes */
+static char * render (size_t *len)
+{
+    struct socket_snapshot snap[MAX_OPEN_SOCK];
+    char *buf = NULL;
+    FILE *out;
+
+    out = open_memstream(&buf, len);
+    if (out == NULL)
+        return NULL;
+    snapshot_sockets(snap);
+    render_entity(out, snap);
+    render_sockets(out, snap);
+    fprintf(out, "# EOF\n");
+    fclose(out);
+    return buf;
+}
+
+static int send_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = libc_send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* answers one HTTP request: GET /metrics (or /), anything else is 404 */
+static void serve (int fd)
+{
+    struct timeval timeout = { REQUEST_TIMEOUT_S, 0 };
+    char req[REQUEST_MAX + 1], head[256];
+    size_t got = 0, len = 0;
+    ssize_t n;
+    char *body;
+
+    libc_setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (got < REQUEST_MAX) {
+        n = libc_recv(fd, req + got, REQUEST_MAX - got, 0);
+        if (n <= 0)
+            break;
+        got += n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+    req[got] = '\0';
+
+    if (strncmp(req, "GET /metrics", 12) && strncmp(req, "GET / ", 6)) {
+        snprintf(head, sizeof(head), "HTTP/1.0 404 Not Found\r\n"
+                 "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        send_all(fd, head, strlen(head));
+        return;
+    }
+
+    body = render(&len);
+    if (body == NULL) {
+        snprintf(head, sizeof(head), "HTTP/1.0 500 Internal Server Error\r\n"
+                 "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        send_all(fd, head, strlen(head));
+        return;
+    }
+    snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: " CONTENT_TYPE
+             "\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long) len);
+    if (send_all(fd, head, strlen(head)) == 0)
+        send_all(fd, body, len);
+    free(body);
+}
+
+static void * exporter_thread (void *arg)
+{
+    struct pollfd pfd;
+    int fd;
+
+    (void) arg;
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, ACCEPT_PERIOD_MS) <= 0)
+            continue;
+        fd = libc_accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        serve(fd);
+        libc_close(fd);
+    }
+    return NULL;
+}
+
+/* starts the exporter on addr: "unix:/path", "port" or "localhost:port"
+ * (always bound to 127.0.0.1); returns -1 if addr is not understood or
+ * the socket cannot be set up
+ */
+int simptcp_metrics_start (const char *addr)
+{
+    struct sockaddr_un sun;
+    struct sockaddr_in sin;
+    struct sockaddr *sa;
+    socklen_t salen;
+    const char *port;
+    char *end;
+    long p;
+    int one = 1;
+
+    if ((addr == NULL) || (listen_fd >= 0))
+        return -1;
+
+    if (!strncmp(addr, "unix:", 5)) {
+        if (strlen(addr + 5) >= sizeof(sun.sun_path))
+            return -1;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, addr + 5);
+        sa = (struct sockaddr *) &sun;
+        salen = sizeof(sun);
+    }
+    else {
+        port = addr;
+        if (!strncmp(addr, "localhost:", 10))
+            port = addr + 10;
+        else if (!strncmp(addr, "127.0.0.1:", 10))
+            port = addr + 10;
+        p = strtol(port, &end, 10);
+        if ((*port == '\0') || (*end != '\0') || (p <= 0) || (p > 65535))
+            return -1;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin.sin_port = htons(p);
+        sa = (struct sockaddr *) &sin;
+        salen = sizeof(sin);
+    }
+
+    listen_fd = libc_socket(sa->sa_family, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return -1;
+    if (sa->sa_family == AF_UNIX)
+        unlink(sun.sun_path);
+    else
+        libc_setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if ((libc_bind(listen_fd, sa, salen) < 0) || (libc_listen(listen_fd, 8) < 0))
+        goto fail;
+    if (sa->sa_family == AF_UNIX)
+        strcpy(unix_path, sun.sun_path);
+
+    stopping = 0;
+    if (pthread_create(&exporter, NULL, exporter_thread, NULL) != 0)
+        goto fail;
+    return 0;
+
+fail:
+    libc_close(listen_fd);
+    listen_fd = -1;
+    if (unix_path[0] != '\0')
+        unlink(unix_path);
+    unix_path[0] = '\0';
+    return -1;
+}
+
+/* stops the exporter and removes its Unix socket */
+void simptcp_metrics_stop (void)
+{
+    if (listen_fd < 0)
+        return;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(exporter, NULL);
+    libc_close(listen_fd);
+    listen_fd = -1;
+    if (unix_path[0] != '\0')
+        unlink(unix_path);
+    unix_path[0] = '\0';
+}
+
+/* SIMPTCP_METRICS=addr: export from the start of the entity, until exit;
+ * returns 0 if the exporter runs (or is not asked for), -1 otherwise
+ */
+int simptcp_metrics_init (void)
+{
+    const char *addr = getenv("SIMPTCP_METRICS");
+
+    if ((addr == NULL) || (*addr == '\0'))
+        return 0;
+    if (simptcp_metrics_start(addr) < 0) {
+        fprintf(stderr, "simptcp_metrics: cannot export on \"%s\"\n", addr);
+        return -1;
+    }
+    atexit(simptcp_metrics_stop);
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,499 @@
+/*! \file simptcp_microbench.c
+ * \brief Microbenchmarks of the SimpTCP stack internals, each measured in
+ *  isolation: checksum and CRC32C of a PDU, header decode and write,
+ *  make_pdu() on the SYN and established paths, demultiplex_packet() with
+ *  1 to MAX_OPEN_SOCK open sockets, timer arm and cancel, check and expiry as
+ *  the entity scans them, socket create and release, and the dispatch of a
+ *  PDU to the function of the socket state.
+ *
+ *  The entity is initialised with init_simptcp() but its handler is not
+ *  started: the functions run one at a time in this thread, on sockets set
+ *  up by hand, and nothing is sent. The stack objects are measured as the
+ *  Makefile builds them.
+ *
+ *  Every case is warmed up for a given time, which also sizes a repetition
+ *  to the time asked for, then repeated: it reports the median, minimum and
+ *  maximum time per operation over the repetitions, and the allocations
+ *  (malloc, calloc and realloc calls of this thread, counted by the
+ *  wrappers below) and bytes allocated per operation, in plain text or in
+ *  JSON (-J). The "call" case is the cost of the benchmark loop itself.
+ *
+ *  usage: simptcp_microbench [-r repetitions] [-t ms per repetition]
+ *                            [-w warm-up ms] [-a cpu] [-f filter] [-J]
+ */
+
+#define _GNU_SOURCE             /* for sched_setaffinity() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>          /* for htonl() */
+#include <simptcp_packet.h>
+#include <simptcp_csum.h>
+#include <simptcp_lib.h>
+#include <simptcp_entity.h>
+#include <simptcp_bench.h>
+
+#define MAX_REPS 101
+#define REMOTE_PORT 16000       /* simpTCP port of the peer of socket fd:
+                                   REMOTE_PORT + fd */
+#define DATA_LEN 1400           /* payload of the data PDUs */
+
+/* Allocation counters: these wrappers replace the allocator functions of the
+ * libc for the whole program, and count the calls of each thread
+ */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static __thread unsigned long nb_allocs;
+static __thread unsigned long alloc_bytes;
+
+void *malloc (size_t size)
+{
+    nb_allocs++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+    nb_allocs++;
+    alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    nb_allocs++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+static unsigned char data[2048];
+static char pdu[SIMPTCP_GHEADER_SIZE + DATA_LEN];
+static int pdu_len;
+static struct sockaddr_in udp_remote;
+static struct simptcp_socket *bench_sock;
+static volatile u_int32_t sink;
+
+/* a case: setup(arg) prepares the sockets and PDUs op(arg) works on, the
+ * sockets are released after the case
+ */
+struct bench_case {
+    const char *name;
+    void (*setup) (int arg);
+    void (*op) (int arg);
+    int arg;
+};
+
+/* results of a case */
+struct bench_result {
+    unsigned long long iters;       /* operations per repetition */
+    double median, min, max;        /* ns per operation */
+    double allocs, bytes;           /* per operation */
+};
+
+/* opens the socket of the next free descriptor, in the given state, as if
+ * connected to the port REMOTE_PORT + fd of the loopback
+ */
+static struct simptcp_socket *open_socket (simptcp_socket_state_funcs *state)
+{
+    struct simptcp_socket *sock;
+    int fd = create_simptcp_socket();
+
+    if (fd < 0) {
+        fprintf(stderr, "ERROR, no free simpTCP socket\n");
+        exit(1);
+    }
+    sock = simptcp_entity.simptcp_socket_descriptors[fd];
+    sock->socket_type = client;
+    sock->remote_simptcp.sin_family = AF_INET;
+    sock->remote_simptcp.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sock->remote_simptcp.sin_port = htons(REMOTE_PORT + fd);
+    memcpy(&(sock->remote_udp), &udp_remote, sizeof(udp_remote));
+    sock->socket_state = state;
+    if (state == &(simptcp_entity.simptcp_socket_states->established))
+        build_header_template(sock);
+    return sock;
+}
+
+/* releases every socket */
+static void close_sockets (void)
+{
+    int fd;
+
+    for (fd = 0; fd < MAX_OPEN_SOCK; fd++)
+        if (simptcp_entity.simptcp_socket_descriptors[fd] != NULL)
+            orphan_simptcp_socket(fd);
+}
+
+/* writes in pdu a PDU without payload, from sport to dport */
+static void build_pdu (u_int16_t sport, u_int16_t dport, u_int16_t seq,
+                       u_int16_t ack, unsigned char flags)
+{
+    simptcp_header_fields h;
+
+    memset(&h, 0, sizeof(h));
+    h.sport = sport;
+    h.dport = dport;
+    h.seq_num = seq;
+    h.ack_num = ack;
+    h.header_len = SIMPTCP_GHEADER_SIZE;
+    h.flags = flags;
+    h.total_len = SIMPTCP_GHEADER_SIZE;
+    simptcp_build_header(pdu, &h);
+    simptcp_add_checksum(pdu, SIMPTCP_GHEADER_SIZE);
+    pdu_len = SIMPTCP_GHEADER_SIZE;
+}
+
+/* setups */
+
+static void setup_none (int arg)
+{
+}
+
+static void setup_header (int arg)
+{
+    build_pdu(REMOTE_PORT, 15000, 1, 2, ACK);
+}
+
+static void setup_closed (int arg)
+{
+    bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->closed));
+    build_pdu(REMOTE_PORT, 15000, 0, 0, ACK);
+}
+
+static void setup_synsent (int arg)
+{
+    bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->synsent));
+}
+
+/* an established socket, and the pure ACK of its PDU in flight */
+static void setup_established (int arg)
+{
+    bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->established));
+    build_pdu(ntohs(bench_sock->remote_simptcp.sin_port),
+              ntohs(bench_sock->local_simptcp.sin_port),
+              bench_sock->next_ack_num, bench_sock->next_seq_num, ACK);
+}
+
+/* an established socket whose timer runs, for a minute */
+static void setup_armed (int arg)
+{
+    setup_established(arg);
+    start_timer(bench_sock, 60000);
+}
+
+static void setup_timewait (int arg)
+{
+    bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->timewait));
+}
+
+/* arg established sockets and a PDU for the last one */
+static void setup_demux_hit (int arg)
+{
+    int i;
+
+    for (i = 0; i < arg; i++)
+        bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->established));
+    build_pdu(ntohs(bench_sock->remote_simptcp.sin_port),
+              ntohs(bench_sock->local_simptcp.sin_port), 0, 0, ACK);
+}
+
+/* arg established sockets and a PDU for none of them */
+static void setup_demux_miss (int arg)
+{
+    int i;
+
+    for (i = 0; i < arg; i++)
+        bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->established));
+    build_pdu(REMOTE_PORT + MAX_OPEN_SOCK, 14999, 0, 0, ACK);
+}
+
+/* arg - 1 established sockets, then a listening one and a SYN for it */
+static void setup_demux_listen (int arg)
+{
+    int i;
+
+    for (i = 0; i < arg - 1; i++)
+        open_socket(&(simptcp_entity.simptcp_socket_states->established));
+    bench_sock = open_socket(&(simptcp_entity.simptcp_socket_states->listen));
+    bench_sock->socket_type = listening_server;
+    build_pdu(REMOTE_PORT + MAX_OPEN_SOCK, ntohs(bench_sock->local_simptcp.sin_port),
+              0, 0, SYN);
+}
+
+/* operations */
+
+static void op_call (int arg)
+{
+    sink++;
+}
+
+static void op_csum (int arg)
+{
+    sink = simptcp_csum_partial(data, arg, sink);
+}
+
+static void op_crc32c (int arg)
+{
+    sink = simptcp_crc32c(data, arg, sink);
+}
+
+static void op_check_checksum (int arg)
+{
+    sink += simptcp_check_checksum(pdu, pdu_len);
+}
+
+static void op_header_parse (int arg)
+{
+    simptcp_header_fields h;
+
+    simptcp_parse_header(pdu, &h);
+    sink += h.seq_num + h.ack_num + h.flags + h.total_len;
+}
+
+static void op_header_build (int arg)
+{
+    simptcp_header_fields h;
+
+    h.sport = REMOTE_PORT;
+    h.dport = 15000;
+    h.seq_num = sink;
+    h.ack_num = sink + 1;
+    h.header_len = SIMPTCP_GHEADER_SIZE;
+    h.flags = ACK;
+    h.total_len = SIMPTCP_GHEADER_SIZE;
+    h.window_size = 0;
+    h.checksum = 0;
+    simptcp_build_header(pdu, &h);
+    sink += (unsigned char) pdu[0];
+}
+
+/* SYN: header field by field, options and checksum */
+static void op_make_pdu_syn (int arg)
+{
+    sink += make_pdu(bench_sock, NULL, 0, SYN);
+}
+
+/* established connection: header from the template */
+static void op_make_pdu (int arg)
+{
+    sink += make_pdu(bench_sock, (char *) data, arg, arg > 0 ? 0 : ACK);
+}
+
+static void op_demux (int arg)
+{
+    sink += demultiplex_packet(pdu, &udp_remote);
+}
+
+static void op_timer_arm_cancel (int arg)
+{
+    start_timer(bench_sock, 1000);
+    stop_timer(bench_sock);
+}
+
+/* what the entity does for a socket whose timer runs and has not expired */
+static void op_timer_check (int arg)
+{
+    if (has_active_timer(bench_sock) && is_timeout(bench_sock))
+        sink++;
+}
+
+/* the end of timewait, detected by the check of the entity */
+static void op_timer_expire (int arg)
+{
+    bench_sock->socket_state = &(simptcp_entity.simptcp_socket_states->timewait);
+    bench_sock->timeout.tv_sec = 1;
+    bench_sock->timeout.tv_usec = 0;
+    if (has_active_timer(bench_sock) && is_timeout(bench_sock))
+        bench_sock->socket_state->handle_timeout(bench_sock);
+}
+
+static void op_socket_create_release (int arg)
+{
+    int fd = create_simptcp_socket();
+
+    orphan_simptcp_socket(fd);
+}
+
+/* the PDU to the function of the socket state, as the entity does */
+static void op_dispatch (int arg)
+{
+    bench_sock->socket_state->process_simptcp_pdu(bench_sock, pdu, pdu_len);
+}
+
+/* the PDU in flight is acknowledged: predicted header, timer stopped */
+static void op_dispatch_ack (int arg)
+{
+    bench_sock->socket_state_sender = wait_ack;
+    bench_sock->socket_state->process_simptcp_pdu(bench_sock, pdu, pdu_len);
+}
+
+static const struct bench_case cases[] = {
+    { "call",                   setup_none,         op_call,                0 },
+    { "csum/64",                setup_none,         op_csum,                64 },
+    { "csum/1500",              setup_none,         op_csum,                1500 },
+    { "crc32c/1500",            setup_none,         op_crc32c,              1500 },
+    { "header/check-checksum",  setup_header,       op_check_checksum,      0 },
+    { "header/parse",           setup_header,       op_header_parse,        0 },
+    { "header/build",           setup_header,       op_header_build,        0 },
+    { "make_pdu/syn",           setup_synsent,      op_make_pdu_syn,        0 },
+    { "make_pdu/ack",           setup_established,  op_make_pdu,            0 },
+    { "make_pdu/data-1400",     setup_established,  op_make_pdu,            DATA_LEN },
+    { "demux/hit-1",            setup_demux_hit,    op_demux,               1 },
+    { "demux/hit-2",            setup_demux_hit,    op_demux,               2 },
+    { "demux/hit-3",            setup_demux_hit,    op_demux,               3 },
+    { "demux/hit-4",            setup_demux_hit,    op_demux,               4 },
+    { "demux/hit-5",            setup_demux_hit,    op_demux,               MAX_OPEN_SOCK },
+    { "demux/miss-5",           setup_demux_miss,   op_demux,               MAX_OPEN_SOCK },
+    { "demux/listen-5",         setup_demux_listen, op_demux,               MAX_OPEN_SOCK },
+    { "timer/arm-cancel",       setup_established,  op_timer_arm_cancel,    0 },
+    { "timer/check",            setup_armed,        op_timer_check,         0 },
+    { "timer/expire",           setup_timewait,     op_timer_expire,        0 },
+    { "socket/create-release",  setup_none,         op_socket_create_release, 0 },
+    { "dispatch/closed",        setup_closed,       op_dispatch,            0 },
+    { "dispatch/ack-predicted", setup_established,  op_dispatch_ack,        0 },
+    { "dispatch/ack-stale",     setup_established,  op_dispatch,            0 },
+};
+#define NB_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static int compare_double (const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* runs a case: warm-up, then reps repetitions of rep_ns each */
+static void run_case (const struct bench_case *c, int reps, uint64_t rep_ns,
+                      uint64_t warm_ns, struct bench_result *res)
+{
+    double ns[MAX_REPS];
+    unsigned long long i, iters, done = 0;
+    unsigned long allocs0, bytes0;
+    uint64_t t0, t1;
+    int r;
+
+    c->setup(c->arg);
+
+    /* warm-up, which also sizes a repetition */
+    iters = 1;
+    t0 = bench_now_ns();
+    do {
+        for (i = 0; i < iters; i++)
+            c->op(c->arg);
+        done += iters;
+        iters *= 2;
+        t1 = bench_now_ns();
+    } while (t1 - t0 < warm_ns);
+    iters = (unsigned long long) ((double) done * rep_ns / (t1 - t0));
+    if (iters < 1)
+        iters = 1;
+
+    allocs0 = nb_allocs;
+    bytes0 = alloc_bytes;
+    for (r = 0; r < reps; r++) {
+        t0 = bench_now_ns();
+        for (i = 0; i < iters; i++)
+            c->op(c->arg);
+        t1 = bench_now_ns();
+        ns[r] = (double) (t1 - t0) / iters;
+    }
+    res->allocs = (double) (nb_allocs - allocs0) / ((double) iters * reps);
+    res->bytes = (double) (alloc_bytes - bytes0) / ((double) iters * reps);
+
+    close_sockets();
+
+    qsort(ns, reps, sizeof(ns[0]), compare_double);
+    res->iters = iters;
+    res->median = (reps % 2) ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+    res->min = ns[0];
+    res->max = ns[reps - 1];
+}
+
+void usage (const char *name)
+{
+    fprintf(stderr, "usage %s [-r repetitions] [-t ms per repetition] "
+            "[-w warm-up ms] [-a cpu] [-f filter] [-J]\n", name);
+    exit(1);
+}
+
+int main (int argc, char *argv[])
+{
+    struct bench_result res;
+    const char *filter = NULL;
+    int reps = 9, rep_ms = 20, warm_ms = 100, cpu = -1, json = 0;
+    int opt, first = 1;
+    cpu_set_t set;
+    unsigned int i;
+
+    while ((opt = getopt(argc, argv, "r:t:w:a:f:J")) != -1) {
+        switch (opt) {
+        case 'r': reps = atoi(optarg); break;
+        case 't': rep_ms = atoi(optarg); break;
+        case 'w': warm_ms = atoi(optarg); break;
+        case 'a': cpu = atoi(optarg); break;
+        case 'f': filter = optarg; break;
+        case 'J': json = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (reps < 1 || reps > MAX_REPS || rep_ms < 1 || warm_ms < 1)
+        usage(argv[0]);
+
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            perror("sched_setaffinity");
+            exit(1);
+        }
+    }
+
+    srand(1);
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = rand();
+    udp_remote.sin_family = AF_INET;
+    udp_remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    udp_remote.sin_port = htons(REMOTE_PORT);
+
+    if (init_simptcp(0) < 0) {
+        fprintf(stderr, "ERROR, simpTCP entity initialisation failed\n");
+        exit(1);
+    }
+
+    if (json)
+        printf("{\n  \"repetitions\": %d,\n  \"repetition_ms\": %d,\n"
+               "  \"warmup_ms\": %d,\n  \"cases\": [", reps, rep_ms, warm_ms);
+    else
+        printf("%-24s %10s %10s %10s %7s %10s %10s\n", "case", "ns/op", "min",
+               "max", "spread", "allocs/op", "bytes/op");
+
+    for (i = 0; i < NB_CASES; i++) {
+        if ((filter != NULL) && (strstr(cases[i].name, filter) == NULL))
+            continue;
+        run_case(&cases[i], reps, rep_ms * 1000000ULL, warm_ms * 1000000ULL, &res);
+        if (json)
+            printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, "
+                   "\"ns_per_op\": %.2f, \"ns_min\": %.2f, \"ns_max\": %.2f, "
+                   "\"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}",
+                   first ? "" : ",", cases[i].name, res.iters, res.median,
+                   res.min, res.max, res.allocs, res.bytes);
+        else
+            printf("%-24s %10.2f %10.2f %10.2f %6.1f%% %10.3f %10.1f\n",
+                   cases[i].name, res.median, res.min, res.max,
+                   100 * (res.max - res.min) / res.median, res.allocs, res.bytes);
+        fflush(stdout);
+        first = 0;
+    }
+    if (json)
+        printf("\n  ]\n}\n");
+
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
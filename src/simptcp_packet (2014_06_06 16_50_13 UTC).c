@@ -10,319 +10,349 @@
 #include <term_colors.h>        /* for colors */
 #define __PREFIX__              "[" COLOR("SIMTCP_PKT", BRIGHT_GREEN) "  ] "
 #include <term_io.h>            /* for printf() and perror() redefinition */
+#define __SUBSYS__              SIMPTCP_LOG_PACKET
+#include <simptcp_log.h>       /* for SIMPTCP_LOG() */
 
 #include <simptcp_packet.h>     /* for simptcp packets*/
+#include <simptcp_csum.h>       /* for checksum kernels */
 
 
-#ifndef __DEBUG__
-#define __DEBUG__               1
-#endif
 
-/*
- * simptcp  generic header get/set functions
+/*! \fn void simptcp_add_checksum (char *buffer, int len)
+ *  \brief calculer le checksum sur le PDU et rajouter la valeur calculee \n 
+ * au champ checksum du PDU Adds checksum to a simptcp_packet of legth len.
+ * Il s'agit du complement a un de la somme en complement a un des mots de 
+ * 16 bits du PDU [RFC 1071] ; si la longueur est impaire, le dernier octet est
+ * complete par un 0 sans ecrire au-dela du PDU
+ * \param buffer pointeur sur PDU simpTCP a envoyer
+ * \param len taille totale du PDU simpTCP a envoyer
  */
-
-
-/*! \fn void simptcp_set_sport(char * buffer, u_int16_t sport)
- * \brief initialise le champ sport (source port) du PDU SimpTCP a sport
- * \param buffer pointeur sur PDU simptcp 
- * \param sport numero de port source
-*/
-void simptcp_set_sport(char * buffer, u_int16_t sport)
-{ 
-#if __DEBUG__
-  //  printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *)buffer)->sport = htons(sport);
-}
-
-
-/*! \fn u_int16_t simptcp_get_sport (const char *buffer)
-* \brief renvoi la valeur du champ sport (source port) du PDU SimpTCP
-* \param buffer pointeur sur PDU simptcp 
-* \return numero de port source du PDU
-*/
-u_int16_t simptcp_get_sport (const char *buffer)
+void simptcp_add_checksum (char *buffer, int len)
 {
-#if __DEBUG__
-  //  printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->sport);
+    simptcp_generic_header *header= (simptcp_generic_header *) buffer;
+    header->checksum = 0;
+    header->checksum = ~simptcp_csum_fold(simptcp_csum_partial(buffer, len, 0));
 }
 
 
-/*! \fn void simptcp_set_dport(char * buffer, u_int16_t dport)
- * \brief initialise le champ dport (destination port) du PDU SimpTCP a dport
- * \param buffer pointeur sur PDU simptcp 
- * \param dport numero de port destination
- */
-void    simptcp_set_dport (char *buffer, u_int16_t dport)
-{ 
-#if __DEBUG__
-  //  printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *)buffer)->dport = htons(dport);
-}
-
 
-/*! \fn u_int16_t simptcp_get_dport (const char *buffer)
- * \brief renvoi la valeur du champ dport (destination port) du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return numero de port destination du PDU
+/*! \fn void simptcp_add_checksum_iov (char *buffer, int hlen, const char *data, int dlen)
+ *  \brief calcule le checksum d'un PDU dont l'en-tete et la charge utile ne sont
+ * pas contigus en memoire et l'ajoute au champ checksum de l'en-tete. Le resultat
+ * est identique a celui de #simptcp_add_checksum sur le PDU reconstitue
+ * \param buffer pointeur sur l'en-tete du PDU simpTCP a envoyer
+ * \param hlen taille de l'en-tete (paire)
+ * \param data pointeur sur la charge utile (peut etre NULL si dlen vaut 0)
+ * \param dlen taille de la charge utile
  */
-u_int16_t simptcp_get_dport (const char *buffer)
+void simptcp_add_checksum_iov (char *buffer, int hlen, const char *data, int dlen)
 {
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->dport);
+    u_int32_t sum;
+    simptcp_generic_header *header= (simptcp_generic_header *) buffer;
+    header->checksum = 0;
+    sum = simptcp_csum_partial(buffer, hlen, 0);
+    if (dlen > 0)
+        sum = simptcp_csum_partial(data, dlen, sum);
+    header->checksum = ~simptcp_csum_fold(sum);
 }
 
 
-/*! \fn void simptcp_set_flags  (char *buffer, u_char flags)
- * \brief initialise le champ flags  du PDU SimpTCP a flags
- * \param buffer pointeur sur PDU simptcp 
- * \param flags englobe la valeur des 7 flags (#SYN, #ACK, ..)  
+/*! \fn void simptcp_add_checksum_sum (char *buffer, int hlen, u_int32_t data_sum)
+ *  \brief calcule le checksum d'un PDU dont la somme partielle de la charge 
+ * utile est deja connue (elle a ete calculee lors de sa recopie par 
+ * #simptcp_csum_copy) : seul l'en-tete est relu
+ * \param buffer pointeur sur l'en-tete du PDU simpTCP a envoyer
+ * \param hlen taille de l'en-tete (paire)
+ * \param data_sum somme partielle de la charge utile
  */
-void    simptcp_set_flags  (char *buffer, u_char flags)
+void simptcp_add_checksum_sum (char *buffer, int hlen, u_int32_t data_sum)
 {
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *) buffer)->flags = flags;
-}
-
+    u_int32_t sum;
+    simptcp_generic_header *header= (simptcp_generic_header *) buffer;
 
-/*! \fn unsigned char simptcp_get_flags  (const char *buffer)
- * \brief renvoi la valeur du champ flags du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur des 7 flags (#SYN, #ACK, ..) 
- */
-unsigned char  simptcp_get_flags  (const char *buffer)
-{
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  return ((const simptcp_generic_header *) buffer)->flags;
+    header->checksum = 0;
+    sum = simptcp_csum_partial(buffer, hlen, 0);
+    sum = simptcp_csum_block_add(sum, data_sum, hlen);
+    header->checksum = ~simptcp_csum_fold(sum);
 }
 
 
-/*! \fn void simptcp_set_seq_num   (char *buffer, u_int16_t seq)
- * \brief initialise le champ seq_num  du PDU SimpTCP a seq
- * \param buffer pointeur sur PDU simptcp 
- * \param seq numero de sequence 
+/*! \fn void simptcp_replace_word16 (char *buffer, int offset, u_int16_t value)
+ *  \brief remplace un champ de 16 bits de l'en-tete d'un PDU deja muni de son
+ * checksum et met a jour le checksum de facon incrementale [RFC 1624] : la 
+ * charge utile n'est pas relue (acquittements, retransmissions)
+ * \param buffer pointeur sur l'en-tete du PDU simpTCP
+ * \param offset position (paire) du champ dans l'en-tete, 
+ * par ex. offsetof(simptcp_generic_header, ack_num)
+ * \param value nouvelle valeur du champ (ordre hote)
  */
-void    simptcp_set_seq_num   (char *buffer, u_int16_t seq)
+void simptcp_replace_word16 (char *buffer, int offset, u_int16_t value)
 {
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *)buffer)->seq_num = htons(seq);
-}
-
-
+    simptcp_generic_header *header= (simptcp_generic_header *) buffer;
+    u_int16_t old_word, new_word = htons(value);
 
-/*! \fn u_int16_t simptcp_get_seq_num (const char *buffer)
- * \brief renvoi la valeur du champ seq_num du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return numero de sequence transporte par le PDU
- */
-u_int16_t   simptcp_get_seq_num   (const char *buffer)
-{
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->seq_num);
+    memcpy(&old_word, buffer + offset, 2);
+    memcpy(buffer + offset, &new_word, 2);
+    header->checksum = simptcp_csum_replace16(header->checksum, old_word, new_word);
 }
 
 
-/*! \fn void simptcp_set_ack_num   (char *buffer, u_int16_t ack)
- * \brief initialise le champ ack_num  du PDU SimpTCP a ack
- * \param buffer pointeur sur PDU simptcp 
- * \param ack numero d'acquittement   
- */
-void    simptcp_set_ack_num   (char *buffer, u_int16_t ack)
-{
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *)buffer)->ack_num = htons(ack);
-}
 
-
-/*! \fn u_int16_t  simptcp_get_ack_num  (const char *buffer)
- * \brief renvoi la valeur du champ flags du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur du champ numero d'acquittement du PDU
+/*! \fn int simptcp_check_checksum(char *buffer, int len)
+ *  \brief verifie la validite du champ checksum d'un PDU simpTCP recu : la 
+ * somme en complement a un de tout le PDU, checksum compris, vaut 0xFFFF. Le 
+ * PDU n'est pas modifie
+ * \param buffer pointeur sur PDU simpTCP a envoyer
+ * \param len taille totale du PDU simpTCP a envoyer
+ * \return 1 si checksum OK, 0 sinon 
  */
-u_int16_t   simptcp_get_ack_num   (const char *buffer)
+int simptcp_check_checksum(char *buffer, int len)
 {
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->ack_num);
+    SIMPTCP_TRACE_CALL();
+    return (simptcp_csum_fold(simptcp_csum_partial(buffer, len, 0)) == 0xffff);
 }
 
 
-/*! \fn void simptcp_set_head_len   (char *buffer, unsigned char hlen)
- * \brief initialise le champ header_len du PDU SimpTCP a hlen
- * \param buffer pointeur sur PDU simptcp 
- * \param hlen taille de l'en-tete
+/*
+ * Longueurs admises pour les options connues. Un type peut figurer sur 
+ * plusieurs lignes (une par intervalle de longueurs admis) ; les options de
+ * type inconnu sont ignorees, quelle que soit leur longueur
  */
-void simptcp_set_head_len   (char *buffer, unsigned char hlen)
+static const struct simptcp_option_desc
 {
-#if __DEBUG__
-  // printf("function %s called\n", __func__);
-#endif
-  ((simptcp_generic_header *) buffer)->header_len = hlen;
-}
-
-
-/*! \fn void simptcp_get_head_len   (const char *buffer)
- * \brief renvoi la valeur du champ header_len du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur du champ Header_len du PDU 
+    unsigned char kind;
+    unsigned char min_len;
+    unsigned char max_len;
+} simptcp_option_descs[] = {
+    { SIMPTCP_MSS_OPTION, SIMPTCP_MSS_LEN, SIMPTCP_MSS_LEN },
+    { SIMPTCP_SACK_OPTION, sizeof(simptcp_option_header), SIMPTCP_SACK_MAX_LEN },
+    { SIMPTCP_TS_OPTION, SIMPTCP_TS_LEN, SIMPTCP_TS_LEN },
+    { SIMPTCP_CRC32C_OPTION, SIMPTCP_CRC32C_PERMITTED_LEN, SIMPTCP_CRC32C_PERMITTED_LEN },
+    { SIMPTCP_CRC32C_OPTION, SIMPTCP_CRC32C_LEN, SIMPTCP_CRC32C_LEN },
+};
+#define NB_OPTION_DESCS (sizeof(simptcp_option_descs) / sizeof(simptcp_option_descs[0]))
+
+/*! \fn int option_len_valid (unsigned char kind, unsigned char len)
+ *  \brief verifie la longueur d'une option d'apres #simptcp_option_descs
+ * \param kind type de l'option
+ * \param len longueur de l'option, en-tete compris
+ * \return 1 si la longueur est admise ou le type inconnu, 0 sinon
  */
-unsigned char   simptcp_get_head_len   (const char *buffer)
+static int option_len_valid (unsigned char kind, unsigned char len)
 {
-#if __DEBUG__
-  //  printf("function %s called\n", __func__); 
-#endif
-  return ((const simptcp_generic_header *) buffer)->header_len;
+    unsigned int i;
+    int known = 0;
+
+    for (i = 0; i < NB_OPTION_DESCS; i++)
+        if (simptcp_option_descs[i].kind == kind) {
+            if ((len >= simptcp_option_descs[i].min_len) && 
+                (len <= simptcp_option_descs[i].max_len))
+                return 1;
+            known = 1;
+        }
+    return !known;
 }
 
-
-/*! \fn void simptcp_set_total_len   (char *buffer, u_int16_t tlen)
- * \brief initialise le champ total_len du PDU SimpTCP a hlen
- * \param buffer pointeur sur PDU simptcp 
- * \param tlen taille totale du PDU, charge utile incluse
+/*! \fn int simptcp_walk_options (const char *buffer, int len, simptcp_options *opts)
+ *  \brief parcourt les options d'un PDU (#simptcp_option_header suivi de la 
+ * valeur, entre l'en-tete generique et header_len) ; une option de type 
+ * SIMPTCP_NO_OPTIONS termine la liste. Appelee par #simptcp_parse_options 
+ * quand l'en-tete porte des options
+ * \param buffer pointeur sur PDU simpTCP
+ * \param len taille du PDU recu
+ * \param [out] opts options decodees (present et nb doivent etre nuls)
+ * \return 0 si l'en-tete est valide, -1 s'il est mal forme
  */
-void    simptcp_set_total_len   (char *buffer, u_int16_t tlen)
+int simptcp_walk_options (const char *buffer, int len, simptcp_options *opts)
 {
-#if __DEBUG__
-  //printf("function %s called\n", __func__);
-#endif  
-((simptcp_generic_header *)buffer)->total_len = htons(tlen);
+    const simptcp_option_header *opt;
+    int off = SIMPTCP_GHEADER_SIZE;
+    int hlen = simptcp_get_head_len(buffer);
+
+    if ((len < (int) SIMPTCP_GHEADER_SIZE) || (hlen < (int) SIMPTCP_GHEADER_SIZE) ||
+        (hlen > len))
+        return -1;
+
+    while (off < hlen) {
+        opt = (const simptcp_option_header *) (buffer + off);
+        if (opt->option_kind == SIMPTCP_NO_OPTIONS)
+            break;
+        if ((off + (int) sizeof(simptcp_option_header) > hlen) ||
+            (opt->option_len < sizeof(simptcp_option_header)) ||
+            (off + opt->option_len > hlen) ||
+            !option_len_valid(opt->option_kind, opt->option_len) ||
+            (opts->nb == SIMPTCP_MAX_OPTIONS))
+            return -1;
+        opts->present |= SIMPTCP_OPTION_BIT(opt->option_kind);
+        opts->offset[opts->nb++] = off;
+        off += opt->option_len;
+    }
+    return 0;
 }
 
-
-/*! \fn void simptcp_get_total_len   (const char *buffer)
- * \brief renvoi la valeur du champ total_len du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur du champ total_len du PDU 
+/*! \fn int simptcp_put_option (char *buffer, int max_hlen, unsigned char kind, const void *value, int vlen)
+ *  \brief ajoute une option a la fin de l'en-tete d'un PDU en construction et
+ * met a jour header_len, qui doit deja etre initialise (a SIMPTCP_GHEADER_SIZE
+ * pour la premiere option)
+ * \param buffer pointeur sur l'en-tete du PDU simpTCP
+ * \param max_hlen place disponible pour l'en-tete
+ * \param kind type de l'option
+ * \param value valeur de l'option (NULL pour une valeur nulle)
+ * \param vlen taille de la valeur
+ * \return nouvelle taille de l'en-tete, -1 si l'option n'y tient pas ou si sa
+ * longueur n'est pas admise pour ce type
  */
-u_int16_t   simptcp_get_total_len   (const char *buffer)
+int simptcp_put_option (char *buffer, int max_hlen, unsigned char kind,
+                        const void *value, int vlen)
 {
-#if __DEBUG__
-  //printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->total_len);
+    simptcp_option_header *opt;
+    int hlen = simptcp_get_head_len(buffer);
+    int olen = sizeof(simptcp_option_header) + vlen;
+
+    if ((kind == SIMPTCP_NO_OPTIONS) || (vlen < 0) || (olen > 255) ||
+        (hlen + olen > max_hlen) || (hlen + olen > 255) ||
+        !option_len_valid(kind, olen))
+        return -1;
+
+    opt = (simptcp_option_header *) (buffer + hlen);
+    opt->option_kind = kind;
+    opt->option_len = olen;
+    if (value != NULL)
+        memcpy(buffer + hlen + sizeof(simptcp_option_header), value, vlen);
+    else
+        memset(buffer + hlen + sizeof(simptcp_option_header), 0, vlen);
+    simptcp_set_head_len(buffer, hlen + olen);
+    return hlen + olen;
 }
 
-
-/*! \fn void simptcp_set_win_size   (char *buffer, u_int16_t size)
- * \brief initialise le champ window_size du PDU SimpTCP a size
- * \param buffer pointeur sur PDU simptcp 
- * \param size taille de la fenêtre de contrôle de flux  
+/*! \fn const char * simptcp_find_option (const char *buffer, int len, unsigned char kind)
+ *  \brief recherche une option dans l'en-tete d'un PDU SimpTCP
+ * \param buffer pointeur sur PDU simpTCP
+ * \param len taille du PDU recu (borne la recherche)
+ * \param kind type de l'option recherchee
+ * \return pointeur sur l'en-tete de l'option, NULL si elle est absente ou si
+ * l'en-tete est mal forme
  */
-void    simptcp_set_win_size   (char *buffer, u_int16_t size)
+const char * simptcp_find_option (const char *buffer, int len, unsigned char kind)
 {
-#if __DEBUG__
-  //printf("function %s called\n", __func__);
-#endif
-((simptcp_generic_header *)buffer)->window_size = htons(size);
+    simptcp_options opts;
+
+    if (simptcp_parse_options(buffer, len, &opts) < 0)
+        return NULL;
+    return simptcp_option_get(buffer, &opts, kind);
 }
 
 
-/*! \fn u_int16_t simptcp_get_win_size  (const char *buffer)
- * \brief renvoi la valeur du champ window_size du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur du champ window_size du PDU
+/*! \fn void simptcp_add_crc32c (char *buffer, int hlen, const char *data, int dlen)
+ *  \brief calcule le CRC32C d'un PDU et le place dans son option CRC32C (qui
+ * doit deja figurer dans l'en-tete avec la longueur SIMPTCP_CRC32C_LEN). Le
+ * champ checksum est mis a 0 : il n'est pas utilise dans ce mode
+ * \param buffer pointeur sur l'en-tete du PDU simpTCP a envoyer
+ * \param hlen taille de l'en-tete, options comprises
+ * \param data pointeur sur la charge utile (peut etre NULL si dlen vaut 0)
+ * \param dlen taille de la charge utile
  */
-u_int16_t   simptcp_get_win_size   (const char *buffer)
+void simptcp_add_crc32c (char *buffer, int hlen, const char *data, int dlen)
 {
-#if __DEBUG__
-  //printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->window_size);
+    char *opt = (char *) simptcp_find_option(buffer, hlen, SIMPTCP_CRC32C_OPTION);
+    u_int32_t crc;
+
+    ((simptcp_generic_header *) buffer)->checksum = 0;
+    if (opt == NULL)
+        return;
+
+    memset(opt + sizeof(simptcp_option_header), 0, 4);
+    crc = simptcp_crc32c(buffer, hlen, 0);
+    if (dlen > 0)
+        crc = simptcp_crc32c(data, dlen, crc);
+    crc = htonl(crc);
+    memcpy(opt + sizeof(simptcp_option_header), &crc, 4);
 }
 
 
-/*! \fn void simptcp_get_checksum   (const char *buffer)
- * \brief renvoi la valeur du champ checksum du PDU SimpTCP
- * \param buffer pointeur sur PDU simptcp 
- * \return valeur du champ checksum du PDU  
+/*! \fn int simptcp_check_integrity (char *buffer, int len)
+ *  \brief verifie l'integrite d'un PDU recu : par son CRC32C s'il porte 
+ * l'option CRC32C avec une valeur, par son checksum sinon. Le PDU n'est pas
+ * modifie (le CRC est calcule comme si sa valeur etait nulle)
+ * \param buffer pointeur sur PDU simpTCP recu
+ * \param len taille totale du PDU recu
+ * \return 1 si le PDU est intact, 0 sinon ou si son en-tete est mal forme
+ * (#simptcp_parse_options, total_len different de la taille recue)
  */
-u_int16_t   simptcp_get_checksum   (const char *buffer)
+int simptcp_check_integrity (char *buffer, int len)
 {
-#if __DEBUG__
-  //printf("function %s called\n", __func__);
-#endif
-  return ntohs(((const simptcp_generic_header  *)buffer)->checksum);
+    static const char zero[4] = { 0, 0, 0, 0 };
+    simptcp_options opts;
+    const char *opt;
+    int off;
+    u_int32_t crc, sent;
+
+    if ((simptcp_parse_options(buffer, len, &opts) < 0) ||
+        (simptcp_get_total_len(buffer) != len))
+        return 0;
+
+    opt = simptcp_option_get(buffer, &opts, SIMPTCP_CRC32C_OPTION);
+    if ((opt == NULL) || 
+        (((const simptcp_option_header *) opt)->option_len != SIMPTCP_CRC32C_LEN))
+        return simptcp_check_checksum(buffer, len);
+
+    if (((const simptcp_generic_header *) buffer)->checksum != 0)
+        return 0;
+
+    off = opt + sizeof(simptcp_option_header) - buffer;
+    memcpy(&sent, buffer + off, 4);
+    crc = simptcp_crc32c(buffer, off, 0);
+    crc = simptcp_crc32c(zero, 4, crc);
+    crc = simptcp_crc32c(buffer + off + 4, len - off - 4, crc);
+
+    return (crc == ntohl(sent));
 }
 
 
-/*! \fn void simptcp_add_checksum (char *buffer, int len)
- *  \brief calculer le checksum sur le PDU et rajouter la valeur calculee \n 
- * au champ checksum du PDU Adds checksum to a simptcp_packet of legth len
- * \param buffer pointeur sur PDU simpTCP a envoyer
- * \param len taille totale du PDU simpTCP a envoyer
+/*! \fn int simptcp_check_integrity_copy (char *buffer, int len, void *payload)
+ *  \brief comme #simptcp_check_integrity, mais recopie en meme temps la charge 
+ * utile (les len - header_len derniers octets du PDU) vers payload : chaque 
+ * octet n'est lu qu'une fois. Si le PDU est corrompu, le contenu de payload
+ * est indetermine
+ * \param buffer pointeur sur PDU simpTCP recu
+ * \param len taille totale du PDU recu
+ * \param [out] payload destination de la charge utile
+ * \return 1 si le PDU est intact, 0 sinon ou si son en-tete est mal forme
  */
-void simptcp_add_checksum (char *buffer, int len)
+int simptcp_check_integrity_copy (char *buffer, int len, void *payload)
 {
-    int i;
-    u_int16_t checksum = 0;
-    u_int16_t *buf = (u_int16_t *) buffer;
-    simptcp_generic_header *header= (simptcp_generic_header *) buffer;
-#if __DEBUG__
-    //printf("function %s called\n", __func__);
-#endif
-    /* if length is odd we pad with 0 */
-    if (len % 2 != 0)
-    {
-	buffer[len] = 0;
-	++len;
+    static const char zero[4] = { 0, 0, 0, 0 };
+    simptcp_options opts;
+    const char *opt;
+    int off, hlen = simptcp_get_head_len(buffer);
+    u_int32_t crc, sent, sum;
+
+    if ((simptcp_parse_options(buffer, len, &opts) < 0) ||
+        (simptcp_get_total_len(buffer) != len))
+        return 0;
+
+    opt = simptcp_option_get(buffer, &opts, SIMPTCP_CRC32C_OPTION);
+    if ((opt == NULL) || 
+        (((const simptcp_option_header *) opt)->option_len != SIMPTCP_CRC32C_LEN)) {
+        sum = simptcp_csum_partial(buffer, hlen, 0);
+        sum = simptcp_csum_block_add(sum, 
+                                     simptcp_csum_copy(payload, buffer + hlen,
+                                                       len - hlen, 0),
+                                     hlen);
+        return (simptcp_csum_fold(sum) == 0xffff);
     }
 
-    /* compute sender checksum */
-    header->checksum = 0;
-    for (i = 0; i < len / 2; ++i)
-	checksum += buf[i];
-    /* add checksum */
-    header->checksum = htons(checksum);
-}
-
+    if (((const simptcp_generic_header *) buffer)->checksum != 0)
+        return 0;
 
+    off = opt + sizeof(simptcp_option_header) - buffer;
+    memcpy(&sent, buffer + off, 4);
+    crc = simptcp_crc32c(buffer, off, 0);
+    crc = simptcp_crc32c(zero, 4, crc);
+    crc = simptcp_crc32c(buffer + off + 4, hlen - off - 4, crc);
+    crc = simptcp_crc32c_copy(payload, buffer + hlen, len - hlen, crc);
 
-/*! \fn int simptcp_check_checksum(char *buffer, int len)
- *  \brief verifie la validite du champ checksum d'un PDU simpTCP recu
- * \param buffer pointeur sur PDU simpTCP a envoyer
- * \param len taille totale du PDU simpTCP a envoyer
- * \return 1 si checksum OK, 0 sinon 
- */
-int simptcp_check_checksum(char *buffer, int len)
-{
-    int i;
-    u_int16_t checksum = 0;
-    u_int16_t *buf = (u_int16_t *) buffer;
-    const simptcp_generic_header *header= (const simptcp_generic_header *) buffer;
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    // if length is odd we pad with 0
-    if (len % 2 != 0)
-    {
-	buffer[len] = 0;
-	++len;
-    }
-
-    /* compute receiver checksum */
-    for (i = 0; i < len / 2; ++i) {
-      if (i == 7) continue;     /* checksum is the 8th double byte word */ 
-	checksum += buf[i];
-    }
-    /* check sender and receiver's checksum */
-   return (checksum == ntohs(header->checksum));
+    return (crc == ntohl(sent));
 }
 
 
@@ -337,9 +367,7 @@ u_int16_t simptcp_extract_data (char * pdu, void * payload) {
 u_int16_t dlen; /* data length */
 u_int16_t hlen; /* header length */
   
-#if __DEBUG__
-  printf("function %s called\n", __func__);
-#endif
+  SIMPTCP_TRACE_CALL();
   hlen = simptcp_get_head_len(pdu); 
   dlen = simptcp_get_total_len(pdu)-hlen;
   if (dlen > 0) 
@@ -372,9 +400,7 @@ void simptcp_lprint_packet (char * buf)
     unsigned char hlen= simptcp_get_head_len(buf);
     unsigned char flags=simptcp_get_flags(buf);
 
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
+    SIMPTCP_TRACE_CALL();
 
     if ((flags & SYN) == SYN)
         strcat (sflags, "S|");
@@ -413,6 +439,19 @@ void simptcp_lprint_packet (char * buf)
 * \param buf PDU SimpTCP a afficher
 */
 void simptcp_print_packet (char * buf)
+{
+  simptcp_print_packet_iov(buf, buf + simptcp_get_head_len(buf));
+}
+
+
+/*!
+* \fn void simptcp_print_packet_iov (char * buf, const char * data)
+* \brief Fonction pour afficher de maniere synthetique, sur une ligne, un paquet
+* dont la charge utile n'est pas placee derriere l'en-tete.
+* \param buf en-tete du PDU SimpTCP a afficher
+* \param data charge utile du PDU
+*/
+void simptcp_print_packet_iov (char * buf, const char * data)
 {
   char sflags[12] = "|";
   unsigned char hlen= simptcp_get_head_len(buf);
@@ -420,9 +459,6 @@ void simptcp_print_packet (char * buf)
   
   unsigned char flags=simptcp_get_flags(buf);
   
-#if __DEBUG__
-  //   printf("function %s called\n", __func__);
-#endif
 
     if ((flags & SYN) == SYN)
         strcat (sflags, "S|");
@@ -446,11 +482,12 @@ void simptcp_print_packet (char * buf)
         strcat (sflags, " |");
 
  
-    printf("Source port: %5hu, Destination port: %5hu, seqnum: %5hu\n acknum:%5hu, hlen: %3hu, flags: %7s, tlen: %5hu\n ",simptcp_get_sport(buf),
-	   simptcp_get_dport(buf),simptcp_get_seq_num(buf), 
-	   simptcp_get_ack_num(buf),hlen,sflags,simptcp_get_total_len(buf));
-    if (tlen != hlen) { /* simptcp packet conveys data */
-      printf("DATA: %35s \n",(buf+hlen));
+    SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "Source port: %5hu, Destination port: %5hu, seqnum: %5hu, "
+                "acknum:%5hu, hlen: %3hu, flags: %7s, tlen: %5hu\n",simptcp_get_sport(buf),
+                simptcp_get_dport(buf),simptcp_get_seq_num(buf), 
+                simptcp_get_ack_num(buf),hlen,sflags,simptcp_get_total_len(buf));
+    if (tlen > hlen) { /* simptcp packet conveys data */
+      SIMPTCP_LOG(SIMPTCP_LOG_DEBUG, "DATA: %35.*s \n",(int)(tlen - hlen), data);
     }
 
 }
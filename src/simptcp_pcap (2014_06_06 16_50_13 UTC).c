@@ -0,0 +1,397 @@
+/*
+ * simptcp_pcap.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>               /* for nanosleep() */
+#include <pthread.h>
+#include <sched.h>              /* for sched_yield() */
+#include <sys/time.h>           /* for gettimeofday() */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <libc_socket.h>        /* for libc_connect(), libc_getsockname() */
+#include <simptcp_pcap.h>
+
+#define PCAP_MAGIC              0xa1b2c3d4      /* microsecond time stamps */
+#define PCAP_LINKTYPE_RAW       101             /* IPv4 or IPv6, no link header */
+#define IP_UDP_HLEN             28
+#define WRITER_PERIOD_MS        10
+#define ROUTE_CACHE_SIZE        16              /* a power of 2 */
+
+struct pcap_file_header {
+    u_int32_t magic;
+    u_int16_t version_major, version_minor;
+    int32_t thiszone;
+    u_int32_t sigfigs, snaplen, linktype;
+};
+
+struct pcap_record_header {
+    u_int32_t ts_sec, ts_usec, incl_len, orig_len;
+};
+
+/* a captured datagram; ready is set by the sender once the slot is filled
+ * and cleared by the writer once it is written out
+ */
+struct pcap_slot {
+    int ready;
+    struct pcap_record_header rec;
+    unsigned char data[SIMPTCP_PCAP_MAX_SNAPLEN];
+};
+
+/* "[src|dst] port N" */
+struct port_filter {
+    int dir;                    /* 0: either, 1: source, 2: destination */
+    u_int16_t port;
+};
+
+volatile int simptcp_pcap_enabled;
+
+/* the ring: slots [tail, head) are reserved or filled, head and tail only
+ * grow; the senders move head, the writer moves tail
+ */
+static struct pcap_slot *slots;
+static u_int64_t head, tail;
+static unsigned long dropped;
+static int inflight;            /* captures running, see simptcp_pcap_close() */
+
+static FILE *output;
+static int snaplen;
+static int stopping;
+static pthread_t writer;
+static int atfork_installed;
+static u_int16_t ip_id;
+
+static struct port_filter filters[SIMPTCP_PCAP_MAX_FILTERS];
+static int nb_filters;
+
+/* local address of the route to a peer: (peer << 32) | local, both in
+ * network byte order, 0 if the entry is empty
+ */
+static u_int64_t route_cache[ROUTE_CACHE_SIZE];
+
+
+/* parses "[src|dst] port N [or ...]" (',' also separates the terms);
+ * returns -1 if filter is not understood
+ */
+static int parse_filter (const char *filter)
+{
+    char buf[256], *tok, *save = NULL;
+    int dir = 0, want_port = 0;
+    long port;
+    char *end;
+
+    nb_filters = 0;
+    if (filter == NULL)
+        return 0;
+    snprintf(buf, sizeof(buf), "%s", filter);
+    for (tok = strtok_r(buf, " ,", &save); tok != NULL; tok = strtok_r(NULL, " ,", &save)) {
+        if (!strcmp(tok, "or"))
+            continue;
+        if (!want_port && !strcmp(tok, "src"))
+            dir = 1;
+        else if (!want_port && !strcmp(tok, "dst"))
+            dir = 2;
+        else if (!want_port && !strcmp(tok, "port"))
+            want_port = 1;
+        else if (want_port) {
+            port = strtol(tok, &end, 10);
+            if ((*end != '\0') || (port < 0) || (port > 65535) ||
+                (nb_filters == SIMPTCP_PCAP_MAX_FILTERS))
+                return -1;
+            filters[nb_filters].dir = dir;
+            filters[nb_filters].port = port;
+            nb_filters++;
+            dir = 0;
+            want_port = 0;
+        }
+        else
+            return -1;
+    }
+    return (want_port || dir) ? -1 : 0;
+}
+
+/* true if the PDU with these simpTCP ports passes the filter */
+static int filter_match (u_int16_t sport, u_int16_t dport)
+{
+    int i;
+
+    if (nb_filters == 0)
+        return 1;
+    for (i = 0; i < nb_filters; i++)
+        if (((filters[i].dir != 2) && (filters[i].port == sport)) ||
+            ((filters[i].dir != 1) && (filters[i].port == dport)))
+            return 1;
+    return 0;
+}
+
+static u_int16_t ip_checksum (const unsigned char *p, int len)
+{
+    u_int32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+/* address the datagrams to peer leave from, for a UDP socket bound to
+ * INADDR_ANY: that of the route to peer, found by connecting a UDP socket
+ * (which sends nothing) and cached
+ */
+static u_int32_t route_local_addr (u_int32_t peer)
+{
+    u_int64_t *entry = &(route_cache[(peer ^ (peer >> 16)) & (ROUTE_CACHE_SIZE - 1)]);
+    u_int64_t e = __atomic_load_n(entry, __ATOMIC_RELAXED);
+    struct sockaddr_in a;
+    socklen_t alen = sizeof(a);
+    int fd;
+
+    if ((e != 0) && ((u_int32_t) (e >> 32) == peer))
+        return (u_int32_t) e;
+    if ((fd = libc_socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return htonl(INADDR_ANY);
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = peer;
+    a.sin_port = htons(9);      /* any port: nothing is sent */
+    if ((libc_connect(fd, (struct sockaddr *) &a, sizeof(a)) < 0) ||
+        (libc_getsockname(fd, (struct sockaddr *) &a, &alen) < 0))
+        a.sin_addr.s_addr = htonl(INADDR_ANY);
+    else
+        __atomic_store_n(entry, ((u_int64_t) peer << 32) | a.sin_addr.s_addr,
+                         __ATOMIC_RELAXED);
+    libc_close(fd);
+    return a.sin_addr.s_addr;
+}
+
+/* writes the IPv4 and UDP headers of a datagram of len bytes of payload;
+ * an INADDR_ANY end (the local UDP socket) gets the address of the route to
+ * the other end
+ */
+static void put_ip_udp (unsigned char *p, const struct sockaddr_in *src,
+                        const struct sockaddr_in *dst, int len, u_int16_t id)
+{
+    u_int16_t tot_len = IP_UDP_HLEN + len, csum;
+    u_int32_t saddr, daddr;
+
+    memset(p, 0, IP_UDP_HLEN);
+    p[0] = 0x45;                /* version 4, 5 words */
+    p[2] = tot_len >> 8;
+    p[3] = tot_len & 0xff;
+    p[4] = id >> 8;
+    p[5] = id & 0xff;
+    p[6] = 0x40;                /* don't fragment */
+    p[8] = 64;                  /* TTL */
+    p[9] = IPPROTO_UDP;
+    saddr = src->sin_addr.s_addr;
+    daddr = dst->sin_addr.s_addr;
+    if (saddr == htonl(INADDR_ANY))
+        saddr = route_local_addr(daddr);
+    else if (daddr == htonl(INADDR_ANY))
+        daddr = route_local_addr(saddr);
+    memcpy(p + 12, &saddr, 4);
+    memcpy(p + 16, &daddr, 4);
+    csum = ip_checksum(p, 20);
+    p[10] = csum >> 8;
+    p[11] = csum & 0xff;
+
+    memcpy(p + 20, &(src->sin_port), 2);
+    memcpy(p + 22, &(dst->sin_port), 2);
+    p[24] = (len + 8) >> 8;
+    p[25] = (len + 8) & 0xff;
+    /* UDP checksum 0: not computed */
+}
+
+/* copies a datagram (the iovcnt pieces of iov) sent from src to dst into a
+ * slot of the ring
+ */
+static void pcap_capture (const struct sockaddr_in *src, const struct sockaddr_in *dst,
+                          const struct iovec *iov, int iovcnt)
+{
+    const unsigned char *pdu = iov[0].iov_base;
+    struct pcap_slot *slot;
+    struct timeval now;
+    u_int64_t h;
+    int i, len = 0, room, n, off;
+
+    if ((iov[0].iov_len < 4) ||
+        !filter_match((pdu[0] << 8) | pdu[1], (pdu[2] << 8) | pdu[3]))
+        return;
+
+    /* reserve a slot */
+    h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= SIMPTCP_PCAP_SLOTS) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &h, h + 1, 0, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+    slot = &(slots[h & (SIMPTCP_PCAP_SLOTS - 1)]);
+
+    gettimeofday(&now, NULL);
+    off = IP_UDP_HLEN;
+    for (i = 0; i < iovcnt; i++) {
+        room = snaplen - off;
+        n = ((int) iov[i].iov_len < room) ? (int) iov[i].iov_len : room;
+        if (n > 0) {
+            memcpy(slot->data + off, iov[i].iov_base, n);
+            off += n;
+        }
+        len += iov[i].iov_len;
+    }
+    put_ip_udp(slot->data, src, dst, len,
+               __atomic_add_fetch(&ip_id, 1, __ATOMIC_RELAXED));
+    slot->rec.ts_sec = now.tv_sec;
+    slot->rec.ts_usec = now.tv_usec;
+    slot->rec.incl_len = (off < snaplen) ? off : snaplen;
+    slot->rec.orig_len = IP_UDP_HLEN + len;
+
+    __atomic_store_n(&(slot->ready), 1, __ATOMIC_RELEASE);
+}
+
+/* called through SIMPTCP_PCAP(); the capture is counted in inflight before
+ * checking again that it is enabled, so that simptcp_pcap_close(), which
+ * disables it and then waits for inflight to drop to 0, never frees the ring
+ * under a sender
+ */
+void simptcp_pcap_capture (const struct sockaddr_in *src, const struct sockaddr_in *dst,
+                           const struct iovec *iov, int iovcnt)
+{
+    __atomic_add_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&simptcp_pcap_enabled, __ATOMIC_SEQ_CST))
+        pcap_capture(src, dst, iov, iovcnt);
+    __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELEASE);
+}
+
+/* writes out the filled slots, in order, until the capture is closed */
+static void * pcap_writer (void *arg)
+{
+    struct timespec period = { 0, WRITER_PERIOD_MS * 1000000L };
+    struct pcap_slot *slot;
+    int stop;
+
+    (void) arg;
+    while (1) {
+        stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        slot = &(slots[tail & (SIMPTCP_PCAP_SLOTS - 1)]);
+        while (__atomic_load_n(&(slot->ready), __ATOMIC_ACQUIRE)) {
+            fwrite(&(slot->rec), sizeof(slot->rec), 1, output);
+            fwrite(slot->data, 1, slot->rec.incl_len, output);
+            slot->ready = 0;
+            __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+            slot = &(slots[tail & (SIMPTCP_PCAP_SLOTS - 1)]);
+        }
+        fflush(output);
+        if (stop)
+            break;
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+/* a child of fork() has no writer thread: the capture stays the parent's */
+static void pcap_atfork_child (void)
+{
+    simptcp_pcap_enabled = 0;
+    output = NULL;
+}
+
+/* starts capturing to path, keeping at most snap bytes per datagram (0: all)
+ * and only the datagrams that pass filter (NULL: all); returns -1 on error
+ */
+int simptcp_pcap_open (const char *path, int snap, const char *filter)
+{
+    struct pcap_file_header hdr;
+
+    if (output != NULL)
+        return -1;
+    if (parse_filter(filter) < 0) {
+        fprintf(stderr, "simptcp_pcap: bad filter \"%s\"\n", filter);
+        return -1;
+    }
+    if ((snap <= 0) || (snap > SIMPTCP_PCAP_MAX_SNAPLEN))
+        snap = SIMPTCP_PCAP_MAX_SNAPLEN;
+    if (snap < IP_UDP_HLEN + 4)
+        snap = IP_UDP_HLEN + 4;
+    snaplen = snap;
+
+    slots = calloc(SIMPTCP_PCAP_SLOTS, sizeof(struct pcap_slot));
+    if (slots == NULL)
+        return -1;
+    output = fopen(path, "wb");
+    if (output == NULL) {
+        free(slots);
+        return -1;
+    }
+
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = snaplen;
+    hdr.linktype = PCAP_LINKTYPE_RAW;
+    fwrite(&hdr, sizeof(hdr), 1, output);
+
+    head = tail = 0;
+    stopping = 0;
+    if (pthread_create(&writer, NULL, pcap_writer, NULL) != 0) {
+        fclose(output);
+        output = NULL;
+        free(slots);
+        return -1;
+    }
+    if (!atfork_installed) {
+        atfork_installed = 1;
+        pthread_atfork(NULL, NULL, pcap_atfork_child);
+    }
+    simptcp_pcap_enabled = 1;
+    return 0;
+}
+
+/* stops capturing and writes out what the ring holds */
+void simptcp_pcap_close (void)
+{
+    if (output == NULL)
+        return;
+    __atomic_store_n(&simptcp_pcap_enabled, 0, __ATOMIC_SEQ_CST);
+    /* the entity and application threads may still be filling slots */
+    while (__atomic_load_n(&inflight, __ATOMIC_SEQ_CST) > 0)
+        sched_yield();
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    if (dropped > 0)
+        fprintf(stderr, "simptcp_pcap: %lu datagrams not captured (ring full)\n",
+                dropped);
+    fclose(output);
+    output = NULL;
+    free(slots);
+    slots = NULL;
+}
+
+/* number of datagrams not captured because the ring was full */
+unsigned long simptcp_pcap_dropped (void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/* SIMPTCP_PCAP=file: capture from the start, until exit */
+static void __attribute__((constructor)) pcap_configure (void)
+{
+    const char *path = getenv("SIMPTCP_PCAP");
+    const char *snap = getenv("SIMPTCP_PCAP_SNAPLEN");
+
+    if ((path == NULL) || (*path == '\0'))
+        return;
+    if (simptcp_pcap_open(path, (snap != NULL) ? atoi(snap) : 0,
+                          getenv("SIMPTCP_PCAP_FILTER")) == 0)
+        atexit(simptcp_pcap_close);
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,427 @@
+/*! \file simptcp_perf.c
+ * \brief Bulk throughput benchmark over simpTCP, in the manner of iperf.
+ *  The client opens one or more connections to the server and, for each of
+ *  them, either sends messages of a given size for a given duration while
+ *  the server discards them (default), or receives what the server sends
+ *  (-R), or both at once over two connections per stream (-d). Each side
+ *  reports, per connection and in total, the throughput in Gbps, the PDUs
+ *  per second and the retransmissions, and its CPU utilisation, in plain
+ *  text or in JSON (-J). The server runs one test, then exits.
+ *
+ *  usage: simptcp_perf -s [-p port] [-J]
+ *         simptcp_perf -c server_hostname [-p port] [-l len] [-t secs]
+ *                      [-P streams] [-R | -d] [-J]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>          /* for htonl() */
+#include <netdb.h>
+#include <simptcp_api.h>
+#include <simptcp_entity.h>     /* for MAX_OPEN_SOCK */
+#include <simptcp_bench.h>
+
+/*!
+ *  \def DEFAULT_LOCAL_UDP_PORT
+ * \brief udp port number used by the simptcp protocol entity of the client.
+ * At the server, the local udp port number is the port number of the
+ * listening simptcp socket
+ */
+#define DEFAULT_LOCAL_UDP_PORT 15555
+
+#define DEFAULT_PORT        5201
+#define DEFAULT_LEN         65536
+#define DEFAULT_DURATION    10
+#define MAX_LEN             (1 << 20)
+#define READ_BUFFER_SIZE    65536
+
+/* the server needs a descriptor for its listening socket */
+#define MAX_CONNS           (MAX_OPEN_SOCK - 1)
+
+/* sent by the client at the start of each connection (network byte order) */
+#define PERF_MAGIC          0x53505246      /* "SPRF" */
+#define PERF_CLIENT_SENDS   0
+#define PERF_SERVER_SENDS   1
+
+struct perf_hello {
+    uint32_t magic;
+    uint32_t conns;             /* connections of the test */
+    uint32_t direction;         /* PERF_CLIENT_SENDS or PERF_SERVER_SENDS */
+    uint32_t len;               /* message size */
+    uint32_t duration_ms;
+};
+
+/* one connection of the test */
+struct perf_conn {
+    int id;
+    int fd;
+    int sending;
+    size_t len;
+    uint64_t deadline_ns;       /* sender: when to stop */
+    pthread_t thread;
+    /* results */
+    unsigned long long bytes;
+    uint64_t t0, t1;            /* first and last byte, ns */
+    uint64_t done_ns;           /* end of the transfer, before close */
+    double done_cpu;
+    unsigned long pdus;
+    unsigned long retransmits;
+    int failed;
+};
+
+/* the totals of one direction */
+struct perf_sum {
+    int conns;
+    unsigned long long bytes;
+    double secs;
+    unsigned long pdus;
+    unsigned long retransmits;
+};
+
+int json = 0;
+
+void error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage %s -s [-p port] [-J]\n"
+            "      %s -c server_hostname [-p port] [-l len] [-t secs] "
+            "[-P streams] [-R | -d] [-J]\n", name, name);
+    exit(1);
+}
+
+/* reads exactly n bytes; 0 on success, -1 on error or early close */
+int recv_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        r = recv(fd, p, n, 0);
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/* sends messages until the deadline, or receives them. The messages are
+ * made of 'x' and the sender ends with a zero byte: in simpTCP, only the
+ * client may close a connection first, so the end of the data cannot be
+ * told by the receiver of the server by a close */
+void *run_conn(void *arg)
+{
+    struct perf_conn *c = arg;
+    static char rbuf[MAX_CONNS][READ_BUFFER_SIZE];
+    struct simptcp_info info;
+    socklen_t ilen = sizeof(info);
+    char *msg;
+    ssize_t n;
+
+    if (c->sending) {
+        msg = malloc(c->len);
+        if (msg == NULL) {
+            c->failed = 1;
+            return NULL;
+        }
+        memset(msg, 'x', c->len);
+        c->t0 = bench_now_ns();
+        do {
+            n = send(c->fd, msg, c->len, 0);
+            if (n < 0) {
+                c->failed = 1;
+                break;
+            }
+            c->bytes += n;
+            c->t1 = bench_now_ns();
+        } while (c->t1 < c->deadline_ns);
+        free(msg);
+        if (!c->failed && send(c->fd, "", 1, 0) < 0)
+            c->failed = 1;
+    } else {
+        while ((n = recv(c->fd, rbuf[c->id], READ_BUFFER_SIZE, 0)) > 0) {
+            if (c->bytes == 0)
+                c->t0 = bench_now_ns();
+            c->t1 = bench_now_ns();
+            if (rbuf[c->id][n - 1] == '\0') {
+                c->bytes += n - 1;
+                break;
+            }
+            c->bytes += n;
+        }
+        if (n <= 0)
+            c->failed = 1;
+    }
+    /* close may linger: the side is timed up to the end of its transfers */
+    c->done_ns = bench_now_ns();
+    c->done_cpu = bench_cpu_seconds();
+
+    if (getsockopt(c->fd, IPPROTO_SIMPTCP, SIMPTCP_INFO, &info, &ilen) == 0) {
+        c->pdus = c->sending ? info.segs_out : info.segs_in;
+        c->retransmits = info.total_retrans;
+    }
+    close(c->fd);
+    return NULL;
+}
+
+void sum_add(struct perf_sum *s, const struct perf_conn *c)
+{
+    double secs = (c->t1 - c->t0) / 1e9;
+
+    s->conns++;
+    s->bytes += c->bytes;
+    if (secs > s->secs)
+        s->secs = secs;
+    s->pdus += c->pdus;
+    s->retransmits += c->retransmits;
+}
+
+/* prints the figures of a connection (id >= 0) or of a direction (id < 0) */
+void report_line(const char *side, int id, int sending, unsigned long long bytes,
+                 double secs, unsigned long pdus, unsigned long retransmits,
+                 int last)
+{
+    double gbps = secs > 0 ? bytes * 8 / secs / 1e9 : 0.0;
+    double pps = secs > 0 ? pdus / secs : 0.0;
+
+    if (json) {
+        printf("    {\"stream\": ");
+        if (id >= 0)
+            printf("%d", id);
+        else
+            printf("\"sum\"");
+        printf(", \"direction\": \"%s\", \"bytes\": %llu, \"seconds\": %.6f, "
+               "\"gbps\": %.6f, \"pdus\": %lu, \"pdus_per_second\": %.1f, "
+               "\"retransmits\": %lu}%s\n", sending ? "send" : "recv", bytes,
+               secs, gbps, pdus, pps, retransmits, last ? "" : ",");
+        return;
+    }
+    if (id >= 0)
+        printf("%s: [%3d]", side, id);
+    else
+        printf("%s: [SUM]", side);
+    printf(" %s %7.3f s %12llu bytes %8.4f Gbps %9.0f PDUs/s %6lu retransmits\n",
+           sending ? "send" : "recv", secs, bytes, gbps, pps, retransmits);
+}
+
+/* prints the results of a side, once all its connections are done; t0 and
+ * cpu0 are the start of the test */
+void report(const char *side, struct perf_conn *conns, int n,
+            uint64_t t0, double cpu0)
+{
+    struct perf_sum sum[2];
+    int i, d, lines = 0, nb_lines;
+    uint64_t t1 = t0;
+    double cpu1 = cpu0, secs, cpu;
+
+    memset(sum, 0, sizeof(sum));
+    for (i = 0; i < n; i++) {
+        sum_add(&sum[conns[i].sending], &conns[i]);
+        if (conns[i].done_ns > t1)
+            t1 = conns[i].done_ns;
+        if (conns[i].done_cpu > cpu1)
+            cpu1 = conns[i].done_cpu;
+    }
+    secs = (t1 - t0) / 1e9;
+    cpu = cpu1 - cpu0;
+    nb_lines = n + (sum[0].conns > 0) + (sum[1].conns > 0);
+
+    if (json)
+        printf("{\n  \"side\": \"%s\",\n  \"streams\": [\n", side);
+    for (i = 0; i < n; i++)
+        report_line(side, conns[i].id, conns[i].sending, conns[i].bytes,
+                    (conns[i].t1 - conns[i].t0) / 1e9, conns[i].pdus,
+                    conns[i].retransmits, ++lines == nb_lines);
+    for (d = 1; d >= 0; d--)
+        if (sum[d].conns > 0)
+            report_line(side, -1, d, sum[d].bytes, sum[d].secs, sum[d].pdus,
+                        sum[d].retransmits, ++lines == nb_lines);
+    if (json)
+        printf("  ],\n  \"seconds\": %.6f,\n  \"cpu_seconds\": %.6f,\n"
+               "  \"cpu_percent\": %.1f\n}\n", secs, cpu,
+               secs > 0 ? 100.0 * cpu / secs : 0.0);
+    else
+        printf("%s: CPU utilisation %.1f%% (%.3f s user+system in %.3f s)\n",
+               side, secs > 0 ? 100.0 * cpu / secs : 0.0, cpu, secs);
+    for (i = 0; i < n; i++)
+        if (conns[i].failed)
+            fprintf(stderr, "%s: stream %d failed\n", side, conns[i].id);
+}
+
+int run_server(int portno)
+{
+    int sockfd, fd, i, n = 1;
+    struct sockaddr_in serv_addr, cli_addr;
+    socklen_t clilen;
+    struct perf_hello hello;
+    struct perf_conn conns[MAX_CONNS];
+    uint64_t t0 = 0;
+    double cpu0 = 0;
+
+    /* the local udp port must be the one of the listening socket */
+    start_simptcp(portno);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(portno);
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+        error("ERROR on binding");
+    listen(sockfd, MAX_CONNS);
+
+    memset(conns, 0, sizeof(conns));
+    for (i = 0; i < n; i++) {
+        clilen = sizeof(cli_addr);
+        fd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+        if (fd < 0)
+            error("ERROR on accept");
+        if (recv_all(fd, &hello, sizeof(hello)) < 0 ||
+            ntohl(hello.magic) != PERF_MAGIC) {
+            fprintf(stderr, "ERROR, not a simptcp_perf client\n");
+            exit(1);
+        }
+        if (i == 0) {
+            n = ntohl(hello.conns);
+            if (n < 1 || n > MAX_CONNS) {
+                fprintf(stderr, "ERROR, %d connections (at most %d)\n", n,
+                        MAX_CONNS);
+                exit(1);
+            }
+            t0 = bench_now_ns();
+            cpu0 = bench_cpu_seconds();
+        }
+        conns[i].id = i;
+        conns[i].fd = fd;
+        conns[i].sending = (ntohl(hello.direction) == PERF_SERVER_SENDS);
+        conns[i].len = ntohl(hello.len);
+        if (conns[i].len < 1 || conns[i].len > MAX_LEN)
+            conns[i].len = DEFAULT_LEN;
+        conns[i].deadline_ns = bench_now_ns() +
+            (uint64_t) ntohl(hello.duration_ms) * 1000000ULL;
+        if (pthread_create(&conns[i].thread, NULL, run_conn, &conns[i]) != 0)
+            error("ERROR creating thread");
+    }
+    for (i = 0; i < n; i++)
+        pthread_join(conns[i].thread, NULL);
+
+    report("server", conns, n, t0, cpu0);
+
+    close(sockfd);
+    return 0;
+}
+
+int run_client(const char *host, int portno, size_t len, int duration,
+               int streams, int reverse, int bidir)
+{
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
+    struct perf_hello hello;
+    struct perf_conn conns[MAX_CONNS];
+    int i, n = bidir ? 2 * streams : streams;
+    uint64_t t0, deadline;
+    double cpu0;
+
+    if (n > MAX_CONNS) {
+        fprintf(stderr, "ERROR, %d connections (at most %d)\n", n, MAX_CONNS);
+        exit(1);
+    }
+
+    server = gethostbyname(host);
+    if (server == NULL) {
+        fprintf(stderr, "ERROR, no such host\n");
+        exit(1);
+    }
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    bcopy((char *) server->h_addr, (char *) &serv_addr.sin_addr.s_addr,
+          server->h_length);
+    serv_addr.sin_port = htons(portno);
+
+    start_simptcp(DEFAULT_LOCAL_UDP_PORT);
+
+    /* open all the connections before the test starts (the server reads
+       the hello of a connection before it accepts the next one) */
+    memset(conns, 0, sizeof(conns));
+    for (i = 0; i < n; i++) {
+        conns[i].id = i;
+        conns[i].len = len;
+        /* with -d, the streams alternate: send, receive, send.. */
+        conns[i].sending = bidir ? (i % 2 == 0) : !reverse;
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+        if (conns[i].fd < 0)
+            error("ERROR opening socket");
+        if (connect(conns[i].fd, (struct sockaddr *) &serv_addr,
+                    sizeof(serv_addr)) < 0)
+            error("ERROR connecting");
+        hello.magic = htonl(PERF_MAGIC);
+        hello.conns = htonl(n);
+        hello.direction = htonl(conns[i].sending ? PERF_CLIENT_SENDS
+                                                 : PERF_SERVER_SENDS);
+        hello.len = htonl(len);
+        hello.duration_ms = htonl(duration * 1000);
+        if (send(conns[i].fd, &hello, sizeof(hello), 0) < 0)
+            error("ERROR writing to socket");
+    }
+
+    t0 = bench_now_ns();
+    cpu0 = bench_cpu_seconds();
+    deadline = t0 + (uint64_t) duration * 1000000000ULL;
+    for (i = 0; i < n; i++) {
+        conns[i].deadline_ns = deadline;
+        if (pthread_create(&conns[i].thread, NULL, run_conn, &conns[i]) != 0)
+            error("ERROR creating thread");
+    }
+    for (i = 0; i < n; i++)
+        pthread_join(conns[i].thread, NULL);
+
+    report("client", conns, n, t0, cpu0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, is_server = 0, portno = DEFAULT_PORT, duration = DEFAULT_DURATION;
+    int streams = 1, reverse = 0, bidir = 0;
+    long len = DEFAULT_LEN;
+    const char *host = NULL;
+
+    while ((opt = getopt(argc, argv, "sc:p:l:t:P:RdJ")) != -1) {
+        switch (opt) {
+        case 's': is_server = 1; break;
+        case 'c': host = optarg; break;
+        case 'p': portno = atoi(optarg); break;
+        case 'l': len = atol(optarg); break;
+        case 't': duration = atoi(optarg); break;
+        case 'P': streams = atoi(optarg); break;
+        case 'R': reverse = 1; break;
+        case 'd': bidir = 1; break;
+        case 'J': json = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (is_server == (host != NULL) || len < 1 || len > MAX_LEN ||
+        duration < 1 || streams < 1 || (reverse && bidir))
+        usage(argv[0]);
+
+    if (is_server)
+        return run_server(portno);
+    return run_client(host, portno, len, duration, streams, reverse, bidir);
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,426 @@
+/*! \file simptcp_rr.c
+ * \brief Request/response latency benchmark over simpTCP, in the manner of
+ *  netperf TCP_RR and TCP_CRR. A server is forked on localhost and one or
+ *  more client threads run transactions against it for a given duration (or
+ *  a given number of transactions each):
+ *
+ *   pingpong  a message of len bytes goes back and forth over a persistent
+ *             connection, the client checks the echo
+ *   rr        a request of req bytes, answered by a response of resp bytes,
+ *             over a persistent connection
+ *   crr       connect, request, response and close: a new connection per
+ *             transaction
+ *
+ *  It reports the transactions per second and the 50th, 99th and 99.9th
+ *  percentiles and the maximum of the transaction latency (to within 1/8,
+ *  see simptcp_hist.h), in plain text or in JSON (-J).
+ *
+ *  usage: simptcp_rr [-m pingpong|rr|crr] [-l len] [-r req,resp]
+ *                    [-c concurrency] [-t secs | -n transactions]
+ *                    [-p port] [-J]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>          /* for htonl() */
+#include <simptcp_api.h>
+#include <simptcp_entity.h>     /* for MAX_OPEN_SOCK */
+#include <simptcp_bench.h>
+#include <simptcp_hist.h>
+
+/*!
+ *  \def DEFAULT_LOCAL_UDP_PORT
+ * \brief udp port number used by the simptcp protocol entity of the client.
+ * At the server, the local udp port number is the port number of the
+ * listening simptcp socket
+ */
+#define DEFAULT_LOCAL_UDP_PORT 15555
+
+#define DEFAULT_PORT        5202
+#define DEFAULT_DURATION    5
+#define MAX_LEN             (1 << 20)
+
+/* the server needs a descriptor for its listening socket */
+#define MAX_CONCURRENCY     (MAX_OPEN_SOCK - 1)
+
+#define MODE_PINGPONG       0
+#define MODE_RR             1
+#define MODE_CRR            2
+
+const char *mode_names[] = { "pingpong", "rr", "crr" };
+
+/* parameters of the test, shared by the server and the client */
+int mode = MODE_RR;
+size_t req_len = 1, resp_len = 1;
+
+/* one client thread */
+struct rr_client {
+    int id;
+    struct sockaddr_in serv_addr;
+    uint64_t deadline_ns;       /* when to stop, or 0 */
+    unsigned long max_trans;    /* how many transactions, or 0 */
+    pthread_t thread;
+    /* results */
+    simptcp_hist hist;          /* transaction latency, us */
+    unsigned long trans;
+    int failed;
+};
+
+int json = 0;
+
+void error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage %s [-m pingpong|rr|crr] [-l len] [-r req,resp] "
+            "[-c concurrency] [-t secs | -n transactions] [-p port] [-J]\n",
+            name);
+    exit(1);
+}
+
+/* reads exactly n bytes; 0 on success, 1 if the connection was closed
+ * before the first byte, -1 on error or in the middle of the data */
+int recv_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        r = recv(fd, p, n, 0);
+        if (r == 0 && p == buf)
+            return 1;
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/* sends exactly n bytes; 0 on success, -1 on error */
+int send_all(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        r = send(fd, p, n, 0);
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/* answers the requests of a connection until the client closes it. A
+ * pingpong request is echoed, the response of rr and crr is made of 'r' */
+void *serve_conn(void *arg)
+{
+    int fd = (int) (long) arg;
+    char *req, *resp;
+
+    req = malloc(req_len);
+    resp = (mode == MODE_PINGPONG) ? req : malloc(resp_len);
+    if (req == NULL || resp == NULL)
+        error("ERROR allocating buffers");
+    if (resp != req)
+        memset(resp, 'r', resp_len);
+
+    while (recv_all(fd, req, req_len) == 0)
+        if (send_all(fd, resp, resp_len) < 0)
+            break;
+
+    close(fd);
+    if (resp != req)
+        free(resp);
+    free(req);
+    return NULL;
+}
+
+void *accept_loop(void *arg)
+{
+    int sockfd = (int) (long) arg, fd;
+    pthread_t thread;
+
+    for (;;) {
+        fd = accept(sockfd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        if (pthread_create(&thread, NULL, serve_conn, (void *) (long) fd) != 0)
+            error("ERROR creating thread");
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/* the forked server: it tells the client it listens through ready_fd, then
+ * runs until SIGTERM. The signal is waited for by the main thread, so that
+ * exit() runs the cleanup handlers of the entity (shared memory, pcap) */
+void run_server(int portno, int ready_fd)
+{
+    int sockfd, sig;
+    struct sockaddr_in serv_addr;
+    sigset_t set;
+    pthread_t thread;
+
+    /* blocked in the threads that the entity and this server create */
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    /* the local udp port must be the one of the listening socket */
+    start_simptcp(portno);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(portno);
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+        error("ERROR on binding");
+    listen(sockfd, MAX_CONCURRENCY);
+
+    if (pthread_create(&thread, NULL, accept_loop, (void *) (long) sockfd) != 0)
+        error("ERROR creating thread");
+    if (write(ready_fd, "", 1) != 1)
+        error("ERROR writing to pipe");
+
+    sigwait(&set, &sig);
+    exit(0);
+}
+
+/* a connected simpTCP socket, or -1 */
+int open_conn(struct rr_client *c)
+{
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &c->serv_addr,
+                sizeof(c->serv_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* runs transactions until the deadline or the count is reached. A crr
+ * transaction is timed from socket() to the return of close() */
+void *run_client(void *arg)
+{
+    struct rr_client *c = arg;
+    char *req, *resp;
+    int fd = -1;
+    uint64_t t0, t1;
+
+    req = malloc(req_len);
+    resp = malloc(resp_len);
+    if (req == NULL || resp == NULL)
+        error("ERROR allocating buffers");
+    memset(req, 'a' + c->id, req_len);
+
+    if (mode != MODE_CRR && (fd = open_conn(c)) < 0) {
+        c->failed = 1;
+        goto out;
+    }
+    for (;;) {
+        t0 = bench_now_ns();
+        if (mode == MODE_CRR && (fd = open_conn(c)) < 0)
+            break;
+        if (send_all(fd, req, req_len) < 0 ||
+            recv_all(fd, resp, resp_len) != 0)
+            break;
+        if (mode == MODE_PINGPONG && memcmp(req, resp, req_len) != 0) {
+            fprintf(stderr, "client %d: echo mismatch\n", c->id);
+            break;
+        }
+        if (mode == MODE_CRR) {
+            close(fd);
+            fd = -1;
+        }
+        t1 = bench_now_ns();
+        simptcp_hist_record(&c->hist, (long long) (t1 - t0) / 1000);
+        c->trans++;
+        if ((c->deadline_ns != 0 && t1 >= c->deadline_ns) ||
+            (c->max_trans != 0 && c->trans >= c->max_trans))
+            goto out;
+    }
+    c->failed = 1;
+out:
+    if (fd >= 0)
+        close(fd);
+    free(resp);
+    free(req);
+    return NULL;
+}
+
+/* prints the figures of the whole test */
+void report(struct rr_client *clients, int n, double secs)
+{
+    simptcp_hist all;
+    unsigned long trans = 0;
+    double tps, mean;
+    int i;
+
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < n; i++) {
+        simptcp_hist_merge(&all, &clients[i].hist);
+        trans += clients[i].trans;
+    }
+    tps = secs > 0 ? trans / secs : 0.0;
+    mean = all.count > 0 ? (double) all.sum / all.count : 0.0;
+
+    if (json) {
+        printf("{\n  \"mode\": \"%s\",\n  \"concurrency\": %d,\n"
+               "  \"request_bytes\": %lu,\n  \"response_bytes\": %lu,\n"
+               "  \"transactions\": %lu,\n  \"seconds\": %.6f,\n"
+               "  \"transactions_per_second\": %.1f,\n"
+               "  \"latency_us\": {\"mean\": %.1f, \"p50\": %u, \"p99\": %u, "
+               "\"p99.9\": %u, \"max\": %u}\n}\n", mode_names[mode], n,
+               (unsigned long) req_len, (unsigned long) resp_len, trans, secs,
+               tps, mean, simptcp_hist_percentile(&all, 50.0),
+               simptcp_hist_percentile(&all, 99.0),
+               simptcp_hist_percentile(&all, 99.9), all.max);
+    } else {
+        printf("%s: %d connection%s, request %lu bytes, response %lu bytes\n",
+               mode_names[mode], n, n > 1 ? "s" : "", (unsigned long) req_len,
+               (unsigned long) resp_len);
+        printf("%s: %lu transactions in %.3f s, %.1f transactions/s\n",
+               mode_names[mode], trans, secs, tps);
+        printf("%s: latency us: mean %.1f p50 %u p99 %u p99.9 %u max %u\n",
+               mode_names[mode], mean, simptcp_hist_percentile(&all, 50.0),
+               simptcp_hist_percentile(&all, 99.0),
+               simptcp_hist_percentile(&all, 99.9), all.max);
+    }
+    for (i = 0; i < n; i++)
+        if (clients[i].failed)
+            fprintf(stderr, "client %d failed after %lu transactions\n",
+                    clients[i].id, clients[i].trans);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, n = 1, portno = DEFAULT_PORT, duration = DEFAULT_DURATION;
+    int ready[2], status;
+    long len = -1, rq = -1, rs = -1;
+    unsigned long max_trans = 0;
+    struct rr_client clients[MAX_CONCURRENCY];
+    struct sockaddr_in serv_addr;
+    uint64_t t0, t1;
+    pid_t server;
+    char c;
+
+    while ((opt = getopt(argc, argv, "m:l:r:c:t:n:p:J")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (mode = 0; mode <= MODE_CRR; mode++)
+                if (strcmp(optarg, mode_names[mode]) == 0)
+                    break;
+            if (mode > MODE_CRR)
+                usage(argv[0]);
+            break;
+        case 'l': len = atol(optarg); break;
+        case 'r':
+            if (sscanf(optarg, "%ld,%ld", &rq, &rs) != 2)
+                usage(argv[0]);
+            break;
+        case 'c': n = atoi(optarg); break;
+        case 't': duration = atoi(optarg); break;
+        case 'n': max_trans = strtoul(optarg, NULL, 10); break;
+        case 'p': portno = atoi(optarg); break;
+        case 'J': json = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    /* -l for pingpong, -r for rr and crr */
+    if (mode == MODE_PINGPONG) {
+        if (rq >= 0)
+            usage(argv[0]);
+        if (len >= 0)
+            req_len = resp_len = len;
+    } else {
+        if (len >= 0)
+            usage(argv[0]);
+        if (rq >= 0) {
+            req_len = rq;
+            resp_len = rs;
+        }
+    }
+    if (req_len < 1 || req_len > MAX_LEN || resp_len < 1 ||
+        resp_len > MAX_LEN || duration < 1 || portno == DEFAULT_LOCAL_UDP_PORT)
+        usage(argv[0]);
+    if (n < 1 || n > MAX_CONCURRENCY) {
+        fprintf(stderr, "ERROR, concurrency %d (at most %d)\n", n,
+                MAX_CONCURRENCY);
+        exit(1);
+    }
+
+    /* one simpTCP entity per process: the server runs in a child */
+    if (pipe(ready) < 0)
+        error("ERROR creating pipe");
+    server = fork();
+    if (server < 0)
+        error("ERROR on fork");
+    if (server == 0) {
+        close(ready[0]);
+        run_server(portno, ready[1]);
+    }
+    close(ready[1]);
+    if (read(ready[0], &c, 1) != 1) {
+        fprintf(stderr, "ERROR, the server did not start\n");
+        exit(1);
+    }
+    close(ready[0]);
+
+    start_simptcp(DEFAULT_LOCAL_UDP_PORT);
+
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    serv_addr.sin_port = htons(portno);
+
+    memset(clients, 0, sizeof(clients));
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++) {
+        clients[i].id = i;
+        clients[i].serv_addr = serv_addr;
+        clients[i].max_trans = max_trans;
+        if (max_trans == 0)
+            clients[i].deadline_ns = t0 + (uint64_t) duration * 1000000000ULL;
+        if (pthread_create(&clients[i].thread, NULL, run_client,
+                           &clients[i]) != 0)
+            error("ERROR creating thread");
+    }
+    for (i = 0; i < n; i++)
+        pthread_join(clients[i].thread, NULL);
+    t1 = bench_now_ns();
+
+    report(clients, n, (t1 - t0) / 1e9);
+
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    for (i = 0; i < n; i++)
+        if (clients[i].failed)
+            return 1;
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,214 @@
+/*
+ * simptcp_stat.c
+ */
+
+#include <stdio.h>              /* for snprintf() */
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>              /* for O_* */
+#include <unistd.h>             /* for ftruncate(), syscall() */
+#include <pthread.h>
+#include <sys/mman.h>           /* for shm_open(), mmap() */
+#include <sys/stat.h>
+#include <sys/syscall.h>        /* for SYS_close */
+#include <sys/time.h>           /* for gettimeofday() */
+#include <simptcp_stat.h>
+
+__thread simptcp_stat_slot *simptcp_stat_my_slot;
+__thread int simptcp_stat_shared;
+
+static simptcp_stat_shm *shm;
+static char shm_name[64];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* slots released by exited threads, to give to the next ones */
+static u_int32_t free_slots[SIMPTCP_STAT_MAX_SLOTS];
+static int nb_free_slots;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t slot_key;
+
+
+static void stat_unlink (void)
+{
+    if (shm_name[0] != '\0')
+        shm_unlink(shm_name);
+}
+
+/* SIMPTCP_STAT_SAVE=path: writes the segment to path at exit, "%p" in path
+ * standing for the pid, for simptcp_stat to read once the process is gone
+ */
+static void stat_save (void)
+{
+    const char *fmt = getenv("SIMPTCP_STAT_SAVE");
+    char path[256];
+    size_t n = 0;
+    FILE *f;
+
+    for (; (*fmt != '\0') && (n < sizeof(path) - 12); fmt++) {
+        if ((fmt[0] == '%') && (fmt[1] == 'p')) {
+            n += snprintf(path + n, sizeof(path) - n, "%d", (int) getpid());
+            fmt++;
+        }
+        else
+            path[n++] = *fmt;
+    }
+    path[n] = '\0';
+
+    f = fopen(path, "wb");
+    if (f == NULL)
+        return;
+    fwrite(shm, sizeof(simptcp_stat_shm), 1, f);
+    fclose(f);
+}
+
+/* pthread key destructor: the slot of an exiting thread goes to the free
+ * list; its counts stay in the totals
+ */
+static void stat_release (void *arg)
+{
+    simptcp_stat_slot *slot = arg;
+
+    pthread_mutex_lock(&slots_lock);
+    free_slots[nb_free_slots++] = slot - shm->slots;
+    pthread_mutex_unlock(&slots_lock);
+    simptcp_stat_my_slot = NULL;
+}
+
+/* maps the shared memory segment, or allocates private memory if it cannot
+ * be created or SIMPTCP_STAT=0
+ */
+static void stat_create (void)
+{
+    const char *env = getenv("SIMPTCP_STAT");
+    struct timeval now;
+    u_int64_t magic;
+    void *p = MAP_FAILED;
+    int fd;
+
+    if ((env == NULL) || strcmp(env, "0")) {
+        snprintf(shm_name, sizeof(shm_name), SIMPTCP_STAT_SHM_FORMAT, (int) getpid());
+        fd = shm_open(shm_name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(simptcp_stat_shm)) == 0)
+                p = mmap(NULL, sizeof(simptcp_stat_shm), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+            /* not close(): the descriptor may also be the number of a
+               simptcp socket */
+            syscall(SYS_close, fd);
+        }
+        if (p == MAP_FAILED) {
+            if (fd >= 0)
+                shm_unlink(shm_name);
+            shm_name[0] = '\0';
+        }
+        else
+            atexit(stat_unlink);
+    }
+    if (p == MAP_FAILED) {
+        p = calloc(1, sizeof(simptcp_stat_shm));
+        if (p == NULL)
+            abort();
+    }
+
+    shm = p;
+    pthread_key_create(&slot_key, stat_release);
+    gettimeofday(&now, NULL);
+    shm->nb_counters = SIMPTCP_STAT_NB;
+    shm->nb_hists = SIMPTCP_HIST_NB;
+    shm->hist_buckets = SIMPTCP_HIST_BUCKETS;
+    shm->max_slots = SIMPTCP_STAT_MAX_SLOTS;
+    shm->pid = getpid();
+    shm->start_us = (u_int64_t) now.tv_sec * 1000000 + now.tv_usec;
+    /* the magic last: the segment is ready */
+    memcpy(&magic, SIMPTCP_STAT_MAGIC, sizeof(magic));
+    __atomic_store_n((u_int64_t *) shm->magic, magic, __ATOMIC_RELEASE);
+
+    env = getenv("SIMPTCP_STAT_SAVE");
+    if ((env != NULL) && (*env != '\0'))
+        atexit(stat_save);
+}
+
+/* creates the counters (done by start_simptcp, or at the first count);
+ * returns 0 if they are exported, -1 if they are private
+ */
+int simptcp_stat_init (void)
+{
+    pthread_once(&init_once, stat_create);
+    return (shm_name[0] != '\0') ? 0 : -1;
+}
+
+/* gives the calling thread its slot: one released by an exited thread, else
+ * a new one, else the shared last slot; called by simptcp_stat_add() the
+ * first time the thread counts something
+ */
+simptcp_stat_slot * simptcp_stat_register (void)
+{
+    u_int32_t n;
+
+    simptcp_stat_init();
+    pthread_mutex_lock(&slots_lock);
+    if (nb_free_slots > 0)
+        n = free_slots[--nb_free_slots];
+    else {
+        n = shm->nb_slots;
+        if (n < SIMPTCP_STAT_MAX_SLOTS - 1)
+            __atomic_store_n(&(shm->nb_slots), n + 1, __ATOMIC_RELAXED);
+        else {
+            __atomic_store_n(&(shm->nb_slots), SIMPTCP_STAT_MAX_SLOTS, __ATOMIC_RELAXED);
+            n = SIMPTCP_STAT_MAX_SLOTS - 1;
+            simptcp_stat_shared = 1;
+        }
+    }
+    pthread_mutex_unlock(&slots_lock);
+    simptcp_stat_my_slot = &(shm->slots[n]);
+    if (!simptcp_stat_shared)
+        pthread_setspecific(slot_key, simptcp_stat_my_slot);
+    return simptcp_stat_my_slot;
+}
+
+/* simptcp_hist_record() on the shared slot, with atomic operations */
+void simptcp_stat_shared_latency (simptcp_hist *h, long long us)
+{
+    u_int32_t v = (us < 0) ? 0 : (us > 0xffffffffLL) ? 0xffffffff : us;
+    u_int32_t max = __atomic_load_n(&(h->max), __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&(h->buckets[simptcp_hist_bucket(v)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(h->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(h->sum), v, __ATOMIC_RELAXED);
+    while ((v > max) &&
+           !__atomic_compare_exchange_n(&(h->max), &max, v, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+
+/* sums the counters of all the slots */
+void simptcp_stat_sum (u_int64_t values[SIMPTCP_STAT_NB])
+{
+    u_int32_t i, nb;
+    int c;
+
+    memset(values, 0, SIMPTCP_STAT_NB * sizeof(u_int64_t));
+    if (shm == NULL)
+        return;
+    nb = __atomic_load_n(&(shm->nb_slots), __ATOMIC_RELAXED);
+    for (i = 0; (i < nb) && (i < SIMPTCP_STAT_MAX_SLOTS); i++)
+        for (c = 0; c < SIMPTCP_STAT_NB; c++)
+            values[c] += shm->slots[i].values[c];
+}
+
+/* merges the latency histograms of all the slots */
+void simptcp_stat_hist_sum (simptcp_hist hist[SIMPTCP_HIST_NB])
+{
+    u_int32_t i, nb;
+    int h;
+
+    memset(hist, 0, SIMPTCP_HIST_NB * sizeof(simptcp_hist));
+    if (shm == NULL)
+        return;
+    nb = __atomic_load_n(&(shm->nb_slots), __ATOMIC_RELAXED);
+    for (i = 0; (i < nb) && (i < SIMPTCP_STAT_MAX_SLOTS); i++)
+        for (h = 0; h < SIMPTCP_HIST_NB; h++)
+            simptcp_hist_merge(&(hist[h]), &(shm->slots[i].hist[h]));
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,271 @@
+/*! \file simptcp_stat_tool.c
+ * \brief Reads the entity-wide counters of a running simpTCP program from its
+ *  shared memory segment (see simptcp_stat.h), without disturbing it.
+ *  Prints the totals, or every interval seconds the counts of the interval
+ *  (and the share of time the entity was idle), or the percentiles of the
+ *  latency histograms. It also reads the file of a program that has exited,
+ *  saved with SIMPTCP_STAT_SAVE.
+ *
+ *  usage: simptcp_stat [-t | -l] [-i interval [-c count]] pid|file
+ *         simptcp_stat -J pid|file
+ *         -t  one column per thread slot
+ *         -l  latency percentiles, since the start or over each interval
+ *         -J  the totals and the latency percentiles, in JSON
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <simptcp_stat.h>
+
+static const char *names[] = SIMPTCP_STAT_NAMES;
+static const char *hist_names[] = SIMPTCP_HIST_NAMES;
+
+void error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/* the segment of a running process (target is its pid) or a saved file */
+static const simptcp_stat_shm * attach(const char *target)
+{
+    char name[256];
+    const simptcp_stat_shm *shm;
+    struct stat st;
+    int fd;
+
+    if (strspn(target, "0123456789") == strlen(target)) {
+        snprintf(name, sizeof(name), SIMPTCP_STAT_SHM_FORMAT, atoi(target));
+        fd = shm_open(name, O_RDONLY, 0);
+    }
+    else {
+        snprintf(name, sizeof(name), "%s", target);
+        fd = open(name, O_RDONLY);
+    }
+    if (fd < 0)
+        error(name);
+    if ((fstat(fd, &st) == 0) && (st.st_size < (off_t) sizeof(simptcp_stat_shm))) {
+        fprintf(stderr, "%s: not a simptcp counter segment\n", name);
+        exit(1);
+    }
+    shm = mmap(NULL, sizeof(simptcp_stat_shm), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        error("mmap");
+    close(fd);
+    if (memcmp(shm->magic, SIMPTCP_STAT_MAGIC, sizeof(shm->magic)) ||
+        (shm->nb_counters != SIMPTCP_STAT_NB) || (shm->nb_hists != SIMPTCP_HIST_NB) ||
+        (shm->hist_buckets != SIMPTCP_HIST_BUCKETS)) {
+        fprintf(stderr, "%s: not a simptcp counter segment (or another version)\n",
+                name);
+        exit(1);
+    }
+    return shm;
+}
+
+static void sample(const simptcp_stat_shm *shm, u_int64_t values[SIMPTCP_STAT_NB])
+{
+    u_int32_t i, nb = shm->nb_slots;
+    int c;
+
+    memset(values, 0, SIMPTCP_STAT_NB * sizeof(u_int64_t));
+    for (i = 0; (i < nb) && (i < SIMPTCP_STAT_MAX_SLOTS); i++)
+        for (c = 0; c < SIMPTCP_STAT_NB; c++)
+            values[c] += shm->slots[i].values[c];
+}
+
+static void print_totals(const simptcp_stat_shm *shm, int per_thread)
+{
+    u_int64_t values[SIMPTCP_STAT_NB];
+    u_int32_t i, nb = shm->nb_slots;
+    int c;
+
+    sample(shm, values);
+    printf("pid %u, %u thread slots\n", shm->pid, nb);
+    for (c = 0; c < SIMPTCP_STAT_NB; c++) {
+        printf("%-16s %14llu", names[c], (unsigned long long) values[c]);
+        if (per_thread)
+            for (i = 0; (i < nb) && (i < SIMPTCP_STAT_MAX_SLOTS); i++)
+                printf(" %12llu", (unsigned long long) shm->slots[i].values[c]);
+        printf("\n");
+    }
+}
+
+static void sample_hists(const simptcp_stat_shm *shm, simptcp_hist hist[SIMPTCP_HIST_NB])
+{
+    u_int32_t i, nb = shm->nb_slots;
+    int h;
+
+    memset(hist, 0, SIMPTCP_HIST_NB * sizeof(simptcp_hist));
+    for (i = 0; (i < nb) && (i < SIMPTCP_STAT_MAX_SLOTS); i++)
+        for (h = 0; h < SIMPTCP_HIST_NB; h++)
+            simptcp_hist_merge(&(hist[h]), &(shm->slots[i].hist[h]));
+}
+
+/* the values recorded in cur but not yet in prev; the largest one is only
+ * known to the bucket */
+static void hist_delta(simptcp_hist *d, const simptcp_hist *cur, const simptcp_hist *prev)
+{
+    int b;
+
+    memset(d, 0, sizeof(*d));
+    for (b = 0; b < SIMPTCP_HIST_BUCKETS; b++) {
+        d->buckets[b] = cur->buckets[b] - prev->buckets[b];
+        if (d->buckets[b] > 0)
+            d->max = simptcp_hist_highest(b);
+    }
+    d->count = cur->count - prev->count;
+    d->sum = cur->sum - prev->sum;
+    if (d->max > cur->max)
+        d->max = cur->max;
+}
+
+static void print_hists(const simptcp_hist hist[SIMPTCP_HIST_NB])
+{
+    const simptcp_hist *h;
+    int i;
+
+    printf("%-16s %10s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "count",
+           "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < SIMPTCP_HIST_NB; i++) {
+        h = &(hist[i]);
+        printf("%-16s %10llu %10llu %10u %10u %10u %10u %10u\n", hist_names[i],
+               (unsigned long long) h->count,
+               (unsigned long long) (h->count ? h->sum / h->count : 0),
+               simptcp_hist_percentile(h, 50), simptcp_hist_percentile(h, 90),
+               simptcp_hist_percentile(h, 99), simptcp_hist_percentile(h, 99.9),
+               h->max);
+    }
+}
+
+static void print_json(const simptcp_stat_shm *shm)
+{
+    u_int64_t values[SIMPTCP_STAT_NB];
+    simptcp_hist hist[SIMPTCP_HIST_NB];
+    const simptcp_hist *h;
+    int i;
+
+    sample(shm, values);
+    sample_hists(shm, hist);
+    printf("{\n  \"pid\": %u,\n  \"start_us\": %llu,\n  \"counters\": {", shm->pid,
+           (unsigned long long) shm->start_us);
+    for (i = 0; i < SIMPTCP_STAT_NB; i++)
+        printf("%s\"%s\": %llu", i ? ", " : "", names[i],
+               (unsigned long long) values[i]);
+    printf("},\n  \"latency_us\": {\n");
+    for (i = 0; i < SIMPTCP_HIST_NB; i++) {
+        h = &(hist[i]);
+        printf("    \"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %u, "
+               "\"p90\": %u, \"p99\": %u, \"p99.9\": %u, \"max\": %u}%s\n",
+               hist_names[i], (unsigned long long) h->count,
+               (unsigned long long) (h->count ? h->sum / h->count : 0),
+               simptcp_hist_percentile(h, 50), simptcp_hist_percentile(h, 90),
+               simptcp_hist_percentile(h, 99), simptcp_hist_percentile(h, 99.9),
+               h->max, (i < SIMPTCP_HIST_NB - 1) ? "," : "");
+    }
+    printf("  }\n}\n");
+}
+
+static u_int64_t now_us(void)
+{
+    struct timeval t;
+
+    gettimeofday(&t, NULL);
+    return (u_int64_t) t.tv_sec * 1000000 + t.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+    const simptcp_stat_shm *shm;
+    u_int64_t prev[SIMPTCP_STAT_NB], cur[SIMPTCP_STAT_NB], t0, t1;
+    simptcp_hist hprev[SIMPTCP_HIST_NB], hcur[SIMPTCP_HIST_NB], hdelta[SIMPTCP_HIST_NB];
+    int opt, per_thread = 0, latency = 0, json = 0, interval = 0, count = -1, c, n;
+
+    while ((opt = getopt(argc, argv, "tlJi:c:")) != -1) {
+        switch (opt) {
+        case 't':
+            per_thread = 1;
+            break;
+        case 'l':
+            latency = 1;
+            break;
+        case 'J':
+            json = 1;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        default:
+            optind = argc;
+        }
+    }
+    if ((optind != argc - 1) || (json && (per_thread || latency || (interval > 0)))) {
+        fprintf(stderr, "usage: %s [-t | -l] [-i interval [-c count]] pid|file\n"
+                "       %s -J pid|file\n", argv[0], argv[0]);
+        return 1;
+    }
+    shm = attach(argv[optind]);
+
+    if (json) {
+        print_json(shm);
+        return 0;
+    }
+
+    if (latency) {
+        sample_hists(shm, hprev);
+        if (interval <= 0) {
+            print_hists(hprev);
+            return 0;
+        }
+        for (n = 0; (count < 0) || (n < count); n++) {
+            sleep(interval);
+            sample_hists(shm, hcur);
+            for (c = 0; c < SIMPTCP_HIST_NB; c++)
+                hist_delta(&(hdelta[c]), &(hcur[c]), &(hprev[c]));
+            print_hists(hdelta);
+            printf("\n");
+            fflush(stdout);
+            memcpy(hprev, hcur, sizeof(hprev));
+        }
+        return 0;
+    }
+
+    if (interval <= 0) {
+        print_totals(shm, per_thread);
+        return 0;
+    }
+
+    for (c = 0; c < SIMPTCP_STAT_NB; c++)
+        if (c != SIMPTCP_STAT_IDLE_US)
+            printf("%*s ", (int) strlen(names[c]) > 10 ? (int) strlen(names[c]) : 10,
+                   names[c]);
+    printf("%6s\n", "idle%");
+
+    sample(shm, prev);
+    t0 = now_us();
+    for (n = 0; (count < 0) || (n < count); n++) {
+        sleep(interval);
+        sample(shm, cur);
+        t1 = now_us();
+        for (c = 0; c < SIMPTCP_STAT_NB; c++)
+            if (c != SIMPTCP_STAT_IDLE_US)
+                printf("%*llu ", (int) strlen(names[c]) > 10 ? (int) strlen(names[c]) : 10,
+                       (unsigned long long) (cur[c] - prev[c]));
+        printf("%6.1f\n", 100.0 * (cur[SIMPTCP_STAT_IDLE_US] - prev[SIMPTCP_STAT_IDLE_US])
+               / (double) (t1 - t0));
+        fflush(stdout);
+        memcpy(prev, cur, sizeof(prev));
+        t0 = t1;
+    }
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
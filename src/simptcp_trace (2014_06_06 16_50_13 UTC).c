@@ -0,0 +1,277 @@
+/*
+ * simptcp_trace.c
+ */
+
+#include <stdio.h>              /* for snprintf() */
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>              /* for open() */
+#include <signal.h>             /* for sigaction() */
+#include <time.h>               /* for clock_gettime() */
+#include <unistd.h>             /* for syscall() */
+#include <sys/syscall.h>        /* for SYS_write, SYS_close */
+#include <pthread.h>
+#include <netinet/in.h>         /* for ntohs() */
+#include <simptcp_packet.h>
+#include <simptcp_trace.h>
+
+#define RING_MASK               (SIMPTCP_TRACE_RING_EVENTS - 1)
+#define MAX_RINGS               256     /* simptcp_trace_event.thread is 8 bits */
+
+/* the events of one thread: only that thread writes, at head */
+struct trace_ring {
+    simptcp_trace_event events[SIMPTCP_TRACE_RING_EVENTS];
+    u_int64_t head;             /* number of events recorded so far */
+    int id;
+    struct trace_ring *next;
+    struct trace_ring *next_free;
+};
+
+volatile int simptcp_trace_enabled;
+
+static __thread struct trace_ring *my_ring;
+static __thread int no_ring;            /* MAX_RINGS threads already trace */
+/* rings are never freed, so that a dump (maybe in a signal handler) can walk
+ * them without a lock: the ring of an exited thread goes to free_rings
+ */
+static struct trace_ring *rings;        /* only grows, at its head */
+static struct trace_ring *free_rings;
+static int nb_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+/* time stamp counter and clock when tracing was enabled, to compute the
+ * counter frequency at dump time
+ */
+static u_int64_t tsc_start, ns_start;
+static char dump_path[256];
+
+
+static inline u_int64_t trace_rdtsc (void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    u_int32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((u_int64_t) hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static u_int64_t trace_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* pthread key destructor: puts the ring of an exiting thread on the free list */
+static void ring_release (void *arg)
+{
+    struct trace_ring *r = arg;
+
+    pthread_mutex_lock(&rings_lock);
+    r->next_free = free_rings;
+    free_rings = r;
+    pthread_mutex_unlock(&rings_lock);
+    my_ring = NULL;
+}
+
+static void ring_key_create (void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/* gives the calling thread its ring, the first time it records an event: a
+ * ring released by an exited thread, else a new one (at most MAX_RINGS)
+ */
+static struct trace_ring * ring_register (void)
+{
+    struct trace_ring *r;
+
+    pthread_once(&ring_key_once, ring_key_create);
+    pthread_mutex_lock(&rings_lock);
+    if ((r = free_rings) != NULL)
+        free_rings = r->next_free;
+    else if ((nb_rings < MAX_RINGS) &&
+             ((r = calloc(1, sizeof(struct trace_ring))) != NULL)) {
+        r->id = nb_rings++;
+        r->next = rings;
+        __atomic_store_n(&rings, r, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    if (r == NULL) {
+        no_ring = 1;
+        return NULL;
+    }
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+/* records one event in the ring of the calling thread; called through
+ * SIMPTCP_TRACE()
+ */
+void simptcp_trace_record (int type, u_int16_t port, u_int32_t value,
+                           u_int16_t a, u_int16_t b, u_int16_t c,
+                           u_int16_t d, u_int16_t e, u_int16_t f)
+{
+    struct trace_ring *r = my_ring;
+    simptcp_trace_event *ev;
+
+    if ((r == NULL) && (no_ring || ((r = ring_register()) == NULL)))
+        return;
+
+    ev = &(r->events[r->head & RING_MASK]);
+    ev->tsc = trace_rdtsc();
+    ev->type = type;
+    ev->thread = r->id;
+    ev->port = port;
+    ev->value = value;
+    ev->a = a;
+    ev->b = b;
+    ev->c = c;
+    ev->d = d;
+    ev->e = e;
+    ev->f = f;
+    ev->pad = 0;
+    __atomic_store_n(&(r->head), r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* records the header of a PDU sent or received (len: its size) */
+void simptcp_trace_pdu (int type, u_int16_t port, const char *pdu, int len)
+{
+    simptcp_header_fields h;
+
+    simptcp_parse_header(pdu, &h);
+    simptcp_trace_record(type, port, len, h.sport, h.dport, h.seq_num, h.ack_num,
+                         h.flags | (h.header_len << 8), h.total_len);
+}
+
+/* write() that neither goes through the simptcp interposition (the file
+ * descriptor may also be the number of a simptcp socket) nor uses anything
+ * unsafe in a signal handler
+ */
+static int write_all (int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    long n;
+
+    while (len > 0) {
+        n = syscall(SYS_write, fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* writes the events of all threads to path (NULL: SIMPTCP_TRACE_FILE or
+ * simptcp-<pid>.trace); may be called from a signal handler. Events recorded
+ * during the dump may appear torn at the oldest end of their ring.
+ * Returns the number of events written, -1 on error.
+ */
+int simptcp_trace_dump (const char *path)
+{
+    simptcp_trace_file_header hdr;
+    struct trace_ring *r, *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    u_int64_t heads[MAX_RINGS], tsc, ns;
+    size_t start;
+    int i, fd, err = 0;
+
+    /* the events written are those recorded before this point */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SIMPTCP_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.event_size = sizeof(simptcp_trace_event);
+    for (r = first, i = 0; (r != NULL) && (i < MAX_RINGS); r = r->next, i++) {
+        heads[i] = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+        hdr.nb_events += (heads[i] < SIMPTCP_TRACE_RING_EVENTS) ?
+            heads[i] : SIMPTCP_TRACE_RING_EVENTS;
+        hdr.nb_threads++;
+    }
+
+    /* counter frequency, over at least 10 ms since tracing was enabled */
+    do {
+        ns = trace_now_ns();
+        tsc = trace_rdtsc();
+    } while (ns - ns_start < 10000000ULL);
+    hdr.tsc_hz = (double) (tsc - tsc_start) * 1e9 / (double) (ns - ns_start);
+
+    fd = open((path != NULL) ? path : dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    err = write_all(fd, &hdr, sizeof(hdr));
+
+    for (r = first, i = 0; (r != NULL) && (i < (int) hdr.nb_threads) && !err;
+         r = r->next, i++) {
+        if (heads[i] <= SIMPTCP_TRACE_RING_EVENTS)
+            err = write_all(fd, r->events, heads[i] * sizeof(simptcp_trace_event));
+        else {
+            /* the ring has wrapped: oldest events first */
+            start = heads[i] & RING_MASK;
+            err = write_all(fd, &(r->events[start]),
+                            (SIMPTCP_TRACE_RING_EVENTS - start) * sizeof(simptcp_trace_event))
+                || write_all(fd, r->events, start * sizeof(simptcp_trace_event));
+        }
+    }
+    syscall(SYS_close, fd);
+    return err ? -1 : (int) hdr.nb_events;
+}
+
+static void trace_signal (int sig)
+{
+    (void) sig;
+    simptcp_trace_dump(NULL);
+}
+
+static void trace_exit (void)
+{
+    if (simptcp_trace_enabled)
+        simptcp_trace_dump(NULL);
+}
+
+/* turns tracing on or off; the first time, installs the SIGUSR2 handler */
+void simptcp_trace_enable (int on)
+{
+    static int installed;
+    struct sigaction sa;
+    const char *path;
+
+    if (on && !installed) {
+        installed = 1;
+        path = getenv("SIMPTCP_TRACE_FILE");
+        if (path != NULL)
+            snprintf(dump_path, sizeof(dump_path), "%s", path);
+        else
+            snprintf(dump_path, sizeof(dump_path), "simptcp-%d.trace", (int) getpid());
+        ns_start = trace_now_ns();
+        tsc_start = trace_rdtsc();
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = trace_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR2, &sa, NULL);
+    }
+    simptcp_trace_enabled = on;
+}
+
+/* SIMPTCP_TRACE set (and not "0"): trace from the start, dump at exit */
+static void __attribute__((constructor)) trace_configure (void)
+{
+    const char *env = getenv("SIMPTCP_TRACE");
+
+    if ((env != NULL) && (*env != '\0') && strcmp(env, "0")) {
+        simptcp_trace_enable(1);
+        atexit(trace_exit);
+    }
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
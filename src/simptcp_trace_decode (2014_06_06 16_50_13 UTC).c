@@ -0,0 +1,328 @@
+/*! \file simptcp_trace_decode.c
+ * \brief Decoder of the binary event traces written by simptcp_trace_dump().
+ *  Prints the events of one or more trace files as a single timeline, or
+ *  (-s) a per-connection summary: round trip time of the data PDUs, delayed
+ *  ACK latency, handshake time, retransmissions and timer expirations.
+ *  Traces of the two ends of a connection, taken on the same host, can be
+ *  decoded together since their time stamps come from the same counter.
+ *
+ *  usage: simptcp_trace [-s] file.trace [file.trace..]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simptcp_packet.h>     /* for SYN, ACK, FIN, RST */
+#include <simptcp_trace.h>
+
+#define NB_PORTS        65536
+#define ESTABLISHED     4       /* index in SIMPTCP_TRACE_STATE_NAMES */
+
+static const char *state_names[] = SIMPTCP_TRACE_STATE_NAMES;
+static const char *timer_names[] = { "retransmit", "delayed ACK" };
+
+/* one file's events, tagged with the index of the file */
+struct event {
+    simptcp_trace_event ev;
+    int file;
+};
+
+struct stat_us {
+    unsigned long n;
+    double min, max, sum;
+};
+
+/* what the summary follows, per local simptcp port */
+struct conn {
+    int file;
+    unsigned long pdus_sent, pdus_recv, data_sent, data_recv, acks_sent;
+    unsigned long retransmits, drops, fires[2];
+    /* last data PDU sent and not yet acknowledged */
+    int data_pending, data_retransmitted;
+    u_int16_t data_seq;
+    double data_us;
+    /* last data PDU received and not yet acknowledged */
+    int ack_pending;
+    u_int16_t ack_seq;
+    double ack_us;
+    /* first SYN sent or received */
+    int syn_seen, established;
+    double syn_us;
+    struct stat_us rtt, delack, handshake;
+};
+
+static struct conn *conns[NB_PORTS];
+
+void error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+static int cmp_event(const void *x, const void *y)
+{
+    const struct event *a = x, *b = y;
+
+    if (a->ev.tsc != b->ev.tsc)
+        return (a->ev.tsc < b->ev.tsc) ? -1 : 1;
+    return (a->file != b->file) ? a->file - b->file : a->ev.thread - b->ev.thread;
+}
+
+/* appends the events of one trace file to *events */
+static void load(const char *path, int file, struct event **events,
+                 size_t *nb, double *tsc_hz)
+{
+    simptcp_trace_file_header hdr;
+    simptcp_trace_event ev;
+    FILE *f = fopen(path, "rb");
+    u_int64_t i;
+
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    if ((fread(&hdr, sizeof(hdr), 1, f) != 1) ||
+        memcmp(hdr.magic, SIMPTCP_TRACE_MAGIC, sizeof(hdr.magic)) ||
+        (hdr.event_size != sizeof(simptcp_trace_event))) {
+        fprintf(stderr, "%s: not a simptcp trace\n", path);
+        exit(1);
+    }
+    if (*tsc_hz == 0.0)
+        *tsc_hz = hdr.tsc_hz;
+
+    *events = realloc(*events, (*nb + hdr.nb_events) * sizeof(struct event));
+    if (*events == NULL)
+        error("out of memory");
+    for (i = 0; (i < hdr.nb_events) && (fread(&ev, sizeof(ev), 1, f) == 1); i++) {
+        (*events)[*nb].ev = ev;
+        (*events)[*nb].file = file;
+        (*nb)++;
+    }
+    if (i < hdr.nb_events)
+        fprintf(stderr, "%s: truncated, %llu of %llu events\n", path,
+                (unsigned long long) i, (unsigned long long) hdr.nb_events);
+    fclose(f);
+}
+
+static void flags_str(char *s, int flags)
+{
+    s[0] = '\0';
+    if (flags & SYN) strcat(s, "S");
+    if (flags & ACK) strcat(s, "A");
+    if (flags & FIN) strcat(s, "F");
+    if (flags & RST) strcat(s, "R");
+    if (s[0] == '\0') strcat(s, ".");
+}
+
+static const char * state_name(int state)
+{
+    return (state < (int) (sizeof(state_names) / sizeof(*state_names))) ?
+        state_names[state] : "?";
+}
+
+static const char * timer_name(int timer)
+{
+    return (timer < 2) ? timer_names[timer] : "?";
+}
+
+static void print_event(const struct event *e, double us)
+{
+    const simptcp_trace_event *ev = &(e->ev);
+    char flags[8];
+
+    printf("%14.3f  %d.%-3d %5hu  ", us, e->file, ev->thread, ev->port);
+    switch (ev->type) {
+    case SIMPTCP_TRACE_PDU_SEND:
+    case SIMPTCP_TRACE_PDU_RECV:
+        flags_str(flags, ev->e & 0xff);
+        printf("%s %5hu > %-5hu [%-4s] seq %5hu ack %5hu hlen %2d tlen %4hu (%u)\n",
+               (ev->type == SIMPTCP_TRACE_PDU_SEND) ? "send" : "recv",
+               ev->a, ev->b, flags, ev->c, ev->d, ev->e >> 8, ev->f, ev->value);
+        break;
+    case SIMPTCP_TRACE_DROP:
+        printf("drop corrupted PDU, %hu bytes\n", ev->a);
+        break;
+    case SIMPTCP_TRACE_DEMUX:
+        if (ev->b == 0xffff)
+            printf("demux port %hu: no socket, %hu bytes\n", ev->a, ev->c);
+        else
+            printf("demux port %hu: fd %hu, %hu bytes\n", ev->a, ev->b, ev->c);
+        break;
+    case SIMPTCP_TRACE_STATE:
+        printf("state %s -> %s\n", state_name(ev->a), state_name(ev->b));
+        break;
+    case SIMPTCP_TRACE_TIMER_ARM:
+        printf("arm %s timer, %u ms\n", timer_name(ev->a), ev->value);
+        break;
+    case SIMPTCP_TRACE_TIMER_STOP:
+        printf("stop %s timer\n", timer_name(ev->a));
+        break;
+    case SIMPTCP_TRACE_TIMER_FIRE:
+        printf("%s timer fired\n", timer_name(ev->a));
+        break;
+    default:
+        printf("unknown event %d\n", ev->type);
+    }
+}
+
+static void stat_add(struct stat_us *s, double us)
+{
+    if ((s->n == 0) || (us < s->min))
+        s->min = us;
+    if ((s->n == 0) || (us > s->max))
+        s->max = us;
+    s->sum += us;
+    s->n++;
+}
+
+static void stat_print(const char *name, const struct stat_us *s)
+{
+    if (s->n == 0)
+        printf("  %-14s        -\n", name);
+    else
+        printf("  %-14s %8lu  min %10.1f  avg %10.1f  max %10.1f us\n", name,
+               s->n, s->min, s->sum / s->n, s->max);
+}
+
+/* updates the summary of the connection of the event */
+static void account(const struct event *e, double us)
+{
+    const simptcp_trace_event *ev = &(e->ev);
+    struct conn *c = conns[ev->port];
+    int data = (ev->f > (ev->e >> 8));
+    int flags = ev->e & 0xff;
+
+    if (c == NULL) {
+        c = conns[ev->port] = calloc(1, sizeof(struct conn));
+        if (c == NULL)
+            error("out of memory");
+        c->file = e->file;
+    }
+
+    switch (ev->type) {
+    case SIMPTCP_TRACE_PDU_SEND:
+        c->pdus_sent++;
+        if ((flags & SYN) && !c->syn_seen) {
+            c->syn_seen = 1;
+            c->syn_us = us;
+        }
+        if (data) {
+            c->data_sent++;
+            if (c->data_pending && (c->data_seq == ev->c)) {
+                c->retransmits++;
+                c->data_retransmitted = 1;
+            } else {
+                c->data_pending = 1;
+                c->data_retransmitted = 0;
+                c->data_seq = ev->c;
+                c->data_us = us;
+            }
+        }
+        if ((flags & ACK) && c->ack_pending && ((u_int16_t) (ev->d - c->ack_seq) > 0)
+            && ((u_int16_t) (ev->d - c->ack_seq) < 0x8000)) {
+            c->acks_sent++;
+            c->ack_pending = 0;
+            stat_add(&(c->delack), us - c->ack_us);
+        }
+        break;
+    case SIMPTCP_TRACE_PDU_RECV:
+        c->pdus_recv++;
+        if ((flags & SYN) && !c->syn_seen) {
+            c->syn_seen = 1;
+            c->syn_us = us;
+        }
+        if (data) {
+            c->data_recv++;
+            if (!c->ack_pending) {
+                c->ack_pending = 1;
+                c->ack_seq = ev->c;
+                c->ack_us = us;
+            }
+        }
+        /* Karn: no sample for a retransmitted PDU */
+        if ((flags & ACK) && c->data_pending && (ev->d == (u_int16_t) (c->data_seq + 1))) {
+            c->data_pending = 0;
+            if (!c->data_retransmitted)
+                stat_add(&(c->rtt), us - c->data_us);
+        }
+        break;
+    case SIMPTCP_TRACE_DROP:
+        c->drops++;
+        break;
+    case SIMPTCP_TRACE_STATE:
+        if ((ev->b == ESTABLISHED) && !c->established && c->syn_seen) {
+            c->established = 1;
+            stat_add(&(c->handshake), us - c->syn_us);
+        }
+        break;
+    case SIMPTCP_TRACE_TIMER_FIRE:
+        if (ev->a < 2)
+            c->fires[ev->a]++;
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct event *events = NULL;
+    size_t nb = 0, i;
+    double tsc_hz = 0.0, us;
+    u_int64_t tsc0;
+    int summary = 0, opt, n, port;
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        if (opt == 's')
+            summary = 1;
+        else
+            optind = argc + 1;
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-s] file.trace [file.trace..]\n"
+                "  -s  per-connection summary instead of the timeline\n", argv[0]);
+        exit(1);
+    }
+    for (n = 0; optind + n < argc; n++)
+        load(argv[optind + n], n, &events, &nb, &tsc_hz);
+    if (nb == 0) {
+        printf("no events\n");
+        return 0;
+    }
+    if (tsc_hz <= 0.0)
+        error("bad time stamp counter frequency");
+
+    qsort(events, nb, sizeof(struct event), cmp_event);
+    tsc0 = events[0].ev.tsc;
+
+    if (!summary)
+        printf("%14s  %-5s %5s  event\n", "time (us)", "thr", "port");
+    for (i = 0; i < nb; i++) {
+        us = (double) (events[i].ev.tsc - tsc0) * 1e6 / tsc_hz;
+        if (summary)
+            account(&events[i], us);
+        else
+            print_event(&events[i], us);
+    }
+    if (!summary)
+        return 0;
+
+    printf("%lu events over %.1f us\n", (unsigned long) nb,
+           (double) (events[nb - 1].ev.tsc - tsc0) * 1e6 / tsc_hz);
+    for (port = 1; port < NB_PORTS; port++) {
+        struct conn *c = conns[port];
+
+        if (c == NULL)
+            continue;
+        printf("\nport %d (file %d): %lu PDUs sent (%lu data), %lu received "
+               "(%lu data), %lu dropped\n", port, c->file, c->pdus_sent,
+               c->data_sent, c->pdus_recv, c->data_recv, c->drops);
+        printf("  %lu retransmissions, timer expirations: %lu retransmit, "
+               "%lu delayed ACK\n", c->retransmits, c->fires[0], c->fires[1]);
+        stat_print("handshake", &(c->handshake));
+        stat_print("data RTT", &(c->rtt));
+        stat_print("ACK latency", &(c->delack));
+    }
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */